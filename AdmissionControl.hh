@@ -0,0 +1,188 @@
+#pragma once
+#include <stdint.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "Transaction.hh"
+
+// Admission control for transaction retry loops.
+//
+// With more threads than cores, or high skew, TRANSACTION/RETRY(true)
+// loops keep every thread re-running conflicting work and throughput
+// collapses. While an AdmissionGate is started, each TRANSACTION block
+// must hold one of limit() tokens from its first attempt until it commits
+// or gives up; threads without a token wait, first spinning, then asleep.
+//
+// The limit follows the abort ratio of the last interval, from the
+// txp_total_aborts and txp_total_starts counters of every thread (so
+// STO_PROFILE_COUNTERS must be on, as by default): above target_abort_ratio
+// the limit is multiplied by decrease, otherwise it grows by increase
+// (AIMD). Any thread passing through the gate after an interval ends
+// adjusts it; there is no controller thread. Transactions started with
+// Sto::start_transaction rather than TRANSACTION bypass the gate.
+class AdmissionGate {
+public:
+    struct params {
+        unsigned min_limit = 1;
+        unsigned max_limit = MAX_THREADS;
+        unsigned initial_limit = MAX_THREADS;
+        double target_abort_ratio = 0.2;
+        double decrease = 0.5;
+        unsigned increase = 1;
+        unsigned interval_us = 10000;
+        // intervals with fewer attempts leave the limit alone
+        unsigned min_starts = 32;
+    };
+
+    struct stats {
+        uint64_t waited = 0;            // admissions that had to wait
+        uint64_t intervals = 0;
+        uint64_t decreases = 0;
+        uint64_t increases = 0;
+        uint64_t limit_sum = 0;         // over intervals, for the mean
+        unsigned min_limit = 0;
+        unsigned max_limit = 0;
+    };
+
+    AdmissionGate()
+        : AdmissionGate(params()) {
+    }
+    explicit AdmissionGate(const params& p)
+        : p_(p), limit_(clamp(p.initial_limit)), active_(0), sleepers_(0) {
+        always_assert(p_.min_limit >= 1 && p_.min_limit <= p_.max_limit, "bad admission limits");
+    }
+    ~AdmissionGate() {
+        stop();
+    }
+
+    // Gates TRANSACTION blocks until stop()
+    void start() {
+        auto c = Transaction::txp_counters_combined();
+        starts_ = c.p(txp_total_starts);
+        aborts_ = c.p(txp_total_aborts);
+        next_ = now_us() + p_.interval_us;
+        stats_ = stats();
+        stats_.min_limit = stats_.max_limit = limit_;
+        Transaction::admission = this;
+    }
+    void stop() {
+        if (Transaction::admission == this)
+            Transaction::admission = nullptr;
+        std::lock_guard<std::mutex> lk(m_);
+        cv_.notify_all();
+    }
+
+    void enter() {
+        bool waited = false;
+        // the clock is read at every 16th admission, and while waiting
+        static __thread unsigned admissions;
+        if (++admissions % 16 == 0)
+            maybe_adjust();
+        for (unsigned spins = 0; ; ++spins) {
+            unsigned a = active_.load(std::memory_order_relaxed);
+            if (a < limit_.load(std::memory_order_relaxed)) {
+                if (active_.compare_exchange_weak(a, a + 1, std::memory_order_acquire))
+                    break;
+                continue;
+            }
+            waited = true;
+            maybe_adjust();
+            if (spins < 100)
+                relax_fence();
+            else if (spins < 200)
+                sched_yield();
+            else {
+                // the timeout bounds a missed wakeup, and lets a sleeper
+                // adjust the limit when every token holder is slow
+                std::unique_lock<std::mutex> lk(m_);
+                ++sleepers_;
+                if (active_.load() >= limit_.load())
+                    cv_.wait_for(lk, std::chrono::microseconds(p_.interval_us));
+                --sleepers_;
+                spins = 0;
+            }
+        }
+        if (waited)
+            __atomic_add_fetch(&stats_.waited, 1, __ATOMIC_RELAXED);
+    }
+    void leave() {
+        // pairs with a sleeper's increment of sleepers_ before it checks
+        // active_
+        active_.fetch_sub(1);
+        if (sleepers_.load()) {
+            std::lock_guard<std::mutex> lk(m_);
+            cv_.notify_one();
+        }
+    }
+
+    unsigned limit() const {
+        return limit_;
+    }
+    unsigned active() const {
+        return active_;
+    }
+    // Read once the gate has stopped
+    const stats& statistics() const {
+        return stats_;
+    }
+
+private:
+    params p_;
+    std::atomic<unsigned> limit_;
+    std::atomic<unsigned> active_;
+    std::atomic<unsigned> sleepers_;
+    std::atomic<uint64_t> next_;
+    std::mutex adjust_;
+    uint64_t starts_;
+    uint64_t aborts_;
+    stats stats_;
+    std::mutex m_;
+    std::condition_variable cv_;
+
+    static uint64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    unsigned clamp(unsigned limit) const {
+        return std::min(std::max(limit, p_.min_limit), p_.max_limit);
+    }
+
+    void maybe_adjust() {
+        uint64_t t = now_us();
+        if (t < next_.load(std::memory_order_relaxed) || !adjust_.try_lock())
+            return;
+        if (t >= next_) {
+            next_ = t + p_.interval_us;
+            adjust();
+        }
+        adjust_.unlock();
+    }
+    void adjust() {
+        auto c = Transaction::txp_counters_combined();
+        uint64_t starts = c.p(txp_total_starts) - starts_, aborts = c.p(txp_total_aborts) - aborts_;
+        if (starts < p_.min_starts)
+            return;
+        starts_ += starts;
+        aborts_ += aborts;
+        unsigned limit = limit_;
+        if (aborts > p_.target_abort_ratio * starts) {
+            limit = clamp(unsigned(limit * p_.decrease));
+            ++stats_.decreases;
+        } else if (limit < p_.max_limit) {
+            limit = clamp(limit + p_.increase);
+            ++stats_.increases;
+        }
+        limit_ = limit;
+        ++stats_.intervals;
+        stats_.limit_sum += limit;
+        stats_.min_limit = std::min(stats_.min_limit, limit);
+        stats_.max_limit = std::max(stats_.max_limit, limit);
+        if (sleepers_.load()) {
+            std::lock_guard<std::mutex> lk(m_);
+            cv_.notify_all();
+        }
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "compiler.hh"
+
+// Routes submitted transactions to worker threads by the partition of
+// their first key, so transactions that conflict tend to run on one
+// worker, one after another, instead of aborting each other across cores.
+// Workers that also generate transactions should run their queue first and
+// submit only when it is empty, which bounds the queued work.
+//
+// Each worker has a FIFO queue. A transaction goes to the queue its first
+// key's partition maps to: by hash (affinity_hash), by contiguous key
+// range (affinity_range), or, for comparison, to a random worker
+// (affinity_random). Skewed keys load some queues more than others, so a
+// worker whose queue is empty steals the newest task of the longest queue
+// holding at least steal_threshold tasks; the victim keeps the older ones.
+// Queues hold at most capacity tasks; submit() fails beyond that, and the
+// caller should run the task itself.
+enum affinity_policy {
+    affinity_hash, affinity_range, affinity_random
+};
+
+template <typename Task>
+class AffinityScheduler {
+public:
+    struct params {
+        affinity_policy policy = affinity_hash;
+        uint64_t nkeys = 0;             // affinity_range partitions [0, nkeys)
+        size_t steal_threshold = 8;
+        size_t capacity = 256;
+        unsigned seed = 0;
+    };
+
+    struct stats {
+        uint64_t submitted = 0;         // routed to this worker
+        uint64_t executed = 0;          // taken by this worker
+        uint64_t stolen = 0;            // of those, from other queues
+    };
+
+    AffinityScheduler(int nworkers, const params& p)
+        : p_(p), queues_(nworkers) {
+        always_assert(nworkers > 0 && p_.steal_threshold > 0 && (p_.policy != affinity_range || p_.nkeys), "bad affinity parameters");
+        for (int w = 0; w < nworkers; ++w)
+            queues_[w].rng.seed(p_.seed + w);
+    }
+
+    int nworkers() const {
+        return queues_.size();
+    }
+
+    // The worker that key's transactions go to; from picks the random
+    // stream under affinity_random.
+    int route(int from, uint64_t key) {
+        uint64_t n = queues_.size();
+        switch (p_.policy) {
+        case affinity_hash:
+            return ((key * 0x9e3779b97f4a7c15ULL) >> 32) % n;
+        case affinity_range:
+            return std::min(key / ((p_.nkeys + n - 1) / n), n - 1);
+        default:
+            return queues_[from].rng() % n;
+        }
+    }
+
+    // Queues t, whose first key is key, for its worker; called on worker
+    // from. Leaves t alone and returns false if that queue is full.
+    bool submit(int from, uint64_t key, Task& t) {
+        queue& q = queues_[route(from, key)];
+        std::lock_guard<std::mutex> lk(q.lock);
+        if (q.tasks.size() >= p_.capacity)
+            return false;
+        q.tasks.push_back(std::move(t));
+        q.length.store(q.tasks.size(), std::memory_order_relaxed);
+        ++q.counts.submitted;
+        return true;
+    }
+
+    // Takes worker me's next task, or steals one. Returns false if there
+    // is none to take.
+    bool next(int me, Task& t) {
+        queue& mine = queues_[me];
+        if (mine.length.load(std::memory_order_relaxed) && pop(mine, t, false)) {
+            ++mine.counts.executed;
+            return true;
+        }
+        queue* victim = nullptr;
+        size_t most = p_.steal_threshold - 1;
+        for (auto& q : queues_) {
+            size_t len = q.length.load(std::memory_order_relaxed);
+            if (len > most && &q != &mine) {
+                victim = &q;
+                most = len;
+            }
+        }
+        if (victim && pop(*victim, t, true)) {
+            ++mine.counts.executed;
+            ++mine.counts.stolen;
+            return true;
+        }
+        return false;
+    }
+
+    // Read once the workers are done
+    stats statistics(int worker) const {
+        return queues_[worker].counts;
+    }
+    stats total() const {
+        stats s;
+        for (auto& q : queues_) {
+            s.submitted += q.counts.submitted;
+            s.executed += q.counts.executed;
+            s.stolen += q.counts.stolen;
+        }
+        return s;
+    }
+
+private:
+    struct queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+        std::atomic<size_t> length;     // read without the lock
+        std::mt19937 rng;
+        stats counts;
+        queue()
+            : length(0) {
+        }
+    } __attribute__((aligned(128)));
+
+    params p_;
+    std::vector<queue> queues_;
+
+    bool pop(queue& q, Task& t, bool steal) {
+        std::lock_guard<std::mutex> lk(q.lock);
+        if (q.tasks.empty() || (steal && q.tasks.size() < p_.steal_threshold))
+            return false;
+        if (steal) {
+            t = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            t = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        q.length.store(q.tasks.size(), std::memory_order_relaxed);
+        return true;
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+class TObject;
+class Checkpoint;
+class Recovery;
+
+// Adapter between the benchmark driver (bench.cc) and a transactional
+// index. Keys and values are 64-bit integers; each adapter maps them onto
+// the index's own key type. Operations other than load() run inside a
+// transaction and may abort it.
+//
+// Adapters register themselves with a static BenchIndex::registrar, so
+// indexes that need their own translation unit (TART, in bench_art.cc)
+// plug in without the driver knowing about them.
+class BenchIndex {
+public:
+    enum {
+        op_read = 1, op_update = 2, op_insert = 4, op_remove = 8, op_scan = 16,
+        op_point = op_read | op_update | op_insert | op_remove
+    };
+
+    virtual ~BenchIndex() {
+    }
+
+    // the op_ bits this index supports
+    virtual unsigned ops() const {
+        return op_point;
+    }
+    // Called by each worker thread, after TThread::set_id, before its first
+    // transaction.
+    virtual void thread_init(int) {
+    }
+
+    // Return true if the key was present (read, update, remove) or absent
+    // (insert). update() writes the key whether or not it is present.
+    virtual bool read(uint64_t key, uint64_t& value) = 0;
+    virtual bool update(uint64_t key, uint64_t value) = 0;
+    virtual bool insert(uint64_t key, uint64_t value) = 0;
+    virtual bool remove(uint64_t key) = 0;
+    // Read up to n keys in order starting at key; returns how many were
+    // read. Only called if ops() includes op_scan.
+    virtual unsigned scan(uint64_t key, unsigned n) {
+        (void) key, (void) n;
+        return 0;
+    }
+    // Prefetch what an operation on key will touch, in prefetch_stages()
+    // stages; bench runs each stage for all the keys of a batch of
+    // transactions before the next, and before the batch starts.
+    virtual int prefetch_stages() const {
+        return 0;
+    }
+    virtual void prefetch(uint64_t key, int stage) {
+        (void) key, (void) stage;
+    }
+    // Populate before the run, outside any transaction. Loading threads
+    // call thread_init() first.
+    virtual void load(uint64_t key, uint64_t value) = 0;
+    // True if load() may run on several threads at once (on different
+    // keys); otherwise the driver loads from one thread.
+    virtual bool concurrent_load() const {
+        return false;
+    }
+    // The TObject whose writes bench --log-dir logs; nullptr if none
+    virtual TObject* log_object() {
+        return nullptr;
+    }
+    // Register the index with a bench --checkpoint; false if unsupported
+    virtual bool add_to_checkpoint(Checkpoint&) {
+        return false;
+    }
+    // Register the index with a bench --recover; false if unsupported
+    virtual bool add_to_recovery(Recovery&) {
+        return false;
+    }
+
+    struct factory {
+        const char* name;
+        const char* desc;
+        BenchIndex* (*make)(uint64_t nkeys);
+    };
+    struct registrar {
+        registrar(const char* name, const char* desc, BenchIndex* (*make)(uint64_t)) {
+            factories().push_back(factory{name, desc, make});
+        }
+    };
+
+    static std::vector<factory>& factories() {
+        static std::vector<factory> f;
+        return f;
+    }
+    // Returns nullptr if no index is called `name`.
+    static BenchIndex* make(const std::string& name, uint64_t nkeys) {
+        for (auto& f : factories())
+            if (name == f.name)
+                return f.make(nkeys);
+        return nullptr;
+    }
+};
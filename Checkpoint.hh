@@ -0,0 +1,242 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "RedoLog.hh"
+
+// Checkpoints: an image of one or more indexes, written while transactions
+// keep running, so recovery loads the image instead of replaying every
+// insert.
+//
+// Writer threads take parts of the registered tables (an index's
+// checkpoint_parts()) and write their entries to their own file,
+// DIR/ckpt.ID.T, as redo_records (RedoLog.hh) with epoch 0. A writer pins
+// its RCU epoch for each part, so the nodes it walks stay alive, and
+// publishes the checkpoint's snapshot TID, so TART_MVCC history stays too.
+// Once every file is synced, the manifest DIR/checkpoint is replaced
+// atomically and the previous checkpoint's files are deleted.
+//
+// Each entry is tagged with the TID that wrote it (TART_MVCC: the
+// snapshot TID - 1). Hashtable and non-MVCC TART entries are read as they
+// are when a writer reaches them, so the image alone is fuzzy, as in
+// Silo. It is consistent once combined with the log from the manifest's
+// log_epoch on: taking, for every key, the entry or log record with the
+// highest TID gives the state as of the log's durable epoch. With a
+// RedoLog, write() publishes the manifest only once every commit the
+// image may hold is durable, then lets the log drop older segments.
+//
+// Writers use STO thread ids first_thread .. first_thread + nthreads - 1;
+// no transaction may run on those meanwhile.
+struct checkpoint_manifest {
+    char magic[8];
+    uint32_t version;
+    uint32_t nfiles;
+    uint64_t id;
+    uint64_t snapshot_tid;
+    uint64_t log_epoch;     // replay log records of this epoch or later
+    uint64_t records;
+};
+
+class Checkpoint {
+public:
+    typedef RedoLog::epoch_type epoch_type;
+    typedef std::function<void(unsigned part, TransactionTid::type snap, TLogWriter& w)> scan_type;
+
+    explicit Checkpoint(const std::string& dir, int nthreads = 1, int first_thread = -1)
+        : dir_(dir), nthreads_(std::max(std::min(nthreads, MAX_THREADS), 1)),
+          first_thread_(first_thread >= 0 ? first_thread : MAX_THREADS - nthreads_),
+          seconds_(0), bytes_(0) {
+        memset(&m_, 0, sizeof(m_));
+        always_assert(first_thread_ + nthreads_ <= MAX_THREADS, "checkpoint thread ids out of range");
+    }
+
+    // index needs loggable(), checkpoint_parts() and checkpoint_scan().
+    // Returns false if index can't be logged.
+    template <typename T>
+    bool add(T& index, uint16_t table) {
+        if (!index.loggable())
+            return false;
+        add_table(table, index.checkpoint_parts(), [&index](unsigned part, TransactionTid::type snap, TLogWriter& w) {
+            index.checkpoint_scan(part, snap, w);
+        });
+        return true;
+    }
+    void add_table(uint16_t table, unsigned nparts, scan_type scan) {
+        tables_.push_back(table_info{table, nparts, scan});
+    }
+
+    // Writes a checkpoint. Returns false, leaving the previous one in
+    // place, if a file can't be written.
+    bool write(RedoLog* log = nullptr) {
+        auto t0 = std::chrono::steady_clock::now();
+        mkdir(dir_.c_str(), 0777);
+        checkpoint_manifest old;
+        bool had_old = read_manifest(dir_, old);
+        memset(&m_, 0, sizeof(m_));
+        memcpy(m_.magic, magic(), sizeof(m_.magic));
+        m_.version = 1;
+        m_.nfiles = nthreads_;
+        m_.id = had_old ? old.id + 1 : 1;
+        // every transaction still running began at or after active_epoch,
+        // so every commit the scan may miss is logged in that epoch or later
+        m_.log_epoch = Transaction::global_epochs->active_epoch;
+        for (int t = 0; t < nthreads_; ++t)
+            Transaction::tinfo[first_thread_ + t].snapshot_tid = 1;
+        memory_fence();
+        m_.snapshot_tid = Transaction::next_tid();
+        for (int t = 0; t < nthreads_; ++t)
+            Transaction::tinfo[first_thread_ + t].snapshot_tid = m_.snapshot_tid;
+
+        std::vector<std::pair<unsigned, unsigned>> parts;   // (table, part)
+        for (unsigned i = 0; i < tables_.size(); ++i)
+            for (unsigned p = 0; p < tables_[i].nparts; ++p)
+                parts.push_back(std::make_pair(i, p));
+        std::atomic<size_t> next(0);
+        std::atomic<uint64_t> records(0), bytes(0);
+        std::atomic<bool> ok(true);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < nthreads_; ++t)
+            writers.emplace_back([&, t] {
+                TThread::set_id(first_thread_ + t);
+                int fd = open(file_path(dir_, m_.id, t).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                if (fd < 0) {
+                    ok = false;
+                    return;
+                }
+                std::string buf;
+                uint64_t n = 0, written = 0;
+                for (size_t i; ok && (i = next++) < parts.size(); ) {
+                    const table_info& ti = tables_[parts[i].first];
+                    Transaction::tinfo[TThread::id()].epoch = Transaction::global_epochs->global_epoch;
+                    TLogWriter w(buf, ti.table);
+                    size_t before = buf.size();
+                    ti.scan(parts[i].second, m_.snapshot_tid, w);
+                    n += count(buf, before);
+                    if (buf.size() >= (1 << 20) && !write_all(fd, buf, written))
+                        ok = false;
+                }
+                Transaction::rcu_quiesce();
+                Transaction::tinfo[TThread::id()].snapshot_tid = 0;
+                if (!write_all(fd, buf, written) || fdatasync(fd) != 0)
+                    ok = false;
+                close(fd);
+                records += n;
+                bytes += written;
+            });
+        for (auto& w : writers)
+            w.join();
+        if (!ok)
+            return false;
+        m_.records = records;
+        bytes_ = bytes;
+
+        // the image may hold commits of every epoch up to now
+        if (log && !log->wait_durable(Transaction::global_epochs->global_epoch))
+            return false;
+        if (!write_manifest())
+            return false;
+        if (had_old && old.id != m_.id)
+            for (uint32_t t = 0; t < old.nfiles; ++t)
+                unlink(file_path(dir_, old.id, t).c_str());
+        if (log)
+            log->truncate(m_.log_epoch);
+        seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        return true;
+    }
+
+    // The last checkpoint write() made
+    const checkpoint_manifest& manifest() const {
+        return m_;
+    }
+    double seconds() const {
+        return seconds_;
+    }
+    uint64_t bytes() const {
+        return bytes_;
+    }
+
+    static const char* magic() {
+        return "STOCKPT";
+    }
+    static std::string manifest_path(const std::string& dir) {
+        return dir + "/checkpoint";
+    }
+    static std::string file_path(const std::string& dir, uint64_t id, int t) {
+        return dir + "/ckpt." + std::to_string(id) + "." + std::to_string(t);
+    }
+    // The manifest of dir's checkpoint; false if there is none
+    static bool read_manifest(const std::string& dir, checkpoint_manifest& m) {
+        int fd = open(manifest_path(dir).c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        bool ok = read(fd, &m, sizeof(m)) == sizeof(m)
+            && memcmp(m.magic, magic(), sizeof(m.magic)) == 0 && m.version == 1;
+        close(fd);
+        return ok;
+    }
+
+private:
+    struct table_info {
+        uint16_t table;
+        unsigned nparts;
+        scan_type scan;
+    };
+
+    std::string dir_;
+    int nthreads_;
+    int first_thread_;
+    std::vector<table_info> tables_;
+    checkpoint_manifest m_;
+    double seconds_;
+    uint64_t bytes_;
+
+    // records in buf from offset pos on
+    static uint64_t count(const std::string& buf, size_t pos) {
+        uint64_t n = 0;
+        while (pos < buf.size()) {
+            redo_record r;
+            memcpy(&r, buf.data() + pos, sizeof(r));
+            pos += sizeof(r) + r.key_len + r.value_len;
+            ++n;
+        }
+        return n;
+    }
+    static bool write_all(int fd, std::string& buf, uint64_t& written) {
+        for (size_t off = 0; off < buf.size(); ) {
+            ssize_t w = ::write(fd, buf.data() + off, buf.size() - off);
+            if (w < 0 && errno != EINTR)
+                return false;
+            off += w > 0 ? w : 0;
+        }
+        written += buf.size();
+        buf.clear();
+        return true;
+    }
+    // written to a temporary file and renamed, so the manifest is always whole
+    bool write_manifest() {
+        std::string tmp = manifest_path(dir_) + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return false;
+        bool ok = ::write(fd, &m_, sizeof(m_)) == sizeof(m_) && fdatasync(fd) == 0;
+        close(fd);
+        if (!ok || rename(tmp.c_str(), manifest_path(dir_).c_str()) != 0)
+            return false;
+        int dfd = open(dir_.c_str(), O_RDONLY);
+        if (dfd >= 0) {
+            fsync(dfd);
+            close(dfd);
+        }
+        return true;
+    }
+};
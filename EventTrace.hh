@@ -0,0 +1,255 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "compiler.hh"
+
+// Binary per-operation event log.
+//
+// Each thread appends fixed-size events to its own ring; no locks, no
+// shared cache lines. A background thread drains the rings to a file
+// every millisecond. A full ring drops events rather than stall its
+// thread, and the drops are counted and logged at close.
+// trace_report reads the file and prints per-operation latency
+// distributions and a timeline of commits and aborts.
+//
+// Timestamps and durations are TSC ticks; the file header records ticks
+// per ns. An event's thread is the ring it was recorded on.
+//
+// File: trace_header, then trace_events in per-thread batches (each
+// thread's events are in time order; threads interleave).
+
+enum trace_op : uint8_t {
+    trace_read, trace_update, trace_insert, trace_remove, trace_scan, trace_rmw,
+    trace_txn,      // one transaction attempt
+    trace_load,     // a phase: initial load
+    trace_run,      // a phase: measured run
+    trace_dropped,  // at close: key_hash is the thread's dropped count
+    trace_nops
+};
+enum trace_outcome : uint8_t {
+    trace_ok,       // operation found its key / transaction committed
+    trace_miss,     // operation did not find its key
+    trace_abort
+};
+// Why a transaction attempt aborted
+enum trace_abort_reason : uint8_t {
+    trace_no_abort,
+    trace_exec_abort,    // during execution: lock held, opacity, explicit
+    trace_commit_abort   // at commit: read validation failed
+};
+
+struct trace_event {
+    uint64_t tsc;       // start
+    uint64_t key_hash;
+    uint32_t duration;  // saturates at UINT32_MAX
+    uint8_t thread;
+    uint8_t op;
+    uint8_t outcome;
+    uint8_t reason;
+};
+static_assert(sizeof(trace_event) == 24, "trace_event layout");
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nthreads;
+    double ticks_per_ns;
+    uint64_t start_tsc;
+};
+
+class EventTrace {
+public:
+    static constexpr size_t default_ring_events = 1 << 16;
+
+    explicit EventTrace(int nthreads, size_t ring_events = default_ring_events)
+        : rings_(nthreads), mask_(round_up(ring_events) - 1), f_(nullptr), ticks_per_ns_(0), stop_(false) {
+        for (auto& r : rings_)
+            r.ev = new trace_event[mask_ + 1];
+    }
+    ~EventTrace() {
+        close();
+        for (auto& r : rings_)
+            delete[] r.ev;
+    }
+
+    // Starts the flusher. Returns false if the file can't be created.
+    bool open(const std::string& path) {
+        close();
+        if (!(f_ = fopen(path.c_str(), "wb")))
+            return false;
+        trace_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, magic(), sizeof(h.magic));
+        h.version = 1;
+        h.nthreads = rings_.size();
+        h.ticks_per_ns = ticks_per_ns_ = calibrate();
+        h.start_tsc = read_tsc();
+        fwrite(&h, sizeof(h), 1, f_);
+        for (auto& r : rings_)
+            r.head = r.tail = r.dropped = 0;
+        stop_ = false;
+        flusher_ = std::thread([this] {
+            while (!stop_.load(std::memory_order_acquire)) {
+                drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        return true;
+    }
+    // Drains every ring, logs drop counts and closes the file.
+    void close() {
+        if (!f_)
+            return;
+        stop_.store(true, std::memory_order_release);
+        flusher_.join();
+        drain();
+        for (size_t t = 0; t < rings_.size(); ++t)
+            if (rings_[t].dropped) {
+                trace_event e = {read_tsc(), rings_[t].dropped, 0, uint8_t(t), trace_dropped, trace_ok, trace_no_abort};
+                fwrite(&e, sizeof(e), 1, f_);
+            }
+        fclose(f_);
+        f_ = nullptr;
+    }
+    bool is_open() const {
+        return f_;
+    }
+    double ticks_per_ns() const {
+        return ticks_per_ns_;
+    }
+
+    static uint64_t now() {
+        return read_tsc();
+    }
+    // Record an event on thread's ring that started at start (from now())
+    // and ends now. Only thread may record on its ring.
+    void record(int thread, uint8_t op, uint8_t outcome, uint8_t reason, uint64_t start, uint64_t key_hash = 0) {
+        uint64_t d = read_tsc() - start;
+        ring& r = rings_[thread];
+        uint64_t h = r.head.load(std::memory_order_relaxed);
+        if (h - r.tail.load(std::memory_order_acquire) > mask_) {
+            ++r.dropped;
+            return;
+        }
+        trace_event& e = r.ev[h & mask_];
+        e.tsc = start;
+        e.key_hash = key_hash;
+        e.duration = d < UINT32_MAX ? d : UINT32_MAX;
+        e.thread = thread;
+        e.op = op;
+        e.outcome = outcome;
+        e.reason = reason;
+        r.head.store(h + 1, std::memory_order_release);
+    }
+    uint64_t dropped(int thread) const {
+        return rings_[thread].dropped;
+    }
+
+    // Keys are hashed so a trace doesn't hold key contents but repeated
+    // keys (hot spots) still show.
+    static uint64_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        return key ^ (key >> 33);
+    }
+    static uint64_t hash(const char* s, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < len; ++i)
+            h = (h ^ uint8_t(s[i])) * 0x100000001b3ULL;
+        return h;
+    }
+
+    static const char* magic() {
+        return "STOTRACE";
+    }
+    static const char* op_name(int op) {
+        static const char* const names[] = {
+            "read", "update", "insert", "remove", "scan", "rmw", "txn", "load", "run", "dropped"
+        };
+        return op < trace_nops ? names[op] : "?";
+    }
+
+    // Reads a trace file.
+    class reader {
+    public:
+        reader()
+            : f_(nullptr) {
+        }
+        ~reader() {
+            if (f_)
+                fclose(f_);
+        }
+        bool open(const std::string& path) {
+            if (!(f_ = fopen(path.c_str(), "rb")))
+                return false;
+            return fread(&h_, sizeof(h_), 1, f_) == 1
+                && memcmp(h_.magic, magic(), sizeof(h_.magic)) == 0
+                && h_.version == 1;
+        }
+        const trace_header& header() const {
+            return h_;
+        }
+        bool next(trace_event& e) {
+            return fread(&e, sizeof(e), 1, f_) == 1;
+        }
+    private:
+        FILE* f_;
+        trace_header h_;
+    };
+
+private:
+    struct ring {
+        std::atomic<uint64_t> head;   // written by the recording thread
+        char pad1[64 - sizeof(std::atomic<uint64_t>)];
+        std::atomic<uint64_t> tail;   // written by the flusher
+        uint64_t dropped;
+        trace_event* ev;
+        char pad2[64 - sizeof(std::atomic<uint64_t>) - sizeof(uint64_t) - sizeof(trace_event*)];
+    };
+
+    std::vector<ring> rings_;
+    uint64_t mask_;
+    FILE* f_;
+    double ticks_per_ns_;
+    std::atomic<bool> stop_;
+    std::thread flusher_;
+
+    // Write each ring's pending events in at most two contiguous pieces.
+    void drain() {
+        for (auto& r : rings_) {
+            uint64_t t = r.tail.load(std::memory_order_relaxed);
+            uint64_t h = r.head.load(std::memory_order_acquire);
+            while (t != h) {
+                uint64_t n = std::min(h - t, mask_ + 1 - (t & mask_));
+                fwrite(&r.ev[t & mask_], sizeof(trace_event), n, f_);
+                t += n;
+            }
+            r.tail.store(t, std::memory_order_release);
+        }
+    }
+
+    static uint64_t round_up(size_t n) {
+        uint64_t x = 2;
+        while (x < n)
+            x <<= 1;
+        return x;
+    }
+    // TSC ticks per ns over 10ms of wall clock
+    static double calibrate() {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = read_tsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t c1 = read_tsc();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        return (c1 - c0) / ns;
+    }
+};
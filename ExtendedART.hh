@@ -118,5 +118,13 @@ public:
         return res;
     }
 
+    // bulk load outside transactions; see TART::nontrans_insert
+    bool nontrans_insert(const Key & k, TID tid, ThreadInfo& t){
+        bool inserted = tart.nontrans_insert(k, tid, t);
+        if(inserted && is_using_bloom())
+            bloom.insert(k.getKey(), k.getKeyLen());
+        return inserted;
+    }
+
 };
 
@@ -8,6 +8,7 @@
 #include "TWrapped.hh"
 #include "simple_str.hh"
 #include "print_value.hh"
+#include "RedoLog.hh"
 
 #define HASHTABLE_DELETE 1
 
@@ -15,6 +16,11 @@
 #define READ_MY_WRITES 1
 #endif 
 
+// SharedHashtable.hh repeats this class's transactional protocol over
+// a table in shared memory, linking by offset instead of by pointer:
+// transGet, transDelete, trans_write, check, lock, install, cleanup and
+// _remove, with the same item flags and bucket-version rules. A fix to
+// either copy must be made to both.
 template <typename K, typename V, bool Opacity = true, unsigned Init_size = 129, typename W = V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
 #ifdef STO_NO_STM
 class Hashtable {
@@ -129,6 +135,12 @@ public:
       //if (Opacity)
       //  check_opacity(e->version);
       retval = e->value.read(item, e->version);
+      // a read that waited for a lock (abort_on_locked off) may have
+      // waited out a delete's install
+      if (!validity_check(item, e)) {
+        Sto::abort();
+        return false;
+      }
       return true;
     } else {
       Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
@@ -367,6 +379,99 @@ public:
     }
   }
 
+  bool loggable() const override {
+    return TLogCodec<Key>::supported && TLogCodec<Value>::supported;
+  }
+
+  void log_write(const TransItem& item, TLogWriter& w) override {
+    auto el = item.key<internal_elem*>();
+    // inserts carry their latest value as a write, too
+    if (has_delete(item))
+      w.remove(el->key);
+    else
+      w.write(el->key, item.template write_value<write_value_type>());
+  }
+
+  // Checkpointing (Checkpoint.hh): part `part` of checkpoint_parts() of the
+  // committed contents, each entry tagged with the TID that wrote it.
+  // Runs alongside transactions, so entries are read as they are when the
+  // scan reaches them; snap is unused. The caller's RCU epoch keeps
+  // elements alive.
+  unsigned checkpoint_parts() const {
+    return std::min<size_t>(map_.size(), 1024);
+  }
+
+  void checkpoint_scan(unsigned part, TransactionTid::type snap, TLogWriter& w) {
+    (void) snap;
+    size_t n = map_.size(), parts = checkpoint_parts();
+    for (size_t b = n * part / parts; b != n * (part + 1) / parts; ++b)
+      for (internal_elem* el = map_[b].head; el; el = el->next)
+        while (1) {
+          Version_type v0 = el->version;
+          if (v0.is_locked()) {
+            relax_fence();
+            continue;
+          }
+          // an uncommitted insert, or a committed delete
+          if (!el->valid())
+            break;
+          fence();
+          Value v = el->value.access();
+          fence();
+          if (el->version == v0) {
+            w.set_tid(v0.value() & ~(TransactionTid::increment_value - 1));
+            w.write(el->key, v);
+            break;
+          }
+        }
+  }
+
+  // Recovery (Recovery.hh): the bulk build's order is by bucket, so
+  // recovery threads fill disjoint bucket ranges, each front to back.
+  uint64_t recover_order(const char* key, uint32_t key_len) {
+    return bucket(TLogCodec<Key>::decode(key, key_len));
+  }
+
+  // Applies a checkpoint entry or log record outside any transaction,
+  // unless the key's entry was written by a later TID (Thomas write rule).
+  // Threads may recover at once if each owns its keys and applies their
+  // records in TID order.
+  void recover_apply(const redo_record& r, const char* key, const char* value) {
+    Key k = TLogCodec<Key>::decode(key, r.key_len);
+    bucket_entry& buck = buck_entry(k);
+    lock(buck.version);
+    internal_elem *prev = NULL;
+    internal_elem *e = buck.head;
+    while (e && !pred_(e->key, k)) {
+      prev = e;
+      e = e->next;
+    }
+    if (e && (e->version.value() & ~(TransactionTid::increment_value - 1)) > r.tid) {
+      unlock(buck.version);
+      return;
+    }
+    if (r.flags & redo_record::remove_flag) {
+      if (e) {
+        if (prev)
+          prev->next = e->next;
+        else
+          buck.head = e->next;
+        Transaction::rcu_delete(e);
+      }
+    } else {
+      Value v = TLogCodec<Value>::decode(value, r.value_len);
+      if (!e) {
+        insert_locked<true>(buck, k, v);
+        e = buck.head;
+      } else
+        e->value.access() = v;
+      lock(e->version);
+      e->version.set_version(r.tid);
+      unlock(e->version);
+    }
+    unlock(buck.version);
+  }
+
   // these are wrappers for concurrent.cc and other
   // frameworks we use the hashtable in
   Value transGet(Key k) {
@@ -661,6 +766,19 @@ public:
   // XXX: there's a race between the read and the remove (oldval might be stale) but mehh
   bool nontrans_remove(const Key& k, Value& oldval) { if (read(k,oldval)) return remove(k); else return false; }
 
+  // Prefetches what a lookup of k will touch, in prefetch_stages stages:
+  // 0, the bucket; 1, the bucket's first element, found through the
+  // bucket. Running a stage for every key of a batch before the next stage
+  // overlaps the batch's cache misses. Doesn't touch transaction state.
+  static constexpr int prefetch_stages = 2;
+  void prefetch(const Key& k, int stage) {
+    bucket_entry& buck = buck_entry(k);
+    if (stage == 0)
+      ::prefetch(&buck);
+    else if (internal_elem* e = buck.head)
+      ::prefetch(e);
+  }
+
 private:
   bucket_entry& buck_entry(const Key& k) {
     return map_[bucket(k)];
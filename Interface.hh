@@ -12,6 +12,7 @@ using namespace std;
 class Transaction;
 class TransItem;
 class TransProxy;
+class TLogWriter;
 
 class TThread {
     static __thread int the_id;
@@ -580,6 +581,15 @@ public:
         (void) item, (void) committed;
     }
     virtual void print(std::ostream& w, const TransItem& item) const;
+
+    // Redo logging (RedoLog.hh): log_write appends a written item's new
+    // state. It's called after validation, before install.
+    virtual bool loggable() const {
+        return false;
+    }
+    virtual void log_write(const TransItem& item, TLogWriter& w) {
+        (void) item, (void) w;
+    }
 };
 
 typedef TObject Shared;
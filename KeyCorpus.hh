@@ -0,0 +1,269 @@
+#pragma once
+#include <stdint.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Binary key corpus for the YCSB-style key files used by the TART
+// benchmarks.
+//
+// A text file with one "P <key>" line per key is converted once into
+//
+//     header | uint64_t offsets[nkeys + 1] | key bytes
+//
+// where key i occupies [offsets[i], offsets[i + 1] - 1) of the key bytes and
+// is followed by a NUL. Later runs mmap the converted file read-only, so
+// loading costs nothing per key, and key(i)/length(i) need neither a
+// per-key allocation nor strlen.
+class KeyCorpus {
+public:
+    struct header {
+        char magic[8];
+        uint64_t nkeys;
+        uint64_t nbytes;
+    };
+
+    KeyCorpus()
+        : map_(nullptr), map_size_(0), offsets_(nullptr), bytes_(nullptr), nkeys_(0) {
+    }
+    KeyCorpus(KeyCorpus&& x)
+        : KeyCorpus() {
+        swap(x);
+    }
+    KeyCorpus& operator=(KeyCorpus&& x) {
+        swap(x);
+        return *this;
+    }
+    KeyCorpus(const KeyCorpus&) = delete;
+    KeyCorpus& operator=(const KeyCorpus&) = delete;
+    ~KeyCorpus() {
+        close();
+    }
+
+    uint64_t size() const {
+        return nkeys_;
+    }
+    const char* key(uint64_t i) const {
+        return bytes_ + offsets_[i];
+    }
+    uint32_t length(uint64_t i) const {
+        return offsets_[i + 1] - offsets_[i] - 1;
+    }
+    // key bytes, including each key's NUL
+    uint64_t byte_size() const {
+        return offsets_ ? offsets_[nkeys_] : 0;
+    }
+
+    // Map the converted corpus at `path`. Returns false if there is none.
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        void* m = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(header))
+            m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED)
+            return false;
+        const header* h = reinterpret_cast<const header*>(m);
+        if (memcmp(h->magic, magic(), sizeof(h->magic)) != 0
+            || layout_size(h->nkeys, h->nbytes) != size_t(st.st_size)) {
+            munmap(m, st.st_size);
+            return false;
+        }
+        map_ = m;
+        map_size_ = st.st_size;
+        nkeys_ = h->nkeys;
+        offsets_ = reinterpret_cast<const uint64_t*>(h + 1);
+        bytes_ = reinterpret_cast<const char*>(offsets_ + nkeys_ + 1);
+        return true;
+    }
+    void close() {
+        if (map_)
+            munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+        offsets_ = nullptr;
+        bytes_ = nullptr;
+        nkeys_ = 0;
+    }
+
+    // Open the corpus converted from the text file `src`, which lives next
+    // to it as `src`.keys. Converts first if that is missing or stale.
+    bool open_text(const std::string& src, unsigned nthreads) {
+        std::string dst = src + ".keys";
+        struct stat s, d;
+        if (stat(src.c_str(), &s) != 0) {
+            fprintf(stderr, "%s: %s\n", src.c_str(), strerror(errno));
+            return false;
+        }
+        if (stat(dst.c_str(), &d) != 0 || d.st_mtime < s.st_mtime || !open(dst)) {
+            if (!convert(src, dst, nthreads))
+                return false;
+            return open(dst);
+        }
+        return true;
+    }
+
+    // Convert the text file `src` into a corpus at `dst`. Lines starting
+    // with "P" are keys; the key is the line minus its first two
+    // characters. `nthreads` threads parse disjoint parts of the file.
+    static bool convert(const std::string& src, const std::string& dst, unsigned nthreads) {
+        int fd = ::open(src.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "%s: %s\n", src.c_str(), strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        size_t size = st.st_size;
+        const char* text = nullptr;
+        if (size) {
+            void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (m == MAP_FAILED) {
+                fprintf(stderr, "%s: %s\n", src.c_str(), strerror(errno));
+                return false;
+            }
+            madvise(m, size, MADV_SEQUENTIAL);
+            text = reinterpret_cast<const char*>(m);
+        } else
+            ::close(fd);
+
+        // split at line boundaries
+        nthreads = std::max(nthreads, 1U);
+        std::vector<size_t> bounds(nthreads + 1, size);
+        bounds[0] = 0;
+        for (unsigned t = 1; t < nthreads; ++t) {
+            size_t p = std::max(bounds[t - 1], size / nthreads * t);
+            if (p == 0)
+                bounds[t] = 0;
+            else {
+                auto nl = reinterpret_cast<const char*>(memchr(text + p - 1, '\n', size - p + 1));
+                bounds[t] = nl ? nl - text + 1 : size;
+            }
+        }
+
+        // pass 1: count keys and key bytes per part
+        std::vector<part> parts(nthreads);
+        run_parts(nthreads, [&](unsigned t) {
+                scan(text, bounds[t], bounds[t + 1], [&](const char*, size_t len) {
+                        ++parts[t].nkeys;
+                        parts[t].nbytes += len + 1;
+                    });
+            });
+        uint64_t nkeys = 0, nbytes = 0;
+        for (auto& p : parts) {
+            p.key_base = nkeys;
+            p.byte_base = nbytes;
+            nkeys += p.nkeys;
+            nbytes += p.nbytes;
+        }
+
+        // pass 2: fill the output in place
+        std::string tmp = dst + ".tmp";
+        size_t out_size = layout_size(nkeys, nbytes);
+        int ofd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        void* om = MAP_FAILED;
+        if (ofd >= 0 && ftruncate(ofd, out_size) == 0)
+            om = mmap(nullptr, out_size, PROT_READ | PROT_WRITE, MAP_SHARED, ofd, 0);
+        if (om == MAP_FAILED) {
+            fprintf(stderr, "%s: %s\n", tmp.c_str(), strerror(errno));
+            if (ofd >= 0)
+                ::close(ofd);
+            if (text)
+                munmap(const_cast<char*>(text), size);
+            return false;
+        }
+        header* h = reinterpret_cast<header*>(om);
+        memcpy(h->magic, magic(), sizeof(h->magic));
+        h->nkeys = nkeys;
+        h->nbytes = nbytes;
+        uint64_t* offsets = reinterpret_cast<uint64_t*>(h + 1);
+        char* bytes = reinterpret_cast<char*>(offsets + nkeys + 1);
+        offsets[nkeys] = nbytes;
+        run_parts(nthreads, [&](unsigned t) {
+                uint64_t k = parts[t].key_base, b = parts[t].byte_base;
+                scan(text, bounds[t], bounds[t + 1], [&](const char* key, size_t len) {
+                        offsets[k++] = b;
+                        memcpy(bytes + b, key, len);
+                        bytes[b + len] = 0;
+                        b += len + 1;
+                    });
+            });
+
+        bool ok = munmap(om, out_size) == 0 && ::close(ofd) == 0
+            && rename(tmp.c_str(), dst.c_str()) == 0;
+        if (!ok)
+            fprintf(stderr, "%s: %s\n", dst.c_str(), strerror(errno));
+        if (text)
+            munmap(const_cast<char*>(text), size);
+        return ok;
+    }
+
+private:
+    void* map_;
+    size_t map_size_;
+    const uint64_t* offsets_;
+    const char* bytes_;
+    uint64_t nkeys_;
+
+    struct part {
+        uint64_t nkeys = 0;
+        uint64_t nbytes = 0;
+        uint64_t key_base = 0;
+        uint64_t byte_base = 0;
+    };
+
+    static const char* magic() {
+        return "STOKEYS1";
+    }
+    static size_t layout_size(uint64_t nkeys, uint64_t nbytes) {
+        return sizeof(header) + (nkeys + 1) * sizeof(uint64_t) + nbytes;
+    }
+
+    void swap(KeyCorpus& x) {
+        std::swap(map_, x.map_);
+        std::swap(map_size_, x.map_size_);
+        std::swap(offsets_, x.offsets_);
+        std::swap(bytes_, x.bytes_);
+        std::swap(nkeys_, x.nkeys_);
+    }
+
+    // Call f(key, length) for every key line in [begin, end).
+    template <typename F>
+    static void scan(const char* text, size_t begin, size_t end, F f) {
+        const char* p = text + begin;
+        const char* e = text + end;
+        while (p < e) {
+            const char* nl = reinterpret_cast<const char*>(memchr(p, '\n', e - p));
+            const char* eol = nl ? nl : e;
+            if (*p == 'P') {
+                const char* k = std::min(p + 2, eol);
+                f(k, eol - k);
+            }
+            p = eol + 1;
+        }
+    }
+    template <typename F>
+    static void run_parts(unsigned nthreads, F f) {
+        std::vector<std::thread> thrs;
+        for (unsigned t = 1; t < nthreads; ++t)
+            thrs.emplace_back(f, t);
+        f(0);
+        for (auto& t : thrs)
+            t.join();
+    }
+};
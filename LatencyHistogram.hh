@@ -0,0 +1,98 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+// Log-linear histogram of nonnegative integer samples (latencies in ns).
+//
+// Values below 2 * sub_buckets are counted exactly. Above that, each
+// power-of-two range is split into sub_buckets equal buckets, so every
+// recorded value is known to within 1/sub_buckets (about 3%) of itself
+// across the whole 64-bit range, in a fixed 15KB. record() is a few
+// instructions and histograms from different threads merge by adding
+// counts.
+class LatencyHistogram {
+public:
+    static constexpr int sub_bucket_bits = 5;
+    static constexpr uint64_t sub_buckets = 1 << sub_bucket_bits;
+    static constexpr int nbuckets = 2 * sub_buckets + (63 - sub_bucket_bits) * sub_buckets;
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(counts_, 0, sizeof(counts_));
+        total_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+    void record(uint64_t v, uint64_t n = 1) {
+        counts_[bucket_of(v)] += n;
+        total_ += n;
+        sum_ += double(v) * n;
+        min_ = std::min(min_, v);
+        max_ = std::max(max_, v);
+    }
+    void merge(const LatencyHistogram& x) {
+        for (int i = 0; i < nbuckets; ++i)
+            counts_[i] += x.counts_[i];
+        total_ += x.total_;
+        sum_ += x.sum_;
+        min_ = std::min(min_, x.min_);
+        max_ = std::max(max_, x.max_);
+    }
+
+    uint64_t count() const {
+        return total_;
+    }
+    uint64_t min() const {
+        return total_ ? min_ : 0;
+    }
+    uint64_t max() const {
+        return max_;
+    }
+    double mean() const {
+        return total_ ? sum_ / total_ : 0;
+    }
+    // The smallest recorded value v such that at least p% of samples are
+    // <= v, to within the bucket resolution. Exact for min and max.
+    uint64_t percentile(double p) const {
+        if (!total_)
+            return 0;
+        uint64_t rank = std::max(uint64_t(p / 100 * total_ + 0.5), uint64_t(1));
+        if (rank >= total_)
+            return max_;
+        uint64_t seen = 0;
+        for (int i = 0; i < nbuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank)
+                return std::min(std::max(bucket_value(i), min_), max_);
+        }
+        return max_;
+    }
+
+    static int bucket_of(uint64_t v) {
+        if (v < 2 * sub_buckets)
+            return v;
+        int shift = 63 - __builtin_clzll(v) - sub_bucket_bits;
+        return 2 * sub_buckets + (shift - 1) * sub_buckets + ((v >> shift) - sub_buckets);
+    }
+    // midpoint of the values bucket i holds
+    static uint64_t bucket_value(int i) {
+        if (i < int(2 * sub_buckets))
+            return i;
+        int shift = (i - 2 * sub_buckets) / sub_buckets + 1;
+        uint64_t top = (i - 2 * sub_buckets) % sub_buckets + sub_buckets;
+        return (top << shift) + (uint64_t(1) << (shift - 1));
+    }
+
+private:
+    uint64_t counts_[nbuckets];
+    uint64_t total_;
+    double sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
@@ -0,0 +1,270 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+
+// Live metrics in Prometheus text format, sampled while a workload runs.
+//
+// Sources are counters: functions returning a running total, usually a sum
+// over per-thread slots. A background thread samples every source each
+// interval. It publishes each counter's total and its rate over the last
+// interval, as NAME_total and NAME_per_second. The output is written to a file
+// (replaced atomically, so a node_exporter textfile collector or
+// `watch cat` can read it) and/or served on a Unix socket. The socket
+// speaks bare text or HTTP/1.0:
+//   curl --unix-socket /tmp/sto.sock http://localhost/metrics
+//
+// Per-thread counters have one writer each. read() loads them relaxed,
+// and the writers STO owns store them relaxed. A 64-bit counter is never
+// torn, so a sample is at worst one increment stale. A total that goes
+// down was reset (Transaction::clear_stats(), a new run); the rate then
+// counts from zero.
+class MetricsSampler {
+public:
+    typedef std::function<uint64_t()> source;
+
+    explicit MetricsSampler(double interval_sec = 1)
+        : interval_(interval_sec), listen_fd_(-1), stop_(false) {
+    }
+    ~MetricsSampler() {
+        stop();
+    }
+
+    // labels: "" or Prometheus label pairs, e.g. "reason=\"lock\""
+    void add_counter(const std::string& name, const std::string& help, const std::string& labels, source f) {
+        metric m;
+        m.name = name;
+        m.help = help;
+        m.labels = labels;
+        m.read = f;
+        m.last = 0;
+        m.rate = 0;
+        metrics_.push_back(m);
+    }
+    // Sum of n per-thread counters at p, p + stride, ... (stride in
+    // elements of T).
+    template <typename T>
+    void add_counter(const std::string& name, const std::string& help, const std::string& labels,
+                     const T* p, int n, size_t stride) {
+        add_counter(name, help, labels, [=] {
+            uint64_t sum = 0;
+            for (int i = 0; i < n; ++i)
+                sum += read(p + i * stride);
+            return sum;
+        });
+    }
+    // STO's transaction counters (txp) and, under STO_TSC_PROFILE, its
+    // timing counters (tc), summed over threads
+    void add_sto_counters() {
+        static const char* const txp_names[] = {
+            "aborts", "starts", "commit_time_nonopaque", "commit_time_aborts", "max_set",
+            "tco", "hco", "hco_lock", "hco_invalid", "hco_abort",
+            "n", "r", "w", "max_transbuffer", "transbuffer", "push_abort", "pop_abort",
+            "check_read", "check_predicate", "hash_find", "hash_collision", "hash_collision2", "searched"
+        };
+        static const char* const tc_names[] = {
+            "commit", "commit_wasted", "find_item", "abort", "cleanup", "opacity"
+        };
+        for (int p = 0; p < txp_count; ++p) {
+            if (txp_is_max(p))
+                continue;
+            add_counter("sto_txp_total", "STO transaction counters (Transaction.hh txp)",
+                        std::string("counter=\"") + txp_names[p] + "\"",
+                        &Transaction::tinfo[0].p_.p_[p], MAX_THREADS, sizeof(threadinfo_t) / sizeof(txp_counter_type));
+        }
+#if STO_TSC_PROFILE
+        for (int c = 0; c < tc_count; ++c)
+            add_counter("sto_tsc_ticks_total", "STO time breakdown in TSC ticks (Transaction.hh tc)",
+                        std::string("phase=\"") + tc_names[c] + "\"",
+                        &Transaction::tinfo[0].tcs_.tcs_[c], MAX_THREADS, sizeof(threadinfo_t) / sizeof(tc_counter_type));
+#else
+        (void) tc_names;
+#endif
+    }
+
+    // Either may be empty. Returns false if the socket can't be bound.
+    bool start(const std::string& file, const std::string& socket_path) {
+        file_ = file;
+        if (!socket_path.empty() && !listen_on(socket_path))
+            return false;
+        stop_ = false;
+        sample();
+        thread_ = std::thread([this] { loop(); });
+        return true;
+    }
+    // Takes a final sample, so the file holds the final totals.
+    void stop() {
+        if (!thread_.joinable())
+            return;
+        stop_ = true;
+        thread_.join();
+        sample();
+        if (listen_fd_ >= 0) {
+            ::close(listen_fd_);
+            unlink(socket_path_.c_str());
+            listen_fd_ = -1;
+        }
+    }
+
+    // The latest sample
+    std::string text() const {
+        std::lock_guard<std::mutex> g(text_lock_);
+        return text_;
+    }
+
+    template <typename T>
+    static uint64_t read(const T* p) {
+        return __atomic_load_n(p, __ATOMIC_RELAXED);
+    }
+
+private:
+    struct metric {
+        std::string name;
+        std::string help;
+        std::string labels;
+        source read;
+        uint64_t last;
+        double rate;
+    };
+
+    std::vector<metric> metrics_;
+    double interval_;
+    std::string file_;
+    std::string socket_path_;
+    int listen_fd_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+    mutable std::mutex text_lock_;
+    std::string text_;
+    std::chrono::steady_clock::time_point last_sample_;
+
+    bool listen_on(const std::string& path) {
+        struct sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        unlink(path.c_str());
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd_ < 0
+            || bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(listen_fd_, 16) != 0) {
+            if (listen_fd_ >= 0)
+                ::close(listen_fd_);
+            listen_fd_ = -1;
+            return false;
+        }
+        socket_path_ = path;
+        return true;
+    }
+
+    void loop() {
+        auto next = std::chrono::steady_clock::now();
+        while (!stop_) {
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval_));
+            // serve requests until the next sample is due, checking for
+            // stop at least every 100ms
+            while (!stop_) {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= next)
+                    break;
+                int ms = std::min<long>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1, 100);
+                if (listen_fd_ < 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+                    continue;
+                }
+                struct pollfd p = {listen_fd_, POLLIN, 0};
+                if (poll(&p, 1, ms) == 1)
+                    serve();
+            }
+            if (!stop_)
+                sample();
+        }
+    }
+
+    void serve() {
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0)
+            return;
+        // an HTTP client sends a request first; a bare client may not
+        char req[1024];
+        struct pollfd p = {fd, POLLIN, 0};
+        ssize_t n = poll(&p, 1, 50) == 1 ? ::read(fd, req, sizeof(req)) : 0;
+        std::string body = text();
+        std::string out;
+        if (n >= 4 && memcmp(req, "GET ", 4) == 0)
+            out = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\n\r\n";
+        out += body;
+        for (size_t off = 0; off < out.size(); ) {
+            ssize_t w = ::write(fd, out.data() + off, out.size() - off);
+            if (w <= 0 && errno != EINTR)
+                break;
+            off += w > 0 ? w : 0;
+        }
+        ::close(fd);
+    }
+
+    void sample() {
+        auto now = std::chrono::steady_clock::now();
+        double dt = last_sample_ == std::chrono::steady_clock::time_point()
+            ? 0 : std::chrono::duration<double>(now - last_sample_).count();
+        last_sample_ = now;
+        for (auto& m : metrics_) {
+            uint64_t v = m.read();
+            uint64_t delta = v >= m.last ? v - m.last : v;
+            m.rate = dt > 0 ? delta / dt : 0;
+            m.last = v;
+        }
+
+        std::string out;
+        char buf[64];
+        for (size_t i = 0; i < metrics_.size(); ++i) {
+            const metric& m = metrics_[i];
+            // labeled series of one metric are adjacent; describe it once
+            bool first = i == 0 || metrics_[i - 1].name != m.name;
+            std::string series = m.labels.empty() ? "" : "{" + m.labels + "}";
+            if (first)
+                out += "# HELP " + m.name + " " + m.help + "\n# TYPE " + m.name + " counter\n";
+            snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long) m.last);
+            out += m.name + series + buf;
+        }
+        for (size_t i = 0; i < metrics_.size(); ++i) {
+            const metric& m = metrics_[i];
+            bool first = i == 0 || metrics_[i - 1].name != m.name;
+            std::string series = m.labels.empty() ? "" : "{" + m.labels + "}";
+            std::string name = m.name.compare(m.name.size() > 6 ? m.name.size() - 6 : 0, 6, "_total") == 0
+                ? m.name.substr(0, m.name.size() - 6) + "_per_second" : m.name + "_per_second";
+            if (first)
+                out += "# HELP " + name + " " + m.name + " over the last sampling interval\n# TYPE " + name + " gauge\n";
+            snprintf(buf, sizeof(buf), " %.1f\n", m.rate);
+            out += name + series + buf;
+        }
+        {
+            std::lock_guard<std::mutex> g(text_lock_);
+            text_ = out;
+        }
+        if (!file_.empty()) {
+            std::string tmp = file_ + ".tmp";
+            if (FILE* f = fopen(tmp.c_str(), "w")) {
+                fwrite(out.data(), 1, out.size(), f);
+                fclose(f);
+                rename(tmp.c_str(), file_.c_str());
+            }
+        }
+    }
+};
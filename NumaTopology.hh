@@ -0,0 +1,195 @@
+#pragma once
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// NUMA topology, read from sysfs, and thread and memory placement on it.
+// Does not need libnuma: memory policies are set through the mbind and
+// set_mempolicy system calls directly.
+//
+// Thread placement policies, for nthreads threads (thread i gets CPU i of
+// the result, which wraps if there are fewer CPUs than threads):
+//   compact   fill node 0's CPUs, then node 1's, ... (fewest sockets)
+//   scatter   round-robin over nodes (most sockets, most memory bandwidth)
+//   node:N    only node N's CPUs
+//   CPULIST   the listed CPUs, e.g. "0,4,8-11"
+//
+// Memory: the kernel's default policy allocates a page on the node of the
+// thread that first touches it. That already keeps memory a pinned thread
+// allocates for itself local; Sto::rehome_thread() re-creates STO's
+// per-thread state after pinning so it benefits too. Shared structures are
+// better spread evenly over all nodes: allocate them inside an
+// interleave_guard, or interleave() an existing range.
+class NumaTopology {
+public:
+    // nodes[i] is node i's CPUs
+    explicit NumaTopology(std::vector<std::vector<int>> nodes)
+        : nodes_(std::move(nodes)) {
+        for (size_t n = 0; n < nodes_.size(); ++n)
+            if (!nodes_[n].empty())
+                cpu_nodes_.push_back(n);
+    }
+
+    // The machine's topology, read once. Without sysfs this is one node
+    // holding every CPU.
+    static const NumaTopology& system() {
+        static NumaTopology t(read_sysfs());
+        return t;
+    }
+
+    int nnodes() const {
+        return nodes_.size();
+    }
+    const std::vector<int>& cpus(int node) const {
+        return nodes_[node];
+    }
+    // -1 if the CPU isn't on any node
+    int node_of(int cpu) const {
+        for (size_t n = 0; n < nodes_.size(); ++n)
+            if (std::find(nodes_[n].begin(), nodes_[n].end(), cpu) != nodes_[n].end())
+                return n;
+        return -1;
+    }
+
+    // Returns false if the policy is malformed or names no CPUs.
+    bool place(const std::string& policy, int nthreads, std::vector<int>& out) const {
+        std::vector<int> order;
+        if (policy == "compact") {
+            for (auto& n : nodes_)
+                order.insert(order.end(), n.begin(), n.end());
+        } else if (policy == "scatter") {
+            for (size_t i = 0, added = 1; added; ++i) {
+                added = 0;
+                for (auto& n : nodes_)
+                    if (i < n.size()) {
+                        order.push_back(n[i]);
+                        ++added;
+                    }
+            }
+        } else if (policy.compare(0, 5, "node:") == 0) {
+            char* end;
+            long n = strtol(policy.c_str() + 5, &end, 10);
+            if (*end || end == policy.c_str() + 5 || n < 0 || n >= nnodes())
+                return false;
+            order = nodes_[n];
+        } else if (!parse_cpulist(policy, order))
+            return false;
+        if (order.empty())
+            return false;
+        out.clear();
+        for (int i = 0; i < nthreads; ++i)
+            out.push_back(order[i % order.size()]);
+        return true;
+    }
+
+    // sysfs list format: "0-3,8,10-11"
+    static bool parse_cpulist(const std::string& s, std::vector<int>& out) {
+        out.clear();
+        std::istringstream in(s);
+        std::string part;
+        while (std::getline(in, part, ',')) {
+            int a, b;
+            char dash;
+            std::istringstream p(part);
+            if (!(p >> a) || a < 0)
+                return false;
+            if (p >> dash >> b) {
+                if (dash != '-' || b < a)
+                    return false;
+            } else
+                b = a;
+            for (; a <= b; ++a)
+                out.push_back(a);
+        }
+        return !out.empty();
+    }
+
+    // Move [addr, addr + len) to node, including pages already touched.
+    // Partial pages at either end are included. Returns false on failure,
+    // e.g. where mbind is not permitted.
+    static bool bind(void* addr, size_t len, int node) {
+        unsigned long mask = 1UL << node;
+        return mbind(addr, len, MPOL_BIND, &mask, MPOL_MF_MOVE);
+    }
+    // Spread [addr, addr + len) page by page over the nodes that have CPUs.
+    bool interleave(void* addr, size_t len) const {
+        unsigned long mask = node_mask();
+        return mbind(addr, len, MPOL_INTERLEAVE, &mask, MPOL_MF_MOVE);
+    }
+
+    // While alive, the calling thread's new pages are interleaved over the
+    // nodes that have CPUs (so are pages it first touches that were allocated
+    // earlier but never touched).
+    class interleave_guard {
+    public:
+        explicit interleave_guard(const NumaTopology& t = system()) {
+            unsigned long mask = t.node_mask();
+            ok_ = syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, &mask, sizeof(mask) * 8 + 1) == 0;
+        }
+        ~interleave_guard() {
+            if (ok_)
+                syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+        }
+        bool ok() const {
+            return ok_;
+        }
+    private:
+        bool ok_;
+    };
+
+private:
+    std::vector<std::vector<int>> nodes_;
+    std::vector<int> cpu_nodes_;
+
+    unsigned long node_mask() const {
+        unsigned long mask = 0;
+        for (int n : cpu_nodes_)
+            if (n < int(sizeof(mask) * 8))
+                mask |= 1UL << n;
+        return mask ? mask : 1;
+    }
+
+    static bool mbind(void* addr, size_t len, int mode, unsigned long* mask, unsigned flags) {
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t first = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+        uintptr_t last = (reinterpret_cast<uintptr_t>(addr) + len + page - 1) & ~(page - 1);
+        return syscall(SYS_mbind, first, last - first, mode, mask, sizeof(*mask) * 8 + 1, flags) == 0;
+    }
+
+    static std::vector<std::vector<int>> read_sysfs() {
+        std::vector<std::vector<int>> nodes;
+        if (DIR* d = opendir("/sys/devices/system/node")) {
+            while (struct dirent* e = readdir(d)) {
+                int n;
+                char extra;
+                if (sscanf(e->d_name, "node%d%c", &n, &extra) != 1)
+                    continue;
+                std::ifstream f(std::string("/sys/devices/system/node/") + e->d_name + "/cpulist");
+                std::string list;
+                std::vector<int> cpus;
+                if (f >> list)
+                    parse_cpulist(list, cpus);
+                if (int(nodes.size()) <= n)
+                    nodes.resize(n + 1);
+                nodes[n] = cpus;
+            }
+            closedir(d);
+        }
+        if (nodes.empty()) {
+            nodes.resize(1);
+            for (unsigned c = 0; c < std::max(std::thread::hardware_concurrency(), 1U); ++c)
+                nodes[0].push_back(c);
+        }
+        return nodes;
+    }
+};
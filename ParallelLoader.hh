@@ -0,0 +1,123 @@
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Loads an index from several threads before a benchmark's measured phase.
+//
+// Keys are numbered 0..n-1. The loader splits them into one partition per
+// thread, then run() loads every key and returns once all threads are
+// done, so it doubles as the barrier before measurement. Each partition is
+// a contiguous range of key space: in a trie or tree, every thread builds
+// its own subtrees, and threads rarely meet past the top levels.
+//
+// Use partition_range() if keys are numbered in key order (e.g. integers
+// stored big-endian), and partition_by_prefix() for arbitrary keys, which
+// it sorts into ranges by their leading bytes.
+class ParallelLoader {
+public:
+    // Thread t runs on cpus[t] if cpus is nonempty.
+    explicit ParallelLoader(int nthreads, std::vector<int> cpus = std::vector<int>())
+        : nthreads_(std::max(nthreads, 1)), cpus_(std::move(cpus)), bounds_(nthreads_ + 1, 0) {
+    }
+
+    int nthreads() const {
+        return nthreads_;
+    }
+    uint64_t size() const {
+        return bounds_.back();
+    }
+    uint64_t size(int t) const {
+        return bounds_[t + 1] - bounds_[t];
+    }
+
+    // Thread t loads keys [n*t/T, n*(t+1)/T).
+    void partition_range(uint64_t n) {
+        order_.clear();
+        for (int t = 0; t <= nthreads_; ++t)
+            bounds_[t] = n * t / nthreads_;
+    }
+
+    // key(i) returns key i as a std::pair<const char*, size_t>. Keys are
+    // bucketed by the two bytes after the prefix all of them share (a
+    // corpus of "user<digits>" keys splits on its digits), and each thread
+    // gets a run of consecutive buckets holding about n/T keys.
+    template <typename KeyFn>
+    void partition_by_prefix(uint64_t n, KeyFn key) {
+        assert(n <= UINT32_MAX);
+        size_t prefix = 0;
+        if (n) {
+            auto k0 = key(0);
+            std::string first(k0.first, k0.second);
+            prefix = first.size();
+            for (uint64_t i = 1; i < n && prefix; ++i) {
+                auto k = key(i);
+                prefix = std::mismatch(first.begin(), first.begin() + std::min(prefix, k.second), k.first).first
+                    - first.begin();
+            }
+        }
+
+        std::vector<uint16_t> bucket(n);
+        std::vector<uint64_t> start(nbuckets + 1, 0);
+        for (uint64_t i = 0; i < n; ++i) {
+            auto k = key(i);
+            unsigned b0 = prefix < k.second ? uint8_t(k.first[prefix]) : 0;
+            unsigned b1 = prefix + 1 < k.second ? uint8_t(k.first[prefix + 1]) : 0;
+            bucket[i] = b0 << 8 | b1;
+            ++start[bucket[i] + 1];
+        }
+        for (unsigned b = 0; b < nbuckets; ++b)
+            start[b + 1] += start[b];
+
+        bounds_[0] = 0;
+        unsigned b = 0;
+        for (int t = 1; t < nthreads_; ++t) {
+            while (b < nbuckets && start[b + 1] <= n * t / nthreads_)
+                ++b;
+            bounds_[t] = start[b];
+        }
+        bounds_[nthreads_] = n;
+
+        order_.resize(n);
+        for (uint64_t i = 0; i < n; ++i)
+            order_[start[bucket[i]]++] = i;
+    }
+
+    // Run init(t) once on each thread t, then load(t, i) for every key i of
+    // its partition. Returns the elapsed seconds.
+    template <typename Init, typename Load>
+    double run(Init init, Load load) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads_; ++t)
+            threads.emplace_back([&, t] {
+                if (!cpus_.empty()) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpus_[t % cpus_.size()], &set);
+                    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+                }
+                init(t);
+                for (uint64_t j = bounds_[t]; j != bounds_[t + 1]; ++j)
+                    load(t, order_.empty() ? j : uint64_t(order_[j]));
+            });
+        for (auto& th : threads)
+            th.join();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+private:
+    static constexpr unsigned nbuckets = 1 << 16;
+
+    int nthreads_;
+    std::vector<int> cpus_;
+    std::vector<uint64_t> bounds_;
+    std::vector<uint32_t> order_;   // empty: identity
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Hardware event counts for a region of a benchmark, read in-process
+// through perf_event_open (no perf binary, no sampling).
+//
+// Counters are opened disabled on the calling thread with inherit set, so
+// they also count every thread it creates afterwards: construct, spawn the
+// workers, start(), and read after the workers are joined. Counters the
+// kernel or CPU won't provide (no PMU, perf_event_paranoid, a VM) are just
+// unavailable. If more counters are open than the PMU has, the kernel
+// multiplexes them; value() scales the count by the time each was running.
+//
+// node_misses counts loads served from another NUMA node's memory, the
+// closest portable measure of cross-socket traffic.
+class PerfCounters {
+public:
+    enum {
+        task_clock, cycles, instructions, llc_misses, branch_misses, node_misses, ncounters
+    };
+
+    PerfCounters() {
+        for (int c = 0; c < ncounters; ++c) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type(c).type;
+            attr.config = type(c).config;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fd_[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+    ~PerfCounters() {
+        for (int c = 0; c < ncounters; ++c)
+            if (fd_[c] >= 0)
+                close(fd_[c]);
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void start() {
+        for (int c = 0; c < ncounters; ++c)
+            if (fd_[c] >= 0) {
+                ioctl(fd_[c], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd_[c], PERF_EVENT_IOC_ENABLE, 0);
+            }
+    }
+    void stop() {
+        for (int c = 0; c < ncounters; ++c)
+            if (fd_[c] >= 0)
+                ioctl(fd_[c], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    bool available(int c) const {
+        return fd_[c] >= 0;
+    }
+    // Count since start() (task_clock is in ns), or -1 if unavailable.
+    double value(int c) const {
+        uint64_t v[3];  // value, time enabled, time running
+        if (fd_[c] < 0 || ::read(fd_[c], v, sizeof(v)) != sizeof(v))
+            return -1;
+        if (v[2] == 0)
+            return v[1] == 0 ? 0 : -1;
+        return v[2] < v[1] ? double(v[0]) * v[1] / v[2] : double(v[0]);
+    }
+
+    static const char* name(int c) {
+        return type(c).name;
+    }
+
+private:
+    struct event_type {
+        const char* name;
+        uint32_t type;
+        uint64_t config;
+    };
+    static constexpr uint64_t cache_read_miss(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+    static const event_type& type(int c) {
+        static const event_type types[ncounters] = {
+            {"task_clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+            {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {"llc_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_LL)},
+            {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {"node_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_NODE)}
+        };
+        return types[c];
+    }
+
+    int fd_[ncounters];
+};
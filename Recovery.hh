@@ -0,0 +1,346 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "RedoLog.hh"
+#include "Checkpoint.hh"
+
+// Recovery: rebuilds indexes after a restart from the latest checkpoint
+// (Checkpoint.hh) and the redo log written since (RedoLog.hh).
+//
+// run() bulk-builds the indexes in two phases, each on nthreads threads:
+//  1. Threads take checkpoint files and log segments from a shared queue
+//     and map them. For each checkpoint entry, and each log record of a
+//     durable epoch from the checkpoint's log_epoch on, a thread keeps a
+//     small sort entry pointing at the record, and sorts the file's
+//     entries by the index's build order (recover_order), key and TID.
+//     Regular samples of the sorted runs split the order into nthreads
+//     ranges (parallel sorting by regular sampling).
+//  2. Thread p merges range p from every run and applies, for each key,
+//     only the record with the highest TID: the key's state as of the
+//     log's durable epoch. Each key is applied once, in build order, and
+//     threads own disjoint ranges: a Hashtable's ranges are of buckets, so
+//     no two threads share one; TART's are of keys, so each thread builds
+//     its own subtrees.
+// Indexes still apply a record only if it is newer than the key's entry
+// (Thomas write rule), so recovering into a non-empty index is safe.
+// Finally the TID counter is advanced past every recovered TID.
+//
+// Records of epochs after the log's persistent epoch are dropped: their
+// commits never became durable. The files stay mapped until run()
+// returns. Recovery threads use STO thread ids first_thread ..
+// first_thread + nthreads - 1, and no transactions may run until run()
+// returns.
+class Recovery {
+public:
+    typedef RedoLog::epoch_type epoch_type;
+    typedef std::function<void(const redo_record& r, const char* key, const char* value)> apply_type;
+    typedef std::function<uint64_t(const char* key, uint32_t key_len)> order_type;
+
+    // Either directory may be empty: recover from the other alone.
+    Recovery(const std::string& checkpoint_dir, const std::string& log_dir, int nthreads = 1, int first_thread = 0)
+        : checkpoint_dir_(checkpoint_dir), log_dir_(log_dir), nthreads_(std::max(std::min(nthreads, MAX_THREADS), 1)),
+          first_thread_(first_thread), load_seconds_(0), replay_seconds_(0), records_(0), log_records_(0),
+          max_tid_(0) {
+        always_assert(first_thread_ + nthreads_ <= MAX_THREADS, "recovery thread ids out of range");
+    }
+
+    // index needs loggable(), recover_apply() and recover_order().
+    // Returns false if index can't be logged.
+    template <typename T>
+    bool add(T& index, uint16_t table) {
+        if (!index.loggable())
+            return false;
+        add_table(table, [&index](const redo_record& r, const char* key, const char* value) {
+            index.recover_apply(r, key, value);
+        }, [&index](const char* key, uint32_t key_len) {
+            return index.recover_order(key, key_len);
+        });
+        return true;
+    }
+    // order places keys in the build: each thread applies a range of it,
+    // in order. Keys of equal order are applied in key order.
+    void add_table(uint16_t table, apply_type apply, order_type order = redo_key_order) {
+        tables_.push_back(table_info{table, apply, order});
+    }
+
+    // Returns false if a file can't be read, or holds a table nobody added.
+    bool run() {
+        auto t0 = std::chrono::steady_clock::now();
+        checkpoint_manifest m;
+        std::vector<std::string> ckpt_files, log_files;
+        epoch_type min_epoch = 0, max_epoch = 0;
+        if (!checkpoint_dir_.empty() && Checkpoint::read_manifest(checkpoint_dir_, m)) {
+            for (uint32_t t = 0; t < m.nfiles; ++t)
+                ckpt_files.push_back(Checkpoint::file_path(checkpoint_dir_, m.id, t));
+            min_epoch = m.log_epoch;
+            max_tid_ = m.snapshot_tid;
+        }
+        if (!log_dir_.empty()) {
+            log_files = RedoLog::log_files(log_dir_);
+            max_epoch = RedoLog::persistent_epoch(log_dir_);
+        }
+
+        // phase 1: map the files, and sort each file's records
+        std::vector<mapped_file> files(ckpt_files.size() + log_files.size());
+        std::vector<std::vector<entry>> runs(files.size());
+        std::vector<TransactionTid::type> max_tids(nthreads_, max_tid_);
+        std::atomic<size_t> next(0);
+        std::atomic<uint64_t> records(0), log_records(0);
+        std::atomic<bool> ok(true);
+        parallel([&](int t) {
+            for (size_t i; ok && (i = next++) < files.size(); ) {
+                bool is_ckpt = i < ckpt_files.size();
+                if (!files[i].open(is_ckpt ? ckpt_files[i] : log_files[i - ckpt_files.size()])) {
+                    ok = false;
+                    break;
+                }
+                // a record is at least a header long; capacity that is never
+                // touched takes no memory
+                std::vector<entry>& run = runs[i];
+                run.reserve(files[i].size() / sizeof(redo_record));
+                redo_record r;
+                const char* end = files[i].data() + files[i].size();
+                for (const char* s = files[i].data(); read_record(s, end, r); s += sizeof(r) + r.key_len + r.value_len) {
+                    if (is_ckpt || (r.epoch >= min_epoch && r.epoch <= max_epoch)) {
+                        const table_info* ti = find(r.table);
+                        if (!ti) {
+                            ok = false;
+                            break;
+                        }
+                        run.push_back(entry{ti->order(s + sizeof(r), r.key_len), s});
+                    }
+                    max_tids[t] = std::max(max_tids[t], TransactionTid::type(r.tid));
+                }
+                (is_ckpt ? records : log_records) += run.size();
+                sort_entries(run.data(), run.data() + run.size());
+            }
+        });
+        records_ = records;
+        log_records_ = log_records;
+        auto t1 = std::chrono::steady_clock::now();
+        load_seconds_ = std::chrono::duration<double>(t1 - t0).count();
+        if (!ok)
+            return false;
+
+        // phase 2: split the order at regular samples of the sorted runs,
+        // then merge each range and apply its keys' newest records
+        std::vector<uint64_t> samples, splitters;
+        for (auto& run : runs)
+            for (int i = 0; i < nthreads_ && !run.empty(); ++i)
+                samples.push_back(run[run.size() * i / nthreads_].order);
+        std::sort(samples.begin(), samples.end());
+        for (int p = 1; p < nthreads_; ++p)
+            splitters.push_back(samples.empty() ? 0 : samples[samples.size() * p / nthreads_]);
+        parallel([&](int p) {
+            typedef std::pair<const entry*, const entry*> cursor;
+            auto later = [](const cursor& a, const cursor& b) {
+                return entry_before(*b.first, *a.first);
+            };
+            std::vector<cursor> heap;
+            for (auto& run : runs) {
+                const entry* b = run.data();
+                const entry* e = b + run.size();
+                if (p > 0)
+                    b = std::lower_bound(b, e, splitters[p - 1], order_less);
+                if (p < nthreads_ - 1)
+                    e = std::lower_bound(b, e, splitters[p], order_less);
+                if (b != e)
+                    heap.push_back(cursor(b, e));
+            }
+            std::make_heap(heap.begin(), heap.end(), later);
+            const entry* last = nullptr;
+            while (!heap.empty()) {
+                std::pop_heap(heap.begin(), heap.end(), later);
+                const entry* x = heap.back().first++;
+                if (heap.back().first == heap.back().second)
+                    heap.pop_back();
+                else
+                    std::push_heap(heap.begin(), heap.end(), later);
+                // a key's records are adjacent, oldest first
+                if (last && (last->order != x->order || compare_keys(last->rec, x->rec) != 0))
+                    apply(last->rec);
+                last = x;
+            }
+            if (last)
+                apply(last->rec);
+        });
+        replay_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+
+        max_tid_ = *std::max_element(max_tids.begin(), max_tids.end());
+        Transaction::advance_tid(max_tid_);
+        return true;
+    }
+
+    // Mapping the checkpoint and log, and sorting their records
+    double load_seconds() const {
+        return load_seconds_;
+    }
+    // Building the indexes from the sorted records
+    double replay_seconds() const {
+        return replay_seconds_;
+    }
+    double seconds() const {
+        return load_seconds_ + replay_seconds_;
+    }
+    // Checkpoint entries read
+    uint64_t records() const {
+        return records_;
+    }
+    // Durable log records read, including those a newer record superseded
+    uint64_t log_records() const {
+        return log_records_;
+    }
+    TransactionTid::type max_tid() const {
+        return max_tid_;
+    }
+
+private:
+    // A checkpoint file or log segment, mapped read-only
+    class mapped_file {
+    public:
+        mapped_file()
+            : data_(nullptr), size_(0) {
+        }
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file() {
+            if (size_)
+                munmap(const_cast<char*>(data_), size_);
+        }
+        bool open(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            bool ok = fstat(fd, &st) == 0;
+            if (ok && st.st_size > 0) {
+                void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if ((ok = m != MAP_FAILED)) {
+                    data_ = static_cast<const char*>(m);
+                    size_ = st.st_size;
+                }
+            }
+            ::close(fd);
+            return ok;
+        }
+        const char* data() const {
+            return data_;
+        }
+        size_t size() const {
+            return size_;
+        }
+    private:
+        const char* data_;
+        size_t size_;
+    };
+
+    struct table_info {
+        uint16_t table;
+        apply_type apply;
+        order_type order;
+    };
+    // A record to sort. Its order sorts most records without touching the
+    // mapped file.
+    struct entry {
+        uint64_t order;
+        const char* rec;
+    };
+
+    std::string checkpoint_dir_;
+    std::string log_dir_;
+    int nthreads_;
+    int first_thread_;
+    std::vector<table_info> tables_;
+    double load_seconds_;
+    double replay_seconds_;
+    uint64_t records_;
+    uint64_t log_records_;
+    TransactionTid::type max_tid_;
+
+    const table_info* find(uint16_t table) const {
+        for (auto& t : tables_)
+            if (t.table == table)
+                return &t;
+        return nullptr;
+    }
+    void apply(const char* s) const {
+        redo_record r;
+        memcpy(&r, s, sizeof(r));
+        find(r.table)->apply(r, s + sizeof(r), s + sizeof(r) + r.key_len);
+    }
+
+    // Reads the header of the record at s; false at the end, or at a
+    // record cut short by a crash
+    static bool read_record(const char* s, const char* end, redo_record& r) {
+        if (size_t(end - s) < sizeof(r))
+            return false;
+        memcpy(&r, s, sizeof(r));
+        return size_t(end - s) - sizeof(r) >= size_t(r.key_len) + r.value_len;
+    }
+    // Orders records by table and key bytes, shorter keys first
+    static int compare_keys(const char* a, const char* b) {
+        redo_record ra, rb;
+        memcpy(&ra, a, sizeof(ra));
+        memcpy(&rb, b, sizeof(rb));
+        if (ra.table != rb.table)
+            return ra.table < rb.table ? -1 : 1;
+        if (int c = memcmp(a + sizeof(ra), b + sizeof(rb), std::min(ra.key_len, rb.key_len)))
+            return c;
+        return int(ra.key_len > rb.key_len) - int(ra.key_len < rb.key_len);
+    }
+    // Build order, then key, then TID
+    static bool entry_before(const entry& a, const entry& b) {
+        if (a.order != b.order)
+            return a.order < b.order;
+        if (int c = compare_keys(a.rec, b.rec))
+            return c < 0;
+        uint64_t ta, tb;
+        memcpy(&ta, a.rec + offsetof(redo_record, tid), sizeof(ta));
+        memcpy(&tb, b.rec + offsetof(redo_record, tid), sizeof(tb));
+        return ta < tb;
+    }
+    // Checkpoints are scanned in build order, so a checkpoint file usually
+    // needs only the entries of equal order sorted.
+    static void sort_entries(entry* b, entry* e) {
+        if (!std::is_sorted(b, e, [](const entry& x, const entry& y) { return x.order < y.order; })) {
+            std::sort(b, e, entry_before);
+            return;
+        }
+        while (b != e) {
+            entry* g = b + 1;
+            while (g != e && g->order == b->order)
+                ++g;
+            if (g - b > 1)
+                std::sort(b, g, entry_before);
+            b = g;
+        }
+    }
+    static bool order_less(const entry& a, uint64_t order) {
+        return a.order < order;
+    }
+    template <typename F>
+    void parallel(F f) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads_; ++t)
+            threads.emplace_back([&, t] {
+                TThread::set_id(first_thread_ + t);
+                f(t);
+                Transaction::rcu_quiesce();
+            });
+        for (auto& th : threads)
+            th.join();
+    }
+};
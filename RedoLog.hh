@@ -0,0 +1,438 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Transaction.hh"
+
+// Redo logging for durability, after Silo's parallel logging.
+//
+// Every committing transaction that writes a registered object appends
+// redo records (table, key, new value or removal, commit TID, epoch) to
+// its thread's in-memory buffer. Logger threads, each owning a subset of
+// worker threads, move those buffers to per-logger files (DIR/log.L.S,
+// segment S of logger L). There is no shared log tail for workers to
+// contend on. truncate() lets loggers start new segments and delete the
+// old ones once a checkpoint (Checkpoint.hh) covers them.
+//
+// Group commit follows Transaction::global_epochs->global_epoch. A
+// transaction's epoch is read after it locks its write set and before it
+// validates, so a transaction's epoch is never smaller than that of one
+// it depends on. When the global epoch reaches G, each logger takes its
+// workers' buffers, writes them and fdatasyncs. Every record of epoch
+// G - 1 or earlier is then on disk. The durable epoch is the minimum over
+// loggers; it is published in DIR/pepoch for recovery, which replays
+// records of epochs up to it. Commits return before they are durable
+// (as in Silo). A client that needs durability waits:
+//   if (log.wait_durable(log.commit_epoch())) ... reply ...
+//
+// The epoch advancer thread must run for the durable epoch to advance.
+// Objects opt in through TObject::loggable()/log_write and
+// register_object().
+struct redo_record {
+    enum { remove_flag = 1 };
+    uint64_t tid;
+    uint64_t epoch;
+    uint32_t key_len;
+    uint32_t value_len;
+    uint16_t table;
+    uint8_t flags;
+    uint8_t pad[5];
+    // key_len key bytes then value_len value bytes follow
+};
+static_assert(sizeof(redo_record) == 32, "redo_record layout");
+
+// Where a key's records go in a recovery bulk build (Recovery.hh), for
+// indexes ordered by key: its first 8 bytes as a big-endian number.
+inline uint64_t redo_key_order(const char* key, uint32_t key_len) {
+    unsigned char b[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(b, key, std::min<size_t>(key_len, sizeof(b)));
+    uint64_t x = 0;
+    for (unsigned char c : b)
+        x = (x << 8) | c;
+    return x;
+}
+
+// How a key or value type is written to the log: trivially copyable types
+// as their bytes, strings as their characters. Other types aren't
+// supported, and objects using them aren't loggable.
+template <typename T>
+struct TLogCodec {
+    static constexpr bool supported = std::is_trivially_copyable<T>::value;
+    static const void* data(const T& x) {
+        return &x;
+    }
+    static size_t size(const T&) {
+        return sizeof(T);
+    }
+    static T decode(const char* s, size_t) {
+        T x;
+        memcpy(static_cast<void*>(&x), s, sizeof(T));
+        return x;
+    }
+};
+template <>
+struct TLogCodec<std::string> {
+    static constexpr bool supported = true;
+    static const void* data(const std::string& x) {
+        return x.data();
+    }
+    static size_t size(const std::string& x) {
+        return x.size();
+    }
+    static std::string decode(const char* s, size_t n) {
+        return std::string(s, n);
+    }
+};
+
+// Handed to TObject::log_write to append an item's record.
+class TLogWriter {
+public:
+    template <typename K, typename V>
+    void write(const K& key, const V& value) {
+        put(TLogCodec<K>::data(key), TLogCodec<K>::size(key), TLogCodec<V>::data(value), TLogCodec<V>::size(value), 0);
+    }
+    template <typename K>
+    void remove(const K& key) {
+        put(TLogCodec<K>::data(key), TLogCodec<K>::size(key), nullptr, 0, redo_record::remove_flag);
+    }
+    TLogWriter(std::string& buf, uint16_t table)
+        : buf_(&buf), tid_(0), epoch_(0), table_(table) {
+    }
+    // the TID of the records that follow
+    void set_tid(uint64_t tid) {
+        tid_ = tid;
+    }
+    void put(const void* key, size_t key_len, const void* value, size_t value_len, uint8_t flags) {
+        redo_record r;
+        memset(&r, 0, sizeof(r));
+        r.tid = tid_;
+        r.epoch = epoch_;
+        r.key_len = key_len;
+        r.value_len = value_len;
+        r.table = table_;
+        r.flags = flags;
+        buf_->append(reinterpret_cast<const char*>(&r), sizeof(r));
+        buf_->append(static_cast<const char*>(key), key_len);
+        if (value_len)
+            buf_->append(static_cast<const char*>(value), value_len);
+    }
+
+private:
+    std::string* buf_;
+    uint64_t tid_;
+    uint64_t epoch_;
+    uint16_t table_;
+    friend class RedoLog;
+};
+
+class RedoLog {
+public:
+    typedef TRcuSet::epoch_type epoch_type;
+
+    explicit RedoLog(const std::string& dir, int nloggers = 1)
+        : dir_(dir), nloggers_(std::max(std::min(nloggers, MAX_THREADS), 1)),
+          durable_(new std::atomic<epoch_type>[nloggers_]), persisted_(0), bytes_(0), truncate_(0), stop_(false) {
+    }
+    ~RedoLog() {
+        stop();
+        delete[] durable_;
+    }
+
+    // Log obj's writes as table. Returns false if obj can't be logged.
+    bool register_object(TObject& obj, uint16_t table) {
+        if (!obj.loggable())
+            return false;
+        tables_.push_back(std::make_pair(&obj, table));
+        return true;
+    }
+
+    // Starts a new log in DIR, replacing any log there, starts the loggers
+    // and turns logging on for every commit. Returns false if the files
+    // can't be created.
+    bool start() {
+        mkdir(dir_.c_str(), 0777);
+        for (auto& f : log_files(dir_))
+            unlink(f.c_str());
+        truncate_ = 0;
+        for (int l = 0; l < nloggers_; ++l) {
+            int fd = open(log_path(dir_, l, 0).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) {
+                for (int fd : fds_)
+                    close(fd);
+                fds_.clear();
+                return false;
+            }
+            fds_.push_back(fd);
+            durable_[l] = 0;
+        }
+        persisted_ = 0;
+        write_persistent_epoch(0);
+        stop_ = false;
+        for (int l = 0; l < nloggers_; ++l)
+            loggers_.emplace_back([this, l] { logger(l); });
+        Transaction::redo_log = this;
+        return true;
+    }
+    // Call once transactions have stopped: writes everything and makes
+    // every commit durable.
+    void stop() {
+        if (loggers_.empty())
+            return;
+        Transaction::redo_log = nullptr;
+        stop_ = true;
+        for (auto& t : loggers_)
+            t.join();
+        loggers_.clear();
+        for (int fd : fds_)
+            close(fd);
+        fds_.clear();
+    }
+
+    // Every commit of this epoch or earlier is on disk.
+    epoch_type durable_epoch() const {
+        epoch_type d = durable_[0].load(std::memory_order_acquire);
+        for (int l = 1; l < nloggers_; ++l)
+            d = std::min(d, durable_[l].load(std::memory_order_acquire));
+        return d;
+    }
+    // The epoch of the calling thread's last logged commit
+    epoch_type commit_epoch() const {
+        return threads_[TThread::id()].last_epoch;
+    }
+    // Block until epoch e is durable. Returns false if logging stops first.
+    bool wait_durable(epoch_type e) const {
+        while (durable_epoch() < e) {
+            if (stop_.load(std::memory_order_acquire))
+                return durable_epoch() >= e;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+    uint64_t bytes() const {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+    // Records of epochs before e are no longer needed. Each logger starts
+    // a new segment at its next sync, and deletes segments whose records
+    // are all older than e.
+    void truncate(epoch_type e) {
+        epoch_type t = truncate_.load();
+        while (t < e && !truncate_.compare_exchange_weak(t, e))
+            ;
+    }
+    int nloggers() const {
+        return nloggers_;
+    }
+
+    static std::string log_path(const std::string& dir, int logger, int segment) {
+        return dir + "/log." + std::to_string(logger) + "." + std::to_string(segment);
+    }
+    // Every log segment in dir, by logger then segment
+    static std::vector<std::string> log_files(const std::string& dir) {
+        std::vector<std::pair<std::pair<int, int>, std::string>> found;
+        if (DIR* d = opendir(dir.c_str())) {
+            while (struct dirent* e = readdir(d)) {
+                int l, seg, n = 0;
+                if (sscanf(e->d_name, "log.%d.%d%n", &l, &seg, &n) == 2 && e->d_name[n] == 0)
+                    found.push_back(std::make_pair(std::make_pair(l, seg), dir + "/" + e->d_name));
+            }
+            closedir(d);
+        }
+        std::sort(found.begin(), found.end());
+        std::vector<std::string> out;
+        for (auto& f : found)
+            out.push_back(f.second);
+        return out;
+    }
+    static std::string epoch_path(const std::string& dir) {
+        return dir + "/pepoch";
+    }
+    // The durable epoch a log directory recorded; 0 if none
+    static epoch_type persistent_epoch(const std::string& dir) {
+        epoch_type e = 0;
+        int fd = open(epoch_path(dir).c_str(), O_RDONLY);
+        if (fd >= 0) {
+            if (read(fd, &e, sizeof(e)) != sizeof(e))
+                e = 0;
+            close(fd);
+        }
+        return e;
+    }
+
+    // Reads one log file's records in order.
+    class reader {
+    public:
+        reader()
+            : f_(nullptr) {
+        }
+        ~reader() {
+            if (f_)
+                fclose(f_);
+        }
+        bool open(const std::string& path) {
+            if (!(f_ = fopen(path.c_str(), "rb")))
+                return false;
+            setvbuf(f_, nullptr, _IOFBF, 1 << 20);
+            return true;
+        }
+        // False at the end, or at a record cut short by a crash
+        bool next(redo_record& r, std::string& key, std::string& value) {
+            if (fread(&r, sizeof(r), 1, f_) != 1)
+                return false;
+            key.resize(r.key_len);
+            value.resize(r.value_len);
+            return (!r.key_len || fread(&key[0], r.key_len, 1, f_) == 1)
+                && (!r.value_len || fread(&value[0], r.value_len, 1, f_) == 1);
+        }
+    private:
+        FILE* f_;
+    };
+
+    // Commit path (Transaction::try_commit). begin is called with the
+    // write set locked, before validation; append for each write once
+    // validation passes; end after the last append or on abort.
+    void commit_begin() {
+        thread_log& t = threads_[TThread::id()];
+        while (t.locked.exchange(true, std::memory_order_acquire))
+            relax_fence();
+        t.epoch = Transaction::global_epochs->global_epoch;
+        fence();
+    }
+    void commit_append(TransItem& item, Transaction& txn) {
+        TObject* obj = item.owner();
+        for (auto& t : tables_)
+            if (t.first == obj) {
+                thread_log& tl = threads_[TThread::id()];
+                TLogWriter w(tl.buf, t.second);
+                w.tid_ = txn.commit_tid();
+                w.epoch_ = tl.epoch;
+                obj->log_write(item, w);
+                tl.last_epoch = tl.epoch;
+                return;
+            }
+    }
+    void commit_end() {
+        threads_[TThread::id()].locked.store(false, std::memory_order_release);
+    }
+
+private:
+    struct thread_log {
+        std::atomic<bool> locked;   // held by the worker while committing
+        epoch_type epoch;           // the committing transaction's
+        epoch_type last_epoch;
+        std::string buf;
+        char pad[64];               // keeps neighbors off our cache lines
+        thread_log()
+            : locked(false), epoch(0), last_epoch(0) {
+        }
+    };
+
+    std::string dir_;
+    int nloggers_;
+    thread_log threads_[MAX_THREADS];
+    std::vector<std::pair<TObject*, uint16_t>> tables_;
+    std::vector<int> fds_;
+    std::vector<std::thread> loggers_;
+    std::atomic<epoch_type>* durable_;
+    std::mutex persist_lock_;
+    epoch_type persisted_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<epoch_type> truncate_;
+    std::atomic<bool> stop_;
+
+    // Logger l serves worker threads l, l + nloggers, ... It writes every
+    // 10ms, and syncs when the global epoch has advanced.
+    void logger(int l) {
+        std::string out;
+        epoch_type synced = Transaction::global_epochs->global_epoch;
+        int segment = 0;
+        uint64_t segment_bytes = 0;
+        epoch_type rotated = 0;
+        // earlier segments, each with a bound on its records' epochs
+        std::vector<std::pair<int, epoch_type>> closed;
+        while (true) {
+            bool last = stop_.load(std::memory_order_acquire);
+            epoch_type g = Transaction::global_epochs->global_epoch;
+            fence();
+            for (int t = l; t < MAX_THREADS; t += nloggers_) {
+                thread_log& tl = threads_[t];
+                while (tl.locked.exchange(true, std::memory_order_acquire))
+                    relax_fence();
+                out.append(tl.buf);
+                tl.buf.clear();
+                tl.locked.store(false, std::memory_order_release);
+            }
+            for (size_t off = 0; off < out.size(); ) {
+                ssize_t w = write(fds_[l], out.data() + off, out.size() - off);
+                always_assert(w > 0 || errno == EINTR, "redo log write failed");
+                off += w > 0 ? w : 0;
+            }
+            bytes_ += out.size();
+            segment_bytes += out.size();
+            out.clear();
+            if (g != synced || last) {
+                fdatasync(fds_[l]);
+                synced = g;
+                // after stop, nothing commits: all of epoch g is here
+                durable_[l].store(last ? g : g - 1, std::memory_order_release);
+                publish();
+                epoch_type t = truncate_.load();
+                if (t > rotated && segment_bytes && !last) {
+                    // no record written so far is newer than the current epoch
+                    closed.push_back(std::make_pair(segment, Transaction::global_epochs->global_epoch));
+                    int fd = open(log_path(dir_, l, segment + 1).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                    always_assert(fd >= 0, "cannot create redo log segment");
+                    close(fds_[l]);
+                    fds_[l] = fd;
+                    ++segment;
+                    segment_bytes = 0;
+                    rotated = t;
+                }
+                while (!closed.empty() && closed.front().second < t) {
+                    unlink(log_path(dir_, l, closed.front().first).c_str());
+                    closed.erase(closed.begin());
+                }
+            }
+            if (last)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    void publish() {
+        std::lock_guard<std::mutex> g(persist_lock_);
+        epoch_type d = durable_epoch();
+        if (d > persisted_) {
+            write_persistent_epoch(d);
+            persisted_ = d;
+        }
+    }
+    // written to a temporary file and renamed, so pepoch is always whole
+    void write_persistent_epoch(epoch_type e) {
+        std::string tmp = epoch_path(dir_) + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return;
+        if (write(fd, &e, sizeof(e)) == sizeof(e) && fdatasync(fd) == 0)
+            rename(tmp.c_str(), epoch_path(dir_).c_str());
+        close(fd);
+        int dfd = open(dir_.c_str(), O_RDONLY);
+        if (dfd >= 0) {
+            fsync(dfd);
+            close(dfd);
+        }
+    }
+};
@@ -0,0 +1,380 @@
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "BenchIndex.hh"
+
+// Serves one shared index to local clients over a Unix socket (bench
+// --serve; loadgen drives it).
+//
+// Clients send fixed-size request_msgs and get a response_msg for each, in
+// order per connection. They may pipeline: send many requests before
+// reading any response.
+//
+// The acceptor hands each connection to one worker thread, round-robin.
+// Workers are pinned to CPUs if given. A worker polls its connections,
+// takes up to batch_size complete requests from those that are readable,
+// and runs the batch as one transaction. Responses are written once it
+// commits. A batch pays for one commit, but its requests commit together,
+// so a conflict retries all of them.
+struct request_msg {
+    enum { get = 0, put = 1, scan = 2, remove = 3 };
+    uint32_t id;
+    uint8_t op;
+    uint8_t pad;
+    uint16_t count;         // scan: keys to read
+    uint64_t key;
+    uint64_t value;         // put
+};
+
+struct response_msg {
+    enum { ok = 0, not_found = 1, bad_request = 2 };
+    uint32_t id;
+    uint8_t status;
+    uint8_t pad[3];
+    uint64_t value;         // get: the value; scan: keys read
+};
+
+class RequestServer {
+public:
+    // Workers use STO thread ids first_thread .. first_thread + nworkers - 1;
+    // worker w runs on cpus[w % cpus.size()] if cpus is nonempty.
+    RequestServer(BenchIndex& index, int nworkers, std::vector<int> cpus = std::vector<int>(),
+                  unsigned batch_size = 32, int first_thread = 0)
+        : index_(index), nworkers_(std::max(std::min(nworkers, MAX_THREADS), 1)), cpus_(std::move(cpus)),
+          batch_size_(std::max(batch_size, 1U)), first_thread_(first_thread), listen_fd_(-1),
+          workers_(new worker_state[nworkers_]), next_worker_(0), stop_(false) {
+        always_assert(first_thread_ + nworkers_ <= MAX_THREADS, "server thread ids out of range");
+    }
+    ~RequestServer() {
+        stop();
+    }
+
+    // Returns false if the socket can't be bound.
+    bool start(const std::string& path) {
+        struct sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        unlink(path.c_str());
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd_ < 0
+            || bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(listen_fd_, 128) != 0) {
+            if (listen_fd_ >= 0)
+                ::close(listen_fd_);
+            listen_fd_ = -1;
+            return false;
+        }
+        path_ = path;
+        stop_ = false;
+        for (int w = 0; w < nworkers_; ++w)
+            threads_.emplace_back([this, w] { work(w); });
+        threads_.emplace_back([this] { accept_loop(); });
+        return true;
+    }
+    // Closes every connection.
+    void stop() {
+        if (threads_.empty())
+            return;
+        stop_ = true;
+        for (auto& t : threads_)
+            t.join();
+        threads_.clear();
+        ::close(listen_fd_);
+        unlink(path_.c_str());
+        listen_fd_ = -1;
+    }
+
+    uint64_t requests() const {
+        uint64_t n = 0;
+        for (int w = 0; w < nworkers_; ++w)
+            n += workers_[w].requests.load(std::memory_order_relaxed);
+        return n;
+    }
+    // Transactions run; requests() / batches() is the mean batch size
+    uint64_t batches() const {
+        uint64_t n = 0;
+        for (int w = 0; w < nworkers_; ++w)
+            n += workers_[w].batches.load(std::memory_order_relaxed);
+        return n;
+    }
+
+private:
+    struct worker_state {
+        std::mutex lock;
+        std::vector<int> incoming;          // accepted, not yet polled
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> batches;
+        char pad[64];
+        worker_state()
+            : requests(0), batches(0) {
+        }
+    };
+    struct connection {
+        int fd;
+        std::string in, out;
+        size_t in_pos = 0, out_pos = 0;
+        bool closed = false;
+        explicit connection(int f)
+            : fd(f) {
+        }
+    };
+
+    BenchIndex& index_;
+    int nworkers_;
+    std::vector<int> cpus_;
+    unsigned batch_size_;
+    int first_thread_;
+    std::string path_;
+    int listen_fd_;
+    std::unique_ptr<worker_state[]> workers_;
+    unsigned next_worker_;
+    std::atomic<bool> stop_;
+    std::vector<std::thread> threads_;
+
+    static constexpr size_t max_pending_output = 1 << 20;
+
+    void accept_loop() {
+        while (!stop_) {
+            struct pollfd p = {listen_fd_, POLLIN, 0};
+            if (poll(&p, 1, 100) != 1)
+                continue;
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            worker_state& w = workers_[next_worker_++ % nworkers_];
+            std::lock_guard<std::mutex> guard(w.lock);
+            w.incoming.push_back(fd);
+        }
+    }
+
+    void work(int w) {
+        TThread::set_id(first_thread_ + w);
+        Sto::update_threadid();
+        if (!cpus_.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus_[w % cpus_.size()], &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        Sto::rehome_thread();
+        index_.thread_init(first_thread_ + w);
+
+        worker_state& ws = workers_[w];
+        std::vector<std::unique_ptr<connection>> conns;
+        std::vector<struct pollfd> pfds;
+        std::vector<std::pair<connection*, request_msg>> batch;
+        std::vector<response_msg> responses;
+        while (!stop_) {
+            {
+                std::lock_guard<std::mutex> guard(ws.lock);
+                for (int fd : ws.incoming)
+                    conns.emplace_back(new connection(fd));
+                ws.incoming.clear();
+            }
+            pfds.resize(conns.size());
+            for (size_t i = 0; i < conns.size(); ++i) {
+                connection& c = *conns[i];
+                pfds[i].fd = c.fd;
+                // stop reading from a client that isn't reading its responses
+                pfds[i].events = c.out.size() - c.out_pos < max_pending_output ? POLLIN : 0;
+                if (c.out_pos < c.out.size())
+                    pfds[i].events |= POLLOUT;
+                pfds[i].revents = 0;
+            }
+            if (poll(pfds.data(), pfds.size(), 100) <= 0)
+                continue;
+            for (size_t i = 0; i < conns.size(); ++i)
+                if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    fill(*conns[i]);
+
+            // run batches until no complete request is left
+            while (1) {
+                batch.clear();
+                for (auto& c : conns)
+                    while (batch.size() < batch_size_ && c->in.size() - c->in_pos >= sizeof(request_msg)) {
+                        request_msg req;
+                        memcpy(&req, c->in.data() + c->in_pos, sizeof(req));
+                        c->in_pos += sizeof(req);
+                        batch.push_back(std::make_pair(c.get(), req));
+                    }
+                if (batch.empty())
+                    break;
+                responses.resize(batch.size());
+                TRANSACTION {
+                    for (size_t i = 0; i < batch.size(); ++i)
+                        execute(batch[i].second, responses[i]);
+                } RETRY(true);
+                for (size_t i = 0; i < batch.size(); ++i)
+                    batch[i].first->out.append(reinterpret_cast<const char*>(&responses[i]), sizeof(response_msg));
+                ws.requests.fetch_add(batch.size(), std::memory_order_relaxed);
+                ws.batches.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            for (size_t i = 0; i < conns.size(); ) {
+                connection& c = *conns[i];
+                if (c.in_pos == c.in.size()) {
+                    c.in.clear();
+                    c.in_pos = 0;
+                }
+                flush(c);
+                if (c.closed) {
+                    ::close(c.fd);
+                    conns[i] = std::move(conns.back());
+                    conns.pop_back();
+                } else
+                    ++i;
+            }
+        }
+        for (auto& c : conns)
+            ::close(c->fd);
+        Transaction::rcu_quiesce();
+    }
+
+    void execute(const request_msg& req, response_msg& resp) {
+        resp.id = req.id;
+        resp.status = response_msg::ok;
+        memset(resp.pad, 0, sizeof(resp.pad));
+        resp.value = 0;
+        switch (req.op) {
+        case request_msg::get:
+            if (!index_.read(req.key, resp.value))
+                resp.status = response_msg::not_found;
+            break;
+        case request_msg::put:
+            index_.update(req.key, req.value);
+            break;
+        case request_msg::remove:
+            if (!index_.remove(req.key))
+                resp.status = response_msg::not_found;
+            break;
+        case request_msg::scan:
+            if (index_.ops() & BenchIndex::op_scan)
+                resp.value = index_.scan(req.key, std::max(req.count, uint16_t(1)));
+            else
+                resp.status = response_msg::bad_request;
+            break;
+        default:
+            resp.status = response_msg::bad_request;
+            break;
+        }
+    }
+
+    // Reads what the client has sent
+    void fill(connection& c) {
+        if (c.in_pos > 0 && c.in_pos * 2 >= c.in.size()) {
+            c.in.erase(0, c.in_pos);
+            c.in_pos = 0;
+        }
+        char buf[16384];
+        while (1) {
+            ssize_t n = ::read(c.fd, buf, sizeof(buf));
+            if (n > 0) {
+                c.in.append(buf, n);
+                if (size_t(n) < sizeof(buf))
+                    return;
+            } else if (n < 0 && errno == EINTR)
+                continue;
+            else {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    c.closed = true;
+                return;
+            }
+        }
+    }
+
+    void flush(connection& c) {
+        while (c.out_pos < c.out.size()) {
+            ssize_t n = ::write(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos);
+            if (n > 0)
+                c.out_pos += n;
+            else if (n < 0 && errno == EINTR)
+                continue;
+            else {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    c.closed = true;
+                break;
+            }
+        }
+        if (c.out_pos == c.out.size()) {
+            c.out.clear();
+            c.out_pos = 0;
+        }
+    }
+};
+
+// A blocking client connection to a RequestServer
+class RequestClient {
+public:
+    RequestClient()
+        : fd_(-1) {
+    }
+    ~RequestClient() {
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    bool connect(const std::string& path) {
+        struct sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        return fd_ >= 0 && ::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+    }
+
+    bool send(const request_msg* reqs, size_t n) {
+        const char* p = reinterpret_cast<const char*>(reqs);
+        for (size_t off = 0, len = n * sizeof(request_msg); off < len; ) {
+            ssize_t w = ::write(fd_, p + off, len - off);
+            if (w < 0 && errno != EINTR)
+                return false;
+            off += w > 0 ? w : 0;
+        }
+        return true;
+    }
+    // Waits for at least one response, and appends every complete response
+    // received so far to out. False if the server closed the connection.
+    bool receive(std::vector<response_msg>& out) {
+        while (1) {
+            size_t n = buf_.size() / sizeof(response_msg);
+            if (n) {
+                size_t at = out.size();
+                out.resize(at + n);
+                memcpy(&out[at], buf_.data(), n * sizeof(response_msg));
+                buf_.erase(0, n * sizeof(response_msg));
+                return true;
+            }
+            char tmp[16384];
+            ssize_t r = ::read(fd_, tmp, sizeof(tmp));
+            if (r > 0)
+                buf_.append(tmp, r);
+            else if (r == 0 || errno != EINTR)
+                return false;
+        }
+    }
+
+private:
+    int fd_;
+    std::string buf_;       // a partial response
+};
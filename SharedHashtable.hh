@@ -0,0 +1,348 @@
+#pragma once
+#include <new>
+#include <type_traits>
+#include "Interface.hh"
+#include "Transaction.hh"
+#include "TWrapped.hh"
+#include "SharedRegion.hh"
+
+// SharedHashtable: Hashtable's transactional protocol over a table that
+// lives in a SharedRegion, so processes that attach to the region run
+// transactions on the same data.
+//
+// The table, its buckets and elements are in the region and link with
+// shm_ptr; the SharedHashtable object is a per-process handle (a TObject
+// has a vtable, which can't be shared). Processes find a table by name.
+// Keys and values must be trivially copyable, and every process must hash
+// keys alike. The bucket count is fixed at creation.
+//
+// The protocol functions mirror Hashtable.hh's one for one (remove is
+// Hashtable's _remove); a fix to either copy must be made to both.
+//
+// An insert that finds the region full throws std::bad_alloc, which aborts
+// the transaction and leaves the TRANSACTION block; other processes carry
+// on.
+template <typename K, typename V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+class SharedHashtable : public TObject {
+public:
+    typedef K key_type;
+    typedef V value_type;
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                  "shared keys and values are copied by layout");
+
+    static constexpr TVersion::type invalid_bit = TransactionTid::user_bit;
+
+    // Opens the table named name in region, creating it with nbuckets
+    // buckets if no process has. ok() is false if the region is full.
+    SharedHashtable(SharedRegion& region, const char* name, size_t nbuckets = 1024, Hash h = Hash(), Pred p = Pred())
+        : hasher_(h), pred_(p) {
+        table_ = reinterpret_cast<table*>(region.find_or_create(name, sizeof(table) + nbuckets * sizeof(bucket_entry), [&](void* m) {
+            table* t = reinterpret_cast<table*>(m);
+            t->nbuckets = nbuckets;
+            for (size_t b = 0; b != nbuckets; ++b)
+                new(&t->buckets[b]) bucket_entry;
+        }));
+        region_ = &region;
+    }
+
+    bool ok() const {
+        return table_;
+    }
+    size_t nbuckets() const {
+        return table_->nbuckets;
+    }
+
+    template <typename KT>
+    bool transGet(const KT& k, V& retval) {
+        bucket_entry& buck = buck_entry(k);
+        TVersion buck_version = buck.version;
+        fence();
+        elem* e = find(buck, k);
+        if (!e) {
+            Sto::item(this, pack_bucket(bucket(k))).observe(TVersion(buck_version.unlocked()));
+            return false;
+        }
+        auto item = Sto::read_item(this, e);
+        if (!has_insert(item) && !e->valid()) {
+            Sto::abort();
+            return false;
+        }
+        if (has_delete(item))
+            return false;
+        if (item.has_write()) {
+            retval = item.template write_value<V>();
+            return true;
+        }
+        retval = e->value.read(item, e->version);
+        // a read that waited for a lock (abort_on_locked off) may have
+        // waited out a delete's install
+        if (!e->valid()) {
+            Sto::abort();
+            return false;
+        }
+        return true;
+    }
+
+    template <typename KT>
+    bool transDelete(const KT& k) {
+        bucket_entry& buck = buck_entry(k);
+        TVersion buck_version = buck.version;
+        fence();
+        elem* e = find(buck, k);
+        if (!e) {
+            Sto::item(this, pack_bucket(bucket(k))).observe(TVersion(buck_version.unlocked()));
+            return false;
+        }
+        TVersion elemvers = e->version;
+        fence();
+        auto item = Sto::item(this, e);
+        bool valid = e->valid();
+        if (!valid && has_insert(item)) {
+            // deleting our own insert: unlink it, and check nobody else
+            // inserts the key
+            remove(e);
+            item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
+            Sto::item(this, pack_bucket(bucket(k))).observe(TVersion(buck_version.unlocked()));
+            return true;
+        } else if (!valid) {
+            Sto::abort();
+            return false;
+        }
+        if (has_delete(item))
+            return false;
+        item.observe(elemvers);
+        item.add_write().add_flags(delete_bit);
+        return true;
+    }
+
+    template <typename KT, typename VT>
+    bool transPut(const KT& k, const VT& v) {
+        return trans_write</*insert*/true, /*set*/true>(k, v);
+    }
+    // returns true if successful
+    template <typename KT, typename VT>
+    bool transInsert(const KT& k, const VT& v) {
+        return !trans_write</*insert*/true, /*set*/false>(k, v);
+    }
+    template <typename KT, typename VT>
+    bool transUpdate(const KT& k, const VT& v) {
+        return trans_write</*insert*/false, /*set*/true>(k, v);
+    }
+
+    bool check(TransItem& item, Transaction&) override {
+        if (is_bucket(item))
+            return table_->buckets[bucket_key(item)].version.check_version(item.template read_value<TVersion>());
+        return item.key<elem*>()->version.check_version(item.template read_value<TVersion>());
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, item.key<elem*>()->version);
+    }
+
+    void install(TransItem& item, Transaction& t) override {
+        elem* el = item.key<elem*>();
+        if (has_delete(item)) {
+            // unlinked in cleanup
+            el->version.set_version_locked(el->version.value() | invalid_bit);
+            return;
+        }
+        if (!has_insert(item))
+            el->value.write(item.template write_value<V>());
+        el->version.set_version(t.commit_tid());    // clears invalid_bit
+        if (has_insert(item)) {
+            // convert the nonopaque bucket version to a commit tid
+            bucket_entry& buck = buck_entry(el->key);
+            buck.version.lock();
+            if (buck.version.value() & TransactionTid::nonopaque_bit)
+                buck.version.set_version(t.commit_tid());
+            buck.version.unlock();
+        }
+    }
+
+    void unlock(TransItem& item) override {
+        item.key<elem*>()->version.unlock();
+    }
+
+    void cleanup(TransItem& item, bool committed) override {
+        if (committed ? has_delete(item) : has_insert(item))
+            remove(item.key<elem*>());
+    }
+
+    bool nontrans_insert(const K& k, const V& v) {
+        bucket_entry& buck = buck_entry(k);
+        buck.version.lock();
+        bool inserted = !find(buck, k) && insert_locked(buck, k, v, true);
+        buck.version.unlock();
+        return inserted;
+    }
+
+    bool nontrans_find(const K& k, V& v) {
+        elem* e = find(buck_entry(k), k);
+        if (e && e->valid())
+            v = e->value.access();
+        return e && e->valid();
+    }
+
+    // Elements in the table, including uncommitted inserts
+    size_t nontrans_size() const {
+        size_t n = 0;
+        for (size_t b = 0; b != table_->nbuckets; ++b)
+            for (elem* e = table_->buckets[b].head; e; e = e->next)
+                ++n;
+        return n;
+    }
+
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{SharedHashtable " << (void*) this;
+        if (is_bucket(item))
+            w << ".b" << bucket_key(item);
+        else
+            w << "." << item.key<void*>();
+        w << "}";
+    }
+
+private:
+    struct elem {
+        K key;
+        shm_ptr<elem> next;
+        TVersion version;
+        TWrapped<V> value;
+        elem(const K& k, const V& v, bool valid)
+            : key(k), version(Sto::initialized_tid() | (valid ? 0 : invalid_bit)), value(v) {
+        }
+        bool valid() const {
+            return !(version.value() & invalid_bit);
+        }
+    };
+    struct bucket_entry {
+        shm_ptr<elem> head;
+        // incremented on insert, so a failed lookup stays failed
+        TVersion version;
+        bucket_entry()
+            : version(0) {
+        }
+    };
+    struct table {
+        uint64_t nbuckets;
+        bucket_entry buckets[0];
+    };
+
+    // marks bucket items' keys; elem pointers are aligned
+    static constexpr uintptr_t bucket_bit = 1;
+    static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit << 1;
+
+    table* table_;
+    SharedRegion* region_;
+    Hash hasher_;
+    Pred pred_;
+
+    template <typename KT>
+    size_t bucket(const KT& k) const {
+        return hasher_(k) % table_->nbuckets;
+    }
+    template <typename KT>
+    bucket_entry& buck_entry(const KT& k) const {
+        return table_->buckets[bucket(k)];
+    }
+    template <typename KT>
+    elem* find(bucket_entry& buck, const KT& k) const {
+        elem* e = buck.head;
+        while (e && !pred_(e->key, k))
+            e = e->next;
+        return e;
+    }
+    static bool is_bucket(const TransItem& item) {
+        return item.key<uintptr_t>() & bucket_bit;
+    }
+    static size_t bucket_key(const TransItem& item) {
+        return item.key<uintptr_t>() >> 1;
+    }
+    static void* pack_bucket(size_t b) {
+        return reinterpret_cast<void*>((b << 1) | bucket_bit);
+    }
+    static bool has_delete(const TransItem& item) {
+        return item.flags() & delete_bit;
+    }
+    static bool has_insert(const TransItem& item) {
+        return item.flags() & insert_bit;
+    }
+
+    bool insert_locked(bucket_entry& buck, const K& k, const V& v, bool valid) {
+        void* m = region_->allocate(sizeof(elem));
+        if (!m)
+            return false;
+        elem* e = new(m) elem(k, v, valid);
+        e->next = buck.head;
+        fence();
+        buck.head = e;
+        buck.version.inc_nonopaque_version();
+        return true;
+    }
+
+    // Unlinks e. Other processes may still be reading it, so the region
+    // frees it once every attached process has left the current epoch.
+    void remove(elem* e) {
+        bucket_entry& buck = buck_entry(e->key);
+        buck.version.lock();
+        shm_ptr<elem>* p = &buck.head;
+        while (p->get() != e)
+            p = &(*p)->next;
+        *p = e->next;
+        buck.version.unlock();
+        region_->retire(e);
+    }
+
+    // returns true if the key already existed
+    template <bool INSERT, bool SET, typename KT, typename VT>
+    bool trans_write(const KT& k, const VT& v) {
+        bucket_entry& buck = buck_entry(k);
+        buck.version.lock();
+        elem* e = find(buck, k);
+        if (e) {
+            buck.version.unlock();
+            TVersion elemvers = e->version;
+            fence();
+            auto item = Sto::item(this, e);
+            if (!has_insert(item) && !e->valid()) {
+                Sto::abort();
+                return false;
+            }
+            if (has_delete(item)) {
+                // delete-then-insert is an update; delete-then-update fails
+                if (INSERT)
+                    item.clear_flags(delete_bit).clear_write().template add_write<V>(v);
+                return false;
+            }
+            item.observe(elemvers);
+            if (SET) {
+                item.template add_write<V>(v);
+                // inserts install no value, so keep ours current
+                if (has_insert(item))
+                    e->value.write(v);
+            }
+            return true;
+        }
+        if (!INSERT) {
+            auto buck_vers = buck.version.unlocked();
+            fence();
+            buck.version.unlock();
+            Sto::item(this, pack_bucket(bucket(k))).observe(TVersion(buck_vers));
+            return false;
+        }
+        auto prev_version = buck.version.unlocked();
+        bool inserted = insert_locked(buck, k, v, false);
+        elem* new_head = buck.head;
+        auto new_version = buck.version.unlocked();
+        fence();
+        buck.version.unlock();
+        if (!inserted)
+            TVersion::opaque_throw(std::bad_alloc());
+        if (auto bucket_item = Sto::check_item(this, pack_bucket(bucket(k))))
+            bucket_item->update_read(TVersion(prev_version), TVersion(new_version));
+        auto item = Sto::new_item(this, new_head);
+        item.template add_write<V>(v);
+        item.add_flags(insert_bit);
+        return false;
+    }
+};
@@ -0,0 +1,399 @@
+#pragma once
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Transaction.hh"
+
+// SharedRegion: a file-backed mapping that several processes on one host
+// share, holding STO data structures (SharedHashtable.hh) and the
+// transaction state those processes must agree on. Put the file on a
+// tmpfs such as /dev/shm.
+//
+// Each process may map the region at a different address, so structures in
+// it link by offset (shm_ptr). The header holds an allocator, a table of
+// named roots through which processes find structures, and a
+// Transaction::shared_state: the epoch state, the commit TID counter and
+// one slot per attached process.
+//
+// attach_transactions() points this process's Transaction at the shared
+// epoch state and TID counter, and reserves a range of STO thread ids:
+// locked versions record their holder's thread id, so ids (like commit
+// TIDs) must be unique across processes. Every process runs its own
+// epoch_advancer, which publishes its process's oldest epoch in its slot.
+// Only the advancer of the lowest-numbered live slot moves the shared
+// epochs, taking the oldest of every live process, so memory is reclaimed
+// only once every attached process is past it.
+//
+// Per-thread state (tinfo: RCU sets, counters, callbacks) stays in each
+// process, since it holds process-local pointers. For the same reason,
+// blocks that other processes may still be reading are retired to a list
+// in the region rather than to an RCU set: a process's RCU callbacks can
+// run after it has unmapped the region.
+//
+// All processes must run the same build: structures are shared by layout.
+// A dead process's slot and thread ids are reclaimed by the next attach,
+// but a process that dies holding a version lock or the allocator lock
+// leaves it held.
+class SharedRegion {
+public:
+    static constexpr uint64_t magic_value = 0x53544f5348524732ULL;  // "STOSHRG2"
+    static constexpr int max_roots = 16;
+    static constexpr size_t max_name = 48;
+
+    SharedRegion()
+        : base_(nullptr), size_(0), me_(nullptr) {
+    }
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+    ~SharedRegion() {
+        close();
+    }
+
+    // Creates (or truncates) the region file at path and maps it.
+    bool create(const std::string& path, size_t size) {
+        close();
+        size = round_up(std::max(size, sizeof(header) + 4096), 4096);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || ftruncate(fd, size) != 0) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        if (!map(fd, size, path))
+            return false;
+        header* h = hdr();
+        h->size = size;
+        h->brk = round_up(sizeof(header), block_align);
+        h->state.epochs = *Transaction::global_epochs;
+        h->state.epochs.run = true;
+        h->state.tid = Transaction::next_tid();
+        fence();
+        h->magic = magic_value;
+        return true;
+    }
+
+    // Maps the existing region at path. Returns false if there is none.
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDWR);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(header)) {
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        if (!map(fd, st.st_size, path))
+            return false;
+        if (hdr()->magic != magic_value || hdr()->size != size_) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (me_)
+            detach_transactions();
+        if (base_)
+            munmap(base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    static bool remove(const std::string& path) {
+        return unlink(path.c_str()) == 0;
+    }
+
+    bool is_open() const {
+        return base_;
+    }
+    size_t size() const {
+        return size_;
+    }
+    // Bytes handed out so far, including freed blocks
+    size_t used() const {
+        return hdr()->brk;
+    }
+
+    // Makes this process's transactions use the region's epochs and TID
+    // counter, and reserves nthreads consecutive STO thread ids for it.
+    // Returns the first, or -1 if there is no room. Call it (and
+    // detach_transactions) while this process runs no transactions.
+    int attach_transactions(int nthreads) {
+        always_assert(!me_, "already attached");
+        header* h = hdr();
+        lock(h->lock);
+        Transaction::process_state* slot = nullptr;
+        uint64_t used = 0;
+        for (auto& p : h->state.processes) {
+            // reclaim dead processes
+            if (p.pid && p.pid != getpid() && kill(p.pid, 0) != 0 && errno == ESRCH)
+                p.pid = 0;
+            if (p.pid)
+                used |= thread_mask(p.first_thread, p.nthreads);
+            else if (!slot)
+                slot = &p;
+        }
+        int first = 0;
+        while (first + nthreads <= MAX_THREADS && (used & thread_mask(first, nthreads)))
+            ++first;
+        if (!slot || nthreads < 1 || first + nthreads > MAX_THREADS) {
+            unlock(h->lock);
+            return -1;
+        }
+        slot->first_thread = first;
+        slot->nthreads = nthreads;
+        // count this process before its advancer first publishes
+        slot->active_epoch = h->state.epochs.global_epoch;
+        slot->snapshot_tid = 0;
+        fence();
+        slot->pid = getpid();
+        unlock(h->lock);
+        me_ = slot;
+        Transaction::use_shared_state(&h->state, slot);
+        return first;
+    }
+
+    void detach_transactions() {
+        if (!me_)
+            return;
+        Transaction::use_shared_state(nullptr, nullptr);
+        fence();
+        me_->pid = 0;
+        me_ = nullptr;
+    }
+
+    // Allocates size bytes, aligned to 16. Returns nullptr if the region is
+    // full.
+    void* allocate(size_t size) {
+        header* h = hdr();
+        lock(h->lock);
+        void* p = allocate_locked(size);
+        unlock(h->lock);
+        return p;
+    }
+    // Frees a block from allocate() once no attached process's transaction
+    // can still read it: when every process is past the current epoch.
+    // allocate() reuses retired blocks after that.
+    void retire(void* p) {
+        header* h = hdr();
+        uint64_t* w = reinterpret_cast<uint64_t*>(p);
+        lock(h->lock);
+        w[0] = 0;
+        w[1] = h->state.epochs.global_epoch;
+        if (h->limbo_tail)
+            *reinterpret_cast<uint64_t*>(at(h->limbo_tail)) = offset_of(p);
+        else
+            h->limbo_head = offset_of(p);
+        h->limbo_tail = offset_of(p);
+        unlock(h->lock);
+    }
+    // Frees a block from allocate() now.
+    static void deallocate(void* p) {
+        block* b = reinterpret_cast<block*>(p) - 1;
+        header* h = reinterpret_cast<header*>(reinterpret_cast<char*>(b) - b->offset);
+        // large blocks aren't reused
+        if (b->size > max_small)
+            return;
+        auto& head = h->free[b->size / block_align - 1];
+        lock(h->lock);
+        *reinterpret_cast<uint64_t*>(p) = head;
+        head = b->offset;
+        unlock(h->lock);
+    }
+
+    // The object named name, or nullptr.
+    void* find(const char* name) const {
+        header* h = hdr();
+        lock(h->lock);
+        root* r = find_root(name);
+        void* p = r ? at(r->offset) : nullptr;
+        unlock(h->lock);
+        return p;
+    }
+    // The object named name. If there is none, allocates size bytes, calls
+    // init on them, and names the result, all while holding the region lock
+    // so concurrent callers agree. Returns nullptr if the region or root
+    // table is full.
+    template <typename F>
+    void* find_or_create(const char* name, size_t size, F init) {
+        always_assert(strlen(name) < max_name, "root name too long");
+        header* h = hdr();
+        lock(h->lock);
+        void* p = nullptr;
+        if (root* r = find_root(name))
+            p = at(r->offset);
+        else if (root* r = find_root(""))
+            if ((p = allocate_locked(size))) {
+                init(p);
+                fence();
+                strcpy(r->name, name);
+                r->offset = offset_of(p);
+            }
+        unlock(h->lock);
+        return p;
+    }
+
+    uint64_t offset_of(const void* p) const {
+        return reinterpret_cast<const char*>(p) - base_;
+    }
+    void* at(uint64_t offset) const {
+        return base_ + offset;
+    }
+
+private:
+    static constexpr size_t block_align = 16;
+    static constexpr size_t max_small = 1024;
+
+    struct block {
+        uint64_t offset;        // of this header from the region start
+        uint64_t size;          // rounded to block_align
+    };
+    struct root {
+        char name[max_name];
+        uint64_t offset;
+    };
+    struct header {
+        uint64_t magic;
+        uint64_t size;
+        uint64_t brk;
+        uint32_t lock;
+        uint64_t free[max_small / block_align];     // offsets of free blocks, by size
+        uint64_t limbo_head;    // retired blocks: {next offset, epoch}
+        uint64_t limbo_tail;
+        root roots[max_roots];
+        Transaction::shared_state state __attribute__((aligned(128)));
+    };
+
+    char* base_;
+    size_t size_;
+    Transaction::process_state* me_;
+
+    header* hdr() const {
+        return reinterpret_cast<header*>(base_);
+    }
+    bool map(int fd, size_t size, const std::string& path) {
+        void* m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        base_ = reinterpret_cast<char*>(m);
+        size_ = size;
+        return true;
+    }
+    static size_t round_up(size_t n, size_t align) {
+        return (n + align - 1) & ~(align - 1);
+    }
+    static uint64_t thread_mask(int first, int n) {
+        return ((uint64_t(1) << n) - 1) << first;
+    }
+    static void lock(uint32_t& l) {
+        while (l != 0 || !bool_cmpxchg(&l, 0U, 1U))
+            relax_fence();
+    }
+    static void unlock(uint32_t& l) {
+        release_fence();
+        l = 0;
+    }
+    root* find_root(const char* name) const {
+        for (auto& r : hdr()->roots)
+            if (strcmp(r.name, name) == 0)
+                return &r;
+        return nullptr;
+    }
+    void reclaim_locked() {
+        header* h = hdr();
+        auto active = h->state.epochs.active_epoch;
+        while (h->limbo_head) {
+            uint64_t* w = reinterpret_cast<uint64_t*>(at(h->limbo_head));
+            if (Transaction::signed_epoch_type(active - w[1]) <= 0)
+                break;
+            uint64_t next = w[0];
+            block* b = reinterpret_cast<block*>(w) - 1;
+            // large blocks aren't reused
+            if (b->size <= max_small) {
+                auto& head = h->free[b->size / block_align - 1];
+                w[0] = head;
+                head = b->offset;
+            }
+            h->limbo_head = next;
+        }
+        if (!h->limbo_head)
+            h->limbo_tail = 0;
+    }
+    void* allocate_locked(size_t size) {
+        header* h = hdr();
+        reclaim_locked();
+        size = round_up(std::max(size, sizeof(uint64_t)), block_align);
+        block* b = nullptr;
+        if (size <= max_small && h->free[size / block_align - 1]) {
+            auto& head = h->free[size / block_align - 1];
+            b = reinterpret_cast<block*>(at(head));
+            head = *reinterpret_cast<uint64_t*>(b + 1);
+        } else if (h->brk + sizeof(block) + size <= size_) {
+            b = reinterpret_cast<block*>(at(h->brk));
+            b->offset = h->brk;
+            b->size = size;
+            h->brk += sizeof(block) + size;
+        } else
+            return nullptr;
+        return b + 1;
+    }
+};
+
+// A pointer stored in a SharedRegion. It holds the target's offset from
+// the pointer itself, so it means the same thing wherever the region is
+// mapped; both must be in the same region. Loads and stores are single
+// words, so readers may follow links that writers change under a lock.
+template <typename T>
+class shm_ptr {
+public:
+    shm_ptr()
+        : off_(0) {
+    }
+    shm_ptr(T* p) {
+        set(p);
+    }
+    shm_ptr(const shm_ptr<T>& x) {
+        set(x.get());
+    }
+    shm_ptr<T>& operator=(const shm_ptr<T>& x) {
+        set(x.get());
+        return *this;
+    }
+    shm_ptr<T>& operator=(T* p) {
+        set(p);
+        return *this;
+    }
+
+    T* get() const {
+        intptr_t off = off_;
+        return off ? reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + off) : nullptr;
+    }
+    operator T*() const {
+        return get();
+    }
+    T* operator->() const {
+        return get();
+    }
+    T& operator*() const {
+        return *get();
+    }
+
+private:
+    intptr_t off_;
+
+    void set(T* p) {
+        off_ = p ? reinterpret_cast<intptr_t>(p) - reinterpret_cast<intptr_t>(this) : 0;
+    }
+};
@@ -0,0 +1,133 @@
+#pragma once
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Transaction.hh"
+
+// Profiles of STO's performance knobs (sto_knobs in Transaction.hh).
+//
+// A profile is a text file of "name value" lines, as written by bench
+// --tune; '#' starts a comment. Knobs a profile leaves out keep their
+// values. Profiles apply only to builds with STO_RUNTIME_KNOBS (make
+// RUNTIME_KNOBS=1), and only while no transactions run: a transaction
+// that sees a knob change may, for instance, lock its write set one way
+// and unlock it the other.
+class StoKnobs {
+public:
+    static constexpr int nknobs = 6;
+
+    static const char* name(int i) {
+        static const char* const names[nknobs] = {
+            "abort_on_locked", "sort_writeset", "spin_bound_write",
+            "spin_bound_wait", "backoff_max", "tset_hash_steps"
+        };
+        return names[i];
+    }
+    static int find(const char* name) {
+        for (int i = 0; i != nknobs; ++i)
+            if (strcmp(name, StoKnobs::name(i)) == 0)
+                return i;
+        return -1;
+    }
+
+    static unsigned get(const sto_knobs& k, int i) {
+        switch (i) {
+        case 0: return k.abort_on_locked;
+        case 1: return k.sort_writeset;
+        case 2: return k.spin_bound_write;
+        case 3: return k.spin_bound_wait;
+        case 4: return k.backoff_max;
+        default: return k.tset_hash_steps;
+        }
+    }
+    // Returns false, leaving k alone, if v is out of knob i's range
+    static bool set(sto_knobs& k, int i, unsigned v) {
+        if (v > max_value(i))
+            return false;
+        switch (i) {
+        case 0: k.abort_on_locked = v; break;
+        case 1: k.sort_writeset = v; break;
+        case 2: k.spin_bound_write = v; break;
+        case 3: k.spin_bound_wait = v; break;
+        case 4: k.backoff_max = v; break;
+        default: k.tset_hash_steps = v; break;
+        }
+        return true;
+    }
+    static unsigned max_value(int i) {
+        // spin bounds are shifts; tset_hash_steps probes at most two slots
+        static const unsigned maxes[nknobs] = {1, 1, 31, 31, 1000000, 2};
+        return maxes[i];
+    }
+
+    static const sto_knobs& current() {
+#if STO_RUNTIME_KNOBS
+        return sto_runtime_knobs;
+#else
+        return sto_default_knobs;
+#endif
+    }
+    // Sets every knob. Fails if they are compile-time constants. No thread
+    // may have a transaction in progress.
+    static bool apply(const sto_knobs& k) {
+#if STO_RUNTIME_KNOBS
+        unsigned ntxns = 0;
+        for (int i = 0; i != MAX_THREADS; ++i)
+            ntxns += Transaction::tinfo[i].ntxns;
+        always_assert(ntxns == 0);
+        sto_runtime_knobs = k;
+        return true;
+#else
+        (void) k;
+        return false;
+#endif
+    }
+
+    // Updates k from the profile at path. On failure, returns false and
+    // sets error; k may be partly updated.
+    static bool read(const std::string& path, sto_knobs& k, std::string& error) {
+        FILE* f = fopen(path.c_str(), "r");
+        if (!f) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        char buf[256], name[64];
+        unsigned long v;
+        char extra;
+        for (int line = 1; fgets(buf, sizeof(buf), f); ++line) {
+            if (char* hash = strchr(buf, '#'))
+                *hash = 0;
+            if (sscanf(buf, " %c", &extra) != 1)
+                continue;
+            int i = -1;
+            if (sscanf(buf, " %63s %lu %c", name, &v, &extra) != 2
+                || (i = find(name)) < 0
+                || v > max_value(i)) {
+                error = path + ":" + std::to_string(line) + ": bad knob setting";
+                fclose(f);
+                return false;
+            }
+            set(k, i, v);
+        }
+        fclose(f);
+        return true;
+    }
+    static bool write(const std::string& path, const sto_knobs& k, const std::string& comment = std::string()) {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f)
+            return false;
+        if (!comment.empty())
+            fprintf(f, "# %s\n", comment.c_str());
+        for (int i = 0; i != nknobs; ++i)
+            fprintf(f, "%s %u\n", name(i), get(k, i));
+        return fclose(f) == 0;
+    }
+    // "name=value,..." for logs
+    static std::string unparse(const sto_knobs& k) {
+        std::string s;
+        for (int i = 0; i != nknobs; ++i)
+            s += std::string(i ? "," : "") + name(i) + "=" + std::to_string(get(k, i));
+        return s;
+    }
+};
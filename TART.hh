@@ -1,6 +1,7 @@
 #pragma once
 #include "Interface.hh"
 #include "TWrapped.hh"
+#include "RedoLog.hh"
 
 #include "OptimisticLockCoupling/Tree.h"
 #include "Key.h"
@@ -8,6 +9,8 @@
 #include "measure_latencies.hh"
 #include <map>
 #include <list>
+#include <atomic>
+#include <shared_mutex>
 
 /* 
  *    A transactional version of ART running on top of STO
@@ -24,6 +27,11 @@ using namespace std;
 #define DEBUG_VALIDATION 0
 #define MEASURE_ABORTS 1
 #define ABSENT_VALIDATION 1 // 1 for node set, 2 for node set with absent keys, 3 for absent keys and lookup starting from target node, 4 for key set
+// 1 keeps a per-record value history so read-only scans can run against a
+// snapshot TID (t_lookup_snapshot, t_lookupRange_snapshot)
+#ifndef TART_MVCC
+#define TART_MVCC 0
+#endif
 
 #if DEBUG == 1
     #define PRINT_DEBUG(...) {printf(__VA_ARGS__);}
@@ -56,7 +64,8 @@ static unsigned accessed_nodes_num=0;
 static const unsigned aborts_sz = 10;
 uint64_t aborts[N_THREADS][aborts_sz];
 static string aborts_descr[aborts_sz];
-#define INCR(arg) arg+=1;
+// relaxed, so MetricsSampler can read the counts live
+#define INCR(arg) __atomic_store_n(&(arg), (arg) + 1, __ATOMIC_RELAXED);
 #else
     #define INCR(arg) {}
 #endif
@@ -70,7 +79,7 @@ typedef struct absent_keys {
 #endif
 
 template <typename T, typename W = TWrapped<T>>
-class TART : public Tree, TObject {
+class TART : public Tree, public TObject {
 
 	typedef typename W::version_type version_type;
 
@@ -84,6 +93,9 @@ class TART : public Tree, TObject {
 public:
 
 	TART(LoadKeyFunction loadKeyFun) : Tree(loadKeyFun) {
+        #if TART_MVCC
+            unlinks_ = new unlink_handle(this);
+        #endif
         #if MEASURE_ABORTS == 1
             bzero(aborts, N_THREADS * aborts_sz * sizeof(uint64_t));
             aborts_descr[0] = "nodeset validation failure";
@@ -99,6 +111,18 @@ public:
         #endif
     }
 
+    #if TART_MVCC
+    // Unlinks still pending in RCU sets run after the tree is gone; they
+    // find the handle cleared and do nothing.
+    ~TART() {
+        {
+            std::unique_lock<std::shared_timed_mutex> guard(unlinks_->lock);
+            unlinks_->tart = nullptr;
+        }
+        unlinks_->release();
+    }
+    #endif
+
 	typedef struct record {
 		// DONE: We might not need to store key here!
 		// ART itself does not store actual keys, client is responsible for
@@ -107,6 +131,31 @@ public:
 		TID val;
 		version_type version;
 		bool deleted;
+#if TART_MVCC
+		// older (val, deleted) states, newest first, tagged with the commit
+		// TID that produced them
+		struct history_node {
+			TransactionTid::type tid;
+			TID val;
+			bool deleted;
+			history_node* next;
+		};
+		history_node* history = nullptr;
+		// no longer reachable from the tree
+		bool unlinked = false;
+
+		~record() {
+			free_history(history);
+		}
+		static void free_history(void* p) {
+			history_node* h = reinterpret_cast<history_node*>(p);
+			while (h) {
+				history_node* next = h->next;
+				delete h;
+				h = next;
+			}
+		}
+#endif
 
 		record(const TID v, bool valid):val(v),
 		// Old STO Does not take a bool argument in version constructor
@@ -162,16 +211,69 @@ public:
         // adds a parent node in the node set together with its version number
         t_info->addNodeNS = [this] (const N* node, uint64_t node_vers){
             #if ABSENT_VALIDATION == 1
-                ns_add_node(node, node_vers);
+                ns_add_node(const_cast<N*>(node), node_vers);
             #endif
             return true;
         };
         bool toContinue = lookupRange(start, end, continueKey, result, resultSize, resultsFound, threadEpocheInfo, t_info);
-        if(t_info->abort){
+        bool abort = t_info->abort;
+        delete t_info;
+        if(abort){
             return lookup_res(0, false);
         }
+        #if TART_MVCC
+        // deleted records stay in the tree until no snapshot can see them
+        std::size_t n = 0;
+        for(std::size_t i=0; i<resultsFound; i++){
+            if(!reinterpret_cast<record*>(result[i])->deleted)
+                result[n++] = result[i];
+        }
+        resultsFound = n;
+        #endif
+        return lookup_res(0, true);
+    }
+
+    #if TART_MVCC
+    // Snapshot reads for read-only transactions: return the client TID each
+    // key had as of the transaction's snapshot TID. Nothing joins the read
+    // set, so concurrent writers never abort these reads. Unlike t_lookupRange,
+    // result[] holds client TIDs, not records.
+    lookup_res t_lookup_snapshot(const Key& k, ThreadInfo& threadEpocheInfo){
+        trans_info_t* t_info = new trans_info_t();
+        memset(t_info, 0, sizeof(trans_info_t));
+        TID tid = lookup(k, threadEpocheInfo, t_info);
+        if(t_info->check_key){
+            tid = checkKeyFromRec(tid, k);
+        }
+        delete t_info;
+        TID val;
+        if(tid == 0 || !snapshot_value(reinterpret_cast<record*>(tid), Sto::transaction()->snapshot_tid(), val))
+            return lookup_res(0, true);
+        return lookup_res(val, true);
+    }
+
+    lookup_res t_lookupRange_snapshot(const Key& start, const Key& end, Key & continueKey, TID result[], std::size_t resultSize, std::size_t &resultsFound, ThreadInfo &threadEpocheInfo) {
+        trans_info_range_t* t_info = new trans_info_range_t();
+        memset(t_info, 0, sizeof(trans_info_range_t));
+        t_info->addKeyRS = [](TID){
+            return true;
+        };
+        t_info->addNodeNS = [] (const N*, uint64_t){
+            return true;
+        };
+        auto snap = Sto::transaction()->snapshot_tid();
+        lookupRange(start, end, continueKey, result, resultSize, resultsFound, threadEpocheInfo, t_info);
+        delete t_info;
+        std::size_t n = 0;
+        for(std::size_t i=0; i<resultsFound; i++){
+            TID val;
+            if(snapshot_value(reinterpret_cast<record*>(result[i]), snap, val))
+                result[n++] = val;
+        }
+        resultsFound = n;
         return lookup_res(0, true);
     }
+    #endif
 
 	lookup_res t_lookup(const Key& k, ThreadInfo& threadEpocheInfo){
 		return t_lookup( k, threadEpocheInfo, true);
@@ -222,6 +324,11 @@ public:
 			// add to read set
 			item.observe(rec->version);
             //item.add_read(rec->version);
+            #if TART_MVCC
+            if(rec->deleted && !item.has_write()){ // deleted, waiting to be unlinked: absent
+                return lookup_res(0, true);
+            }
+            #endif
         }
 		return lookup_res(rec->val, true);
 		abort:
@@ -283,6 +390,11 @@ public:
             item.add_write(t_info->updatedVal);
             // TODO: In some runs l_n was null! Check it!
             delete t_info;
+            #if TART_MVCC
+            // a deleted record still in the tree comes back to life
+            if(rec->deleted && !has_delete(item))
+                return ins_res(true, true);
+            #endif
             return ins_res(false, true);
         }
 
@@ -402,6 +514,55 @@ public:
 			return ins_res(false, false);
 	}
 
+    // Insert or update a key outside any transaction, for bulk loading: the
+    // record is created valid and no STO state is touched. Any number of
+    // threads may load at once (ART's lock coupling orders them), but not
+    // while transactions run on the tree. Returns true if the key was new;
+    // *recp, if given, is set to the key's record.
+    bool nontrans_insert(const Key& k, TID tid, ThreadInfo& epocheInfo, record** recp = nullptr){
+        trans_info_t t_info;
+        memset(&t_info, 0, sizeof(trans_info_t));
+        insert(k, tid, epocheInfo, &t_info);
+        if(t_info.updatedVal > 0){
+            record* rec = reinterpret_cast<record*>(t_info.prevVal);
+            rec->val = t_info.updatedVal;
+            rec->deleted = false;
+            if(recp)
+                *recp = rec;
+            return false;
+        }
+        N* n = t_info.cur_node;
+        record* rec = new record(tid, true);
+        if(recp)
+            *recp = rec;
+        N* leaf = N::setLeaf(reinterpret_cast<TID>(rec));
+        switch(n->getType()){
+            case NTypes::N4:
+                (static_cast<N4*>(n))->insert(t_info.keyslice, leaf);
+                break;
+            case NTypes::N16:
+                (static_cast<N16*>(n))->insert(t_info.keyslice, leaf);
+                break;
+            case NTypes::N48:
+                (static_cast<N48*>(n))->insert(t_info.keyslice, leaf);
+                break;
+            case NTypes::N256:
+                (static_cast<N256*>(n))->insert(t_info.keyslice, leaf);
+                break;
+        }
+        if(t_info.w_unlock_obsolete)
+            t_info.l_node->writeUnlockObsolete();
+        else
+            t_info.l_node->writeUnlock();
+        if(t_info.l_parent_node)
+            t_info.l_parent_node->writeUnlock();
+        #if MEASURE_TREE_SIZE == 1
+        if(t_info.addedSize > 0)
+            tree_sz[TThread::id()] += t_info.addedSize;
+        #endif
+        return true;
+    }
+
 	rem_res t_remove(const Key & k, TID tid, ThreadInfo &threadEpocheInfo){
 		bool tid_mismatch = false;
 		trans_info_t* t_info = new trans_info_t();
@@ -427,9 +588,18 @@ public:
 		if(rec->val != tid){ // that's the behavior of ART insert: If the encountered tuple id is different than the supplied one, return
 			tid_mismatch = true;
 		}
+		#if TART_MVCC
+		if(rec->deleted) { // already deleted, waiting to be unlinked: not found
+			auto item = Sto::item(this, rec);
+			item.observe(rec->version);
+			if(!item.has_write())
+				return rem_res(false, true);
+		}
+		#else
 		if(rec->deleted) { // abort
 			 return rem_res(false, false);
 		}
+		#endif
 		if(tid_mismatch){
             //stringstream ss;
             //ss<<"TID mismatch in remove... Found TID: "<<rec->val<<", requested TID: "<<tid<<endl;
@@ -574,6 +744,125 @@ public:
 		return item.flags() & delete_bit;
 	}
 
+    static TransactionTid::type tid_of(const version_type& v){
+        return v.value() & ~(TransactionTid::increment_value - 1);
+    }
+
+    #if TART_MVCC
+
+    // Called with rec->version locked, before the install changes rec.
+    // History older than the newest version every live snapshot can see is
+    // trimmed and freed through RCU.
+    static void save_history(record* rec){
+        auto oldest = Transaction::global_epochs->snapshot_tid;
+        auto h = new typename record::history_node{tid_of(rec->version), rec->val, rec->deleted, rec->history};
+        typename record::history_node* cut = nullptr;
+        for(auto n = h; n; n = n->next){
+            if(n->tid < oldest){
+                cut = n->next;
+                n->next = nullptr;
+                break;
+            }
+        }
+        release_fence();
+        rec->history = h;
+        if(cut)
+            Transaction::rcu_call(record::free_history, cut);
+    }
+
+    // The client TID of rec as of snapshot `snap`; false if the key did not
+    // exist then. Waits out a committing writer rather than aborting.
+    static bool snapshot_value(record* rec, TransactionTid::type snap, TID& val){
+        while(1){
+            version_type v0 = rec->version;
+            if(v0.is_locked()){
+                relax_fence();
+                continue;
+            }
+            // uncommitted inserts will commit after snap
+            if(!rec->valid())
+                return false;
+            fence();
+            if(tid_of(v0) < snap){
+                bool deleted = rec->deleted;
+                val = rec->val;
+                fence();
+                if(rec->version == v0)
+                    return !deleted;
+                continue;
+            }
+            for(auto h = rec->history; h; h = h->next){
+                if(h->tid < snap){
+                    val = h->val;
+                    return !h->deleted;
+                }
+            }
+            // inserted after snap
+            return false;
+        }
+    }
+
+    // Pending unlinks reach the tree through this handle, which each of
+    // them and the tree hold a reference to. Unlinks hold `lock` shared
+    // while they use `tart`; the destructor clears it under the exclusive
+    // lock.
+    struct unlink_handle {
+        TART* tart;
+        std::shared_timed_mutex lock;
+        std::atomic<unsigned> refs;
+
+        unlink_handle(TART* t)
+            : tart(t), refs(1) {
+        }
+        void acquire() {
+            refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        void release() {
+            if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+    };
+    struct unlink_info {
+        unlink_handle* handle;
+        record* rec;
+        TransactionTid::type tid;
+    };
+    // RCU callback: physically remove a deleted record, unless it was
+    // brought back in the meantime or the tree was destroyed. Readers that
+    // still hold the record see it poisoned and retry.
+    static void unlink_deleted(void* p){
+        unlink_info* u = reinterpret_cast<unlink_info*>(p);
+        {
+            std::shared_lock<std::shared_timed_mutex> guard(u->handle->lock);
+            if(u->handle->tart)
+                u->handle->tart->unlink(u->rec, u->tid);
+        }
+        u->handle->release();
+        delete u;
+    }
+    void unlink(record* rec, TransactionTid::type tid){
+        auto& v = const_cast<TransactionTid::type&>(rec->version.value());
+        TransactionTid::lock(v, TThread::id());
+        if(rec->deleted && !rec->unlinked && tid_of(rec->version) == tid){
+            Key k;
+            loadKey(reinterpret_cast<TID>(rec), k);
+            ThreadInfo epocheInfo = getThreadInfo();
+            trans_info_t* t_info = new trans_info_t();
+            bzero(t_info, sizeof(trans_info_t));
+            remove(k, reinterpret_cast<TID>(rec), epocheInfo, t_info);
+            bool removed = !t_info->shouldAbort;
+            delete t_info;
+            rec->unlinked = true;
+            TransactionTid::set_version_unlock(v, TransactionTid::unlocked(v) | invalid_bit, TThread::id());
+            if(removed)
+                Transaction::rcu_delete(rec);
+        } else
+            TransactionTid::unlock(v, TThread::id());
+    }
+
+    unlink_handle* unlinks_;
+    #endif
+
 	/* STO callbacks
      * -------------
      */
@@ -589,6 +878,14 @@ public:
         if(!res){
             INCR(aborts[TThread::id()][3])
         }
+        #if TART_MVCC
+        // an update of a deleted record raced with its unlink
+        else if(!rec->valid() && !has_insert(item)){
+            rec->version.unlock();
+            INCR(aborts[TThread::id()][4])
+            return false;
+        }
+        #endif
         return res;
     }
 
@@ -744,6 +1041,9 @@ public:
                 // Dimos: For the case that we call delete in the same element!
                 // (Might happen in the test_meme that accesses keys with zipf distribution)
                 if(!rec->deleted){
+                    #if TART_MVCC
+                    save_history(rec);
+                    #endif
                     txn.set_version(rec->version);
 				    rec->deleted = true;
 				    fence();
@@ -754,6 +1054,10 @@ public:
 		if(!has_insert(item)){ // update : not supported yet
             PRINT_DEBUG("Will update\n")
             auto val = item.write_value<uint64_t>();
+            #if TART_MVCC
+            save_history(rec);
+            rec->deleted = false;
+            #endif
             rec->val = val;
 		}
 		// clear user bits: Make record valid!
@@ -780,6 +1084,18 @@ public:
         assert(!is_in_keyset(item));
         #endif
 		record* rec = item.key<record*>();
+		#if TART_MVCC
+		if(committed && has_delete(item) && !has_insert(item)){
+			// Older snapshots may still read this key; unlink once they finish.
+			// Use the current epoch, not ours: a snapshot taken after we
+			// started may predate our commit.
+			unlinks_->acquire();
+			Transaction::tinfo[TThread::id()].rcu_set.add(Transaction::global_epochs->global_epoch,
+					unlink_deleted, new unlink_info{unlinks_, rec, tid_of(rec->version)});
+			item.clear_needs_unlock();
+			return;
+		}
+		#endif
 		Key k;
 		TID tid = reinterpret_cast<TID>(rec);
 		loadKey(tid, k);
@@ -796,6 +1112,135 @@ public:
         }
 		item.clear_needs_unlock();
     }
+
+    public:
+
+    // Redo logging: a record's key and its new value (the TID); an insert
+    // deleted in the same transaction logs nothing.
+    bool loggable() const {
+        return true;
+    }
+
+    void log_write(const TransItem& item, TLogWriter& w){
+        record* rec = item.key<record*>();
+        if(has_delete(item) && has_insert(item))
+            return;
+        Key k;
+        loadKey(reinterpret_cast<TID>(rec), k);
+        uint64_t val = has_insert(item) ? rec->val : item.write_value<uint64_t>();
+        if(has_delete(item))
+            w.put(&k[0], k.getKeyLen(), nullptr, 0, redo_record::remove_flag);
+        else
+            w.put(&k[0], k.getKeyLen(), &val, sizeof(val), 0);
+    }
+
+    // Checkpointing (Checkpoint.hh): part p of 256 holds the keys whose
+    // first byte is p. Under TART_MVCC values are as of snapshot TID snap,
+    // and tagged snap - 1 (every commit before snap is in). Otherwise each
+    // record is read as it is when the scan reaches it, and tagged with the
+    // TID that wrote it.
+    unsigned checkpoint_parts() const {
+        return 256;
+    }
+
+    void checkpoint_scan(unsigned part, TransactionTid::type snap, TLogWriter& w){
+        (void) snap;
+        ThreadInfo t = getThreadInfo();
+        char b = part;
+        Key start, end, cont;
+        start.set(&b, 1);
+        end.set(&b, 1);
+        trans_info_range_t t_info = trans_info_range_t();
+        t_info.addKeyRS = [](TID){
+            return true;
+        };
+        t_info.addNodeNS = [] (const N*, uint64_t){
+            return true;
+        };
+        std::vector<TID> results(1024);
+        bool more = true;
+        while(more){
+            std::size_t found = 0;
+            more = lookupRange(start, end, cont, results.data(), results.size(), found, t, &t_info);
+            for(std::size_t i=0; i<found; i++){
+                record* rec = reinterpret_cast<record*>(results[i]);
+                TID val;
+                #if TART_MVCC
+                if(!snapshot_value(rec, snap, val))
+                    continue;
+                w.set_tid(snap - 1);
+                #else
+                bool live;
+                while(1){
+                    version_type v0 = rec->version;
+                    if(v0.is_locked()){
+                        relax_fence();
+                        continue;
+                    }
+                    live = rec->valid();
+                    fence();
+                    live = live && !rec->deleted;
+                    val = rec->val;
+                    fence();
+                    if(rec->version == v0){
+                        w.set_tid(tid_of(v0));
+                        break;
+                    }
+                }
+                if(!live)
+                    continue;
+                #endif
+                Key k;
+                loadKey(reinterpret_cast<TID>(rec), k);
+                uint64_t v = val;
+                w.put(&k[0], k.getKeyLen(), &v, sizeof(v), 0);
+            }
+            if(more)
+                start.set(reinterpret_cast<const char*>(&cont[0]), cont.getKeyLen());
+        }
+    }
+
+    // Recovery (Recovery.hh): the bulk build's order is key order, so
+    // recovery threads build disjoint subtrees, each in key order.
+    uint64_t recover_order(const char* key, uint32_t key_len) const {
+        return redo_key_order(key, key_len);
+    }
+
+    // Applies a checkpoint entry or log record outside any transaction, as
+    // nontrans_insert does, unless the key's record was written by a later
+    // TID (Thomas write rule). Threads may recover at once if each owns its
+    // keys and applies their records in TID order.
+    void recover_apply(const redo_record& r, const char* key, const char* value){
+        Key k;
+        k.set(key, r.key_len);
+        ThreadInfo t = getThreadInfo();
+        trans_info_t t_info;
+        memset(&t_info, 0, sizeof(trans_info_t));
+        TID found = lookup(k, t, &t_info);
+        if(found && t_info.check_key)
+            found = checkKeyFromRec(found, k);
+        record* rec = reinterpret_cast<record*>(found);
+        if(rec && tid_of(rec->version) > r.tid)
+            return;
+        if(r.flags & redo_record::remove_flag){
+            if(rec){
+                memset(&t_info, 0, sizeof(trans_info_t));
+                remove(k, found, t, &t_info);
+                if(!t_info.shouldAbort)
+                    Transaction::rcu_delete(rec);
+            }
+            return;
+        }
+        uint64_t val;
+        memcpy(&val, value, sizeof(val));
+        if(rec)
+            rec->val = val;
+        else
+            nontrans_insert(k, val, t, &rec);
+        rec->version.lock();
+        rec->version.set_version(r.tid);
+        rec->version.unlock();
+    }
 };
 
 
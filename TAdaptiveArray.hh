@@ -0,0 +1,228 @@
+#pragma once
+#include "TWrapped.hh"
+#include "TArrayProxy.hh"
+
+// A TArray whose slots switch between optimistic and pessimistic concurrency
+// control depending on how contended they are.
+//
+// Every slot carries a small conflict score. Validation and lock failures
+// raise it; clean commits and uncontended lock acquisitions lower it. Once the
+// score reaches pessimistic_threshold the slot stops being read
+// optimistically: transactions take a shared read lock on it during
+// execution, so concurrent writers cannot invalidate the read, and the read
+// never joins the read set. If a transaction holding a read lock later fails
+// to upgrade it at commit (the classic read-modify-write pattern on a hot
+// key), the slot moves to exclusive mode, where execution-time locks are
+// exclusive. When the score decays back to zero the slot returns to plain
+// optimistic reads.
+template <typename T, unsigned N, template <typename> class W = TOpaqueWrapped>
+class TAdaptiveArray : public TObject {
+public:
+    typedef T value_type;
+    typedef typename W<T>::read_type get_type;
+    typedef typename W<T>::version_type version_type;
+    typedef unsigned size_type;
+    typedef int difference_type;
+    typedef TConstArrayProxy<TAdaptiveArray<T, N, W> > const_proxy_type;
+    typedef TArrayProxy<TAdaptiveArray<T, N, W> > proxy_type;
+
+    enum mode_type : uint8_t {
+        mode_optimistic = 0, mode_shared = 1, mode_exclusive = 2
+    };
+
+    static constexpr int16_t pessimistic_threshold = 16;
+    static constexpr int16_t score_max = 64;
+    static constexpr unsigned spin_bound = 1 << 14;
+
+    size_type size() const {
+        return N;
+    }
+
+    const_proxy_type operator[](size_type i) const {
+        assert(i < N);
+        return const_proxy_type(this, i);
+    }
+    proxy_type operator[](size_type i) {
+        assert(i < N);
+        return proxy_type(this, i);
+    }
+
+    // transGet and friends
+    get_type transGet(size_type i) const {
+        assert(i < N);
+        auto item = Sto::item(this, i);
+        if (item.has_write())
+            return item.template write_value<T>();
+        elem& e = data_[i];
+        if (item.has_flag(rlocked_bit))
+            return e.v.access();
+        if (e.mode != mode_optimistic) {
+            acquire(item, i, e.mode == mode_exclusive);
+            return e.v.access();
+        }
+        return e.v.read(item, e.vers);
+    }
+    void transPut(size_type i, T x) const {
+        assert(i < N);
+        Sto::item(this, i).add_write(x);
+    }
+
+    get_type nontrans_get(size_type i) const {
+        assert(i < N);
+        return data_[i].v.access();
+    }
+    void nontrans_put(size_type i, const T& x) {
+        assert(i < N);
+        data_[i].v.access() = x;
+    }
+    void nontrans_put(size_type i, T&& x) {
+        assert(i < N);
+        data_[i].v.access() = std::move(x);
+    }
+    mode_type nontrans_mode(size_type i) const {
+        assert(i < N);
+        return mode_type(data_[i].mode);
+    }
+
+    // approximate counts of mode switches, for benchmark reports
+    uint64_t pessimistic_switches() const {
+        return to_pessimistic_;
+    }
+    uint64_t optimistic_switches() const {
+        return to_optimistic_;
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        if (item.has_flag(lockitem_bit))
+            return true;
+        elem& e = data_[item.key<size_type>()];
+        if (!txn.try_lock(item, e.vers)) {
+            note_conflict(e);
+            return false;
+        }
+        // The lock's cmpxchg is a full barrier, so this load is ordered
+        // against readers' increments in acquire().
+        uint32_t mine = 0;
+        if (item.has_flag(rlocked_bit))
+            mine = item.has_flag(exclusive_bit) ? excl_bit : 1;
+        if (e.lockword != mine) {
+            e.vers.unlock();
+            if (mine == 1)
+                e.mode = mode_exclusive;
+            note_conflict(e);
+            return false;
+        }
+        return true;
+    }
+    bool check(TransItem& item, Transaction&) override {
+        elem& e = data_[item.key<size_type>()];
+        if (!item.check_version(e.vers)) {
+            note_conflict(e);
+            return false;
+        }
+        if (e.score)
+            note_success(e);
+        return true;
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        if (item.has_flag(lockitem_bit))
+            return;
+        size_type i = item.key<size_type>();
+        data_[i].v.write(item.write_value<T>());
+        txn.set_version_unlock(data_[i].vers, item);
+    }
+    void unlock(TransItem& item) override {
+        if (!item.has_flag(lockitem_bit))
+            data_[item.key<size_type>()].vers.unlock();
+    }
+    void cleanup(TransItem& item, bool) override {
+        if (!item.has_flag(lockitem_bit))
+            return;
+        elem& e = data_[item.key<uintptr_t>() & ~lockitem_key];
+        fetch_and_add(&e.lockword, item.has_flag(exclusive_bit) ? -excl_bit : uint32_t(-1));
+    }
+
+private:
+    struct elem {
+        version_type vers;
+        W<T> v;
+        uint32_t lockword;   // shared reader count | excl_bit
+        int16_t score;
+        uint8_t mode;
+
+        elem()
+            : lockword(0), score(0), mode(mode_optimistic) {
+        }
+    };
+    mutable elem data_[N];
+    mutable uint64_t to_pessimistic_ = 0;
+    mutable uint64_t to_optimistic_ = 0;
+
+    // on the slot's item: this transaction holds an execution-time lock
+    static constexpr TransItem::flags_type rlocked_bit = TransItem::user0_bit;
+    // on the lock item, which only exists to release the lock in cleanup()
+    static constexpr TransItem::flags_type lockitem_bit = TransItem::user0_bit << 1;
+    static constexpr TransItem::flags_type exclusive_bit = TransItem::user0_bit << 2;
+    static constexpr uint32_t excl_bit = uint32_t(1) << 31;
+    static constexpr uintptr_t lockitem_key = uintptr_t(1) << 63;
+
+    void note_conflict(elem& e) const {
+        int16_t s = e.score + 2;
+        e.score = s = s > score_max ? score_max : s;
+        if (s >= pessimistic_threshold && e.mode == mode_optimistic) {
+            e.mode = mode_shared;
+            ++to_pessimistic_;
+        }
+    }
+    void note_success(elem& e) const {
+        if (--e.score <= 0) {
+            e.score = 0;
+            if (e.mode != mode_optimistic) {
+                e.mode = mode_optimistic;
+                ++to_optimistic_;
+            }
+        }
+    }
+
+    void acquire(TransProxy& item, size_type i, bool exclusive) const {
+        elem& e = data_[i];
+        bool contended = false;
+        unsigned n = 0;
+        uint32_t held;
+        if (exclusive) {
+            while (!(e.lockword == 0 && bool_cmpxchg(&e.lockword, uint32_t(0), excl_bit)))
+                spin(e, n, contended, 0);
+            held = excl_bit;
+        } else {
+            fetch_and_add(&e.lockword, uint32_t(1));
+            held = 1;
+            while (e.lockword & excl_bit)
+                spin(e, n, contended, held);
+        }
+        // a committing writer may have locked the version before seeing us;
+        // it either backs off or finishes installing
+        while (e.vers.is_locked())
+            spin(e, n, contended, held);
+        if (contended && e.score < score_max)
+            ++e.score;
+        else if (!contended)
+            note_success(e);
+
+        // register the release before anything below can abort
+        auto xbit = exclusive ? exclusive_bit : 0;
+        Sto::item(this, lockitem_key | i).add_flags(lockitem_bit | xbit).add_write();
+        item.add_flags(rlocked_bit | xbit);
+        item.observe_opacity(e.vers);
+    }
+    void spin(elem& e, unsigned& n, bool& contended, uint32_t held) const {
+        contended = true;
+        if (++n == spin_bound) {
+            if (held)
+                fetch_and_add(&e.lockword, -held);
+            note_conflict(e);
+            Sto::abort();
+        }
+        relax_fence();
+    }
+};
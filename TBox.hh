@@ -22,6 +22,16 @@ public:
         else
             return v_.read(item, vers_);
     }
+    // Large trivially copyable values only: copies one field instead of the
+    // whole value.
+    template <typename F, typename U>
+    F read(F U::* field) const {
+        auto item = Sto::item(this, 0);
+        if (item.has_write())
+            return item.template write_value<T>().*field;
+        else
+            return v_.read_field(field, item, vers_);
+    }
     void write(const T& x) {
         Sto::item(this, 0).add_write(x);
     }
@@ -94,3 +104,39 @@ protected:
     version_type vers_;
     W v_;
 };
+
+// TBox that keeps a short version history. Read-only transactions can use
+// snapshot_read() to see a consistent snapshot without validation, so they
+// never abort because of concurrent writers. Writers are unchanged.
+template <typename T>
+class TMvBox : public TBox<T, TMvWrapped<T> > {
+    typedef TBox<T, TMvWrapped<T> > base_type;
+public:
+    using base_type::base_type;
+    using base_type::operator=;
+
+    // For read-only transactions; does not see this transaction's writes.
+    T snapshot_read() const {
+        return this->v_.snapshot_read(this->vers_, Sto::transaction()->snapshot_tid());
+    }
+
+    void install(TransItem& item, Transaction& txn) override {
+        this->v_.save_history(txn.commit_tid(), item.template write_value<T>());
+        base_type::install(item, txn);
+    }
+
+    void nontrans_write(const T& x) {
+        base_type::nontrans_write(x);
+        this->v_.reset_history(this->vers_);
+    }
+    void nontrans_write(T&& x) {
+        base_type::nontrans_write(std::move(x));
+        this->v_.reset_history(this->vers_);
+    }
+    // Writes through a reference would bypass the history
+    T& nontrans_access() = delete;
+
+    unsigned nontrans_history_length() const {
+        return this->v_.history_length();
+    }
+};
@@ -17,6 +17,18 @@ TRcuSet::~TRcuSet() {
     // ngroups_ = 0;
 }
 
+void TRcuSet::rehome() {
+    if (first_ != current_ || first_->head_ != first_->tail_)
+        return;
+    unsigned capacity = first_->capacity_;
+    while (first_) {
+        TRcuGroup* next = first_->next_;
+        TRcuGroup::free(first_);
+        first_ = next;
+    }
+    current_ = first_ = TRcuGroup::make(capacity);
+}
+
 void TRcuSet::check() {
     // check invariants
     TRcuGroup* first = first_;
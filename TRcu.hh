@@ -82,6 +82,9 @@ public:
     epoch_type clean_epoch() const {
         return clean_epoch_;
     }
+    // Reallocate an empty set's storage from the calling thread, so that
+    // first-touch allocation puts it on that thread's NUMA node.
+    void rehome();
 
 private:
     TRcuGroup* current_;
@@ -0,0 +1,202 @@
+#pragma once
+#include "Interface.hh"
+#include "TWrapped.hh"
+
+// A box for a large trivially copyable row, such as a per-key statistics
+// record, with one version per cache line.
+//
+// Transactions may read and write individual fields. A field read copies and
+// validates only the lines the field spans, so it does not conflict with
+// writes to fields on other lines. Writes are staged per line together with
+// a byte mask and installed in place, so a blind write to one field never
+// clobbers a concurrent commit to another field of the same line.
+template <typename T>
+class TRowBox : public TObject {
+    static_assert(mass::is_trivially_copyable<T>::value, "TRowBox requires a trivially copyable type");
+public:
+    typedef T value_type;
+    typedef TVersion version_type;
+    typedef uint64_t mask_type;
+
+    static constexpr unsigned line_size = 64;
+    static constexpr unsigned nlines = (sizeof(T) + line_size - 1) / line_size;
+    static_assert(nlines <= 64, "TRowBox rows are limited to 64 lines");
+    static constexpr mask_type all_lines = nlines == 64 ? ~mask_type(0) : (mask_type(1) << nlines) - 1;
+
+    TRowBox()
+        : v_() {
+    }
+    explicit TRowBox(const T& x)
+        : v_(x) {
+    }
+
+    T read() const {
+        return read(all_lines);
+    }
+    // Reads only the lines in `lines`; the rest of the result is zero.
+    T read(mask_type lines) const {
+        T x;
+        memset(&x, 0, sizeof(T));
+        for (unsigned l = 0; l < nlines; ++l)
+            if (lines & (mask_type(1) << l))
+                read_bytes(reinterpret_cast<unsigned char*>(&x) + l * line_size,
+                           l * line_size, line_length(l));
+        return x;
+    }
+    template <typename F>
+    F read(F T::* field) const {
+        typename std::aligned_storage<sizeof(F), alignof(F)>::type x;
+        read_bytes(&x, offset_of(field), sizeof(F));
+        return *reinterpret_cast<F*>(&x);
+    }
+
+    void write(const T& x) {
+        write_bytes(&x, 0, sizeof(T));
+    }
+    template <typename F>
+    void write(F T::* field, const F& x) {
+        write_bytes(&x, offset_of(field), sizeof(F));
+    }
+
+    // The read mask covering `field`, for combining into read(mask_type).
+    template <typename F>
+    mask_type mask_of(F T::* field) const {
+        size_t off = offset_of(field);
+        unsigned first = off / line_size, last = (off + sizeof(F) - 1) / line_size;
+        return ((mask_type(2) << last) - 1) & ~((mask_type(1) << first) - 1);
+    }
+
+    const T& nontrans_read() const {
+        return v_;
+    }
+    T& nontrans_access() {
+        return v_;
+    }
+    void nontrans_write(const T& x) {
+        v_ = x;
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, vers_[item.key<unsigned>()]);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(vers_[item.key<unsigned>()]);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        unsigned l = item.key<unsigned>();
+        const line_buffer& buf = item.write_value<line_buffer>();
+        unsigned char* line = bytes() + l * line_size;
+        mask_type m = buf.mask;
+        if (m == line_mask(0, line_length(l)))
+            memcpy(line, buf.bytes, line_length(l));
+        else
+            while (m) {
+                unsigned lo = __builtin_ctzll(m);
+                mask_type rest = ~(m >> lo);
+                unsigned n = rest ? __builtin_ctzll(rest) : line_size - lo;
+                memcpy(line + lo, buf.bytes + lo, n);
+                m &= ~line_mask(lo, n);
+            }
+        txn.set_version_unlock(vers_[l], item);
+    }
+    void unlock(TransItem& item) override {
+        vers_[item.key<unsigned>()].unlock();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{TRowBox<" << typeid(T).name() << "> " << (void*) this
+          << " line " << item.key<unsigned>();
+        if (item.has_read())
+            w << " R" << item.read_value<version_type>();
+        if (item.has_write())
+            w << " W" << std::hex << item.write_value<line_buffer>().mask << std::dec;
+        w << "}";
+    }
+
+private:
+    // staged writes to one line; `mask` has a bit per written byte
+    struct line_buffer {
+        mask_type mask;
+        unsigned char bytes[line_size];
+    };
+
+    alignas(line_size) T v_;
+    version_type vers_[nlines];
+
+    unsigned char* bytes() const {
+        return reinterpret_cast<unsigned char*>(const_cast<T*>(&v_));
+    }
+    template <typename F>
+    size_t offset_of(F T::* field) const {
+        return reinterpret_cast<const unsigned char*>(&(v_.*field))
+            - reinterpret_cast<const unsigned char*>(&v_);
+    }
+    static constexpr unsigned last_line_size = sizeof(T) - (nlines - 1) * line_size;
+
+    static unsigned line_length(unsigned l) {
+        return l + 1 == nlines ? last_line_size : line_size;
+    }
+    static mask_type line_mask(unsigned lo, unsigned n) {
+        return (n == 64 ? ~mask_type(0) : (mask_type(1) << n) - 1) << lo;
+    }
+
+    // Copy bytes [off, off + n) of the row, line by line.
+    void read_bytes(void* dst, size_t off, size_t n) const {
+        unsigned char* out = reinterpret_cast<unsigned char*>(dst);
+        while (n) {
+            unsigned l = off / line_size, lo = off % line_size;
+            unsigned len = std::min(size_t(line_size - lo), n);
+            read_line(out, l, lo, len);
+            out += len;
+            off += len;
+            n -= len;
+        }
+    }
+    void read_line(unsigned char* out, unsigned l, unsigned lo, unsigned len) const {
+        auto item = Sto::item(this, l);
+        mask_type want = line_mask(lo, len);
+        const line_buffer* buf = nullptr;
+        if (item.has_write()) {
+            buf = &item.template write_value<line_buffer>();
+            if ((buf->mask & want) == want) {
+                memcpy(out, buf->bytes + lo, len);
+                return;
+            }
+        }
+        read_committed(out, l, lo, len, item);
+        if (buf)
+            for (mask_type m = buf->mask & want; m; m &= m - 1) {
+                unsigned b = __builtin_ctzll(m);
+                out[b - lo] = buf->bytes[b];
+            }
+    }
+    void read_committed(unsigned char* out, unsigned l, unsigned lo, unsigned len,
+                        TransProxy item) const {
+        // copy whole lines so memcpy sees a constant size
+        unsigned char line[line_size];
+        unsigned char* dst = lo == 0 && len == line_size ? out : line;
+        if (l + 1 < nlines)
+            TWrappedAccess::read_seqlock<line_size>(dst, bytes() + l * line_size, item, vers_[l], true);
+        else
+            TWrappedAccess::read_seqlock<last_line_size>(dst, bytes() + l * line_size, item, vers_[l], true);
+        if (dst != out)
+            memcpy(out, line + lo, len);
+    }
+
+    void write_bytes(const void* src, size_t off, size_t n) {
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+        while (n) {
+            unsigned l = off / line_size, lo = off % line_size;
+            unsigned len = std::min(size_t(line_size - lo), n);
+            auto item = Sto::item(this, l);
+            if (!item.has_write())
+                item.add_write(line_buffer());
+            line_buffer& buf = item.template write_value<line_buffer>();
+            memcpy(buf.bytes + lo, in, len);
+            buf.mask |= line_mask(lo, len);
+            in += len;
+            off += len;
+            n -= len;
+        }
+    }
+};
@@ -1,6 +1,8 @@
 #pragma once
 #include "Transaction.hh"
 #include <utility>
+#include <type_traits>
+#include <string.h>
 
 template <typename T, bool Opaque = true,
           bool Trivial = mass::is_trivially_copyable<T>::value,
@@ -8,14 +10,17 @@ template <typename T, bool Opaque = true,
           > class TWrapped;
 
 namespace TWrappedAccess {
-template <typename T, typename V>
-static T read_wait_atomic(const T*, TransProxy, const V&, bool);
-template <typename T, typename V>
-static T read_wait_nonatomic(const T*, TransProxy, const V&, bool);
-
-template <typename T, typename V>
-static T read_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
-#if STO_ABORT_ON_LOCKED
+// Each read is compiled once per abort_on_locked setting; the unsuffixed
+// functions dispatch on the knob, as try_commit does on sort_writeset.
+template <bool AbortOnLocked, typename T, typename V>
+static T read_wait_atomic_impl(const T*, TransProxy, const V&, bool);
+template <bool AbortOnLocked, typename T, typename V>
+static T read_wait_nonatomic_impl(const T*, TransProxy, const V&, bool);
+
+template <bool AbortOnLocked, typename T, typename V>
+static T read_atomic_impl(const T* v, TransProxy item, const V& version, bool add_read) {
+    if (!AbortOnLocked)
+        return read_wait_atomic_impl<false>(v, item, version, add_read);
     // This version returns immediately if v1 is locked. We assume as a result
     // that we will quickly converge to either `v0 == v1` or `v1.is_locked()`,
     // and don't bother to back off.
@@ -31,22 +36,74 @@ static T read_atomic(const T* v, TransProxy item, const V& version, bool add_rea
         }
         relax_fence();
     }
-#else
-    return read_wait_atomic(v, item, version, add_read);
-#endif
 }
 template <typename T, typename V>
-static T read_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
-#if STO_ABORT_ON_LOCKED
+static T read_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    if (STO_KNOB(abort_on_locked))
+        return read_atomic_impl<true>(v, item, version, add_read);
+    else
+        return read_atomic_impl<false>(v, item, version, add_read);
+}
+
+template <bool AbortOnLocked, typename T, typename V>
+static T read_nonatomic_impl(const T* v, TransProxy item, const V& version, bool add_read) {
+    if (!AbortOnLocked)
+        return read_wait_nonatomic_impl<false>(v, item, version, add_read);
     item.observe(version, add_read);
     fence();
     return *v;
-#else
-    return read_wait_nonatomic(v, item, version, add_read);
-#endif
 }
 template <typename T, typename V>
-static T read_wait_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
+static T read_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    if (STO_KNOB(abort_on_locked))
+        return read_nonatomic_impl<true>(v, item, version, add_read);
+    else
+        return read_nonatomic_impl<false>(v, item, version, add_read);
+}
+
+// Seqlock-style read for large trivially copyable values. The copy is only
+// attempted while the version is unlocked, so a concurrent install costs a
+// short spin rather than a string of torn copies, and the fixed-size memcpy
+// compiles to vector moves. `src` may point into the middle of a value, which
+// lets callers copy a single field.
+template <size_t Size, bool AbortOnLocked, typename V>
+static void read_seqlock_impl(void* dst, const void* src, TransProxy item, const V& version, bool add_read) {
+    unsigned n = 0;
+    while (1) {
+        V v0 = version;
+        acquire_fence();
+        if (!v0.is_locked_elsewhere(item.transaction())) {
+            memcpy(dst, src, Size);
+            fence();
+            V v1 = version;
+            if (v0 == v1) {
+                item.observe(v1, add_read);
+                return;
+            }
+        }
+        else if (AbortOnLocked)
+            item.observe(v0, add_read); // aborts
+        if (++n > (1U << STO_KNOB(spin_bound_wait)))
+            Sto::abort();
+        relax_fence();
+    }
+}
+template <size_t Size, typename V>
+static void read_seqlock(void* dst, const void* src, TransProxy item, const V& version, bool add_read) {
+    if (STO_KNOB(abort_on_locked))
+        read_seqlock_impl<Size, true>(dst, src, item, version, add_read);
+    else
+        read_seqlock_impl<Size, false>(dst, src, item, version, add_read);
+}
+template <typename T, typename V>
+static T read_large(const T* v, TransProxy item, const V& version, bool add_read) {
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type result;
+    read_seqlock<sizeof(T)>(&result, v, item, version, add_read);
+    return *reinterpret_cast<T*>(&result);
+}
+
+template <bool AbortOnLocked, typename T, typename V>
+static T read_wait_atomic_impl(const T* v, TransProxy item, const V& version, bool add_read) {
     unsigned n = 0;
     while (1) {
         V v0 = version;
@@ -59,26 +116,34 @@ static T read_wait_atomic(const T* v, TransProxy item, const V& version, bool ad
             return result;
         }
 
-#if !STO_ABORT_ON_LOCKED
-        relax_fence();
-        continue;
-#endif
+        if (!AbortOnLocked) {
+            relax_fence();
+            continue;
+        }
 
 #if STO_SPIN_EXPBACKOFF
-        if (++n > STO_SPIN_BOUND_WAIT)
+        if (++n > STO_KNOB(spin_bound_wait))
             Sto::abort();
         if (n > 3)
             for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
                 relax_fence();
 #else
-        if (++n > (1 << STO_SPIN_BOUND_WAIT))
+        if (++n > (1U << STO_KNOB(spin_bound_wait)))
             Sto::abort();
 #endif
         relax_fence();
     }
 }
 template <typename T, typename V>
-static T read_wait_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
+static T read_wait_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    if (STO_KNOB(abort_on_locked))
+        return read_wait_atomic_impl<true>(v, item, version, add_read);
+    else
+        return read_wait_atomic_impl<false>(v, item, version, add_read);
+}
+
+template <bool AbortOnLocked, typename T, typename V>
+static T read_wait_nonatomic_impl(const T* v, TransProxy item, const V& version, bool add_read) {
     unsigned n = 0;
     while (1) {
         V v0 = version;
@@ -89,22 +154,28 @@ static T read_wait_nonatomic(const T* v, TransProxy item, const V& version, bool
         }
         relax_fence();
 
-#if !STO_ABORT_ON_LOCKED
-        continue;
-#endif
+        if (!AbortOnLocked)
+            continue;
 
 #if STO_SPIN_EXPBACKOFF
-        if (++n > STO_SPIN_BOUND_WAIT)
+        if (++n > STO_KNOB(spin_bound_wait))
             Sto::abort();
         if (n > 3)
             for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
                 relax_fence();
 #else
-        if (++n > (1 << STO_SPIN_BOUND_WAIT))
+        if (++n > (1U << STO_KNOB(spin_bound_wait)))
             Sto::abort();
 #endif
     }
 }
+template <typename T, typename V>
+static T read_wait_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    if (STO_KNOB(abort_on_locked))
+        return read_wait_nonatomic_impl<true>(v, item, version, add_read);
+    else
+        return read_wait_nonatomic_impl<false>(v, item, version, add_read);
+}
 }
 
 template <typename T>
@@ -163,19 +234,23 @@ public:
         return v_;
     }
     read_type snapshot(TransProxy item, const version_type& version) const {
-        return TWrappedAccess::read_atomic(&v_, item, version, false);
+        return TWrappedAccess::read_large(&v_, item, version, false);
     }
     read_type wait_snapshot(TransProxy item, const version_type& version, bool add_read) const {
         return TWrappedAccess::read_wait_atomic(&v_, item, version, add_read);
     }
     read_type read(TransProxy item, const version_type& version) const {
-        return TWrappedAccess::read_atomic(&v_, item, version, true);
+        return TWrappedAccess::read_large(&v_, item, version, true);
     }
-    void write(const T& v) {
-        v_ = v;
+    // Copies just one field, still validated against the whole value.
+    template <typename F, typename U>
+    F read_field(F U::* field, TransProxy item, const version_type& version) const {
+        typename std::aligned_storage<sizeof(F), alignof(F)>::type result;
+        TWrappedAccess::read_seqlock<sizeof(F)>(&result, &(v_.*field), item, version, true);
+        return *reinterpret_cast<F*>(&result);
     }
-    void write(T&& v) {
-        v_ = std::move(v);
+    void write(const T& v) {
+        memcpy(&v_, &v, sizeof(T));
     }
 
 protected:
@@ -253,19 +328,23 @@ public:
         return v_;
     }
     read_type snapshot(TransProxy item, const version_type& version) const {
-        return TWrappedAccess::read_atomic(&v_, item, version, false);
+        return TWrappedAccess::read_large(&v_, item, version, false);
     }
     read_type wait_snapshot(TransProxy item, const version_type& version, bool add_read) const {
         return TWrappedAccess::read_wait_atomic(&v_, item, version, add_read);
     }
     read_type read(TransProxy item, const version_type& version) const {
-        return TWrappedAccess::read_atomic(&v_, item, version, true);
+        return TWrappedAccess::read_large(&v_, item, version, true);
     }
-    void write(const T& v) {
-        v_ = v;
+    // Copies just one field, still validated against the whole value.
+    template <typename F, typename U>
+    F read_field(F U::* field, TransProxy item, const version_type& version) const {
+        typename std::aligned_storage<sizeof(F), alignof(F)>::type result;
+        TWrappedAccess::read_seqlock<sizeof(F)>(&result, &(v_.*field), item, version, true);
+        return *reinterpret_cast<F*>(&result);
     }
-    void write(T&& v) {
-        v_ = std::move(v);
+    void write(const T& v) {
+        memcpy(&v_, &v, sizeof(T));
     }
 
 private:
@@ -379,5 +458,97 @@ private:
 };
 
 
+// Multiversion wrapper. The current value lives in the opaque TWrapped base
+// for ordinary reads. Each committed value is also pushed, as an immutable
+// copy tagged with its commit TID, onto a short history chain, so
+// read-only transactions can read the value as of their snapshot TID
+// without joining the read set. Snapshot reads copy only from the chain,
+// never from the live value an install may be overwriting, so T need not
+// be trivially copyable. History no snapshot can reach is trimmed on
+// install and freed through RCU.
+template <typename T>
+class TMvWrapped : public TWrapped<T> {
+public:
+    typedef TWrapped<T> base_type;
+    typedef typename base_type::read_type read_type;
+    typedef TVersion version_type;
+    typedef TransactionTid::type tid_type;
+
+    // The initial value predates every snapshot.
+    template <typename... Args> TMvWrapped(Args&&... args)
+        : base_type(std::forward<Args>(args)...),
+          history_(new history_node{0, nullptr, this->access()}) {
+    }
+    ~TMvWrapped() {
+        free_history(history_);
+    }
+
+    // The value as of snapshot `snap`. Never aborts: a committing writer
+    // with an earlier commit TID locked before the snapshot was taken, so
+    // waiting for the lock to clear lets us see its version.
+    T snapshot_read(const version_type& version, tid_type snap) const {
+        while (version.is_locked())
+            relax_fence();
+        acquire_fence();
+        for (history_node* h = history_; h; h = h->next)
+            if (h->tid < snap)
+                return h->value;
+        always_assert(false && "multiversion history trimmed past a live snapshot");
+    }
+
+    // Call with the version locked, before installing `value`.
+    void save_history(tid_type commit_tid, const T& value) {
+        tid_type oldest = Transaction::global_epochs->snapshot_tid;
+        history_node* h = new history_node{commit_tid, history_, value};
+        // every live snapshot is at or after `oldest`, so none reads past
+        // the newest version committed before it
+        history_node* cut = nullptr;
+        for (history_node* n = h; n; n = n->next)
+            if (n->tid < oldest) {
+                cut = n->next;
+                n->next = nullptr;
+                break;
+            }
+        release_fence();
+        history_ = h;
+        if (cut)
+            Transaction::rcu_call(free_history, cut);
+    }
+
+    // Call after a nontransactional write; no transaction may be running.
+    void reset_history(const version_type& version) {
+        free_history(history_);
+        history_ = new history_node{tid(version), nullptr, this->access()};
+    }
+
+    // Old versions kept, not counting the current one
+    unsigned history_length() const {
+        unsigned n = 0;
+        for (history_node* h = history_->next; h; h = h->next)
+            ++n;
+        return n;
+    }
+
+private:
+    struct history_node {
+        tid_type tid;
+        history_node* next;
+        T value;
+    };
+    history_node* history_;
+
+    static tid_type tid(const version_type& v) {
+        return v.value() & ~(TransactionTid::increment_value - 1);
+    }
+    static void free_history(void* p) {
+        history_node* h = reinterpret_cast<history_node*>(p);
+        while (h) {
+            history_node* next = h->next;
+            delete h;
+            h = next;
+        }
+    }
+};
+
 template <typename T> using TOpaqueWrapped = TWrapped<T>;
 template <typename T> using TNonopaqueWrapped = TWrapped<T, false>;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Boosting_locks.hh"
+#include "TransUndoable.hh"
 
 // TODO: kind of an awkward name :)
 class TransPessimisticLocking : public TObject {
@@ -53,10 +54,13 @@ public:
   }
 
   bool lock(TransItem&, Transaction&) override { return true; }
-  bool check(const TransItem&, const Transaction&) override { return false; }
-  void install(TransItem&, const Transaction&) override {}
+  bool check(TransItem&, Transaction&) override { return false; }
+  void install(TransItem&, Transaction&) override {}
   void unlock(TransItem&) override {}
   void cleanup(TransItem& item, bool committed) override {
+    // undo eager updates while they are still protected by our locks
+    if (!committed)
+      TransUndoable::rollback();
     auto type = item.template write_value<bit_type>();
     if (type == spin_lock()) {
       item.template key<SpinLock*>()->unlock();
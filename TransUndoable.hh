@@ -1,30 +1,163 @@
 #pragma once
 
 #include "Transaction.hh"
+#include <new>
+#include <type_traits>
 
+// Per-thread undo log for objects that update eagerly (under pessimistic
+// locks) instead of buffering their writes until commit.
+//
+// Records are closures stored back to back in a reused buffer, each followed
+// by a trailer holding a trampoline and the record's size, so the log is
+// type-erased without std::function or a per-record allocation and can be
+// walked newest-first. The buffer is a list of chunks: records never move
+// once written, so closures need not be trivially copyable.
+class TUndoLog {
+public:
+  static constexpr size_t granule = 16;
+  static constexpr size_t initial_capacity = 16384;
+
+  TUndoLog() : cur_(nullptr), n_(0) {}
+  ~TUndoLog() {
+    clear();
+    free(cur_);
+  }
+
+  static TUndoLog& thread_log() {
+    static TUndoLog logs[MAX_THREADS];
+    return logs[TThread::id()];
+  }
+
+  bool empty() const {
+    return n_ == 0;
+  }
+  unsigned size() const {
+    return n_;
+  }
+
+  template <typename F>
+  void push(F&& f) {
+    typedef typename std::decay<F>::type fn_type;
+    static_assert(alignof(fn_type) <= granule, "undo closure alignment too large");
+    size_t need = round_up(sizeof(fn_type)) + sizeof(trailer);
+    if (!cur_ || cur_->len + need > cur_->cap)
+      grow(need);
+    char* p = cur_->data() + cur_->len;
+    new (p) fn_type(std::forward<F>(f));
+    trailer* t = reinterpret_cast<trailer*>(p + need - sizeof(trailer));
+    t->run = &run<fn_type>;
+    t->size = need;
+    cur_->len += need;
+    ++n_;
+  }
+
+  // Run every record, newest first, and empty the log.
+  void rollback() {
+    unwind(true);
+  }
+  // Drop every record without running it.
+  void clear() {
+    unwind(false);
+  }
+
+private:
+  struct alignas(granule) trailer {
+    void (*run)(void*, bool);
+    size_t size;
+  };
+  struct alignas(granule) chunk {
+    chunk* prev;
+    size_t len;
+    size_t cap;
+    char* data() {
+      return reinterpret_cast<char*>(this + 1);
+    }
+  };
+  chunk* cur_;
+  unsigned n_;
+
+  static size_t round_up(size_t n) {
+    return (n + granule - 1) & ~(granule - 1);
+  }
+
+  template <typename F>
+  static void run(void* p, bool undo) {
+    F* f = reinterpret_cast<F*>(p);
+    if (undo)
+      (*f)();
+    f->~F();
+  }
+
+  void grow(size_t need) {
+    size_t cap = cur_ ? cur_->cap * 2 : size_t(initial_capacity);
+    while (cap < need)
+      cap *= 2;
+    chunk* c = reinterpret_cast<chunk*>(malloc(sizeof(chunk) + cap));
+    if (!c)
+      throw std::bad_alloc();
+    c->prev = cur_;
+    c->len = 0;
+    c->cap = cap;
+    cur_ = c;
+  }
+
+  void unwind(bool undo) {
+    if (!n_)
+      return;
+    for (chunk* c = cur_; c; c = c->prev)
+      while (c->len) {
+        trailer* t = reinterpret_cast<trailer*>(c->data() + c->len - sizeof(trailer));
+        c->len -= t->size;
+        t->run(c->data() + c->len, undo);
+      }
+    n_ = 0;
+    // keep only the newest, largest chunk for the next transaction
+    while (cur_->prev) {
+      chunk* p = cur_->prev;
+      cur_->prev = p->prev;
+      free(p);
+    }
+  }
+};
+
+// Base for objects that apply operations immediately and register how to
+// reverse them. All undo records of a transaction go to the thread's
+// TUndoLog, which gets a single item: on abort its cleanup rolls back the
+// whole log in one pass, on commit it just discards the records.
 class TransUndoable : public TObject {
 public:
   typedef void (*UndoFunction)(void*, void*, void*);
   void add_undo(UndoFunction undo_func, void *context1, void *context2) {
-    // abusing semantics a bit here: technically there *could* be duplicates, but we're only
-    // using this item for cleanup; duplicates shouldn't affect anything.
-    // best solution is probably to have only one item for this and stuff everything in there.
-    auto item = Sto::new_item(this, undo_func);
-    item.set_stash(context1);
-    item.add_write(context2);
+    add_undo([=]() { undo_func(this, context1, context2); });
+  }
+  template <typename F>
+  void add_undo(F&& f) {
+    TUndoLog& log = TUndoLog::thread_log();
+    // the log is emptied when the item is cleaned up, so an empty log means
+    // this transaction has no item yet
+    if (log.empty())
+      Sto::item(this, undo_key).add_write();
+    log.push(std::forward<F>(f));
   }
 
-  // TODO: would be nice to have an add_undo that takes a std::function or something too.
-
+  // Roll back this thread's eager updates now. Cleanup runs in reverse
+  // item order, so objects that release the locks protecting eager updates
+  // call this first.
+  static void rollback() {
+    TUndoLog::thread_log().rollback();
+  }
 
   bool lock(TransItem&, Transaction&) override { return true; }
   void unlock(TransItem&) override {}
-  bool check(const TransItem&, const Transaction&) override { return false; }
-  void install(TransItem&, const Transaction&) override {}
-  void cleanup(TransItem& item, bool committed) override {
-    if (!committed) {
-      auto undo_func = item.key<UndoFunction>();
-      undo_func(this, item.stash_value<void*>(), item.write_value<void*>());
-    }
+  bool check(TransItem&, Transaction&) override { return false; }
+  void install(TransItem&, Transaction&) override {}
+  void cleanup(TransItem&, bool committed) override {
+    if (committed)
+      TUndoLog::thread_log().clear();
+    else
+      TUndoLog::thread_log().rollback();
   }
+
+private:
+  static constexpr uintptr_t undo_key = 0;
 };
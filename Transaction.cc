@@ -1,16 +1,31 @@
 #include "Transaction.hh"
+#include "RedoLog.hh"
+#include "TxnSchedule.hh"
+#include "AdmissionControl.hh"
 #include <typeinfo>
+#include <errno.h>
+#include <signal.h>
 
 Transaction::testing_type Transaction::testing;
 threadinfo_t Transaction::tinfo[MAX_THREADS];
 __thread int TThread::the_id;
-Transaction::epoch_state __attribute__((aligned(128))) Transaction::global_epochs = {
-    1, 0, TransactionTid::increment_value, true
+Transaction::epoch_state __attribute__((aligned(128))) Transaction::local_epochs = {
+    1, 0, TransactionTid::increment_value, 0, true
 };
+Transaction::epoch_state* Transaction::global_epochs = &Transaction::local_epochs;
 __thread Transaction *TThread::txn = nullptr;
 std::function<void(threadinfo_t::epoch_type)> Transaction::epoch_advance_callback;
-TransactionTid::type __attribute__((aligned(128))) Transaction::_TID = 2 * TransactionTid::increment_value;
+#if STO_RUNTIME_KNOBS
+sto_knobs sto_runtime_knobs = sto_default_knobs;
+#endif
+RedoLog* Transaction::redo_log;
+TxnSchedule* Transaction::schedule;
+AdmissionGate* Transaction::admission;
+TransactionTid::type __attribute__((aligned(128))) Transaction::local_tid = 2 * TransactionTid::increment_value;
    // reserve TransactionTid::increment_value for prepopulated
+TransactionTid::type* Transaction::_TID = &Transaction::local_tid;
+Transaction::shared_state* Transaction::shared_;
+Transaction::process_state* Transaction::shared_process_;
 
 static void __attribute__((used)) check_static_assertions() {
     static_assert(sizeof(threadinfo_t) % 128 == 0, "threadinfo is 2-cache-line aligned");
@@ -51,19 +66,59 @@ void* Transaction::epoch_advancer(void*) {
 
     // don't bother epoch'ing til things have picked up
     usleep(100000);
-    while (global_epochs.run) {
-        epoch_type g = global_epochs.global_epoch;
+    while (global_epochs->run) {
+        epoch_type g = global_epochs->global_epoch;
         epoch_type e = g;
+        // read the TID before scanning: a snapshot published after the scan
+        // is taken after this point
+        TransactionTid::type recent = *_TID;
+        TransactionTid::type s = recent;
+        memory_fence();
         for (auto& t : tinfo) {
             if (t.epoch != 0 && signed_epoch_type(t.epoch - e) < 0)
                 e = t.epoch;
+            TransactionTid::type ts = t.snapshot_tid;
+            if (ts != 0 && ts < s)
+                s = ts;
+        }
+        bool leader = true;
+        if (process_state* me = shared_process_) {
+            // publish this process's oldest epoch and snapshot. The
+            // advancer of the lowest live slot takes the oldest of every
+            // attached process and moves the shared epochs; the others
+            // only publish, so epochs pass at one advancer's pace however
+            // many processes attach.
+            me->active_epoch = e;
+            me->snapshot_tid = s;
+            memory_fence();
+            for (auto& p : shared_->processes) {
+                int32_t pid = p.pid;
+                if (pid == 0 || (&p != me && kill(pid, 0) != 0 && errno == ESRCH))
+                    continue;
+                if (&p < me) {
+                    leader = false;
+                    break;
+                }
+                epoch_type pe = p.active_epoch;
+                TransactionTid::type ps = p.snapshot_tid;
+                if (pe != 0 && signed_epoch_type(pe - e) < 0)
+                    e = pe;
+                if (ps != 0 && ps < s)
+                    s = ps;
+            }
+            // a CAS, in case leadership is changing hands
+            if (leader)
+                bool_cmpxchg(&global_epochs->global_epoch, g, std::max(g + 1, epoch_type(1)));
+        } else
+            global_epochs->global_epoch = std::max(g + 1, epoch_type(1));
+        if (leader) {
+            global_epochs->active_epoch = e;
+            global_epochs->recent_tid = recent;
+            global_epochs->snapshot_tid = s;
         }
-        global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
-        global_epochs.active_epoch = e;
-        global_epochs.recent_tid = Transaction::_TID;
 
         if (epoch_advance_callback)
-            epoch_advance_callback(global_epochs.global_epoch);
+            epoch_advance_callback(global_epochs->global_epoch);
 
         usleep(100000);
     }
@@ -112,7 +167,7 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
         TXP_INCREMENT(txp_hco_invalid);
 
     state_ = s_opacity_check;
-    start_tid_ = _TID;
+    start_tid_ = *_TID;
     release_fence();
     TransItem* it = nullptr;
     for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
@@ -165,7 +220,7 @@ void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
     if (!any_writes_)
         goto after_unlock;
 
-    if (committed && !STO_SORT_WRITESET) {
+    if (committed && writeset) {
         for (unsigned* idxit = writeset + nwriteset; idxit != writeset; ) {
             --idxit;
             if (*idxit < tset_initial_capacity)
@@ -204,6 +259,11 @@ void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
 after_unlock:
     // TODO: this will probably mess up with nested transactions
     threadinfo_t& thr = tinfo[TThread::id()];
+    if (snapshot_tid_)
+        thr.snapshot_tid = 0;
+    --thr.ntxns;
+    if (schedule)
+        schedule->stopped(committed);
     if (thr.trans_end_callback)
         thr.trans_end_callback();
     // XXX should reset trans_end_callback after calling it...
@@ -217,6 +277,14 @@ after_unlock:
 }
 
 bool Transaction::try_commit() {
+    if (STO_KNOB(sort_writeset))
+        return try_commit_impl<true>();
+    else
+        return try_commit_impl<false>();
+}
+
+template <bool SortWriteset>
+bool Transaction::try_commit_impl() {
 #if STO_TSC_PROFILE
     TimeKeeper<tc_commit> tk;
 #endif
@@ -234,12 +302,16 @@ bool Transaction::try_commit() {
     assert(state_ == s_in_progress || state_ >= s_aborted);
     if (state_ >= s_aborted)
         return state_ > s_aborted;
+    if (schedule)
+        schedule->commit_begin();
 
     if (any_nonopaque_)
         TXP_INCREMENT(txp_commit_time_nonopaque);
 #if !CONSISTENCY_CHECK
     // commit immediately if read-only transaction with opacity
     if (!any_writes_ && !any_nonopaque_) {
+        if (schedule)
+            schedule->commit_point();
         stop(true, nullptr, 0);
         return true;
     }
@@ -250,23 +322,26 @@ bool Transaction::try_commit() {
     unsigned writeset[tset_size_];
     unsigned nwriteset = 0;
     writeset[0] = tset_size_;
+    bool logging = false;
 
     TransItem* it = nullptr;
     for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
         it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
         if (it->has_write()) {
             writeset[nwriteset++] = tidx;
-#if !STO_SORT_WRITESET
-            if (nwriteset == 1) {
-                first_write_ = writeset[0];
-                state_ = s_committing_locked;
+            if (!SortWriteset) {
+                if (nwriteset == 1) {
+                    first_write_ = writeset[0];
+                    state_ = s_committing_locked;
+                }
+                if (!it->owner()->lock(*it, *this)) {
+                    mark_abort_because(it, "commit lock");
+                    goto abort;
+                }
+                it->__or_flags(TransItem::lock_bit);
+                if (schedule)
+                    schedule->locked(*it);
             }
-            if (!it->owner()->lock(*it, *this)) {
-                mark_abort_because(it, "commit lock");
-                goto abort;
-            }
-            it->__or_flags(TransItem::lock_bit);
-#endif
         }
         if (it->has_read())
             TXP_INCREMENT(txp_total_r);
@@ -282,28 +357,40 @@ bool Transaction::try_commit() {
     first_write_ = writeset[0];
 
     //phase1
-#if STO_SORT_WRITESET
-    std::sort(writeset, writeset + nwriteset, [&] (unsigned i, unsigned j) {
-        TransItem* ti = &tset_[i / tset_chunk][i % tset_chunk];
-        TransItem* tj = &tset_[j / tset_chunk][j % tset_chunk];
-        return *ti < *tj;
-    });
-
-    if (nwriteset) {
-        state_ = s_committing_locked;
-        auto writeset_end = writeset + nwriteset;
-        for (auto it = writeset; it != writeset_end; ) {
-            TransItem* me = &tset_[*it / tset_chunk][*it % tset_chunk];
-            if (!me->owner()->lock(*me, *this)) {
-                mark_abort_because(me, "commit lock");
-                goto abort;
+    if (SortWriteset) {
+        std::sort(writeset, writeset + nwriteset, [&] (unsigned i, unsigned j) {
+            TransItem* ti = &tset_[i / tset_chunk][i % tset_chunk];
+            TransItem* tj = &tset_[j / tset_chunk][j % tset_chunk];
+            return *ti < *tj;
+        });
+
+        if (nwriteset) {
+            state_ = s_committing_locked;
+            auto writeset_end = writeset + nwriteset;
+            for (auto it = writeset; it != writeset_end; ) {
+                TransItem* me = &tset_[*it / tset_chunk][*it % tset_chunk];
+                if (!me->owner()->lock(*me, *this)) {
+                    mark_abort_because(me, "commit lock");
+                    goto abort;
+                }
+                me->__or_flags(TransItem::lock_bit);
+                if (schedule)
+                    schedule->locked(*me);
+                ++it;
             }
-            me->__or_flags(TransItem::lock_bit);
-            ++it;
         }
     }
-#endif
 
+    // the serialization point: the write set is locked, reads not yet
+    // validated
+    if (schedule)
+        schedule->commit_point();
+
+    // the log epoch is read with the write set locked, before validation
+    if (redo_log && nwriteset) {
+        redo_log->commit_begin();
+        logging = true;
+    }
 
 #if CONSISTENCY_CHECK
     fence();
@@ -323,20 +410,27 @@ bool Transaction::try_commit() {
             }
         }
     }
+    if (schedule)
+        schedule->validated();
+
+    if (logging) {
+        for (auto idxit = writeset; idxit != writeset + nwriteset; ++idxit)
+            redo_log->commit_append(tset_[*idxit / tset_chunk][*idxit % tset_chunk], *this);
+        redo_log->commit_end();
+    }
 
     // fence();
 
     //phase3
-#if STO_SORT_WRITESET
-    for (unsigned tidx = first_write_; tidx != tset_size_; ++tidx) {
-        it = &tset_[tidx / tset_chunk][tidx % tset_chunk];
-        if (it->has_write()) {
-            TXP_INCREMENT(txp_total_w);
-            it->owner()->install(*it, *this);
+    if (SortWriteset) {
+        for (unsigned tidx = first_write_; tidx != tset_size_; ++tidx) {
+            it = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+            if (it->has_write()) {
+                TXP_INCREMENT(txp_total_w);
+                it->owner()->install(*it, *this);
+            }
         }
-    }
-#else
-    if (nwriteset) {
+    } else if (nwriteset) {
         auto writeset_end = writeset + nwriteset;
         for (auto idxit = writeset; idxit != writeset_end; ++idxit) {
             if (likely(*idxit < tset_initial_capacity))
@@ -347,14 +441,16 @@ bool Transaction::try_commit() {
             it->owner()->install(*it, *this);
         }
     }
-#endif
 
     // fence();
-    stop(true, writeset, nwriteset);
+    // stop unlocks a sorted write set by scanning the transaction set
+    stop(true, SortWriteset ? nullptr : writeset, nwriteset);
     return true;
 
 abort:
     // fence();
+    if (logging)
+        redo_log->commit_end();
     TXP_INCREMENT(txp_commit_time_aborts);
     stop(false, nullptr, 0);
 #if STO_TSC_PROFILE
@@ -398,7 +494,7 @@ void Transaction::print_stats() {
     if (txp_count >= txp_total_transbuffer)
         fprintf(stderr, "$ %llu max buffer per txn, %llu total buffer\n",
                 out.p(txp_max_transbuffer), out.p(txp_total_transbuffer));
-    fprintf(stderr, "$ %llu next commit-tid\n", (unsigned long long) _TID);
+    fprintf(stderr, "$ %llu next commit-tid\n", (unsigned long long) *_TID);
 
 #if STO_TSC_PROFILE
     tc_counters out_tcs = tc_counters_combined();
@@ -439,6 +535,14 @@ void Transaction::print() const {
     print(std::cerr);
 }
 
+void TransactionLoopGuard::enter(AdmissionGate* gate) {
+    gate->enter();
+}
+
+void TransactionLoopGuard::leave(AdmissionGate* gate) {
+    gate->leave();
+}
+
 void TObject::print(std::ostream& w, const TransItem& item) const {
     w << "{" << typeid(*this).name() << " " << (void*) this << "." << item.key<void*>();
     if (item.has_read())
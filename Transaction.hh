@@ -47,6 +47,11 @@
 #define STO_SORT_WRITESET 0
 #endif
 
+// Make the knobs in sto_knobs (below) runtime parameters
+#ifndef STO_RUNTIME_KNOBS
+#define STO_RUNTIME_KNOBS 0
+#endif
+
 #ifndef DEBUG_SKEW
 #define DEBUG_SKEW 0
 #endif
@@ -77,7 +82,9 @@
 
 #define CONSISTENCY_CHECK 0
 #define ASSERT_TX_SIZE 0
+#ifndef TRANSACTION_HASHTABLE
 #define TRANSACTION_HASHTABLE 1
+#endif
 
 #if ASSERT_TX_SIZE
 #if STO_PROFILE_COUNTERS > 1
@@ -96,7 +103,9 @@
 #define MAX_THREADS 32
 
 #define BACKOFF 1
+#ifndef BACKOFF_MAX
 #define BACKOFF_MAX 64
+#endif
 // 2100
 // 4100
 // 10000
@@ -106,7 +115,7 @@
 #if BACKOFF == 1
     #define INIT_BACKOFF unsigned backoff_time=0;
     #define INCREASE_WAIT /*stringstream ss; ss<<"Incr, before "<<backoff_time<<endl; cout<<ss.str();*/\
-                            backoff_time = (backoff_time==0? 1: (backoff_time*2 <= BACKOFF_MAX? backoff_time*2 : backoff_time ));\
+                            backoff_time = (backoff_time==0? 1: (backoff_time*2 <= STO_KNOB(backoff_max)? backoff_time*2 : backoff_time ));\
                           /*ss.clear(); ss<<"Incr, after "<<backoff_time<<endl; cout<<ss.str();*/\
                           usleep(backoff_time);
     #define DECREASE_WAIT   /*stringstream ss; ss<<"Decr, before "<<backoff_time<<endl; cout<<ss.str();*/\
@@ -120,6 +129,31 @@
     #define RESET_WAIT {}
 #endif
 
+// Performance knobs. Their defaults come from the macros above. Normally
+// they are constants, so code using STO_KNOB compiles as if it tested the
+// macros. With STO_RUNTIME_KNOBS, STO_KNOB reads sto_runtime_knobs
+// instead, which StoKnobs.hh can set while no transactions run; try_commit
+// then dispatches to a version compiled for the write-set order, and
+// TWrapped reads to one compiled for abort_on_locked.
+struct sto_knobs {
+    bool abort_on_locked;           // readers abort on locked versions
+    bool sort_writeset;             // lock writes in item order, waiting
+    unsigned spin_bound_write;      // commit lock attempts: 1 << bound
+    unsigned spin_bound_wait;       // waiting reads' attempts: 1 << bound
+    unsigned backoff_max;           // TRANSACTION retry sleep cap, us
+    unsigned tset_hash_steps;       // item lookup probes; 0: linear search
+};
+constexpr sto_knobs sto_default_knobs = {
+    STO_ABORT_ON_LOCKED, STO_SORT_WRITESET, STO_SPIN_BOUND_WRITE, STO_SPIN_BOUND_WAIT,
+    BACKOFF_MAX, TRANSACTION_HASHTABLE
+};
+#if STO_RUNTIME_KNOBS
+extern sto_knobs sto_runtime_knobs;
+#define STO_KNOB(k) (sto_runtime_knobs.k)
+#else
+#define STO_KNOB(k) (sto_default_knobs.k)
+#endif
+
 // TRANSACTION macros that can be used to wrap transactional code
 #define TRANSACTION                               \
     {                                             \
@@ -286,11 +320,13 @@ template <unsigned P, unsigned N> struct txp_helper<P, N, true> {
     static bool counter_exists(unsigned p) {
         return p < N;
     }
+    // one writer per thread's array; relaxed stores so MetricsSampler can
+    // read the counters while they run
     static void account_array(txp_counter_type* p, txp_counter_type v) {
         if (txp_is_max(P))
-            p[P] = std::max(p[P], v);
+            __atomic_store_n(&p[P], std::max(p[P], v), __ATOMIC_RELAXED);
         else
-            p[P] += v;
+            __atomic_store_n(&p[P], p[P] + v, __ATOMIC_RELAXED);
     }
 };
 template <unsigned P, unsigned N> struct txp_helper<P, N, false> {
@@ -338,7 +374,7 @@ struct tc_helper<C, N, true> {
         return tc < N;
     }
     static void account_array(tc_counter_type *tcs, tc_counter_type v) {
-        tcs[C] += v;
+        __atomic_store_n(&tcs[C], tcs[C] + v, __ATOMIC_RELAXED);
     }
 };
 
@@ -372,6 +408,10 @@ void reportPerf();
 struct __attribute__((aligned(128))) threadinfo_t {
     using epoch_type = TRcuSet::epoch_type;
     epoch_type epoch;
+    // nonzero while a transaction on this thread reads a multiversion snapshot
+    TransactionTid::type snapshot_tid;
+    // transactions started on this thread and not yet stopped
+    unsigned ntxns;
     TRcuSet rcu_set;
     // XXX(NH): these should be vectors so multiple data structures can register
     // callbacks for these
@@ -380,7 +420,7 @@ struct __attribute__((aligned(128))) threadinfo_t {
     txp_counters p_;
     tc_counters tcs_;
     threadinfo_t()
-        : epoch(0) {
+        : epoch(0), snapshot_tid(0), ntxns(0) {
     }
 };
 
@@ -413,6 +453,10 @@ private:
         Transaction::tinfo[TThread::id()].tcs_.tcs_, \
         ticks)
 
+class RedoLog;
+class TxnSchedule;
+class AdmissionGate;
+
 class Transaction {
 public:
     static constexpr unsigned tset_initial_capacity = 512;
@@ -423,18 +467,45 @@ public:
     using signed_epoch_type = TRcuSet::signed_epoch_type;
 
     static threadinfo_t tinfo[MAX_THREADS];
-    static struct epoch_state {
+    struct epoch_state {
         epoch_type global_epoch; // != 0
         epoch_type active_epoch; // no thread is before this epoch
         TransactionTid::type recent_tid;
+        TransactionTid::type snapshot_tid; // no snapshot reader is before this TID
         bool run;
-    } global_epochs;
+    };
+    // Processes sharing one SharedRegion (SharedRegion.hh) share the epoch
+    // state and TID counter; each publishes its threads' oldest epoch and
+    // snapshot in a process_state.
+    struct process_state {
+        int32_t pid;                    // 0: free
+        int32_t first_thread;
+        int32_t nthreads;
+        epoch_type active_epoch;
+        TransactionTid::type snapshot_tid;
+    };
+    struct shared_state {
+        epoch_state epochs;
+        TransactionTid::type tid;
+        process_state processes[MAX_THREADS];
+    };
+    static epoch_state* global_epochs;
     typedef TransactionTid::type tid_type;
 private:
-    static TransactionTid::type _TID;
+    static epoch_state local_epochs;
+    static TransactionTid::type local_tid;
+    static TransactionTid::type* _TID;
+    static shared_state* shared_;
+    static process_state* shared_process_;
 public:
 
     static std::function<void(threadinfo_t::epoch_type)> epoch_advance_callback;
+    // Set while a RedoLog runs; try_commit logs registered objects' writes
+    static RedoLog* redo_log;
+    // Set while a TxnSchedule records; try_commit and stop report commits
+    static TxnSchedule* schedule;
+    // Set while an AdmissionGate runs; TRANSACTION blocks take its tokens
+    static AdmissionGate* admission;
 
     static txp_counters txp_counters_combined() {
         txp_counters out;
@@ -541,8 +612,8 @@ private:
 #if STO_TSC_PROFILE
         start_tsc_ = read_tsc();
 #endif
-        thr.epoch = global_epochs.global_epoch;
-        thr.rcu_set.clean_until(global_epochs.active_epoch);
+        thr.epoch = global_epochs->global_epoch;
+        thr.rcu_set.clean_until(global_epochs->active_epoch);
         if (thr.trans_start_callback)
             thr.trans_start_callback();
         hash_base_ += tset_size_ + 1;
@@ -556,7 +627,7 @@ private:
 #endif
         any_writes_ = any_nonopaque_ = may_duplicate_items_ = false;
         first_write_ = 0;
-        start_tid_ = commit_tid_ = 0;
+        start_tid_ = commit_tid_ = snapshot_tid_ = 0;
         buf_.clear();
 #if STO_DEBUG_ABORTS
         abort_item_ = nullptr;
@@ -564,6 +635,7 @@ private:
         abort_version_ = 0;
 #endif
         TXP_INCREMENT(txp_total_starts);
+        ++thr.ntxns;
         state_ = s_in_progress;
     }
 
@@ -584,13 +656,13 @@ private:
         ++tset_size_;
         new(reinterpret_cast<void*>(tset_next_)) TransItem(const_cast<TObject*>(obj), xkey);
 #if TRANSACTION_HASHTABLE
-        unsigned hi = hash(obj, xkey);
-# if TRANSACTION_HASHTABLE > 1
-        if (hashtable_[hi] > hash_base_)
-            hi = (hi + hash_step) % hash_size;
-# endif
-        if (hashtable_[hi] <= hash_base_)
-            hashtable_[hi] = hash_base_ + tset_size_;
+        if (STO_KNOB(tset_hash_steps)) {
+            unsigned hi = hash(obj, xkey);
+            if (STO_KNOB(tset_hash_steps) > 1 && hashtable_[hi] > hash_base_)
+                hi = (hi + hash_step) % hash_size;
+            if (hashtable_[hi] <= hash_base_)
+                hashtable_[hi] = hash_base_ + tset_size_;
+        }
 #endif
         return tset_next_++;
     }
@@ -656,7 +728,7 @@ private:
 #if TRANSACTION_HASHTABLE
         TXP_INCREMENT(txp_hash_find);
         unsigned hi = hash(obj, xkey);
-        for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
+        for (unsigned steps = 0; steps < STO_KNOB(tset_hash_steps); ++steps) {
             if (hashtable_[hi] <= hash_base_)
                 return nullptr;
             unsigned tidx = hashtable_[hi] - hash_base_ - 1;
@@ -748,11 +820,10 @@ public:
         return try_lock(item, const_cast<TransactionTid::type&>(vers.value()));
     }
     bool try_lock(TransItem& item, TransactionTid::type& vers) {
-#if STO_SORT_WRITESET
-        (void) item;
-        TransactionTid::lock(vers, threadid_);
-        return true;
-#else
+        if (STO_KNOB(sort_writeset)) {
+            TransactionTid::lock(vers, threadid_);
+            return true;
+        }
         // This function will eventually help us track the commit TID when we
         // have no opacity, or for GV7 opacity.
         unsigned n = 0;
@@ -760,27 +831,26 @@ public:
             if (TransactionTid::try_lock(vers, threadid_))
                 return true;
             ++n;
-# if STO_SPIN_EXPBACKOFF
-            if (item.has_read() || n == STO_SPIN_BOUND_WRITE) {
-#  if STO_DEBUG_ABORTS
+#if STO_SPIN_EXPBACKOFF
+            if (item.has_read() || n == STO_KNOB(spin_bound_write)) {
+# if STO_DEBUG_ABORTS
                 abort_version_ = vers;
-#  endif
+# endif
                 return false;
             }
             if (n > 3)
                 for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
                     relax_fence();
-# else
-            if (item.has_read() || n == (1 << STO_SPIN_BOUND_WRITE)) {
-#  if STO_DEBUG_ABORTS
+#else
+            if (item.has_read() || n == (1U << STO_KNOB(spin_bound_write))) {
+# if STO_DEBUG_ABORTS
                 abort_version_ = vers;
-#  endif
+# endif
                 return false;
             }
-# endif
+#endif
             relax_fence();
         }
-#endif
     }
 
     void check_opacity(TransItem& item, TransactionTid::type v) {
@@ -790,7 +860,7 @@ public:
         assert(state_ <= s_committing_locked);
         TXP_INCREMENT(txp_tco);
         if (!start_tid_)
-            start_tid_ = _TID;
+            start_tid_ = *_TID;
         if (!TransactionTid::try_check_opacity(start_tid_, v)
             && state_ < s_committing)
             hard_check_opacity(&item, v);
@@ -804,14 +874,57 @@ public:
     void check_opacity(TransactionTid::type v) {
         assert(state_ <= s_committing_locked);
         if (!start_tid_)
-            start_tid_ = _TID;
+            start_tid_ = *_TID;
         if (!TransactionTid::try_check_opacity(start_tid_, v)
             && state_ < s_committing)
             hard_check_opacity(nullptr, v);
     }
 
     void check_opacity() {
-        check_opacity(_TID);
+        check_opacity(*_TID);
+    }
+
+    // multiversion snapshots
+    // Multiversion objects read a read-only transaction at this TID: every
+    // commit with a smaller TID is visible, no later commit is. The TID is
+    // published in tinfo so history it needs is not trimmed.
+    tid_type snapshot_tid() {
+        if (!snapshot_tid_) {
+            threadinfo_t& thr = tinfo[TThread::id()];
+            // hold back trimming until the real snapshot is published
+            thr.snapshot_tid = 1;
+            memory_fence();
+            snapshot_tid_ = *_TID;
+            thr.snapshot_tid = snapshot_tid_;
+        }
+        return snapshot_tid_;
+    }
+
+    // The smallest TID a commit starting now can get. Checkpoint.hh uses
+    // it as a snapshot TID outside any transaction.
+    static tid_type next_tid() {
+        return *_TID;
+    }
+
+    // Makes every later commit TID larger than t. Recovery.hh calls it
+    // before transactions run, so new commits order after recovered ones.
+    static void advance_tid(tid_type t) {
+        tid_type next = (t | (TransactionTid::increment_value - 1)) + 1;
+        tid_type cur = *_TID;
+        while (cur < next && !bool_cmpxchg(_TID, cur, next))
+            cur = *_TID;
+    }
+
+    // Moves the epoch state and TID counter into s, a region other
+    // processes map, with me as this process's slot; nullptr moves them
+    // back. SharedRegion::attach_transactions calls it while no
+    // transactions run.
+    static void use_shared_state(shared_state* s, process_state* me) {
+        shared_ = s;
+        shared_process_ = me;
+        global_epochs = s ? &s->epochs : &local_epochs;
+        memory_fence();
+        _TID = s ? &s->tid : &local_tid;
     }
 
     // committing
@@ -820,7 +933,7 @@ public:
         assert(state_ == s_committing_locked || state_ == s_committing);
 #endif
         if (!commit_tid_)
-            commit_tid_ = fetch_and_add(&_TID, TransactionTid::increment_value);
+            commit_tid_ = fetch_and_add(_TID, TransactionTid::increment_value);
         return commit_tid_;
     }
     void set_version(TVersion& vers, TVersion::type flags = 0) const {
@@ -883,6 +996,7 @@ private:
     unsigned tset_size_;
     mutable tid_type start_tid_;
     mutable tid_type commit_tid_;
+    tid_type snapshot_tid_;
     mutable TransactionBuffer buf_;
     mutable uint32_t lrng_state_;
 #if STO_DEBUG_ABORTS
@@ -900,6 +1014,7 @@ private:
     TransItem tset0_[tset_initial_capacity];
 
     void hard_check_opacity(TransItem* item, TransactionTid::type t);
+    template <bool SortWriteset> bool try_commit_impl();
     void stop(bool committed, unsigned* writes, unsigned nwrites);
 
     friend class TransProxy;
@@ -942,6 +1057,19 @@ public:
             TThread::txn->threadid_ = TThread::id();
     }
 
+    // Re-create the calling thread's per-thread state (RCU set, transaction
+    // and its tset chunks) from the thread itself, so that first-touch
+    // allocation puts it on the NUMA node the thread is pinned to. Call
+    // after pinning and TThread::set_id, outside a transaction.
+    static void rehome_thread() {
+        always_assert(!in_progress());
+        Transaction::tinfo[TThread::id()].rcu_set.rehome();
+        if (TThread::txn && !TThread::txn->is_test_) {
+            delete TThread::txn;
+            TThread::txn = nullptr;
+        }
+    }
+
     static bool in_progress() {
         return TThread::txn && TThread::txn->in_progress();
     }
@@ -1011,7 +1139,7 @@ public:
     }
 
     static TransactionTid::type recent_tid() {
-        return Transaction::global_epochs.recent_tid;
+        return Transaction::global_epochs->recent_tid;
     }
 
     static TransactionTid::type initialized_tid() {
@@ -1067,11 +1195,16 @@ class TransactionGuard {
 
 class TransactionLoopGuard {
   public:
-    TransactionLoopGuard() {
+    TransactionLoopGuard()
+        : gate_(Transaction::admission) {
+        if (gate_)
+            enter(gate_);
     }
     ~TransactionLoopGuard() {
         if (TThread::txn->in_progress())
             TThread::txn->silent_abort();
+        if (gate_)
+            leave(gate_);
     }
     void start() {
         Sto::start_transaction();
@@ -1083,6 +1216,12 @@ class TransactionLoopGuard {
     bool try_commit() {
         return TThread::txn->try_commit();
     }
+
+  private:
+    AdmissionGate* gate_;
+
+    static void enter(AdmissionGate* gate);
+    static void leave(AdmissionGate* gate);
 };
 
 
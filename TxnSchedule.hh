@@ -0,0 +1,400 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+
+// Record and replay of transaction schedules, for reproducing anomalies
+// such as abort storms in detail.
+//
+// While recording, each transaction event -- an attempt's start, each
+// operation, the attempt's commit, or its abort during execution -- takes
+// the next number from a global sequence. Events collect in per-thread
+// buffers and are written in sequence order by write(), so record short
+// runs.
+//
+// The numbering is the recorded run's serialization order. An operation
+// runs inside a recording section, which one thread holds at a time, and
+// takes its number there. A commit holds the section from before it locks
+// its write set until it has validated, and takes its number once the
+// write set is locked; the items it locked follow the commit event, in
+// lock order. Installs and unlocks run outside the section. So an
+// operation numbered after a commit sees that commit's writes (or aborts
+// on its locks), and one numbered before it sees none of them. An
+// attempt that aborts leaves the section once it has cleaned up.
+//
+// TxnReplay runs a schedule's events on the same thread ids, one at a time
+// in sequence order: a thread waits for its event's turn, runs it, and
+// passes the turn on. Replays of a schedule are therefore identical, and
+// every event is timed without interference. Attempts that aborted when
+// recorded are aborted at the same point: at the operation that aborted,
+// or at commit. An attempt that behaves differently anyway (its commit
+// fails validation, an operation aborts, or an operation's hit differs)
+// counts as a divergence. Indexes whose own threads change them during a
+// run can diverge; the others replay exactly.
+
+enum schedule_event_type : uint8_t {
+    sched_start,    // an attempt starts
+    sched_op,       // kind, key, value; outcome: sched_op_done | sched_op_hit
+    sched_commit,   // outcome: committed; value: items locked
+    sched_abort,    // the attempt aborted during execution
+    sched_lock      // key: hash of the item locked
+};
+
+struct schedule_event {
+    uint64_t ns;        // since recording started
+    uint64_t key;
+    uint64_t value;
+    uint8_t thread;
+    uint8_t type;
+    uint8_t kind;
+    uint8_t outcome;
+    uint32_t pad;
+};
+static_assert(sizeof(schedule_event) == 32, "schedule_event layout");
+// An operation without sched_op_done aborted its attempt
+enum { sched_op_hit = 1, sched_op_done = 2 };
+
+// The load a replay must repeat is described by ds, nkeys and prepopulate.
+struct schedule_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nthreads;
+    uint64_t nevents;
+    uint64_t nkeys;
+    uint64_t prepopulate;
+    char ds[32];
+};
+
+class TxnSchedule {
+public:
+    explicit TxnSchedule(int nthreads)
+        : threads_(nthreads), seq_(0) {
+    }
+    ~TxnSchedule() {
+        stop();
+    }
+
+    // Makes try_commit report its commits
+    void start() {
+        for (auto& t : threads_)
+            t.events.clear();
+        seq_ = 0;
+        start_ = std::chrono::steady_clock::now();
+        Transaction::schedule = this;
+    }
+    void stop() {
+        if (Transaction::schedule == this)
+            Transaction::schedule = nullptr;
+    }
+
+    // Each thread records only its own events. An operation runs between
+    // op() and op_done(), inside the recording section; if it aborts, the
+    // attempt's cleanup ends the section.
+    void attempt(int thread) {
+        add(thread, sched_start);
+    }
+    void op(int thread, int kind, uint64_t key, uint64_t value) {
+        enter(thread);
+        schedule_event& e = add(thread, sched_op);
+        e.kind = kind;
+        e.key = key;
+        e.value = value;
+    }
+    void op_done(int thread, bool hit) {
+        last(thread, sched_op).outcome = sched_op_done | (hit ? sched_op_hit : 0);
+        leave(thread);
+    }
+    void abort(int thread) {
+        add(thread, sched_abort);
+    }
+
+    // From try_commit and Transaction::stop, on the committing thread.
+    // commit_begin() comes before the write set is locked; commit_point()
+    // once it is (or, for a read-only commit, instead); validated() after
+    // validation succeeds.
+    void commit_begin() {
+        if (thread_events* t = mine()) {
+            enter(TThread::id());
+            t->committing = true;
+            t->locks.clear();
+        }
+    }
+    void locked(const TransItem& item) {
+        if (thread_events* t = mine())
+            t->locks.push_back(reinterpret_cast<uintptr_t>(item.owner()) * 0x9e3779b97f4a7c15ULL ^ item.key<uintptr_t>());
+    }
+    void commit_point() {
+        thread_events* t = mine();
+        if (!t || !t->committing || t->commit_numbered)
+            return;
+        schedule_event& c = add(TThread::id(), sched_commit);
+        c.value = t->locks.size();
+        t->commit = t->events.size() - 1;
+        t->commit_numbered = true;
+        schedule_event e = c;
+        e.type = sched_lock;
+        e.value = 0;
+        for (uint64_t key : t->locks) {
+            e.key = key;
+            t->events.push_back(std::make_pair(t->events[t->commit].first, e));
+        }
+    }
+    void validated() {
+        leave(TThread::id());
+    }
+    // An attempt ended. A commit that failed to lock its write set is
+    // numbered here.
+    void stopped(bool committed) {
+        thread_events* t = mine();
+        if (!t)
+            return;
+        if (t->committing) {
+            commit_point();
+            t->events[t->commit].second.outcome = committed;
+            t->committing = t->commit_numbered = false;
+        }
+        leave(TThread::id());
+    }
+
+    uint64_t size() const {
+        uint64_t n = 0;
+        for (auto& t : threads_)
+            n += t.events.size();
+        return n;
+    }
+
+    // Writes the events in sequence order. Recording must be over.
+    bool write(const std::string& path, const std::string& ds, uint64_t nkeys, uint64_t prepopulate) {
+        std::vector<std::pair<uint64_t, schedule_event>> all;
+        for (auto& t : threads_)
+            all.insert(all.end(), t.events.begin(), t.events.end());
+        // locks share their commit's number and follow it
+        std::stable_sort(all.begin(), all.end(), [](const std::pair<uint64_t, schedule_event>& a,
+                                                    const std::pair<uint64_t, schedule_event>& b) {
+            return a.first < b.first;
+        });
+        schedule_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, magic(), sizeof(h.magic));
+        h.version = 1;
+        h.nthreads = threads_.size();
+        h.nevents = all.size();
+        h.nkeys = nkeys;
+        h.prepopulate = prepopulate;
+        strncpy(h.ds, ds.c_str(), sizeof(h.ds) - 1);
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+        for (auto& e : all)
+            ok = ok && fwrite(&e.second, sizeof(e.second), 1, f) == 1;
+        return fclose(f) == 0 && ok;
+    }
+
+    static const char* magic() {
+        return "STOSCHED";
+    }
+
+private:
+    struct thread_events {
+        std::vector<std::pair<uint64_t, schedule_event>> events;   // (sequence, event)
+        size_t commit = 0;      // the latest commit event
+        std::vector<uint64_t> locks;    // the committing write set's items
+        bool committing = false;
+        bool commit_numbered = false;
+        bool in_section = false;
+    } __attribute__((aligned(128)));
+
+    std::vector<thread_events> threads_;
+    std::atomic<uint64_t> seq_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex section_;
+
+    thread_events* mine() {
+        unsigned id = TThread::id();
+        return id < threads_.size() ? &threads_[id] : nullptr;
+    }
+    void enter(int thread) {
+        section_.lock();
+        threads_[thread].in_section = true;
+    }
+    void leave(int thread) {
+        if (threads_[thread].in_section) {
+            threads_[thread].in_section = false;
+            section_.unlock();
+        }
+    }
+
+    schedule_event& add(int thread, uint8_t type) {
+        schedule_event e;
+        memset(&e, 0, sizeof(e));
+        e.thread = thread;
+        e.type = type;
+        uint64_t seq = seq_.fetch_add(1);
+        e.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+        auto& v = threads_[thread].events;
+        v.push_back(std::make_pair(seq, e));
+        return v.back().second;
+    }
+    schedule_event& last(int thread, uint8_t type) {
+        auto& v = threads_[thread].events;
+        auto it = v.end();
+        while ((--it)->second.type != type)
+            /* do nothing */;
+        return it->second;
+    }
+};
+
+class TxnReplay {
+public:
+    struct stats {
+        uint64_t attempts = 0;
+        uint64_t commits = 0;
+        uint64_t forced_aborts = 0;     // aborted as recorded
+        uint64_t divergences = 0;
+    };
+    // op runs an operation in the current transaction and returns whether
+    // it hit. done gets each replayed event (not locks) and its duration.
+    typedef std::function<bool(const schedule_event& e)> op_type;
+    typedef std::function<void(const schedule_event& e, bool ok, uint64_t ns)> done_type;
+
+    bool open(const std::string& path) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+        bool ok = fread(&h_, sizeof(h_), 1, f) == 1 && memcmp(h_.magic, TxnSchedule::magic(), sizeof(h_.magic)) == 0
+            && h_.version == 1 && h_.nthreads <= unsigned(MAX_THREADS);
+        if (ok) {
+            events_.resize(h_.nevents);
+            ok = fread(events_.data(), sizeof(schedule_event), events_.size(), f) == events_.size();
+        }
+        fclose(f);
+        for (auto& e : events_)
+            ok = ok && e.thread < h_.nthreads;
+        return ok;
+    }
+    const schedule_header& header() const {
+        return h_;
+    }
+    const std::vector<schedule_event>& events() const {
+        return events_;
+    }
+
+    // Replays on header().nthreads threads; thread_init runs first on each.
+    void run(std::function<void(int thread)> thread_init, op_type op, done_type done) {
+        // a thread's events and their turns; locks take no turn
+        std::vector<std::vector<std::pair<uint64_t, const schedule_event*>>> mine(h_.nthreads);
+        uint64_t turns = 0;
+        for (auto& e : events_)
+            if (e.type != sched_lock)
+                mine[e.thread].push_back(std::make_pair(turns++, &e));
+        stats_ = std::vector<stats>(h_.nthreads);
+        turn_ = 0;
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < h_.nthreads; ++t)
+            threads.emplace_back([&, t] {
+                thread_init(t);
+                replay(mine[t], stats_[t], op, done);
+            });
+        for (auto& th : threads)
+            th.join();
+    }
+
+    stats total() const {
+        stats s;
+        for (auto& t : stats_) {
+            s.attempts += t.attempts;
+            s.commits += t.commits;
+            s.forced_aborts += t.forced_aborts;
+            s.divergences += t.divergences;
+        }
+        return s;
+    }
+
+private:
+    schedule_header h_;
+    std::vector<schedule_event> events_;
+    std::vector<stats> stats_;
+    std::atomic<uint64_t> turn_;
+
+    void wait(uint64_t turn) {
+        for (unsigned spins = 0; turn_.load(std::memory_order_acquire) != turn; ++spins)
+            if (spins < 1000)
+                relax_fence();
+            else
+                sched_yield();
+    }
+
+    void replay(const std::vector<std::pair<uint64_t, const schedule_event*>>& mine, stats& s, op_type& op,
+                done_type& done) {
+        // ended: this attempt already aborted
+        bool ended = false;
+        for (auto& m : mine) {
+            const schedule_event& e = *m.second;
+            wait(m.first);
+            auto t0 = std::chrono::steady_clock::now();
+            bool ok = true;
+            switch (e.type) {
+            case sched_start:
+                Sto::start_transaction();
+                ended = false;
+                ++s.attempts;
+                break;
+            case sched_op:
+                if (ended)
+                    ok = false;
+                else if (!(e.outcome & sched_op_done)) {
+                    // the recorded attempt aborted here
+                    Sto::silent_abort();
+                    ok = false;
+                    ended = true;
+                    ++s.forced_aborts;
+                } else
+                    try {
+                        ok = op(e);
+                        if (ok != bool(e.outcome & sched_op_hit))
+                            ++s.divergences;
+                    } catch (Transaction::Abort&) {
+                        Sto::silent_abort();
+                        ok = false;
+                        ended = true;
+                        ++s.divergences;
+                    }
+                break;
+            case sched_commit:
+                if (ended)
+                    ok = false;
+                else if (!e.outcome) {
+                    Sto::silent_abort();
+                    ok = false;
+                    ++s.forced_aborts;
+                } else if ((ok = Sto::try_commit()))
+                    ++s.commits;
+                else
+                    ++s.divergences;
+                break;
+            case sched_abort:
+                if (!ended) {
+                    Sto::silent_abort();
+                    ++s.forced_aborts;
+                }
+                ok = false;
+                break;
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            done(e, ok, std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+            turn_.store(m.first + 1, std::memory_order_release);
+        }
+        Sto::silent_abort();
+    }
+};
@@ -0,0 +1,1565 @@
+// Benchmark driver: runs a transactional workload against any index with a
+// BenchIndex adapter. The index, operation mix, key distribution, thread
+// placement and transaction size are all options; results are JSON, with
+// hardware counters for each run.
+//
+//   ./bench --ds=masstree --read=80 --update=20 --dist=zipf --skew=0.9
+//       --keys=1000000 --nthreads=8 --pin=compact --duration=10
+//
+// Index, thread count, transaction size and skew also take lists, to run
+// a matrix in one process:
+//
+//   ./bench --ds=hashtable,masstree --nthreads=1,2,4,8 --repeat=5
+//       --csv=runs.csv --baseline=baseline.csv
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <climits>
+#include <cmath>
+#include <map>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "RBTree.hh"
+#include "BenchIndex.hh"
+#include "bench.hh"
+#include "clp.h"
+#include "sampling.hh"
+#include "LatencyHistogram.hh"
+#include "PerfCounters.hh"
+#include "NumaTopology.hh"
+#include "ParallelLoader.hh"
+#include "EventTrace.hh"
+#include "Metrics.hh"
+#include "RedoLog.hh"
+#include "Checkpoint.hh"
+#include "Recovery.hh"
+#include "RequestServer.hh"
+#include "TxnSchedule.hh"
+#include "AdmissionControl.hh"
+#include "AffinityScheduler.hh"
+#include "StoKnobs.hh"
+
+#ifndef BENCH_MASSTREE
+#define BENCH_MASSTREE 1
+#endif
+#ifndef BENCH_LAYOUT_BT
+#define BENCH_LAYOUT_BT 1
+#endif
+
+#if BENCH_MASSTREE
+#include "MassTrans.hh"
+#endif
+#if BENCH_LAYOUT_BT
+#include "TLayoutBT.hh"
+#endif
+
+// If we have N keys, we make our hashtable have size N/HASHTABLE_LOAD_FACTOR
+#define HASHTABLE_LOAD_FACTOR 1.1
+
+class HashtableIndex : public BenchIndex {
+public:
+    typedef Hashtable<uint64_t, uint64_t, true> type;
+
+    HashtableIndex(uint64_t nkeys)
+        : h_(nkeys / HASHTABLE_LOAD_FACTOR + 1) {
+    }
+    bool read(uint64_t key, uint64_t& value) override {
+        return h_.transGet(key, value);
+    }
+    bool update(uint64_t key, uint64_t value) override {
+        return h_.transPut(key, value);
+    }
+    bool insert(uint64_t key, uint64_t value) override {
+        return h_.transInsert(key, value);
+    }
+    bool remove(uint64_t key) override {
+        return h_.transDelete(key);
+    }
+    int prefetch_stages() const override {
+        return type::prefetch_stages;
+    }
+    void prefetch(uint64_t key, int stage) override {
+        h_.prefetch(key, stage);
+    }
+    void load(uint64_t key, uint64_t value) override {
+        h_.nontrans_insert(key, value);
+    }
+    bool concurrent_load() const override {
+        return true;
+    }
+    TObject* log_object() override {
+        return &h_;
+    }
+    bool add_to_checkpoint(Checkpoint& c) override {
+        return c.add(h_, 0);
+    }
+    bool add_to_recovery(Recovery& r) override {
+        return r.add(h_, 0);
+    }
+private:
+    type h_;
+};
+static BenchIndex::registrar hashtable_registrar("hashtable", "Hashtable<uint64_t, uint64_t>",
+    [](uint64_t nkeys) -> BenchIndex* { return new HashtableIndex(nkeys); });
+
+class RBTreeIndex : public BenchIndex {
+public:
+    typedef RBTree<uint64_t, uint64_t, true> type;
+
+    RBTreeIndex(uint64_t) {
+    }
+    bool read(uint64_t key, uint64_t& value) override {
+        if (!t_.count(key))
+            return false;
+        value = t_[key];
+        return true;
+    }
+    bool update(uint64_t key, uint64_t value) override {
+        bool found = t_.count(key);
+        t_[key] = value;
+        return found;
+    }
+    bool insert(uint64_t key, uint64_t value) override {
+        if (t_.count(key))
+            return false;
+        t_[key] = value;
+        return true;
+    }
+    bool remove(uint64_t key) override {
+        return t_.erase(key);
+    }
+    void load(uint64_t key, uint64_t value) override {
+        t_.nontrans_insert(key, value);
+    }
+private:
+    type t_;
+};
+static BenchIndex::registrar rbtree_registrar("rbtree", "RBTree<uint64_t, uint64_t>",
+    [](uint64_t nkeys) -> BenchIndex* { return new RBTreeIndex(nkeys); });
+
+#if BENCH_MASSTREE
+class MasstreeIndex : public BenchIndex {
+public:
+    typedef MassTrans<uint64_t> type;
+
+    MasstreeIndex(uint64_t) {
+        type::static_init();
+    }
+    unsigned ops() const override {
+        return op_point | op_scan;
+    }
+    void thread_init(int) override {
+        type::thread_init();
+    }
+    bool read(uint64_t key, uint64_t& value) override {
+        char buf[8];
+        return t_.transGet(str(key, buf), value);
+    }
+    bool update(uint64_t key, uint64_t value) override {
+        char buf[8];
+        return t_.transPut(str(key, buf), value);
+    }
+    bool insert(uint64_t key, uint64_t value) override {
+        char buf[8];
+        return t_.transInsert(str(key, buf), value);
+    }
+    bool remove(uint64_t key) override {
+        char buf[8];
+        return t_.transDelete(str(key, buf));
+    }
+    unsigned scan(uint64_t key, unsigned n) override {
+        char buf[8];
+        unsigned found = 0;
+        t_.transQuery(str(key, buf), Masstree::Str(), [&](Masstree::Str, uint64_t) {
+                return ++found < n;
+            });
+        return found;
+    }
+    void load(uint64_t key, uint64_t value) override {
+        char buf[8];
+        t_.nontransPut(str(key, buf), value);
+    }
+    bool concurrent_load() const override {
+        return true;
+    }
+private:
+    type t_;
+
+    // big-endian, so key order is integer order
+    static Masstree::Str str(uint64_t key, char* buf) {
+        for (int i = 7; i >= 0; --i, key >>= 8)
+            buf[i] = key;
+        return Masstree::Str(buf, 8);
+    }
+};
+static BenchIndex::registrar masstree_registrar("masstree", "MassTrans<uint64_t>, 8-byte big-endian keys",
+    [](uint64_t nkeys) -> BenchIndex* { return new MasstreeIndex(nkeys); });
+#endif
+
+#if BENCH_LAYOUT_BT
+// TLayoutBT stores keys only and has no transactional lookup, so it runs
+// insert/remove workloads.
+class LayoutBTIndex : public BenchIndex {
+public:
+    typedef TLayoutBT<unsigned> type;
+
+    LayoutBTIndex(uint64_t nkeys) {
+        always_assert(nkeys <= UINT_MAX, "TLayoutBT keys are 32 bits");
+    }
+    unsigned ops() const override {
+        return op_insert | op_remove;
+    }
+    void thread_init(int tid) override {
+        Layout_Lock::setup();
+        dirty_[tid] = t_.llock_.getDirtyP();
+    }
+    bool read(uint64_t, uint64_t&) override {
+        always_assert(false, "TLayoutBT has no lookup");
+        return false;
+    }
+    bool update(uint64_t, uint64_t) override {
+        always_assert(false, "TLayoutBT has no values");
+        return false;
+    }
+    bool insert(uint64_t key, uint64_t) override {
+        return t_.insert(key, dirty_[TThread::id()]);
+    }
+    bool remove(uint64_t key) override {
+        return t_.remove(key, dirty_[TThread::id()]);
+    }
+    void load(uint64_t key, uint64_t) override {
+        Layout_Lock::setup();
+        t_.LayoutTree::insert(key, t_.llock_.getDirtyP());
+    }
+private:
+    type t_;
+    dptrtype* dirty_[MAX_THREADS];
+};
+static BenchIndex::registrar layout_bt_registrar("layout-bt", "TLayoutBT<unsigned>, insert/remove only",
+    [](uint64_t nkeys) -> BenchIndex* { return new LayoutBTIndex(nkeys); });
+#endif
+
+
+static const char* const kind_names[] = {"read", "update", "insert", "remove", "scan", "rmw"};
+static_assert(int(trace_read) == kind_read && int(trace_rmw) == kind_rmw, "trace ops are kinds");
+static const unsigned kind_ops[] = {
+    BenchIndex::op_read, BenchIndex::op_update, BenchIndex::op_insert, BenchIndex::op_remove,
+    BenchIndex::op_scan, BenchIndex::op_read | BenchIndex::op_update
+};
+
+// The ycsb- presets are the YCSB core workloads A-F. As in YCSB, their
+// inserts append new keys rather than choosing keys from the distribution,
+// and "latest" favors the most recently appended keys.
+struct workload_preset {
+    const char* name;
+    double pct[nkinds];
+    const char* dist;
+    bool append;
+};
+static const workload_preset workload_presets[] = {
+    {"mixed", {50, 50, 0, 0, 0, 0}, "uniform", false},
+    {"readonly", {100, 0, 0, 0, 0, 0}, "uniform", false},
+    {"update", {0, 100, 0, 0, 0, 0}, "uniform", false},
+    {"insert-remove", {0, 0, 50, 50, 0, 0}, "uniform", false},
+    {"ycsb-a", {50, 50, 0, 0, 0, 0}, "zipf", true},
+    {"ycsb-b", {95, 5, 0, 0, 0, 0}, "zipf", true},
+    {"ycsb-c", {100, 0, 0, 0, 0, 0}, "zipf", true},
+    {"ycsb-d", {95, 0, 5, 0, 0, 0}, "latest", true},
+    {"ycsb-e", {0, 0, 5, 0, 95, 0}, "zipf", true},
+    {"ycsb-f", {50, 0, 0, 0, 0, 50}, "zipf", true}
+};
+
+
+struct bench_op {
+    int kind;
+    unsigned len;
+    uint64_t key;
+};
+
+// A transaction waiting in an AffinityScheduler queue
+struct routed_txn {
+    std::vector<bench_op> ops;
+    std::chrono::steady_clock::time_point intended;
+};
+
+static const char* type_name(int t) {
+    return t < nkinds ? kind_names[t] : "mixed";
+}
+
+
+bench_config cfg;
+static BenchIndex* idx;
+static std::vector<int> cpus;
+static thread_result results[MAX_THREADS];
+static std::atomic<int> nready;
+static std::atomic<bool> go, stop;
+static double offered_rate;                 // this run's open-loop rate
+double counters[PerfCounters::ncounters];  // this run's; -1: unavailable
+static int load_threads;                    // this run's loading threads
+double load_seconds;
+static EventTrace* trace;                   // null unless --trace
+static uint64_t log_bytes;                  // this run's redo log
+static uint64_t log_durable_epoch;
+static RedoLog* redo_log;                   // this run's, if --log-dir
+static Checkpoint* checkpoint;              // this run's, if --checkpoint
+static Recovery* recovery;                  // this run's, if --recover
+static double first_query_seconds;          // from recovery's start
+static TxnSchedule* schedule;               // this run's, if --record
+static TxnReplay* replay;                   // this run's, if --replay
+static AdmissionGate* admission;            // this run's, if --admission
+static AffinityScheduler<routed_txn>* router;   // this run's, if --route
+// appended keys come from here
+static std::atomic<uint64_t> next_key;
+
+// "none", or a NumaTopology placement policy: "compact", "scatter",
+// "node:N", or a CPU list like "0,4,8-11"
+static bool parse_pin(const std::string& pin, int nthreads, std::vector<int>& out) {
+    out.clear();
+    return pin == "none" || NumaTopology::system().place(pin, nthreads, out);
+}
+
+static bool run_op(const bench_op& op, uint64_t value) {
+    uint64_t v;
+    switch (op.kind) {
+    case kind_read:
+        return idx->read(op.key, v);
+    case kind_update:
+        return idx->update(op.key, value);
+    case kind_insert:
+        return idx->insert(op.key, value);
+    case kind_remove:
+        return idx->remove(op.key);
+    case kind_scan:
+        return idx->scan(op.key, op.len) != 0;
+    default:
+        if (!idx->read(op.key, v))
+            return false;
+        idx->update(op.key, v + 1);
+        return true;
+    }
+}
+
+// Wait for an open-loop arrival. Returns false if the run ends first.
+static bool wait_until(std::chrono::steady_clock::time_point t) {
+    while (true) {
+        if (stop.load(std::memory_order_relaxed))
+            return false;
+        auto now = std::chrono::steady_clock::now();
+        if (now >= t)
+            return true;
+        if (t - now > std::chrono::microseconds(200))
+            usleep(std::chrono::duration_cast<std::chrono::microseconds>(t - now).count() - 100);
+        else
+            relax_fence();
+    }
+}
+
+// Runs the index's prefetch stages for the keys of transactions txns[0,
+// n), each stage for every key before the next, so the misses of the
+// whole batch overlap.
+static void prefetch_txns(const std::vector<bench_op>* txns, unsigned n) {
+    for (int stage = 0; stage < idx->prefetch_stages(); ++stage)
+        for (unsigned i = 0; i != n; ++i)
+            for (auto& op : txns[i])
+                idx->prefetch(op.key, stage);
+}
+
+// Runs the transaction ops on thread me, retrying until it commits. Its
+// latency counts from intended.
+static void run_txn(int me, thread_result& r, const std::vector<bench_op>& ops,
+                    std::chrono::steady_clock::time_point intended) {
+    uint64_t hits[nkinds];
+    int type = ops[0].kind;
+    for (auto& op : ops)
+        if (op.kind != type)
+            type = nkinds;
+    auto t0 = std::chrono::steady_clock::now();
+    // traced attempts: an attempt that finished executing yet is
+    // retried failed at commit
+    uint64_t attempt_start = 0;
+    bool executed = false;
+    bool attempted = false;
+    TRANSACTION {
+        if (trace) {
+            if (attempt_start)
+                trace->record(me, trace_txn, trace_abort, executed ? trace_commit_abort : trace_exec_abort, attempt_start);
+            attempt_start = EventTrace::now();
+        }
+        if (schedule) {
+            if (attempted && !executed)
+                schedule->abort(me);
+            schedule->attempt(me);
+            attempted = true;
+        }
+        executed = false;
+        ++r.attempts;
+        memset(hits, 0, sizeof(hits));
+        for (auto& op : ops)
+            if (trace || schedule) {
+                uint64_t op_start = EventTrace::now();
+                if (schedule)
+                    schedule->op(me, op.kind, op.key, op.kind == kind_scan ? op.len : r.commits);
+                bool hit = run_op(op, r.commits);
+                hits[op.kind] += hit;
+                if (schedule)
+                    schedule->op_done(me, hit);
+                if (trace)
+                    trace->record(me, op.kind, hit ? trace_ok : trace_miss, trace_no_abort, op_start, EventTrace::hash(op.key));
+            } else
+                hits[op.kind] += run_op(op, r.commits);
+        executed = true;
+    } RETRY(true);
+    auto t1 = std::chrono::steady_clock::now();
+    if (trace)
+        trace->record(me, trace_txn, trace_ok, trace_no_abort, attempt_start);
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - intended).count();
+    r.latency.record(latency);
+    r.type_latency[type].record(latency);
+    r.service.record(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+    ++r.commits;
+    for (auto& op : ops)
+        ++r.ops[op.kind];
+    for (int k = 0; k < nkinds; ++k)
+        r.hits[k] += hits[k];
+}
+
+static void worker(int me) {
+    TThread::set_id(me);
+    Sto::update_threadid();
+    thread_result& r = results[me];
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[me], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+            r.cpu = cpus[me];
+            r.node = NumaTopology::system().node_of(r.cpu);
+        } else
+            std::cerr << "thread " << me << ": cannot pin to CPU " << cpus[me] << "\n";
+    }
+    // STO's per-thread state was allocated by the main thread; move it here
+    Sto::rehome_thread();
+    idx->thread_init(me);
+
+    std::unique_ptr<StoSampling::StoRandomDistribution> keys;
+    int dseed = cfg.seed + me * 7919;
+    if (cfg.dist == "uniform")
+        keys.reset(new StoSampling::StoUniformDistribution(dseed, 0, cfg.nkeys - 1));
+    else if (cfg.dist == "scrambled-zipf")
+        keys.reset(new StoSampling::StoScrambledZipfDistribution(dseed, 0, cfg.nkeys - 1, cfg.skew));
+    else if (cfg.dist == "hotspot")
+        keys.reset(new StoSampling::StoHotspotDistribution(dseed, 0, cfg.nkeys - 1));
+    else
+        keys.reset(new StoSampling::StoZipfDistribution(dseed, 0, cfg.nkeys - 1, cfg.skew));
+    std::mt19937 gen(dseed);
+    std::uniform_real_distribution<double> pct(0, 100);
+    std::uniform_int_distribution<unsigned> scan_len(1, cfg.scan_length);
+    // --prefetch=N chooses up to N transactions at once, prefetches all
+    // their keys, then runs them one by one
+    unsigned nbatch = std::max(cfg.prefetch, 1U);
+    std::vector<std::vector<bench_op>> batch(nbatch, std::vector<bench_op>(cfg.txn_size));
+    std::vector<std::chrono::steady_clock::time_point> batch_intended(nbatch);
+    uint64_t quota = cfg.ntxns ? cfg.ntxns / cfg.nthreads + (uint64_t(me) < cfg.ntxns % cfg.nthreads) : 0;
+    // open loop: this thread serves its share of the arrivals in order
+    double mean_gap = offered_rate ? 1e9 * cfg.nthreads / offered_rate : 0;
+    std::exponential_distribution<double> gap(1.0);
+    double arrival = 0;
+    bool arrival_drawn = false;
+
+    ++nready;
+    while (!go.load(std::memory_order_acquire))
+        relax_fence();
+    auto start = std::chrono::steady_clock::now();
+
+    bool running = true;
+    while (running && (quota ? r.commits < quota : !stop.load(std::memory_order_relaxed))) {
+        // routed: run this thread's queue (or a long one's) before adding
+        // to the queues
+        routed_txn t;
+        if (router && router->next(me, t)) {
+            if (cfg.prefetch)
+                prefetch_txns(&t.ops, 1);
+            run_txn(me, r, t.ops, t.intended);
+            continue;
+        }
+        unsigned n = 0;
+        while (n < nbatch && (!quota || r.commits + n < quota)) {
+            auto intended = std::chrono::steady_clock::now();
+            if (mean_gap) {
+                if (!arrival_drawn)
+                    arrival += cfg.arrival == "poisson" ? mean_gap * gap(gen) : mean_gap;
+                arrival_drawn = true;
+                intended = start + std::chrono::nanoseconds(uint64_t(arrival));
+                // batch only transactions that have arrived
+                if (n && intended > std::chrono::steady_clock::now())
+                    break;
+                if (!n && !wait_until(intended)) {
+                    running = false;
+                    break;
+                }
+                arrival_drawn = false;
+            }
+            // choose the operations up front so retries repeat them
+            std::vector<bench_op>& ops = batch[n];
+            for (auto& op : ops) {
+                double p = pct(gen);
+                op.kind = 0;
+                while (op.kind < nkinds - 1 && p >= cfg.pct[op.kind]) {
+                    p -= cfg.pct[op.kind];
+                    ++op.kind;
+                }
+                if (op.kind == kind_insert && cfg.append)
+                    op.key = next_key.fetch_add(1, std::memory_order_relaxed);
+                else if (cfg.dist == "latest") {
+                    uint64_t top = next_key.load(std::memory_order_relaxed), back = keys->sample();
+                    op.key = back < top ? top - 1 - back : 0;
+                } else
+                    op.key = keys->sample();
+                op.len = op.kind == kind_scan ? scan_len(gen) : 1;
+            }
+            if (router) {
+                t.ops = ops;
+                t.intended = intended;
+                // queued for another thread: run what we have
+                if (router->submit(me, ops[0].key, t))
+                    break;
+            }
+            batch_intended[n] = intended;
+            ++n;
+        }
+        if (cfg.prefetch)
+            prefetch_txns(batch.data(), n);
+        for (unsigned i = 0; i != n; ++i)
+            run_txn(me, r, batch[i], batch_intended[i]);
+    }
+
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+thread_result totals() {
+    thread_result total;
+    for (int i = 0; i < cfg.nthreads; ++i) {
+        auto& r = results[i];
+        total.commits += r.commits;
+        total.attempts += r.attempts;
+        total.latency.merge(r.latency);
+        for (int t = 0; t < ntypes; ++t)
+            total.type_latency[t].merge(r.type_latency[t]);
+        total.service.merge(r.service);
+        for (int k = 0; k < nkinds; ++k) {
+            total.ops[k] += r.ops[k];
+            total.hits[k] += r.hits[k];
+        }
+    }
+    return total;
+}
+
+void print_config(FILE* f) {
+    fprintf(f, "  \"config\": {\"ds\": \"%s\", \"workload\": \"%s\", \"mix\": {",
+            cfg.ds.c_str(), cfg.workload.c_str());
+    for (int k = 0; k < nkinds; ++k)
+        fprintf(f, "%s\"%s\": %g", k ? ", " : "", kind_names[k], cfg.pct[k]);
+    fprintf(f, "}, \"dist\": \"%s\", \"skew\": %g, \"append\": %s, \"scan_length\": %u,\n"
+            "    \"keys\": %llu, \"prepopulate\": %lld, \"nthreads\": %d, \"txn_size\": %d, \"duration\": %g,\n"
+            "    \"ntxns\": %llu, \"rate\": %g, \"arrival\": \"%s\", \"sla_p99_us\": %g, \"pin\": \"%s\", \"interleave\": %s,\n"
+            "    \"seed\": %u, \"prefetch\": %u, \"knobs\": \"%s\"},\n",
+            cfg.dist.c_str(), cfg.skew, cfg.append ? "true" : "false", cfg.scan_length,
+            (unsigned long long) cfg.nkeys, (long long) cfg.prepopulate, cfg.nthreads, cfg.txn_size, cfg.duration,
+            (unsigned long long) cfg.ntxns, cfg.rate, cfg.arrival.c_str(), cfg.sla_p99, cfg.pin.c_str(),
+            cfg.interleave ? "true" : "false", cfg.seed, cfg.prefetch, StoKnobs::unparse(StoKnobs::current()).c_str());
+}
+
+void print_latency(FILE* f, const LatencyHistogram& l) {
+    fprintf(f, "{\"count\": %llu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f}",
+            (unsigned long long) l.count(), l.mean() / 1000, l.percentile(50) / 1000.,
+            l.percentile(90) / 1000., l.percentile(99) / 1000., l.percentile(99.9) / 1000., l.max() / 1000.);
+}
+
+static void report(FILE* f, double seconds) {
+    thread_result total = totals();
+    uint64_t aborts = total.attempts - total.commits;
+    uint64_t nops = 0;
+    for (int k = 0; k < nkinds; ++k)
+        nops += total.ops[k];
+
+    fprintf(f, "{\n");
+    print_config(f);
+    if (recovery)
+        fprintf(f, "  \"recovery\": {\"threads\": %d, \"checkpoint_records\": %llu, \"log_records\": %llu, \"load_seconds\": %.6f, \"replay_seconds\": %.6f, \"first_query_seconds\": %.6f},\n",
+                load_threads, (unsigned long long) recovery->records(), (unsigned long long) recovery->log_records(),
+                recovery->load_seconds(), recovery->replay_seconds(), first_query_seconds);
+    else
+        fprintf(f, "  \"load\": {\"keys\": %lld, \"threads\": %d, \"seconds\": %.6f, \"keys_per_sec\": %.1f},\n",
+                (long long) cfg.prepopulate, load_threads, load_seconds, cfg.prepopulate / load_seconds);
+    if (!cfg.log_dir.empty())
+        fprintf(f, "  \"log\": {\"loggers\": %d, \"bytes\": %llu, \"mb_per_sec\": %.1f, \"durable_epoch\": %llu},\n",
+                cfg.loggers, (unsigned long long) log_bytes, log_bytes / seconds / 1e6,
+                (unsigned long long) log_durable_epoch);
+    if (schedule)
+        fprintf(f, "  \"record\": {\"schedule\": \"%s\", \"events\": %llu},\n",
+                cfg.record.c_str(), (unsigned long long) schedule->size());
+    if (replay) {
+        TxnReplay::stats rs = replay->total();
+        fprintf(f, "  \"replay\": {\"schedule\": \"%s\", \"events\": %zu, \"from\": %g, \"to\": %g, \"attempts\": %llu, \"commits\": %llu, \"forced_aborts\": %llu, \"divergences\": %llu},\n",
+                cfg.replay.c_str(), replay->events().size(), cfg.replay_from, cfg.replay_to,
+                (unsigned long long) rs.attempts, (unsigned long long) rs.commits,
+                (unsigned long long) rs.forced_aborts, (unsigned long long) rs.divergences);
+    }
+    if (admission) {
+        const AdmissionGate::stats& as = admission->statistics();
+        fprintf(f, "  \"admission\": {\"target_abort_pct\": %g, \"limit\": %u, \"mean_limit\": %.1f, \"min_limit\": %u, \"max_limit\": %u, \"intervals\": %llu, \"decreases\": %llu, \"waited\": %llu},\n",
+                cfg.admission_target, admission->limit(), as.intervals ? double(as.limit_sum) / as.intervals : admission->limit(),
+                as.min_limit, as.max_limit, (unsigned long long) as.intervals, (unsigned long long) as.decreases,
+                (unsigned long long) as.waited);
+    }
+    if (router) {
+        AffinityScheduler<routed_txn>::stats rs = router->total();
+        uint64_t most = 0;
+        for (int i = 0; i < cfg.nthreads; ++i)
+            most = std::max(most, router->statistics(i).submitted);
+        fprintf(f, "  \"route\": {\"policy\": \"%s\", \"routed\": %llu, \"stolen\": %llu, \"max_share\": %.3f},\n",
+                cfg.route.c_str(), (unsigned long long) rs.submitted, (unsigned long long) rs.stolen,
+                rs.submitted ? double(most) / rs.submitted : 0.0);
+    }
+    if (checkpoint) {
+        const checkpoint_manifest& m = checkpoint->manifest();
+        fprintf(f, "  \"checkpoint\": {\"threads\": %d, \"seconds\": %.6f, \"records\": %llu, \"bytes\": %llu, \"records_per_sec\": %.1f},\n",
+                cfg.checkpoint_threads, checkpoint->seconds(), (unsigned long long) m.records,
+                (unsigned long long) checkpoint->bytes(), m.records / checkpoint->seconds());
+    }
+    fprintf(f, "  \"seconds\": %.6f,\n  \"commits\": %llu,\n  \"aborts\": %llu,\n  \"abort_rate\": %.6f,\n"
+            "  \"txns_per_sec\": %.1f,\n  \"ops_per_sec\": %.1f,\n  \"ops\": {",
+            seconds, (unsigned long long) total.commits, (unsigned long long) aborts,
+            total.attempts ? double(aborts) / total.attempts : 0.0,
+            total.commits / seconds, nops / seconds);
+    for (int k = 0; k < nkinds; ++k)
+        fprintf(f, "%s\"%s\": {\"count\": %llu, \"hits\": %llu}", k ? ", " : "", kind_names[k],
+                (unsigned long long) total.ops[k], (unsigned long long) total.hits[k]);
+    fprintf(f, "},\n  \"latency_us\": ");
+    print_latency(f, total.latency);
+    fprintf(f, ",\n  \"latency_by_type_us\": {");
+    const char* sep = "";
+    for (int t = 0; t < ntypes; ++t)
+        if (total.type_latency[t].count()) {
+            fprintf(f, "%s\n    \"%s\": ", sep, type_name(t));
+            print_latency(f, total.type_latency[t]);
+            sep = ",";
+        }
+    fprintf(f, "\n  },\n");
+    if (offered_rate) {
+        fprintf(f, "  \"service_us\": ");
+        print_latency(f, total.service);
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "  \"counters\": {");
+    for (int c = 0; c < PerfCounters::ncounters; ++c) {
+        fprintf(f, "%s\"%s\": ", c ? ", " : "", PerfCounters::name(c));
+        if (counters[c] < 0)
+            fprintf(f, "null");
+        else
+            fprintf(f, "%.0f", counters[c]);
+    }
+    fprintf(f, "},\n");
+    std::vector<int> nodes;
+    for (int i = 0; i < cfg.nthreads; ++i)
+        if (results[i].node >= 0 && std::find(nodes.begin(), nodes.end(), results[i].node) == nodes.end())
+            nodes.push_back(results[i].node);
+    fprintf(f, "  \"nodes_used\": %zu,\n", nodes.size());
+    fprintf(f, "  \"threads\": [\n");
+    for (int i = 0; i < cfg.nthreads; ++i) {
+        auto& r = results[i];
+        fprintf(f, "    {\"cpu\": %d, \"node\": %d, \"commits\": %llu, \"aborts\": %llu, \"seconds\": %.6f}%s\n",
+                r.cpu, r.node, (unsigned long long) r.commits, (unsigned long long) (r.attempts - r.commits),
+                r.seconds, i + 1 < cfg.nthreads ? "," : "");
+    }
+    fprintf(f, "  ]\n}");
+
+    fprintf(stderr, "%s: %llu commits, %llu aborts in %.3f sec, %.0f txns/sec, p99 %.1f us",
+            cfg.ds.c_str(), (unsigned long long) total.commits, (unsigned long long) aborts,
+            seconds, total.commits / seconds, total.latency.percentile(99) / 1000.);
+    if (counters[PerfCounters::cycles] > 0 && counters[PerfCounters::instructions] >= 0)
+        fprintf(stderr, ", IPC %.2f", counters[PerfCounters::instructions] / counters[PerfCounters::cycles]);
+    fprintf(stderr, "\n");
+}
+
+// One run at the given open-loop rate (0 for closed loop). Returns its
+// length in seconds; per-thread results are in results[].
+double run(double rate) {
+    for (int i = 0; i < cfg.nthreads; ++i)
+        results[i] = thread_result();
+    offered_rate = rate;
+    nready = 0;
+    go = stop = false;
+
+    // opened before the workers exist so they inherit the counters
+    PerfCounters perf;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < cfg.nthreads; ++i)
+        threads.emplace_back(worker, i);
+    while (nready != cfg.nthreads)
+        usleep(1000);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t trace_start = EventTrace::now();
+    perf.start();
+    go = true;
+    if (!cfg.ntxns) {
+        if (checkpoint) {
+            usleep(cfg.duration * 500000);
+            if (!checkpoint->write(redo_log)) {
+                perror(cfg.checkpoint_dir.c_str());
+                exit(1);
+            }
+            double left = cfg.duration - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (left > 0)
+                usleep(left * 1000000);
+        } else
+            usleep(cfg.duration * 1000000);
+        stop = true;
+    }
+    for (auto& t : threads)
+        t.join();
+    perf.stop();
+    // thread 0's ring is free once the workers are done
+    if (trace)
+        trace->record(0, trace_run, trace_ok, trace_no_abort, trace_start);
+    for (int c = 0; c < PerfCounters::ncounters; ++c)
+        counters[c] = perf.value(c);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Replay --replay's schedule instead of running the workload. Results and
+// the trace cover the events recorded in [--replay-from, --replay-to);
+// latencies add up a transaction's events, leaving out time spent waiting
+// for other threads' turns. Returns the replay's length in seconds.
+static double run_replay() {
+    for (int i = 0; i < cfg.nthreads; ++i)
+        results[i] = thread_result();
+    struct txn_state {
+        uint64_t ns = 0;            // this transaction's events so far
+        uint64_t attempt_ns = 0;
+        int type = -1;
+    };
+    std::vector<txn_state> txns(cfg.nthreads);
+    auto in_window = [](const schedule_event& e) {
+        double t = e.ns / 1e9;
+        return t >= cfg.replay_from && (!cfg.replay_to || t < cfg.replay_to);
+    };
+    auto start = std::chrono::steady_clock::now();
+    replay->run([](int t) {
+            TThread::set_id(t);
+            Sto::update_threadid();
+            Sto::rehome_thread();
+            idx->thread_init(t);
+        }, [&](const schedule_event& e) {
+            bench_op op = {e.kind, e.kind == kind_scan ? unsigned(e.value) : 1, e.key};
+            uint64_t op_start = EventTrace::now();
+            bool hit = run_op(op, e.value);
+            if (in_window(e)) {
+                auto& r = results[e.thread];
+                ++r.ops[e.kind];
+                r.hits[e.kind] += hit;
+                if (trace)
+                    trace->record(e.thread, e.kind, hit ? trace_ok : trace_miss, trace_no_abort, op_start, EventTrace::hash(e.key));
+            }
+            return hit;
+        }, [&](const schedule_event& e, bool ok, uint64_t ns) {
+            txn_state& x = txns[e.thread];
+            thread_result& r = results[e.thread];
+            x.ns += ns;
+            x.attempt_ns += ns;
+            if (e.type == sched_start) {
+                x.attempt_ns = ns;
+                r.attempts += in_window(e);
+            } else if (e.type == sched_op)
+                x.type = x.type < 0 || x.type == e.kind ? int(e.kind) : int(nkinds);
+            else if (in_window(e)) {
+                if (trace)
+                    trace->record(e.thread, trace_txn, ok ? trace_ok : trace_abort,
+                                  ok ? trace_no_abort : e.type == sched_commit ? trace_commit_abort : trace_exec_abort,
+                                  EventTrace::now() - uint64_t(x.attempt_ns * trace->ticks_per_ns()));
+                if (ok) {
+                    ++r.commits;
+                    r.latency.record(x.ns);
+                    r.type_latency[x.type < 0 ? nkinds : x.type].record(x.ns);
+                    r.service.record(x.ns);
+                }
+            }
+            // the recorded transaction is over, even if its replay failed
+            if (e.type == sched_commit && e.outcome)
+                x = txn_state();
+        });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (int i = 0; i < cfg.nthreads; ++i)
+        results[i].seconds = seconds;
+    return seconds;
+}
+
+// Serve the index to loadgen clients for --duration seconds instead of
+// running the workload, checkpointing halfway like run().
+static void serve(FILE* f) {
+    RequestServer server(*idx, cfg.nthreads, cpus, cfg.batch);
+    if (!server.start(cfg.serve)) {
+        perror(cfg.serve.c_str());
+        exit(1);
+    }
+    fprintf(stderr, "serving %s on %s with %d workers\n", cfg.ds.c_str(), cfg.serve.c_str(), cfg.nthreads);
+    auto start = std::chrono::steady_clock::now();
+    if (checkpoint) {
+        usleep(cfg.duration * 500000);
+        if (!checkpoint->write(redo_log)) {
+            perror(cfg.checkpoint_dir.c_str());
+            exit(1);
+        }
+    }
+    double left = cfg.duration - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (left > 0)
+        usleep(left * 1000000);
+    server.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (redo_log) {
+        redo_log->stop();
+        log_bytes = redo_log->bytes();
+        log_durable_epoch = redo_log->durable_epoch();
+    }
+    uint64_t requests = server.requests(), batches = server.batches();
+    fprintf(f, "{\n");
+    print_config(f);
+    fprintf(f, "  \"serve\": {\"socket\": \"%s\", \"batch\": %u, \"seconds\": %.6f, \"requests\": %llu, \"transactions\": %llu,\n"
+            "    \"requests_per_sec\": %.1f, \"mean_batch\": %.2f}",
+            cfg.serve.c_str(), cfg.batch, seconds, (unsigned long long) requests, (unsigned long long) batches,
+            requests / seconds, batches ? double(requests) / batches : 0.0);
+    if (redo_log)
+        fprintf(f, ",\n  \"log\": {\"loggers\": %d, \"bytes\": %llu, \"mb_per_sec\": %.1f, \"durable_epoch\": %llu}",
+                cfg.loggers, (unsigned long long) log_bytes, log_bytes / seconds / 1e6,
+                (unsigned long long) log_durable_epoch);
+    fprintf(f, "\n}");
+    fprintf(stderr, "%s: served %llu requests in %llu transactions in %.3f sec, %.0f requests/sec\n",
+            cfg.ds.c_str(), (unsigned long long) requests, (unsigned long long) batches, seconds, requests / seconds);
+}
+
+
+
+
+enum {
+    opt_ds = 1, opt_workload, opt_read, opt_update, opt_insert, opt_remove, opt_scan, opt_rmw, opt_dist,
+    opt_skew, opt_scan_length, opt_keys, opt_prepopulate, opt_nthreads, opt_duration, opt_ntxns, opt_txn_size, opt_pin,
+    opt_interleave, opt_load_threads,
+    opt_rate, opt_arrival, opt_sla_p99, opt_seed, opt_repeat, opt_json, opt_csv, opt_baseline, opt_regress_pct,
+    opt_trace, opt_metrics, opt_metrics_socket, opt_metrics_interval, opt_log_dir, opt_loggers,
+    opt_checkpoint, opt_checkpoint_threads, opt_recover, opt_serve, opt_batch, opt_record, opt_replay,
+    opt_replay_from, opt_replay_to, opt_admission, opt_admission_target,
+    opt_route, opt_prefetch, opt_knobs, opt_tune, opt_tune_seconds,
+    opt_help
+};
+
+static const Clp_Option options[] = {
+    { "ds", 0, opt_ds, Clp_ValString, 0 },
+    { "workload", 'w', opt_workload, Clp_ValString, 0 },
+    { "read", 0, opt_read, Clp_ValDouble, 0 },
+    { "update", 0, opt_update, Clp_ValDouble, 0 },
+    { "insert", 0, opt_insert, Clp_ValDouble, 0 },
+    { "remove", 0, opt_remove, Clp_ValDouble, 0 },
+    { "scan", 0, opt_scan, Clp_ValDouble, 0 },
+    { "rmw", 0, opt_rmw, Clp_ValDouble, 0 },
+    { "dist", 0, opt_dist, Clp_ValString, 0 },
+    { "skew", 0, opt_skew, Clp_ValString, 0 },
+    { "scan-length", 0, opt_scan_length, Clp_ValUnsigned, 0 },
+    { "keys", 'k', opt_keys, Clp_ValUnsignedLong, 0 },
+    { "prepopulate", 0, opt_prepopulate, Clp_ValLong, 0 },
+    { "nthreads", 'j', opt_nthreads, Clp_ValString, 0 },
+    { "duration", 'd', opt_duration, Clp_ValDouble, 0 },
+    { "ntxns", 0, opt_ntxns, Clp_ValUnsignedLong, 0 },
+    { "txn-size", 0, opt_txn_size, Clp_ValString, 0 },
+    { "pin", 0, opt_pin, Clp_ValString, 0 },
+    { "interleave", 0, opt_interleave, 0, Clp_Negate },
+    { "load-threads", 0, opt_load_threads, Clp_ValInt, 0 },
+    { "rate", 0, opt_rate, Clp_ValDouble, 0 },
+    { "arrival", 0, opt_arrival, Clp_ValString, 0 },
+    { "sla-p99", 0, opt_sla_p99, Clp_ValDouble, 0 },
+    { "seed", 's', opt_seed, Clp_ValUnsigned, 0 },
+    { "repeat", 0, opt_repeat, Clp_ValInt, 0 },
+    { "json", 0, opt_json, Clp_ValString, 0 },
+    { "csv", 0, opt_csv, Clp_ValString, 0 },
+    { "baseline", 0, opt_baseline, Clp_ValString, 0 },
+    { "regress-pct", 0, opt_regress_pct, Clp_ValDouble, 0 },
+    { "trace", 0, opt_trace, Clp_ValString, 0 },
+    { "metrics", 0, opt_metrics, Clp_ValString, 0 },
+    { "metrics-socket", 0, opt_metrics_socket, Clp_ValString, 0 },
+    { "metrics-interval", 0, opt_metrics_interval, Clp_ValDouble, 0 },
+    { "log-dir", 0, opt_log_dir, Clp_ValString, 0 },
+    { "loggers", 0, opt_loggers, Clp_ValInt, 0 },
+    { "checkpoint", 0, opt_checkpoint, Clp_ValString, 0 },
+    { "checkpoint-threads", 0, opt_checkpoint_threads, Clp_ValInt, 0 },
+    { "recover", 0, opt_recover, 0, Clp_Negate },
+    { "serve", 0, opt_serve, Clp_ValString, 0 },
+    { "batch", 0, opt_batch, Clp_ValUnsigned, 0 },
+    { "record", 0, opt_record, Clp_ValString, 0 },
+    { "replay", 0, opt_replay, Clp_ValString, 0 },
+    { "replay-from", 0, opt_replay_from, Clp_ValDouble, 0 },
+    { "replay-to", 0, opt_replay_to, Clp_ValDouble, 0 },
+    { "admission", 0, opt_admission, 0, Clp_Negate },
+    { "admission-target", 0, opt_admission_target, Clp_ValDouble, 0 },
+    { "route", 0, opt_route, Clp_ValString, 0 },
+    { "prefetch", 0, opt_prefetch, Clp_ValUnsigned, Clp_Optional | Clp_Negate },
+    { "knobs", 0, opt_knobs, Clp_ValString, 0 },
+    { "tune", 0, opt_tune, Clp_ValString, 0 },
+    { "tune-seconds", 0, opt_tune_seconds, Clp_ValDouble, 0 },
+    { "help", 'h', opt_help, 0, 0 }
+};
+
+// "A,B,C" into {A, B, C}
+template <typename T>
+static bool parse_list(const char* str, std::vector<T>& out) {
+    out.clear();
+    std::istringstream in(str);
+    std::string part;
+    while (std::getline(in, part, ',')) {
+        std::istringstream p(part);
+        T x;
+        if (!(p >> x) || !p.eof())
+            return false;
+        out.push_back(x);
+    }
+    return !out.empty();
+}
+
+static void help(const char* name) {
+    printf("Usage: %s [OPTIONS]\n\
+Options:\n\
+ --ds=NAME, index to run (default %s)\n\
+ -w, --workload=NAME, operation mix preset (default %s)\n\
+ --read=PCT, --update=PCT, --insert=PCT, --remove=PCT, --scan=PCT, --rmw=PCT,\n\
+   override the preset's operation mix\n\
+ --dist=DIST, key distribution: uniform, zipf, scrambled-zipf, latest, or hotspot\n\
+   (20%% of keys get 80%% of requests) (default: the preset's)\n\
+ --skew=SKEW, zipf skew (default %g)\n\
+ --scan-length=N, scans read up to N keys (default %u)\n\
+ -k, --keys=N, size of the key space (default %llu)\n\
+ --prepopulate=N, load keys 0..N-1 before the run (default: every key)\n\
+ --load-threads=N, load from N threads, placed by --pin, if the index allows\n\
+   concurrent loads (default: one per CPU)\n\
+ -j, --nthreads=N (default %d)\n\
+ -d, --duration=SEC, run for SEC seconds (default %g)\n\
+ --ntxns=N, instead commit N transactions, split between threads\n\
+ --txn-size=N, operations per transaction (default %d)\n\
+ --pin=POLICY, thread placement (default %s): none; compact (fill NUMA node 0's\n\
+   CPUs first, then node 1's, ...); scatter (round-robin over nodes); node:N\n\
+   (node N's CPUs only); or a CPU list like 0,4,8-11\n\
+ --interleave, interleave the index's memory over all NUMA nodes (default:\n\
+   pages go to the node of the loading thread)\n\
+ --rate=TPS, open loop: transactions arrive at TPS per second in total, and\n\
+   latency counts from the scheduled arrival (default: closed loop)\n\
+ --arrival=poisson|constant, open-loop interarrival times (default %s)\n\
+ --sla-p99=US, find the highest open-loop rate whose p99 latency is at most\n\
+   US microseconds, starting from --rate (default 10000); each trial runs\n\
+   for --duration\n\
+ -s, --seed=SEED (default: random)\n\
+ --json=FILE, write results to FILE (default: stdout)\n\
+\n\
+--ds, --nthreads, --txn-size and --skew take comma-separated lists; every\n\
+combination is run, and results are a JSON array.\n\
+ --repeat=N, run each combination N times, with seeds SEED..SEED+N-1\n\
+ --csv=FILE, append a row per run to FILE (created with a header)\n\
+ --baseline=FILE, compare throughput with the runs in CSV FILE and exit\n\
+   with status 2 if any combination regressed\n\
+ --regress-pct=PCT, a regression is a significant drop of more than PCT%% (default %g)\n\
+ --trace=FILE, log every operation and transaction attempt to FILE; read it\n\
+   with trace_report\n\
+ --metrics=FILE, keep live Prometheus-format counters and rates in FILE\n\
+ --metrics-socket=PATH, serve the same on a Unix socket (text or HTTP)\n\
+ --metrics-interval=SEC, sampling interval (default 1)\n\
+ --log-dir=DIR, redo-log the run's commits to DIR (loading isn't logged)\n\
+ --loggers=N, logger threads and log files (default 1)\n\
+ --checkpoint=DIR, write a checkpoint to DIR halfway through the run\n\
+ --checkpoint-threads=N, checkpoint writer threads (default 1)\n\
+ --recover, instead of loading, recover the index from --checkpoint's DIR and\n\
+   --log-dir's DIR on --load-threads threads, then checkpoint it afresh\n\
+ --serve=PATH, instead of running the workload, serve the index on Unix socket\n\
+   PATH to loadgen clients for --duration, on --nthreads workers placed by --pin\n\
+ --batch=N, requests per served transaction, at most (default %u)\n\
+ --record=FILE, record the run's transaction schedule to FILE: attempts,\n\
+   operations, outcomes and commit lock order (keep the run short)\n\
+ --replay=FILE, instead of running the workload, replay schedule FILE one\n\
+   event at a time on the recorded thread ids; load options must match the\n\
+   recording's\n\
+ --replay-from=SEC, --replay-to=SEC, report and trace only the events\n\
+   recorded in this window of the recording\n\
+ --admission, limit the transactions running at once, adjusting the limit to\n\
+   keep the abort rate near --admission-target (AdmissionControl.hh)\n\
+ --admission-target=PCT, abort rate above which the limit halves (default %g)\n\
+ --route=POLICY, queue each transaction for the thread owning its first key's\n\
+   partition, stealing from long queues when idle (AffinityScheduler.hh): hash,\n\
+   range, or random for comparison (default: each thread runs its own)\n\
+ --prefetch[=N], choose N transactions at once (default 8) and prefetch the\n\
+   index memory all their keys will touch, stage by stage, before running them\n\
+   in turn (indexes that support it)\n\
+ --knobs=FILE, set STO's tuning knobs from profile FILE (StoKnobs.hh); needs a\n\
+   build with RUNTIME_KNOBS=1\n\
+ --tune=FILE, instead of running the workload, search for the knobs that give\n\
+   it the highest throughput, starting from --knobs, and write them to FILE\n\
+ --tune-seconds=SEC, length of each tuning trial (default %g)\n",
+           name, cfg.ds.c_str(), cfg.workload.c_str(), cfg.skew, cfg.scan_length,
+           (unsigned long long) cfg.nkeys, cfg.nthreads, cfg.duration, cfg.txn_size, cfg.pin.c_str(),
+           cfg.arrival.c_str(), cfg.regress_pct, cfg.batch, cfg.admission_target, cfg.tune_seconds);
+    printf("\nIndexes:\n");
+    for (auto& f : BenchIndex::factories())
+        printf(" %-12s %s\n", f.name, f.desc);
+    printf("\nWorkloads (read/update/insert/remove/scan/rmw %%, distribution):\n");
+    for (auto& w : workload_presets)
+        printf(" %-14s %g/%g/%g/%g/%g/%g %s%s\n", w.name, w.pct[0], w.pct[1], w.pct[2], w.pct[3],
+               w.pct[4], w.pct[5], w.dist, w.append ? ", appending inserts" : "");
+    exit(1);
+}
+
+// Load a fresh index and run the current combination.
+void run_one(FILE* f, throughput_map& measured, std::vector<std::string>& keys) {
+    if (!parse_pin(cfg.pin, cfg.nthreads, cpus)) {
+        fprintf(stderr, "bad --pin %s\n", cfg.pin.c_str());
+        exit(1);
+    }
+    // the index is shared by every thread, so spread it over all nodes
+    std::unique_ptr<NumaTopology::interleave_guard> interleave;
+    if (cfg.interleave && !(interleave.reset(new NumaTopology::interleave_guard), interleave->ok()))
+        fprintf(stderr, "cannot interleave memory, using the default policy\n");
+    idx = BenchIndex::make(cfg.ds, cfg.nkeys);
+    for (int k = 0; k < nkinds; ++k)
+        if (cfg.pct[k] > 0 && (idx->ops() & kind_ops[k]) != kind_ops[k]) {
+            fprintf(stderr, "%s does not support %s operations\n", cfg.ds.c_str(), kind_names[k]);
+            exit(1);
+        }
+
+    // keys are big-endian integers, so ranges of keys are ranges of key space
+    load_threads = idx->concurrent_load() ? cfg.load_threads : 1;
+    std::vector<int> load_cpus;
+    parse_pin(cfg.pin, load_threads, load_cpus);
+    ParallelLoader loader(load_threads, load_cpus);
+    loader.partition_range(cfg.prepopulate);
+    uint64_t trace_start = EventTrace::now();
+    std::unique_ptr<Recovery> rec;
+    if (cfg.recover) {
+        rec.reset(new Recovery(cfg.checkpoint_dir, cfg.log_dir, load_threads));
+        if (!idx->add_to_recovery(*rec)) {
+            fprintf(stderr, "%s does not support recovery\n", cfg.ds.c_str());
+            exit(1);
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        if (!rec->run()) {
+            fprintf(stderr, "cannot recover from %s and %s\n", cfg.checkpoint_dir.c_str(), cfg.log_dir.c_str());
+            exit(1);
+        }
+        // time to first query: recovery plus one read transaction
+        TThread::set_id(0);
+        idx->thread_init(0);
+        TRANSACTION {
+            uint64_t value;
+            idx->read(0, value);
+        } RETRY(true);
+        first_query_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        load_seconds = rec->seconds();
+        fprintf(stderr, "recovered %llu checkpoint entries and %llu log records in %.3f sec (%d threads), first query after %.3f sec\n",
+                (unsigned long long) rec->records(), (unsigned long long) rec->log_records(), load_seconds,
+                load_threads, first_query_seconds);
+    } else {
+        load_seconds = loader.run([](int t) {
+                TThread::set_id(t);
+                idx->thread_init(t);
+            }, [](int, uint64_t i) {
+                idx->load(i, i);
+            });
+        fprintf(stderr, "loaded %lld keys in %.3f sec (%.0f keys/sec, %d threads)\n", (long long) cfg.prepopulate,
+                load_seconds, cfg.prepopulate / load_seconds, load_threads);
+    }
+    recovery = rec.get();
+    if (trace)
+        trace->record(0, trace_load, trace_ok, trace_no_abort, trace_start);
+    next_key = cfg.prepopulate;
+    interleave.reset();
+
+    std::unique_ptr<Checkpoint> ckpt;
+    if (!cfg.checkpoint_dir.empty()) {
+        ckpt.reset(new Checkpoint(cfg.checkpoint_dir, cfg.checkpoint_threads));
+        if (!idx->add_to_checkpoint(*ckpt)) {
+            fprintf(stderr, "%s does not support checkpoints\n", cfg.ds.c_str());
+            exit(1);
+        }
+        // restarting the log deletes the one just recovered from
+        if (rec && !ckpt->write()) {
+            perror(cfg.checkpoint_dir.c_str());
+            exit(1);
+        }
+    }
+    checkpoint = ckpt.get();
+
+    std::unique_ptr<RedoLog> log;
+    if (!cfg.log_dir.empty()) {
+        log.reset(new RedoLog(cfg.log_dir, cfg.loggers));
+        if (!idx->log_object() || !log->register_object(*idx->log_object(), 0)) {
+            fprintf(stderr, "%s does not support logging\n", cfg.ds.c_str());
+            exit(1);
+        }
+        if (!log->start()) {
+            perror(cfg.log_dir.c_str());
+            exit(1);
+        }
+    }
+    redo_log = log.get();
+
+    std::unique_ptr<TxnSchedule> sched;
+    if (!cfg.record.empty()) {
+        sched.reset(new TxnSchedule(cfg.nthreads));
+        sched->start();
+    }
+    schedule = sched.get();
+
+    std::unique_ptr<AdmissionGate> gate;
+    if (cfg.admission) {
+        AdmissionGate::params p;
+        p.target_abort_ratio = cfg.admission_target / 100;
+        p.max_limit = p.initial_limit = cfg.nthreads;
+        gate.reset(new AdmissionGate(p));
+        gate->start();
+    }
+    admission = gate.get();
+
+    std::unique_ptr<AffinityScheduler<routed_txn>> sched_router;
+    if (!cfg.route.empty()) {
+        AffinityScheduler<routed_txn>::params p;
+        p.policy = cfg.route == "range" ? affinity_range : cfg.route == "random" ? affinity_random : affinity_hash;
+        p.nkeys = cfg.nkeys;
+        p.seed = cfg.seed;
+        sched_router.reset(new AffinityScheduler<routed_txn>(cfg.nthreads, p));
+    }
+    router = sched_router.get();
+
+    if (!cfg.serve.empty()) {
+        serve(f);
+        redo_log = nullptr;
+        checkpoint = nullptr;
+        recovery = nullptr;
+        admission = nullptr;
+        router = nullptr;
+    } else if (cfg.sla_p99) {
+        sweep(f);
+        admission = nullptr;
+    } else if (!cfg.tune.empty()) {
+        tune(f);
+        admission = nullptr;
+        router = nullptr;
+        redo_log = nullptr;
+    } else {
+        double seconds = replay ? run_replay() : run(cfg.rate);
+        if (gate)
+            gate->stop();
+        if (sched) {
+            sched->stop();
+            if (!sched->write(cfg.record, cfg.ds, cfg.nkeys, cfg.prepopulate)) {
+                perror(cfg.record.c_str());
+                exit(1);
+            }
+        }
+        if (log) {
+            log->stop();
+            log_bytes = log->bytes();
+            log_durable_epoch = log->durable_epoch();
+        }
+        report(f, seconds);
+        schedule = nullptr;
+        admission = nullptr;
+        router = nullptr;
+        redo_log = nullptr;
+        checkpoint = nullptr;
+        recovery = nullptr;
+        if (!cfg.csv.empty())
+            write_csv(seconds);
+        std::string key = csv_key();
+        if (!measured.count(key))
+            keys.push_back(key);
+        measured[key].push_back(totals().commits / seconds);
+    }
+    delete idx;
+    idx = nullptr;
+}
+
+int main(int argc, char* argv[]) {
+    bench_matrix matrix;
+    Clp_Parser* clp = Clp_NewParser(argc, argv, sizeof(options) / sizeof(options[0]), options);
+    int opt;
+    bool ok = true;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_ds:
+            ok = ok && parse_list(clp->vstr, matrix.ds);
+            break;
+        case opt_workload:
+            cfg.workload = clp->vstr;
+            break;
+        case opt_read:
+        case opt_update:
+        case opt_insert:
+        case opt_remove:
+        case opt_scan:
+        case opt_rmw:
+            cfg.pct[opt - opt_read] = clp->val.d;
+            break;
+        case opt_dist:
+            cfg.dist = clp->vstr;
+            break;
+        case opt_skew:
+            ok = ok && parse_list(clp->vstr, matrix.skew);
+            break;
+        case opt_scan_length:
+            cfg.scan_length = clp->val.u;
+            break;
+        case opt_keys:
+            cfg.nkeys = clp->val.ul;
+            break;
+        case opt_prepopulate:
+            cfg.prepopulate = clp->val.l;
+            break;
+        case opt_nthreads:
+            ok = ok && parse_list(clp->vstr, matrix.nthreads);
+            break;
+        case opt_duration:
+            cfg.duration = clp->val.d;
+            break;
+        case opt_ntxns:
+            cfg.ntxns = clp->val.ul;
+            break;
+        case opt_txn_size:
+            ok = ok && parse_list(clp->vstr, matrix.txn_size);
+            break;
+        case opt_pin:
+            cfg.pin = clp->vstr;
+            break;
+        case opt_interleave:
+            cfg.interleave = !clp->negated;
+            break;
+        case opt_load_threads:
+            cfg.load_threads = clp->val.i;
+            break;
+        case opt_rate:
+            cfg.rate = clp->val.d;
+            break;
+        case opt_arrival:
+            cfg.arrival = clp->vstr;
+            break;
+        case opt_sla_p99:
+            cfg.sla_p99 = clp->val.d;
+            break;
+        case opt_seed:
+            cfg.seed = clp->val.u;
+            break;
+        case opt_repeat:
+            cfg.repeat = clp->val.i;
+            break;
+        case opt_json:
+            cfg.json = clp->vstr;
+            break;
+        case opt_csv:
+            cfg.csv = clp->vstr;
+            break;
+        case opt_baseline:
+            cfg.baseline = clp->vstr;
+            break;
+        case opt_trace:
+            cfg.trace = clp->vstr;
+            break;
+        case opt_metrics:
+            cfg.metrics = clp->vstr;
+            break;
+        case opt_metrics_socket:
+            cfg.metrics_socket = clp->vstr;
+            break;
+        case opt_metrics_interval:
+            cfg.metrics_interval = clp->val.d;
+            break;
+        case opt_log_dir:
+            cfg.log_dir = clp->vstr;
+            break;
+        case opt_loggers:
+            cfg.loggers = clp->val.i;
+            break;
+        case opt_checkpoint:
+            cfg.checkpoint_dir = clp->vstr;
+            break;
+        case opt_checkpoint_threads:
+            cfg.checkpoint_threads = clp->val.i;
+            break;
+        case opt_recover:
+            cfg.recover = !clp->negated;
+            break;
+        case opt_serve:
+            cfg.serve = clp->vstr;
+            break;
+        case opt_batch:
+            cfg.batch = clp->val.u;
+            break;
+        case opt_record:
+            cfg.record = clp->vstr;
+            break;
+        case opt_replay:
+            cfg.replay = clp->vstr;
+            break;
+        case opt_replay_from:
+            cfg.replay_from = clp->val.d;
+            break;
+        case opt_replay_to:
+            cfg.replay_to = clp->val.d;
+            break;
+        case opt_admission:
+            cfg.admission = !clp->negated;
+            break;
+        case opt_admission_target:
+            cfg.admission_target = clp->val.d;
+            break;
+        case opt_route:
+            cfg.route = clp->vstr;
+            break;
+        case opt_prefetch:
+            cfg.prefetch = clp->negated ? 0 : clp->have_val ? clp->val.u : 8;
+            break;
+        case opt_knobs:
+            cfg.knobs = clp->vstr;
+            break;
+        case opt_tune:
+            cfg.tune = clp->vstr;
+            break;
+        case opt_tune_seconds:
+            cfg.tune_seconds = clp->val.d;
+            break;
+        case opt_regress_pct:
+            cfg.regress_pct = clp->val.d;
+            break;
+        default:
+            help(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (!ok) {
+        fprintf(stderr, "bad list in --ds, --nthreads, --txn-size or --skew\n");
+        help(argv[0]);
+    }
+    if (matrix.ds.empty())
+        matrix.ds.push_back(cfg.ds);
+    if (matrix.nthreads.empty())
+        matrix.nthreads.push_back(cfg.nthreads);
+    if (matrix.txn_size.empty())
+        matrix.txn_size.push_back(cfg.txn_size);
+    if (matrix.skew.empty())
+        matrix.skew.push_back(cfg.skew);
+
+    const workload_preset* preset = nullptr;
+    for (auto& w : workload_presets)
+        if (cfg.workload == w.name)
+            preset = &w;
+    if (!preset) {
+        fprintf(stderr, "unknown workload %s\n", cfg.workload.c_str());
+        help(argv[0]);
+    }
+    if (cfg.dist.empty())
+        cfg.dist = preset->dist;
+    cfg.append = preset->append;
+    double sum = 0;
+    for (int k = 0; k < nkinds; ++k) {
+        if (cfg.pct[k] < 0)
+            cfg.pct[k] = preset->pct[k];
+        sum += cfg.pct[k];
+    }
+    if (sum <= 0) {
+        fprintf(stderr, "the operation mix is empty\n");
+        exit(1);
+    }
+    for (int k = 0; k < nkinds; ++k)
+        cfg.pct[k] *= 100 / sum;
+    for (int n : matrix.nthreads) {
+        if (n < 1 || n > MAX_THREADS) {
+            fprintf(stderr, "asked for %d threads but MAX_THREADS is %d\n", n, MAX_THREADS);
+            exit(1);
+        }
+        if (!parse_pin(cfg.pin, n, cpus)) {
+            fprintf(stderr, "bad --pin %s\n", cfg.pin.c_str());
+            exit(1);
+        }
+    }
+    if (cfg.nkeys < 2 || *std::min_element(matrix.txn_size.begin(), matrix.txn_size.end()) < 1
+        || cfg.scan_length < 1
+        || (cfg.dist != "uniform" && cfg.dist != "zipf" && cfg.dist != "scrambled-zipf"
+            && cfg.dist != "latest" && cfg.dist != "hotspot")) {
+        fprintf(stderr, "bad --keys, --txn-size, --scan-length or --dist\n");
+        help(argv[0]);
+    }
+    if (cfg.rate < 0 || cfg.sla_p99 < 0 || (cfg.arrival != "poisson" && cfg.arrival != "constant")) {
+        fprintf(stderr, "bad --rate, --sla-p99 or --arrival\n");
+        help(argv[0]);
+    }
+    if (cfg.sla_p99 && cfg.ntxns) {
+        fprintf(stderr, "--sla-p99 runs by --duration, not --ntxns\n");
+        exit(1);
+    }
+    if (!cfg.route.empty() && cfg.route != "hash" && cfg.route != "range" && cfg.route != "random") {
+        fprintf(stderr, "bad --route\n");
+        help(argv[0]);
+    }
+    // a routed thread commits other threads' transactions, so it has no quota
+    if (!cfg.route.empty() && (cfg.ntxns || cfg.rate || cfg.sla_p99 || !cfg.replay.empty())) {
+        fprintf(stderr, "--route runs closed loop by --duration, without --ntxns, --rate, --sla-p99 or --replay\n");
+        exit(1);
+    }
+    if (cfg.loggers < 1 || cfg.loggers > MAX_THREADS) {
+        fprintf(stderr, "bad --loggers\n");
+        help(argv[0]);
+    }
+    if (!cfg.checkpoint_dir.empty()) {
+        if (cfg.checkpoint_threads < 1
+            || cfg.checkpoint_threads + *std::max_element(matrix.nthreads.begin(), matrix.nthreads.end()) > MAX_THREADS) {
+            fprintf(stderr, "checkpoint threads and workers need distinct ids below MAX_THREADS (%d)\n", MAX_THREADS);
+            exit(1);
+        }
+        if (cfg.ntxns || cfg.sla_p99) {
+            fprintf(stderr, "--checkpoint runs by --duration, without --sla-p99\n");
+            exit(1);
+        }
+    }
+    if (!cfg.serve.empty() && (cfg.ntxns || cfg.sla_p99 || cfg.rate || !cfg.trace.empty()
+                               || !cfg.csv.empty() || !cfg.baseline.empty() || cfg.batch < 1)) {
+        fprintf(stderr, "--serve runs by --duration, without --ntxns, --sla-p99, --rate, --trace, --csv or --baseline\n");
+        exit(1);
+    }
+    // the restarted log deletes the old one, so it must be checkpointed
+    if (cfg.recover && cfg.checkpoint_dir.empty()) {
+        fprintf(stderr, "--recover needs --checkpoint\n");
+        exit(1);
+    }
+    if (cfg.repeat < 1) {
+        fprintf(stderr, "bad --repeat\n");
+        help(argv[0]);
+    }
+    if (cfg.sla_p99 && (!cfg.csv.empty() || !cfg.baseline.empty())) {
+        fprintf(stderr, "--csv and --baseline record runs, not --sla-p99 sweeps\n");
+        exit(1);
+    }
+    if ((!cfg.knobs.empty() || !cfg.tune.empty()) && !STO_RUNTIME_KNOBS) {
+        fprintf(stderr, "--knobs and --tune need a build with RUNTIME_KNOBS=1\n");
+        exit(1);
+    }
+    if (!cfg.knobs.empty()) {
+        sto_knobs k = StoKnobs::current();
+        std::string error;
+        if (!StoKnobs::read(cfg.knobs, k, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            exit(1);
+        }
+        StoKnobs::apply(k);
+    }
+    if (!cfg.tune.empty()
+        && (matrix.ds.size() * matrix.nthreads.size() * matrix.txn_size.size() * matrix.skew.size() > 1
+            || cfg.repeat > 1 || cfg.ntxns || cfg.rate || cfg.sla_p99 || !cfg.serve.empty() || !cfg.replay.empty()
+            || !cfg.record.empty() || !cfg.checkpoint_dir.empty() || !cfg.csv.empty() || !cfg.baseline.empty()
+            || !(cfg.tune_seconds > 0))) {
+        fprintf(stderr, "--tune covers one closed-loop workload by --tune-seconds, without --ntxns, --rate,\n"
+                "--sla-p99, --serve, --replay, --record, --checkpoint, --csv or --baseline\n");
+        exit(1);
+    }
+    for (auto& ds : matrix.ds)
+        if (std::none_of(BenchIndex::factories().begin(), BenchIndex::factories().end(),
+                         [&](const BenchIndex::factory& f) { return ds == f.name; })) {
+            fprintf(stderr, "unknown index %s\n", ds.c_str());
+            help(argv[0]);
+        }
+    throughput_map baseline;
+    if (!cfg.baseline.empty() && !read_baseline(cfg.baseline, baseline)) {
+        fprintf(stderr, "%s: cannot read baseline CSV\n", cfg.baseline.c_str());
+        exit(1);
+    }
+    if (cfg.load_threads <= 0)
+        cfg.load_threads = std::min(std::max(int(std::thread::hardware_concurrency()), 1), MAX_THREADS);
+    if (cfg.load_threads > MAX_THREADS) {
+        fprintf(stderr, "asked for %d load threads but MAX_THREADS is %d\n", cfg.load_threads, MAX_THREADS);
+        exit(1);
+    }
+    if (cfg.prepopulate < 0 || uint64_t(cfg.prepopulate) > cfg.nkeys)
+        cfg.prepopulate = cfg.nkeys;
+    if ((!cfg.record.empty() || !cfg.replay.empty())
+        && (matrix.ds.size() * matrix.nthreads.size() * matrix.txn_size.size() * matrix.skew.size() > 1
+            || cfg.repeat > 1 || cfg.sla_p99 || !cfg.serve.empty() || (!cfg.record.empty() && !cfg.replay.empty()))) {
+        fprintf(stderr, "--record and --replay cover one run, without --sla-p99 or --serve\n");
+        exit(1);
+    }
+    std::unique_ptr<TxnReplay> replayer;
+    if (!cfg.replay.empty()) {
+        if (cfg.ntxns || cfg.rate || !cfg.csv.empty() || !cfg.baseline.empty() || !cfg.checkpoint_dir.empty()
+            || cfg.admission) {
+            fprintf(stderr, "--replay runs without --ntxns, --rate, --csv, --baseline, --checkpoint or --admission\n");
+            exit(1);
+        }
+        replayer.reset(new TxnReplay);
+        if (!replayer->open(cfg.replay)) {
+            fprintf(stderr, "%s: cannot read schedule\n", cfg.replay.c_str());
+            exit(1);
+        }
+        // the replay must start from the recorded run's loaded index
+        const schedule_header& h = replayer->header();
+        if (matrix.ds[0] != h.ds || cfg.nkeys != h.nkeys || uint64_t(cfg.prepopulate) != h.prepopulate) {
+            fprintf(stderr, "%s was recorded with --ds=%s --keys=%llu --prepopulate=%llu\n", cfg.replay.c_str(),
+                    h.ds, (unsigned long long) h.nkeys, (unsigned long long) h.prepopulate);
+            exit(1);
+        }
+        matrix.nthreads.assign(1, h.nthreads);
+        replay = replayer.get();
+    }
+    if (!cfg.seed)
+        cfg.seed = std::random_device()();
+
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+
+    FILE* f = stdout;
+    if (!cfg.json.empty() && !(f = fopen(cfg.json.c_str(), "w"))) {
+        perror(cfg.json.c_str());
+        exit(1);
+    }
+    if (!cfg.trace.empty() && !(trace = new EventTrace(MAX_THREADS))->open(cfg.trace)) {
+        perror(cfg.trace.c_str());
+        exit(1);
+    }
+    // results[] is reset for each run; the sampler counts that as a reset
+    MetricsSampler metrics(cfg.metrics_interval);
+    if (!cfg.metrics.empty() || !cfg.metrics_socket.empty()) {
+        metrics.add_sto_counters();
+        metrics.add_counter("bench_commits_total", "committed bench transactions", "",
+                            &results[0].commits, MAX_THREADS, sizeof(thread_result) / sizeof(uint64_t));
+        metrics.add_counter("bench_attempts_total", "bench transaction attempts", "",
+                            &results[0].attempts, MAX_THREADS, sizeof(thread_result) / sizeof(uint64_t));
+        if (!(cfg.metrics_interval > 0)) {
+            fprintf(stderr, "--metrics-interval must be positive\n");
+            exit(1);
+        }
+        if (!metrics.start(cfg.metrics, cfg.metrics_socket)) {
+            fprintf(stderr, "cannot serve metrics on %s\n", cfg.metrics_socket.c_str());
+            exit(1);
+        }
+    }
+    throughput_map measured;
+    std::vector<std::string> keys;
+    run_matrix(f, matrix, measured, keys);
+    if (f != stdout)
+        fclose(f);
+    delete trace;
+    metrics.stop();
+
+    if (!cfg.baseline.empty() && compare_baseline(keys, measured, baseline))
+        return 2;
+    return 0;
+}
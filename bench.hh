@@ -0,0 +1,125 @@
+// Shared by the benchmark driver's translation units: bench.cc runs the
+// workload; bench_sweep.cc, bench_tune.cc and bench_matrix.cc drive runs
+// of it for --sla-p99, --tune, and option lists with --csv and --baseline.
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "sampling.hh"
+#include "LatencyHistogram.hh"
+#include "PerfCounters.hh"
+
+// A transaction is txn_size operations, each chosen by the operation mix.
+// rmw reads a key and writes it back incremented.
+enum { kind_read, kind_update, kind_insert, kind_remove, kind_scan, kind_rmw, nkinds };
+
+struct bench_config {
+    std::string ds = "hashtable";
+    std::string workload = "mixed";
+    double pct[nkinds] = {-1, -1, -1, -1, -1, -1};  // -1: from the preset
+    std::string dist;                       // empty: from the preset
+    double skew = StoSampling::StoZipfDistribution::default_skew;
+    bool append = false;
+    unsigned scan_length = 100;             // scans read 1..scan_length keys
+    uint64_t nkeys = 1000000;
+    int64_t prepopulate = -1;               // -1: every key
+    int load_threads = 0;                   // 0: one per CPU
+    int nthreads = 4;
+    double duration = 10;
+    uint64_t ntxns = 0;                     // nonzero: run this many instead
+    double rate = 0;                        // nonzero: open loop, txns/sec
+    std::string arrival = "poisson";
+    double sla_p99 = 0;                     // nonzero: sweep for the max rate, us
+    int txn_size = 10;
+    std::string pin = "none";
+    bool interleave = false;                // spread the index over NUMA nodes
+    unsigned seed = 0;
+    int repeat = 1;
+    std::string json;                       // empty: stdout
+    std::string csv;                        // nonempty: append a row per run
+    std::string baseline;                   // nonempty: compare with this CSV
+    std::string trace;                      // nonempty: EventTrace file
+    std::string metrics;                    // nonempty: Prometheus text file
+    std::string metrics_socket;             // nonempty: serve metrics here
+    double metrics_interval = 1;
+    std::string log_dir;                    // nonempty: redo log here
+    int loggers = 1;
+    std::string checkpoint_dir;             // nonempty: checkpoint mid-run
+    int checkpoint_threads = 1;
+    bool recover = false;                   // load from checkpoint and log
+    std::string serve;                      // nonempty: serve requests here
+    unsigned batch = 32;                    // requests per served transaction
+    std::string record;                     // nonempty: record the schedule here
+    std::string replay;                     // nonempty: replay this schedule
+    double replay_from = 0;                 // time the replay's events in
+    double replay_to = 0;                   // [from, to) sec of the record; 0: end
+    bool admission = false;                 // gate transactions by abort rate
+    double admission_target = 20;           // abort %
+    std::string route;                      // nonempty: AffinityScheduler policy
+    unsigned prefetch = 0;                  // nonzero: prefetch this many txns' keys together
+    std::string knobs;                      // nonempty: apply this knob profile
+    std::string tune;                       // nonempty: tune knobs, write profile here
+    double tune_seconds = 1;                // per tuning trial
+    double regress_pct = 5;
+};
+
+// Options given as comma-separated lists run every combination of their
+// values, each --repeat times; cfg holds the current combination.
+struct bench_matrix {
+    std::vector<std::string> ds;
+    std::vector<int> nthreads;
+    std::vector<int> txn_size;
+    std::vector<double> skew;
+};
+
+// A transaction's type is the kind of its operations, or "mixed".
+static const int ntypes = nkinds + 1;
+
+// Latencies are in ns. Closed loop, a transaction's latency runs from its
+// first attempt to its commit. Open loop, it runs from the transaction's
+// scheduled arrival, so time spent queued behind earlier transactions
+// counts (no coordinated omission); service is then the part from the
+// first attempt.
+struct thread_result {
+    int cpu = -1;
+    int node = -1;
+    uint64_t commits = 0;
+    uint64_t attempts = 0;
+    uint64_t ops[nkinds] = {0, 0, 0, 0, 0, 0};
+    uint64_t hits[nkinds] = {0, 0, 0, 0, 0, 0};
+    double seconds = 0;
+    LatencyHistogram latency;
+    LatencyHistogram type_latency[ntypes];
+    LatencyHistogram service;
+} __attribute__((aligned(128)));
+
+// Runs are keyed by the options that define a benchmark; a run's
+// throughput is recorded under its key.
+typedef std::map<std::string, std::vector<double>> throughput_map;
+
+extern bench_config cfg;
+extern double counters[PerfCounters::ncounters];  // this run's; -1: unavailable
+extern double load_seconds;                 // this run's
+
+// bench.cc
+double run(double rate);
+thread_result totals();
+void print_config(FILE* f);
+void print_latency(FILE* f, const LatencyHistogram& l);
+void run_one(FILE* f, throughput_map& measured, std::vector<std::string>& keys);
+
+// bench_sweep.cc
+void sweep(FILE* f);
+
+// bench_tune.cc
+void tune(FILE* f);
+
+// bench_matrix.cc
+std::string csv_key();
+void write_csv(double seconds);
+bool read_baseline(const std::string& fn, throughput_map& out);
+int compare_baseline(const std::vector<std::string>& keys, const throughput_map& now,
+                     const throughput_map& base);
+void run_matrix(FILE* f, const bench_matrix& matrix, throughput_map& measured, std::vector<std::string>& keys);
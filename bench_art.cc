@@ -0,0 +1,117 @@
+// TART adapter for the benchmark driver (bench.cc). Kept in its own
+// translation unit: TART.hh defines globals and pulls ART's namespace in.
+#include <vector>
+#include "Transaction.hh"
+#include "TART.hh"
+#include "Checkpoint.hh"
+#include "Recovery.hh"
+#include "BenchIndex.hh"
+
+// ART stores a record* per key and recovers keys from it through the load
+// function, so keys are derived from record values: key i is stored with
+// TID i + 1 (TID 0 means "absent") as 8 big-endian bytes.
+class TARTIndex : public BenchIndex {
+public:
+    typedef TART<uint64_t> type;
+
+    TARTIndex(uint64_t)
+        : t_(load_key) {
+        for (auto& ti : tinfo_)
+            ti = nullptr;
+    }
+    ~TARTIndex() {
+        for (auto ti : tinfo_)
+            delete ti;
+    }
+    unsigned ops() const override {
+        return op_point | op_scan;
+    }
+    void thread_init(int tid) override {
+        if (!tinfo_[tid])
+            tinfo_[tid] = new ThreadInfo(t_.getThreadInfo());
+    }
+    // values are not stored: reads report presence, updates rewrite the TID
+    bool read(uint64_t key, uint64_t& value) override {
+        Key k;
+        lookup_res r = t_.t_lookup(make_key(key, k), thread_info());
+        if (!std::get<1>(r))
+            Sto::abort();
+        value = std::get<0>(r);
+        return value != 0;
+    }
+    bool update(uint64_t key, uint64_t) override {
+        Key k;
+        ins_res r = t_.t_insert(make_key(key, k), key + 1, thread_info());
+        if (!std::get<1>(r))
+            Sto::abort();
+        return !std::get<0>(r);
+    }
+    bool insert(uint64_t key, uint64_t value) override {
+        uint64_t v;
+        if (read(key, v))
+            return false;
+        update(key, value);
+        return true;
+    }
+    bool remove(uint64_t key) override {
+        Key k;
+        rem_res r = t_.t_remove(make_key(key, k), key + 1, thread_info());
+        if (!std::get<1>(r))
+            Sto::abort();
+        return std::get<0>(r);
+    }
+    unsigned scan(uint64_t key, unsigned n) override {
+        Key start, end, next;
+        std::vector<TID>& buf = scanbuf_[TThread::id()];
+        buf.resize(n);
+        size_t found = 0;
+        lookup_res r = t_.t_lookupRange(make_key(key, start), make_key(UINT64_MAX, end), next,
+                                        buf.data(), n, found, thread_info());
+        if (!std::get<1>(r))
+            Sto::abort();
+        return found;
+    }
+    void load(uint64_t key, uint64_t) override {
+        Key k;
+        t_.nontrans_insert(make_key(key, k), key + 1, thread_info());
+    }
+    bool concurrent_load() const override {
+        return true;
+    }
+    TObject* log_object() override {
+        return &t_;
+    }
+    bool add_to_checkpoint(Checkpoint& c) override {
+        return c.add(t_, 0);
+    }
+    bool add_to_recovery(Recovery& r) override {
+        return r.add(t_, 0);
+    }
+
+private:
+    type t_;
+    ThreadInfo* tinfo_[MAX_THREADS];
+    std::vector<TID> scanbuf_[MAX_THREADS];
+
+    ThreadInfo& thread_info() {
+        thread_init(TThread::id());
+        return *tinfo_[TThread::id()];
+    }
+    static const Key& make_key(uint64_t key, Key& k) {
+        uint8_t buf[8];
+        for (int i = 7; i >= 0; --i, key >>= 8)
+            buf[i] = key;
+        k.set(reinterpret_cast<const char*>(buf), 8);
+        return k;
+    }
+    static void load_key(TID tid, Key& k) {
+        uintptr_t tid_p = tid;
+        if (tid_p & dont_cast_from_rec_bit)
+            tid = tid_p & ~dont_cast_from_rec_bit;
+        else
+            tid = type::getTIDFromRec(tid);
+        make_key(tid - 1, k);
+    }
+};
+static BenchIndex::registrar tart_registrar("tart", "TART<uint64_t>, 8-byte big-endian keys",
+    [](uint64_t nkeys) -> BenchIndex* { return new TARTIndex(nkeys); });
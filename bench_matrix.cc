@@ -0,0 +1,183 @@
+// Matrix runs for the benchmark driver (bench.cc): option lists, the --csv
+// store, and --baseline comparisons.
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "bench.hh"
+
+// The CSV store has a row per run. Runs with equal key columns are
+// repeats of the same benchmark; --baseline compares their throughput.
+// CPU lists in --pin have their commas written as semicolons.
+static const char* const csv_key_columns = "ds,workload,dist,skew,keys,nthreads,txn_size,rate,pin,interleave";
+
+std::string csv_key() {
+    std::string pin = cfg.pin;
+    std::replace(pin.begin(), pin.end(), ',', ';');
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s,%s,%s,%g,%llu,%d,%d,%g,%s,%d", cfg.ds.c_str(), cfg.workload.c_str(),
+             cfg.dist.c_str(), cfg.skew, (unsigned long long) cfg.nkeys, cfg.nthreads, cfg.txn_size, cfg.rate,
+             pin.c_str(), cfg.interleave);
+    return buf;
+}
+
+void write_csv(double seconds) {
+    FILE* f = fopen(cfg.csv.c_str(), "a");
+    if (!f) {
+        perror(cfg.csv.c_str());
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0) {
+        fprintf(f, "%s,seed,seconds,commits,aborts,txns_per_sec,abort_rate,p50_us,p99_us,load_keys_per_sec",
+                csv_key_columns);
+        for (int c = 0; c < PerfCounters::ncounters; ++c)
+            fprintf(f, ",%s", PerfCounters::name(c));
+        fprintf(f, "\n");
+    }
+    thread_result total = totals();
+    uint64_t aborts = total.attempts - total.commits;
+    fprintf(f, "%s,%u,%.6f,%llu,%llu,%.1f,%.6f,%.3f,%.3f,%.1f", csv_key().c_str(), cfg.seed, seconds,
+            (unsigned long long) total.commits, (unsigned long long) aborts, total.commits / seconds,
+            total.attempts ? double(aborts) / total.attempts : 0.0,
+            total.latency.percentile(50) / 1000., total.latency.percentile(99) / 1000.,
+            cfg.prepopulate / load_seconds);
+    for (int c = 0; c < PerfCounters::ncounters; ++c)
+        if (counters[c] < 0)
+            fprintf(f, ",");
+        else
+            fprintf(f, ",%.0f", counters[c]);
+    fprintf(f, "\n");
+    fclose(f);
+}
+
+static std::vector<std::string> split_csv(const std::string& line) {
+    std::vector<std::string> out;
+    std::istringstream in(line);
+    std::string field;
+    while (std::getline(in, field, ','))
+        out.push_back(field);
+    if (!line.empty() && line.back() == ',')
+        out.push_back("");
+    return out;
+}
+
+// Throughput of every run in a CSV store, by key
+bool read_baseline(const std::string& fn, throughput_map& out) {
+    FILE* f = fopen(fn.c_str(), "r");
+    if (!f)
+        return false;
+    std::vector<int> key_col;
+    int tps_col = -1;
+    char buf[4096];
+    for (int lineno = 0; fgets(buf, sizeof(buf), f); ++lineno) {
+        std::string line(buf);
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        auto fields = split_csv(line);
+        if (lineno == 0) {
+            for (auto& name : split_csv(csv_key_columns))
+                key_col.push_back(std::find(fields.begin(), fields.end(), name) - fields.begin());
+            tps_col = std::find(fields.begin(), fields.end(), "txns_per_sec") - fields.begin();
+            bool ok = tps_col < int(fields.size());
+            for (int c : key_col)
+                ok = ok && c < int(fields.size());
+            if (!ok) {
+                fclose(f);
+                return false;
+            }
+            continue;
+        }
+        if (int(fields.size()) <= tps_col)
+            continue;
+        std::string key;
+        for (size_t i = 0; i < key_col.size(); ++i)
+            key += (i ? "," : "") + fields[key_col[i]];
+        out[key].push_back(strtod(fields[tps_col].c_str(), nullptr));
+    }
+    fclose(f);
+    return true;
+}
+
+static void mean_stddev(const std::vector<double>& v, double& mean, double& var) {
+    mean = var = 0;
+    for (double x : v)
+        mean += x;
+    mean /= v.size();
+    for (double x : v)
+        var += (x - mean) * (x - mean);
+    var = v.size() > 1 ? var / (v.size() - 1) : 0;
+}
+
+// one-sided 95% critical value of Student's t
+static double t_critical(double df) {
+    static const double t[] = {6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812};
+    if (df <= 10)
+        return t[std::max(int(df), 1) - 1];
+    return 1.645 + 1.6 / df;
+}
+
+// A benchmark regressed if its mean throughput is more than regress_pct
+// below the baseline's and, when both sides have repeats, Welch's t-test
+// says the drop is significant. Returns the number of regressions.
+int compare_baseline(const std::vector<std::string>& keys, const throughput_map& now,
+                     const throughput_map& base) {
+    int nregress = 0;
+    fprintf(stderr, "\ncomparison with %s (%s: txns/sec mean +- stddev (runs)):\n",
+            cfg.baseline.c_str(), csv_key_columns);
+    for (auto& key : keys) {
+        auto it = base.find(key);
+        if (it == base.end()) {
+            fprintf(stderr, "%s: not in baseline\n", key.c_str());
+            continue;
+        }
+        const std::vector<double>& a = it->second;
+        const std::vector<double>& b = now.at(key);
+        double ma, va, mb, vb;
+        mean_stddev(a, ma, va);
+        mean_stddev(b, mb, vb);
+        double change = ma ? (mb - ma) / ma * 100 : 0;
+        bool significant = true;
+        if (a.size() > 1 && b.size() > 1) {
+            double sa = va / a.size(), sb = vb / b.size();
+            if (sa + sb > 0) {
+                double t = (ma - mb) / std::sqrt(sa + sb);
+                double df = (sa + sb) * (sa + sb) / (sa * sa / (a.size() - 1) + sb * sb / (b.size() - 1));
+                significant = t > t_critical(df);
+            }
+        }
+        bool regress = change < -cfg.regress_pct && significant;
+        nregress += regress;
+        fprintf(stderr, "%s: %.0f +- %.0f (%zu) vs baseline %.0f +- %.0f (%zu), %+.1f%%%s\n",
+                key.c_str(), mb, std::sqrt(vb), b.size(), ma, std::sqrt(va), a.size(), change,
+                regress ? ": REGRESSION" : "");
+    }
+    return nregress;
+}
+
+// Runs every combination of the matrix's values, each --repeat times, as
+// a JSON array if there is more than one run.
+void run_matrix(FILE* f, const bench_matrix& matrix, throughput_map& measured, std::vector<std::string>& keys) {
+    size_t nruns = matrix.ds.size() * matrix.nthreads.size() * matrix.txn_size.size()
+        * matrix.skew.size() * cfg.repeat;
+    unsigned seed = cfg.seed;
+    if (nruns > 1)
+        fprintf(f, "[\n");
+    size_t n = 0;
+    for (auto& ds : matrix.ds)
+        for (int nthreads : matrix.nthreads)
+            for (int txn_size : matrix.txn_size)
+                for (double skew : matrix.skew)
+                    for (int rep = 0; rep < cfg.repeat; ++rep) {
+                        cfg.ds = ds;
+                        cfg.nthreads = nthreads;
+                        cfg.txn_size = txn_size;
+                        cfg.skew = skew;
+                        cfg.seed = seed + rep;
+                        if (n++)
+                            fprintf(f, ",\n");
+                        run_one(f, measured, keys);
+                        fflush(f);
+                    }
+    fprintf(f, nruns > 1 ? "\n]\n" : "\n");
+}
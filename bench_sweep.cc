@@ -0,0 +1,35 @@
+// SLA sweep for the benchmark driver (bench.cc): --sla-p99.
+#include "bench.hh"
+
+// Search for the highest rate that meets the p99 SLA: double the rate until
+// a trial fails, then bisect to within 5%. A trial passes if its p99 is
+// within the SLA and it kept up with at least 95% of the offered rate.
+void sweep(FILE* f) {
+    double lo = 0, hi = 0;
+    double rate = cfg.rate ? cfg.rate : 10000;
+    fprintf(f, "{\n");
+    print_config(f);
+    fprintf(f, "  \"trials\": [");
+    for (int trial = 0; trial < 20 && rate >= 1 && (!hi || hi > lo * 1.05); ++trial) {
+        double seconds = run(rate);
+        thread_result total = totals();
+        double achieved = total.commits / seconds;
+        double p99 = total.latency.percentile(99) / 1000.;
+        bool pass = p99 <= cfg.sla_p99 && achieved >= 0.95 * rate;
+        fprintf(f, "%s\n    {\"rate\": %.1f, \"txns_per_sec\": %.1f, \"abort_rate\": %.6f, \"pass\": %s,\n"
+                "     \"latency_us\": ", trial ? "," : "", rate, achieved,
+                total.attempts ? double(total.attempts - total.commits) / total.attempts : 0.0,
+                pass ? "true" : "false");
+        print_latency(f, total.latency);
+        fprintf(f, "}");
+        fprintf(stderr, "%s: offered %.0f txns/sec, achieved %.0f, p99 %.1f us: %s\n",
+                cfg.ds.c_str(), rate, achieved, p99, pass ? "pass" : "fail");
+        if (pass)
+            lo = rate;
+        else
+            hi = rate;
+        rate = hi ? (lo + hi) / 2 : rate * 2;
+    }
+    fprintf(f, "\n  ],\n  \"max_rate\": %.1f\n}", lo);
+    fprintf(stderr, "%s: max rate within p99 %g us: %.0f txns/sec\n", cfg.ds.c_str(), cfg.sla_p99, lo);
+}
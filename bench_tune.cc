@@ -0,0 +1,87 @@
+// Knob tuning for the benchmark driver (bench.cc): --tune.
+#include <string>
+#include <vector>
+#include "StoKnobs.hh"
+#include "bench.hh"
+
+// Tune the runtime knobs for the loaded workload by coordinate descent:
+// for each knob in turn, run a trial per candidate value, and the current
+// value, with the other knobs at their best so far; keep the fastest if it
+// beats the current value by more than 2%. Passes repeat until one changes
+// nothing, at most three times. Trials run closed loop for --tune-seconds
+// on the same index, so inserts grow it as the search goes, and throughput
+// drifts; comparisons are between nearby trials, and the initial and best
+// knobs are finally run back to back, keeping the initial ones unless the
+// best confirm their gain. The result is left applied and written to the
+// --tune profile.
+void tune(FILE* f) {
+    static const std::vector<unsigned> candidates[StoKnobs::nknobs] = {
+        {0, 1}, {0, 1}, {0, 1, 3, 5, 7}, {10, 15, 20}, {1, 16, 64, 256}, {0, 1, 2}
+    };
+    double duration = cfg.duration;
+    cfg.duration = cfg.tune_seconds;
+    int ntrials = 0;
+    auto trial = [&](const sto_knobs& k) {
+        StoKnobs::apply(k);
+        double seconds = run(0);
+        thread_result total = totals();
+        double tps = total.commits / seconds;
+        double abort_rate = total.attempts ? double(total.attempts - total.commits) / total.attempts : 0.0;
+        std::string knobs = StoKnobs::unparse(k);
+        fprintf(f, "%s\n    {\"knobs\": \"%s\", \"txns_per_sec\": %.1f, \"abort_rate\": %.6f}",
+                ntrials++ ? "," : "", knobs.c_str(), tps, abort_rate);
+        fprintf(stderr, "%s: %s: %.0f txns/sec, %.2f%% aborts\n", cfg.ds.c_str(), knobs.c_str(), tps,
+                100 * abort_rate);
+        return tps;
+    };
+
+    fprintf(f, "{\n");
+    print_config(f);
+    fprintf(f, "  \"trials\": [");
+    const sto_knobs initial = StoKnobs::current();
+    sto_knobs best = initial;
+    for (int pass = 0; pass < 3; ++pass) {
+        bool changed = false;
+        for (int i = 0; i < StoKnobs::nknobs; ++i) {
+            double current_tps = trial(best), best_tps = current_tps;
+            sto_knobs next = best;
+            for (unsigned v : candidates[i]) {
+                sto_knobs k = best;
+                if (v == StoKnobs::get(k, i) || !StoKnobs::set(k, i, v))
+                    continue;
+                double tps = trial(k);
+                if (tps > best_tps) {
+                    next = k;
+                    best_tps = tps;
+                }
+            }
+            if (best_tps > current_tps * 1.02) {
+                best = next;
+                changed = true;
+            }
+        }
+        if (!changed)
+            break;
+    }
+    double initial_tps = trial(initial), best_tps = trial(best);
+    // an unconfirmed gain was noise
+    if (best_tps < initial_tps) {
+        best = initial;
+        best_tps = initial_tps;
+    }
+    StoKnobs::apply(best);
+    cfg.duration = duration;
+
+    std::string comment = "bench --tune: " + cfg.ds + " " + cfg.workload + ", " + std::to_string(cfg.nthreads)
+        + " threads, " + std::to_string(uint64_t(best_tps)) + " txns/sec";
+    if (!StoKnobs::write(cfg.tune, best, comment)) {
+        perror(cfg.tune.c_str());
+        exit(1);
+    }
+    std::string knobs = StoKnobs::unparse(best);
+    fprintf(f, "\n  ],\n  \"profile\": \"%s\",\n  \"best_knobs\": \"%s\",\n"
+            "  \"initial_txns_per_sec\": %.1f,\n  \"best_txns_per_sec\": %.1f\n}",
+            cfg.tune.c_str(), knobs.c_str(), initial_tps, best_tps);
+    fprintf(stderr, "%s: best %s after %d trials: %.0f txns/sec (initial %.0f); wrote %s\n", cfg.ds.c_str(),
+            knobs.c_str(), ntrials, best_tps, initial_tps, cfg.tune.c_str());
+}
@@ -11,6 +11,7 @@
 #include <sys/resource.h>
 
 #include "TArray.hh"
+#include "TAdaptiveArray.hh"
 #include "TGeneric.hh"
 #include "Hashtable.hh"
 #include "Queue.hh"
@@ -41,6 +42,7 @@
 #define USE_MASSTREE_STR 8
 #define USE_HASHTABLE_STR 9
 #define USE_ARRAY_NONOPAQUE 10
+#define USE_ARRAY_ADAPTIVE 11
 
 // set this to USE_DATASTRUCTUREYOUWANT
 #define DATA_STRUCTURE USE_HASHTABLE
@@ -195,6 +197,27 @@ private:
     type v_;
 };
 
+template <> struct Container<USE_ARRAY_ADAPTIVE> {
+    typedef TAdaptiveArray<value_type, ARRAY_SZ> type;
+    typedef int index_type;
+    static constexpr bool has_delete = false;
+    value_type nontrans_get(index_type key) {
+        return v_.nontrans_get(key);
+    }
+    value_type transGet(index_type key) {
+        return v_.transGet(key);
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, value);
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_ARRAY_ADAPTIVE>&) {
+    }
+private:
+    type v_;
+};
+
 template <> struct Container<USE_VECTOR> {
     typedef Vector<value_type> type;
     typedef typename type::size_type index_type;
@@ -1507,7 +1530,8 @@ void print_time(double time) {
     {name, desc, 7, new type<7, ## __VA_ARGS__>},     \
     {name, desc, 8, new type<8, ## __VA_ARGS__>},     \
     {name, desc, 9, new type<9, ## __VA_ARGS__>},     \
-    {name, desc, 10, new type<10, ## __VA_ARGS__>}
+    {name, desc, 10, new type<10, ## __VA_ARGS__>},    \
+    {name, desc, 11, new type<11, ## __VA_ARGS__>}
 
 struct Test {
     const char* name;
@@ -1535,6 +1559,7 @@ struct {
 } ds_names[] = {
     {"array", USE_ARRAY},
     {"array-nonopaque", USE_ARRAY_NONOPAQUE},
+    {"array-adaptive", USE_ARRAY_ADAPTIVE},
     {"hashtable", USE_HASHTABLE},
     {"hash", USE_HASHTABLE},
     {"hash-str", USE_HASHTABLE_STR},
@@ -1774,7 +1799,7 @@ int main(int argc, char *argv[]) {
          MAINTAIN_TRUE_ARRAY_STATE, Transaction::tset_initial_capacity, seed, STO_PROFILE_COUNTERS);
   if (!strcmp(tests[test].name, "zipfrw"))
     printf("  Zipf distribution parameter(s): zipf_skew = %f, read-only txn prob. = %f, write prob. = %f\n", zipf_skew, readonly_percent, write_percent);
-  printf("  STO_SORT_WRITESET: %d\n", STO_SORT_WRITESET);
+  printf("  STO_SORT_WRITESET: %d\n", STO_KNOB(sort_writeset));
 #endif
 
 #if STO_PROFILE_COUNTERS
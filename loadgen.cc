@@ -0,0 +1,265 @@
+// Load generator for a RequestServer (bench --serve).
+//
+//   ./bench --ds=tart -k1000000 -j4 -d30 --serve=/tmp/sto.sock &
+//   ./loadgen --socket=/tmp/sto.sock -c8 --pipeline=16 -d10 -k1000000
+//
+// Each connection runs on its own thread and keeps --pipeline requests in
+// flight: whenever responses arrive, it sends as many new requests. Latency
+// counts from a request's send to its response. Results are JSON.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "clp.h"
+#include "sampling.hh"
+#include "LatencyHistogram.hh"
+#include "RequestServer.hh"
+
+struct loadgen_config {
+    std::string socket;
+    int connections = 4;
+    int pipeline = 8;
+    double duration = 10;
+    uint64_t nkeys = 1000000;
+    double pct[4] = {95, 5, 0, 0};          // get, put, scan, remove
+    unsigned scan_length = 100;
+    std::string dist = "zipf";
+    double skew = StoSampling::StoZipfDistribution::default_skew;
+    unsigned seed = 0;
+    std::string json;                       // empty: stdout
+};
+
+struct connection_result {
+    uint64_t requests = 0;
+    uint64_t not_found = 0;
+    uint64_t errors = 0;
+    LatencyHistogram latency;
+};
+
+static loadgen_config cfg;
+static std::atomic<bool> stop;
+static std::atomic<bool> failed;
+
+static void drive(int me, connection_result& r) {
+    RequestClient c;
+    if (!c.connect(cfg.socket)) {
+        perror(cfg.socket.c_str());
+        failed = true;
+        return;
+    }
+    int dseed = cfg.seed + me * 7919;
+    std::unique_ptr<StoSampling::StoRandomDistribution> keys;
+    if (cfg.dist == "uniform")
+        keys.reset(new StoSampling::StoUniformDistribution(dseed, 0, cfg.nkeys - 1));
+    else
+        keys.reset(new StoSampling::StoZipfDistribution(dseed, 0, cfg.nkeys - 1, cfg.skew));
+    std::mt19937 gen(dseed);
+    std::uniform_real_distribution<double> pct(0, 100);
+    std::uniform_int_distribution<unsigned> scan_len(1, cfg.scan_length);
+    std::vector<std::chrono::steady_clock::time_point> sent(cfg.pipeline);
+    std::vector<request_msg> reqs;
+    std::vector<response_msg> resps;
+    uint32_t next_id = 0;
+
+    auto add = [&](int n) {
+        reqs.clear();
+        auto now = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            request_msg q;
+            memset(&q, 0, sizeof(q));
+            double p = pct(gen);
+            q.op = 0;
+            while (q.op < 3 && p >= cfg.pct[q.op]) {
+                p -= cfg.pct[q.op];
+                ++q.op;
+            }
+            q.id = next_id++;
+            q.key = keys->sample();
+            q.value = q.id;
+            q.count = q.op == request_msg::scan ? scan_len(gen) : 0;
+            sent[q.id % cfg.pipeline] = now;
+            reqs.push_back(q);
+        }
+        return c.send(reqs.data(), reqs.size());
+    };
+
+    int outstanding = cfg.pipeline;
+    if (!add(outstanding)) {
+        failed = true;
+        return;
+    }
+    while (outstanding) {
+        resps.clear();
+        if (!c.receive(resps)) {
+            fprintf(stderr, "connection %d: server closed the connection\n", me);
+            failed = true;
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        for (auto& p : resps) {
+            r.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent[p.id % cfg.pipeline]).count());
+            ++r.requests;
+            r.not_found += p.status == response_msg::not_found;
+            r.errors += p.status == response_msg::bad_request;
+        }
+        outstanding -= resps.size();
+        if (!stop.load(std::memory_order_relaxed)) {
+            if (!add(resps.size())) {
+                failed = true;
+                return;
+            }
+            outstanding += resps.size();
+        }
+    }
+}
+
+static void print_latency(FILE* f, const LatencyHistogram& l) {
+    fprintf(f, "{\"count\": %llu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f}",
+            (unsigned long long) l.count(), l.mean() / 1000, l.percentile(50) / 1000.,
+            l.percentile(90) / 1000., l.percentile(99) / 1000., l.percentile(99.9) / 1000., l.max() / 1000.);
+}
+
+enum {
+    opt_socket = 1, opt_connections, opt_pipeline, opt_duration, opt_keys, opt_get, opt_put, opt_scan, opt_remove,
+    opt_scan_length, opt_dist, opt_skew, opt_seed, opt_json, opt_help
+};
+
+static const Clp_Option options[] = {
+    { "socket", 0, opt_socket, Clp_ValString, 0 },
+    { "connections", 'c', opt_connections, Clp_ValInt, 0 },
+    { "pipeline", 'p', opt_pipeline, Clp_ValInt, 0 },
+    { "duration", 'd', opt_duration, Clp_ValDouble, 0 },
+    { "keys", 'k', opt_keys, Clp_ValUnsignedLong, 0 },
+    { "get", 0, opt_get, Clp_ValDouble, 0 },
+    { "put", 0, opt_put, Clp_ValDouble, 0 },
+    { "scan", 0, opt_scan, Clp_ValDouble, 0 },
+    { "remove", 0, opt_remove, Clp_ValDouble, 0 },
+    { "scan-length", 0, opt_scan_length, Clp_ValUnsigned, 0 },
+    { "dist", 0, opt_dist, Clp_ValString, 0 },
+    { "skew", 0, opt_skew, Clp_ValDouble, 0 },
+    { "seed", 's', opt_seed, Clp_ValUnsigned, 0 },
+    { "json", 0, opt_json, Clp_ValString, 0 },
+    { "help", 'h', opt_help, 0, 0 }
+};
+
+static void help(const char* name) {
+    printf("Usage: %s --socket=PATH [OPTIONS]\n\
+Options:\n\
+ --socket=PATH, the server's Unix socket (bench --serve=PATH)\n\
+ -c, --connections=N, connections, each on its own thread (default %d)\n\
+ -p, --pipeline=N, requests in flight per connection (default %d)\n\
+ -d, --duration=SEC (default %g)\n\
+ -k, --keys=N, request keys 0..N-1 (default %llu)\n\
+ --get=PCT, --put=PCT, --scan=PCT, --remove=PCT, request mix (default %g/%g/%g/%g)\n\
+ --scan-length=N, scans read up to N keys (default %u)\n\
+ --dist=uniform|zipf, key distribution (default %s)\n\
+ --skew=SKEW, zipf skew (default %g)\n\
+ -s, --seed=SEED (default: random)\n\
+ --json=FILE, write results to FILE (default: stdout)\n",
+           name, cfg.connections, cfg.pipeline, cfg.duration, (unsigned long long) cfg.nkeys,
+           cfg.pct[0], cfg.pct[1], cfg.pct[2], cfg.pct[3], cfg.scan_length, cfg.dist.c_str(), cfg.skew);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, sizeof(options) / sizeof(options[0]), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_socket:
+            cfg.socket = clp->vstr;
+            break;
+        case opt_connections:
+            cfg.connections = clp->val.i;
+            break;
+        case opt_pipeline:
+            cfg.pipeline = clp->val.i;
+            break;
+        case opt_duration:
+            cfg.duration = clp->val.d;
+            break;
+        case opt_keys:
+            cfg.nkeys = clp->val.ul;
+            break;
+        case opt_get:
+        case opt_put:
+        case opt_scan:
+        case opt_remove:
+            cfg.pct[opt - opt_get] = clp->val.d;
+            break;
+        case opt_scan_length:
+            cfg.scan_length = clp->val.u;
+            break;
+        case opt_dist:
+            cfg.dist = clp->vstr;
+            break;
+        case opt_skew:
+            cfg.skew = clp->val.d;
+            break;
+        case opt_seed:
+            cfg.seed = clp->val.u;
+            break;
+        case opt_json:
+            cfg.json = clp->vstr;
+            break;
+        default:
+            help(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+    double total_pct = cfg.pct[0] + cfg.pct[1] + cfg.pct[2] + cfg.pct[3];
+    if (cfg.socket.empty() || cfg.connections < 1 || cfg.pipeline < 1 || cfg.nkeys < 2 || cfg.scan_length < 1
+        || cfg.scan_length > UINT16_MAX || std::abs(total_pct - 100) > 1e-6
+        || (cfg.dist != "uniform" && cfg.dist != "zipf"))
+        help(argv[0]);
+    if (!cfg.seed)
+        cfg.seed = std::random_device()();
+
+    std::vector<connection_result> results(cfg.connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < cfg.connections; ++i)
+        threads.emplace_back(drive, i, std::ref(results[i]));
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.duration));
+    stop = true;
+    for (auto& t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed)
+        return 1;
+
+    connection_result total;
+    for (auto& r : results) {
+        total.requests += r.requests;
+        total.not_found += r.not_found;
+        total.errors += r.errors;
+        total.latency.merge(r.latency);
+    }
+    FILE* f = stdout;
+    if (!cfg.json.empty() && !(f = fopen(cfg.json.c_str(), "w"))) {
+        perror(cfg.json.c_str());
+        return 1;
+    }
+    fprintf(f, "{\n  \"config\": {\"socket\": \"%s\", \"connections\": %d, \"pipeline\": %d, \"keys\": %llu,\n"
+            "    \"mix\": {\"get\": %g, \"put\": %g, \"scan\": %g, \"remove\": %g}, \"dist\": \"%s\", \"skew\": %g, \"seed\": %u},\n",
+            cfg.socket.c_str(), cfg.connections, cfg.pipeline, (unsigned long long) cfg.nkeys,
+            cfg.pct[0], cfg.pct[1], cfg.pct[2], cfg.pct[3], cfg.dist.c_str(), cfg.skew, cfg.seed);
+    fprintf(f, "  \"seconds\": %.6f,\n  \"requests\": %llu,\n  \"not_found\": %llu,\n  \"errors\": %llu,\n"
+            "  \"requests_per_sec\": %.1f,\n  \"latency_us\": ",
+            seconds, (unsigned long long) total.requests, (unsigned long long) total.not_found,
+            (unsigned long long) total.errors, total.requests / seconds);
+    print_latency(f, total.latency);
+    fprintf(f, "\n}\n");
+    if (f != stdout)
+        fclose(f);
+    fprintf(stderr, "%llu requests in %.3f sec, %.0f requests/sec, p50 %.1f us, p99 %.1f us\n",
+            (unsigned long long) total.requests, seconds, total.requests / seconds,
+            total.latency.percentile(50) / 1000., total.latency.percentile(99) / 1000.);
+    return 0;
+}
@@ -197,42 +197,172 @@ protected:
 };
 
 // specialization 2: zipf distribution
+// Rank r (1-based) has probability proportional to 1/r^skew; rank 1 is index
+// a (or the first entry of the translation table).
+//
+// Sampling uses rejection-inversion (Hoermann and Derflinger, "Rejection-
+// inversion to generate variates from monotone discrete distributions",
+// 1996): constant time and memory per sample, with no per-index setup, so
+// large universes cost nothing to construct. Any skew >= 0 works.
 class StoZipfDistribution : public StoRandomDistribution {
 public:
     static constexpr double default_skew = 1.0;
 
     StoZipfDistribution(int thid, index_t a, index_t b, double skew = default_skew, bool shuffle = false) :
         StoRandomDistribution(thid, a, b, shuffle), skewness(skew) {
-        calculate_sum();
-        generate();
+        init();
     }
     StoZipfDistribution(int thid, index_t a, index_t b, double skew, std::vector<index_t> index_table) :
         StoRandomDistribution(thid, a, b, index_table), skewness(skew) {
-        calculate_sum();
-        generate();
+        init();
+    }
+
+    index_t sample() const override {
+        index_t r = sample_rank() - 1;
+        if (index_transform)
+            return index_translation_table[r];
+        else
+            return r + begin;
+    }
+
+    // a rank in [1, n]
+    index_t sample_rank() const {
+        while (true) {
+            double u = h_integral_n + uniform01() * (h_integral_x1 - h_integral_n);
+            double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            if (k < 1)
+                k = 1;
+            else if (k > n)
+                k = n;
+            if (k - x <= s || u >= h_integral(k + 0.5) - h(k))
+                return index_t(k);
+        }
     }
 
 protected:
+    // the exact pmf; only for callers that want it, sampling does not use it
     weight_type generate_weights() override {
         weight_type pmf;
-        for (auto i = begin; i <= end; ++i) {
-            double p = 1.0/(std::pow((double)(i-begin+1), skewness)*sum_);
-            //std::cout << p << std::endl;
-            pmf.push_back(p);
-        }
+        double sum = 0.0;
+        for (auto i = begin; i <= end; ++i)
+            sum += std::pow(1.0/(double)(i-begin+1), skewness);
+        for (auto i = begin; i <= end; ++i)
+            pmf.push_back(1.0/(std::pow((double)(i-begin+1), skewness)*sum));
         return pmf;
     }
 
+    double uniform01() const {
+        return std::generate_canonical<double, 53>(uis.generator());
+    }
+
 private:
-    void calculate_sum() {
-        double s = 0.0;
-        for (auto i = begin; i <= end; ++i)
-            s += std::pow(1.0/(double)(i-begin+1), skewness);
-        sum_ = s;
+    void init() {
+        n = double(end - begin + 1);
+        h_integral_x1 = h_integral(1.5) - 1;
+        h_integral_n = h_integral(n + 0.5);
+        s = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+    }
+
+    // h(x) = x^-skew; h_integral is an antiderivative of h
+    double h(double x) const {
+        return std::exp(-skewness * std::log(x));
+    }
+    double h_integral(double x) const {
+        double log_x = std::log(x);
+        return helper2((1 - skewness) * log_x) * log_x;
+    }
+    double h_integral_inverse(double x) const {
+        double t = x * (1 - skewness);
+        if (t < -1)
+            t = -1;  // only through rounding
+        return std::exp(helper1(t) * x);
+    }
+    // log1p(x)/x and expm1(x)/x, continuous at 0 (skew == 1)
+    static double helper1(double x) {
+        if (std::abs(x) > 1e-8)
+            return std::log1p(x) / x;
+        return 1 - x * (0.5 - x * (1.0/3 - 0.25 * x));
+    }
+    static double helper2(double x) {
+        if (std::abs(x) > 1e-8)
+            return std::expm1(x) / x;
+        return 1 + x * 0.5 * (1 + x * (1.0/3) * (1 + 0.25 * x));
     }
 
     double skewness;
-    double sum_;
+    double n;
+    double h_integral_x1;
+    double h_integral_n;
+    double s;
+};
+
+// specialization 3: zipf popularity with the popular indices spread over
+// [a, b] instead of clustered at a. Ranks go through a fixed pseudorandom
+// permutation of [0, n), so every index still has exactly one rank.
+class StoScrambledZipfDistribution : public StoZipfDistribution {
+public:
+    StoScrambledZipfDistribution(int thid, index_t a, index_t b, double skew = default_skew) :
+        StoZipfDistribution(thid, a, b, skew), mask(1) {
+        while (mask < b - a)
+            mask = (mask << 1) | 1;
+        bits = 0;
+        while ((index_t(1) << bits) <= mask && bits < 63)
+            ++bits;
+    }
+
+    index_t sample() const override {
+        return begin + permute(sample_rank() - 1);
+    }
+
+    // a bijection on [0, b - a]: a bijective mix on the next power of two,
+    // cycle-walked until it lands in range
+    index_t permute(index_t x) const {
+        do {
+            x = (x * 0x9E3779B97F4A7C15ULL) & mask;
+            x ^= x >> ((bits + 1) / 2);
+            x = (x * 0xC2B2AE3D27D4EB4FULL) & mask;
+            x ^= x >> ((bits + 2) / 3);
+        } while (x > end - begin);
+        return x;
+    }
+
+private:
+    index_t mask;
+    int bits;
+};
+
+// specialization 4: hotspot. A fraction hot_op_fraction of samples fall
+// uniformly in the first hot_fraction of [a, b], the rest uniformly in the
+// remainder (YCSB's hotspot distribution).
+class StoHotspotDistribution : public StoRandomDistribution {
+public:
+    StoHotspotDistribution(int thid, index_t a, index_t b, double hot_fraction = 0.2, double hot_op_fraction = 0.8) :
+        StoRandomDistribution(thid, a, b), hot_op_fraction(hot_op_fraction) {
+        index_t n = b - a + 1;
+        hot = std::min(std::max(index_t(n * hot_fraction), index_t(1)), n);
+    }
+
+    index_t sample() const override {
+        index_t n = end - begin + 1;
+        if (hot == n || std::generate_canonical<double, 53>(uis.generator()) < hot_op_fraction)
+            return begin + uniform_below(hot);
+        else
+            return begin + hot + uniform_below(n - hot);
+    }
+
+protected:
+    weight_type generate_weights() override {
+        return weight_type();
+    }
+
+private:
+    index_t uniform_below(index_t n) const {
+        return std::uniform_int_distribution<index_t>(0, n - 1)(uis.generator());
+    }
+
+    double hot_op_fraction;
+    index_t hot;
 };
 
 }; // namespace StoSampling
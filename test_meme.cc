@@ -35,9 +35,13 @@ const unsigned ops_per_thread=20000000;
 
 #include "ARTSynchronized/OptimisticLockCoupling/Tree.h"
 
+#include "KeyCorpus.hh"
+#include "NumaTopology.hh"
+#include "ParallelLoader.hh"
+#include "Metrics.hh"
+
 #define GUARDED if (TransactionGuard tguard{})
 
-#define NUM_KEYS_MAX 40000000 // 40M keys max
 
 
 #define HIT_RATIO_MOD 2
@@ -51,18 +55,50 @@ const unsigned ops_per_thread=20000000;
 #define MEASURE_WITH_STEADY_STATE 0
 //#define BLOOM_ACCESS_TEST 1
 #define MEASURE_KEY_ACCESSES 0
+// nonempty: keep live Prometheus metrics in this file, updated every second
+// (see Metrics.hh)
+#define METRICS_FILE ""
+
+// Thread placement (see NumaTopology.hh): "node:0" keeps every thread on
+// one socket; "scatter" spreads them over all sockets, where interleaving
+// the shared tree's memory evens out remote accesses.
+#define PIN_POLICY "node:0"
+#define INTERLEAVE_TREE 0
 
 
 ZipfianGenerator zipf_inserts, zipf_lookups;
 
 bool runZipf = false;
 
-char * key_dat [NUM_KEYS_MAX];
+// one mmapped corpus per key file, in TID order
+std::vector<KeyCorpus> corpora;
+
+// key bytes stay valid while the corpus is mapped
+inline std::pair<const char*, size_t> corpus_key_bytes(TID tid){
+    uint64_t i = tid - 1;
+    auto c = corpora.begin();
+    while (i >= c->size()) {
+        i -= c->size();
+        ++c;
+    }
+    return std::make_pair(c->key(i), size_t(c->length(i)));
+}
+
+inline void corpus_key(TID tid, Key& key){
+    auto k = corpus_key_bytes(tid);
+    key.set(k.first, k.second);
+}
 
-// CPUs from NUMA node 0
-unsigned CPUS [] = {0,4,8,12,16,20,24,28,32,36, 40, 44, 48, 52, 56, 60, 64, 68, 72, 76};
-// CPUs from NUMA node 2
-unsigned CPUS_N2[] = {2,6,10,14,18,22,26,30,34,38,42,46,50,54,58,62,66,70,74,78};
+// CPUS[0] is the main thread's, CPUS[i] worker i's
+std::vector<int> placement(const char* policy) {
+    std::vector<int> cpus;
+    if (!NumaTopology::system().place(policy, N_THREADS, cpus)) {
+        cerr << "bad placement " << policy << ", using compact\n";
+        NumaTopology::system().place("compact", N_THREADS, cpus);
+    }
+    return cpus;
+}
+std::vector<int> CPUS = placement(PIN_POLICY);
 const unsigned thread_pool_sz = N_THREADS-1;
 std::thread thread_pool[thread_pool_sz];
 
@@ -92,31 +128,17 @@ void error(int param){
 
 
 void loadKeyInit(TID tid, Key& key){
-	key.set(key_dat[tid-1], strlen(key_dat[tid-1]));
+	corpus_key(tid, key);
 }
 
 uint64_t key_bytes_init=0, key_bytes_exec=0;
 
-void addKeyStr(TID tid, const char* key_str, bool init){
-    if ((key_dat[tid-1] = (char*) malloc((strlen(key_str)+1)*sizeof(char))) == nullptr) {
-		fprintf(stderr, "Malloc returned null!\n");
-		exit(-1);
-	}
-    if(init)
-        key_bytes_init+=strlen(key_str)+1;
-    else
-        key_bytes_exec+=strlen(key_str)+1;
-    memcpy(key_dat[tid-1], key_str, strlen(key_str)+1);
-	//strcpy(key_dat[tid-1], key_str);
-}
-
-void cleanup_keys(uint64_t keys_num){
-	for (TID tid=0; tid < keys_num; tid++)
-		free(key_dat[tid]);
+void cleanup_keys(){
+	corpora.clear();
 }
 
 void loadKey(TID tid, Key &key){
-	key.set(key_dat[tid-1], strlen(key_dat[tid-1]));
+	corpus_key(tid, key);
 }
 
 void loadKeyTART(TID tid, Key &key){
@@ -127,7 +149,7 @@ void loadKeyTART(TID tid, Key &key){
 	else
         // It doesn't matter what template arguments we pass.
         actual_tid = TART<uint64_t, DoubleLookup>::getTIDFromRec(tid);
-	key.set(key_dat[actual_tid-1], strlen(key_dat[actual_tid-1]));
+	corpus_key(actual_tid, key);
 }
 
 inline void checkVal(TID val, uint64_t tid){
@@ -418,18 +440,28 @@ void run_bench(uint64_t num_keys, unsigned insert_ratio, unsigned ops_per_txn, u
     int ret = sched_setaffinity(0, sizeof(cpu_set_t), &cpu_set);
     if(ret!=0)
         cout<<"Error setting affinity for main thread!\n";
+#if INTERLEAVE_TREE
+    NumaTopology::interleave_guard interleave;
+#endif
     // Build tree
 	{
         uint64_t partition_size = num_keys / N_THREADS;
 		auto starttime = std::chrono::system_clock::now();
 		if(multithreaded && ! transactional){
-            /*start_threads(1, num_keys, Operation::insert_op, 0);
-            uint64_t ind_start = (thread_pool_sz)* partition_size +1;
-            uint64_t ind_end = rw_size+1;
-            insert_partition(0, 0, ind_start, ind_end);
-            for(unsigned i=0; i<thread_pool_sz; i++)
-                thread_pool[i].join();
-            */
+            // each thread builds its own range of key space; keys are
+            // numbered from 0 here, TIDs from 1
+            ParallelLoader loader(N_THREADS, CPUS);
+            loader.partition_by_prefix(num_keys, [](uint64_t i) { return corpus_key_bytes(i+1); });
+            // ThreadInfo must be created on its thread (its epoch state is per thread)
+            std::vector<std::unique_ptr<ThreadInfo>> tinfo(N_THREADS);
+            double secs = loader.run([&](int t) {
+                tinfo[t].reset(new ThreadInfo(eART.getTART().getThreadInfo()));
+            }, [&](int t, uint64_t i) {
+                Key key;
+                loadKeyInit(i+1, key);
+                eART.nontrans_insert(key, i+1, *tinfo[t]);
+            });
+            printf("load,%lu,%f keys/sec\n", num_keys, num_keys / secs);
 		}
 		else if (multithreaded && transactional){
             start_threads(1, num_keys, Operation::insert_op, ops_per_txn);
@@ -879,22 +911,20 @@ void init_key_accesses(unsigned thread_id, uint64_t keys_read, bool lookupsOnly,
 
 }
 
-uint64_t read_keys_from_file(string file_name, uint64_t key_offset, bool init){
-    std::ifstream file(file_name);
-    std::string line;
-    uint64_t keys_read=0;
-    
-    while(std::getline(file, line)){
-        if(line.rfind("P", 0) == 0){
-            line = line.replace(0, 2, "");
-            keys_read++;
-            //if (key_offset == keys_read){
-                //keys_read--;
-                //break;
-            //}
-            addKeyStr(key_offset + keys_read, line.c_str(), init);
-        }
+// Keys of the text file `file_name` take the next TIDs. The file is
+// converted to a binary corpus (`file_name`.keys) on first use.
+uint64_t read_keys_from_file(string file_name, bool init){
+    KeyCorpus corpus;
+    if(!corpus.open_text(file_name, std::thread::hardware_concurrency())){
+        fprintf(stderr, "Cannot load keys from %s\n", file_name.c_str());
+        exit(-1);
     }
+    uint64_t keys_read = corpus.size();
+    if(init)
+        key_bytes_init += corpus.byte_size();
+    else
+        key_bytes_exec += corpus.byte_size();
+    corpora.push_back(std::move(corpus));
     return keys_read;
 }
 
@@ -986,10 +1016,11 @@ int main(int argc, char **argv) {
 
     char* cur_file;
     uint64_t init_keys_read=0, exec_keys_read=0;
+    auto load_start = std::chrono::steady_clock::now();
     cur_file = strtok(init_files, ",");
     while(cur_file != nullptr){
         cout<<"Reading from "<< cur_file<<endl;
-        init_keys_read += read_keys_from_file(cur_file, 0, true);
+        init_keys_read += read_keys_from_file(cur_file, true);
         cur_file = strtok(nullptr, ",");
     }
 
@@ -997,10 +1028,12 @@ int main(int argc, char **argv) {
         cur_file = strtok(exec_files, ",");
         while(cur_file != nullptr){
             cout<<"Reading from "<<cur_file<<endl;
-            exec_keys_read += read_keys_from_file(cur_file, init_keys_read+exec_keys_read, false);
+            exec_keys_read += read_keys_from_file(cur_file, false);
             cur_file = strtok(nullptr, ",");
         }
 	}
+    auto load_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start);
+    cout<<"Loaded keys in "<< load_time.count() <<" sec"<<endl;
 
     cout<<"total keys read:" <<(init_keys_read + exec_keys_read) <<", init keys: "<< init_keys_read << ", exec keys: "<< exec_keys_read <<endl;
     zipf_inserts = ZipfianGenerator(1, init_keys_read+exec_keys_read, skew_inserts);
@@ -1016,7 +1049,22 @@ int main(int argc, char **argv) {
         thread_pool[i].join();
     }
     cout<<"Running bench with insert ratio "<< insert_ratio <<endl;
+    MetricsSampler metrics;
+    if(strlen(METRICS_FILE) > 0){
+        metrics.add_sto_counters();
+        #if MEASURE_ABORTS == 1
+        for(unsigned i=0; i<aborts_sz; i++)
+            metrics.add_counter("tart_aborts_total", "TART aborts by cause", "reason=\"" + aborts_descr[i] + "\"",
+                                &aborts[0][i], N_THREADS, aborts_sz);
+        #endif
+        #if BLOOM == 1 && MEASURE_BF_FALSE_POSITIVES == 1
+        metrics.add_counter("bloom_accesses_total", "bloom filter lookups", "", &eART.BF_false_positives[0][0], N_THREADS, 2);
+        metrics.add_counter("bloom_false_positives_total", "bloom filter false positives", "", &eART.BF_false_positives[0][1], N_THREADS, 2);
+        #endif
+        metrics.start(METRICS_FILE, "");
+    }
     run_bench(init_keys_read, insert_ratio, ops_per_txn, init_keys_read+1, multithreaded);
+    metrics.stop();
     #if MEASURE_KEY_ACCESSES == 1
     uint64_t rw_lookups=0, ro_lookups=0, off_lookups=0, rw_inserts=0, ro_inserts=0, off_inserts=0;
     double lookup_freq=0, insert_freq=0; // count the average frequency of key accesses
@@ -1042,6 +1090,6 @@ int main(int argc, char **argv) {
     #endif
     cout<<"Keys init (MB): "<< ((double)key_bytes_init) / 1024 / 1024 <<endl;
     cout<<"Keys exec (MB): "<< ((double)key_bytes_exec) / 1024 / 1024 <<endl;
-	cleanup_keys(init_keys_read + exec_keys_read);
+	cleanup_keys();
     return 0;
 }
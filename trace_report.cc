@@ -0,0 +1,105 @@
+// Summarizes an EventTrace file (bench --trace).
+//
+//   ./trace_report FILE [INTERVAL_MS]
+//
+// Prints latency percentiles for each operation and outcome, abort counts
+// by reason, and a timeline with INTERVAL_MS (default 10) rows. Each row
+// shows commits, aborts, the abort ratio, p99 attempt latency, and the
+// phases (load, run) active during it.
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <set>
+#include <string>
+#include "EventTrace.hh"
+#include "LatencyHistogram.hh"
+
+struct interval {
+    uint64_t commits = 0;
+    uint64_t aborts = 0;
+    LatencyHistogram txn;
+    std::set<int> phases;
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s FILE [INTERVAL_MS]\n", argv[0]);
+        return 1;
+    }
+    EventTrace::reader in;
+    if (!in.open(argv[1])) {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 1;
+    }
+    double interval_ms = argc == 3 ? atof(argv[2]) : 10;
+    if (!(interval_ms > 0)) {
+        fprintf(stderr, "bad interval %s\n", argv[2]);
+        return 1;
+    }
+    const trace_header& h = in.header();
+    double tpn = h.ticks_per_ns;
+    uint64_t ticks_per_interval = std::max(uint64_t(interval_ms * 1e6 * tpn), uint64_t(1));
+
+    std::map<std::pair<int, int>, LatencyHistogram> latency;  // (op, outcome)
+    uint64_t aborts[3] = {0, 0, 0};
+    uint64_t dropped = 0, nevents = 0;
+    std::map<uint64_t, interval> timeline;
+    trace_event e;
+    while (in.next(e)) {
+        ++nevents;
+        if (e.op == trace_dropped) {
+            dropped += e.key_hash;
+            continue;
+        }
+        uint64_t ns = e.duration / tpn;
+        uint64_t first = e.tsc > h.start_tsc ? (e.tsc - h.start_tsc) / ticks_per_interval : 0;
+        if (e.op == trace_load || e.op == trace_run) {
+            uint64_t last = first + e.duration / ticks_per_interval;
+            for (uint64_t i = first; i <= last; ++i)
+                timeline[i].phases.insert(e.op);
+        } else if (e.op == trace_txn) {
+            interval& iv = timeline[first];
+            if (e.outcome == trace_abort) {
+                ++iv.aborts;
+                ++aborts[std::min(int(e.reason), 2)];
+            } else
+                ++iv.commits;
+            iv.txn.record(ns);
+        }
+        latency[std::make_pair(int(e.op), int(e.outcome))].record(ns);
+    }
+
+    static const char* const outcomes[] = {"ok", "miss", "abort"};
+    printf("# %llu events, %u threads, %.3f ticks/ns", (unsigned long long) nevents, h.nthreads, tpn);
+    if (dropped)
+        printf(", %llu dropped (ring full)", (unsigned long long) dropped);
+    printf("\n\n# latency (ns)\n%-8s %-6s %10s %10s %10s %10s %10s %10s %10s\n",
+           "op", "result", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (auto& l : latency) {
+        const LatencyHistogram& x = l.second;
+        printf("%-8s %-6s %10llu %10.0f %10llu %10llu %10llu %10llu %10llu\n",
+               EventTrace::op_name(l.first.first), outcomes[std::min(l.first.second, 2)],
+               (unsigned long long) x.count(), x.mean(),
+               (unsigned long long) x.percentile(50), (unsigned long long) x.percentile(90),
+               (unsigned long long) x.percentile(99), (unsigned long long) x.percentile(99.9),
+               (unsigned long long) x.max());
+    }
+
+    printf("\n# aborts\nexecution %llu\ncommit %llu\n",
+           (unsigned long long) aborts[trace_exec_abort], (unsigned long long) aborts[trace_commit_abort]);
+
+    printf("\n# timeline (%g ms intervals)\n%10s %10s %10s %8s %12s  %s\n",
+           interval_ms, "ms", "commits", "aborts", "abort%", "p99_ns", "phases");
+    for (auto& t : timeline) {
+        const interval& iv = t.second;
+        uint64_t n = iv.commits + iv.aborts;
+        std::string phases;
+        for (int p : iv.phases)
+            phases += std::string(phases.empty() ? "" : ",") + EventTrace::op_name(p);
+        printf("%10.0f %10llu %10llu %8.2f %12llu  %s\n", t.first * interval_ms,
+               (unsigned long long) iv.commits, (unsigned long long) iv.aborts,
+               n ? 100.0 * iv.aborts / n : 0.0, (unsigned long long) iv.txn.percentile(99),
+               phases.c_str());
+    }
+    return 0;
+}
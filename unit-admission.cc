@@ -0,0 +1,111 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "TBox.hh"
+#include "AdmissionControl.hh"
+
+template <typename F>
+static void run_threads(int nthreads, F f) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([=] {
+            TThread::set_id(t);
+            f(t);
+        });
+    for (auto& th : threads)
+        th.join();
+}
+
+void testLimit() {
+    AdmissionGate::params p;
+    p.max_limit = p.initial_limit = 2;
+    AdmissionGate gate(p);
+    gate.start();
+    TBox<int> boxes[8];
+    std::atomic<int> inside(0), most(0);
+    run_threads(8, [&](int t) {
+        for (int i = 0; i < 200; ++i)
+            TRANSACTION {
+                int n = ++inside;
+                for (int m = most; n > m && !most.compare_exchange_weak(m, n); )
+                    /* do nothing */;
+                boxes[t] = boxes[t] + 1;
+                if (i % 10 == 0)
+                    usleep(10);
+                --inside;
+            } RETRY(true);
+    });
+    gate.stop();
+    assert(most >= 1 && most <= 2);
+    assert(gate.active() == 0);
+    for (auto& b : boxes)
+        assert(b.nontrans_read() == 200);
+    // stopped gates admit freely
+    TRANSACTION {
+        boxes[0] = 0;
+    } RETRY(true);
+    assert(gate.active() == 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDecrease() {
+    // every transaction reads and writes one box and holds it a while, so
+    // concurrent ones mostly abort
+    AdmissionGate::params p;
+    p.max_limit = p.initial_limit = 8;
+    p.interval_us = 2000;
+    p.min_starts = 8;
+    AdmissionGate gate(p);
+    gate.start();
+    TBox<int> box;
+    run_threads(8, [&](int) {
+        for (int i = 0; i < 300; ++i)
+            TRANSACTION {
+                int v = box;
+                usleep(20);
+                box = v + 1;
+            } RETRY(true);
+    });
+    gate.stop();
+    assert(box.nontrans_read() == 8 * 300);
+    auto& s = gate.statistics();
+    assert(s.decreases > 0 && s.min_limit < 8);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testIncrease() {
+    // no conflicts: the limit grows from 1 to its maximum
+    AdmissionGate::params p;
+    p.max_limit = 4;
+    p.initial_limit = 1;
+    p.interval_us = 1000;
+    p.min_starts = 8;
+    AdmissionGate gate(p);
+    gate.start();
+    TBox<int> boxes[4];
+    run_threads(4, [&](int t) {
+        for (int i = 0; i < 2000; ++i)
+            TRANSACTION {
+                boxes[t] = boxes[t] + 1;
+                if (i % 100 == 0)
+                    usleep(100);
+            } RETRY(true);
+    });
+    gate.stop();
+    auto& s = gate.statistics();
+    assert(s.decreases == 0 && s.increases >= 3 && gate.limit() == 4);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    testLimit();
+    testDecrease();
+    testIncrease();
+    return 0;
+}
@@ -0,0 +1,111 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <vector>
+#include "AffinityScheduler.hh"
+
+typedef AffinityScheduler<int> scheduler_type;
+
+void testRoute() {
+    scheduler_type::params p;
+    scheduler_type h(4, p);
+    for (uint64_t k = 0; k < 1000; ++k) {
+        int w = h.route(0, k);
+        assert(w >= 0 && w < 4 && h.route(3, k) == w);
+    }
+    p.policy = affinity_range;
+    p.nkeys = 1000;
+    scheduler_type r(4, p);
+    assert(r.route(0, 0) == 0 && r.route(0, 249) == 0 && r.route(0, 250) == 1 && r.route(0, 999) == 3);
+    // keys past nkeys (appends) go to the last range
+    assert(r.route(0, 5000) == 3);
+    p.policy = affinity_random;
+    scheduler_type x(4, p);
+    int seen[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 1000; ++i)
+        ++seen[x.route(1, 7)];
+    for (int w = 0; w < 4; ++w)
+        assert(seen[w] > 150);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSteal() {
+    scheduler_type::params p;
+    p.policy = affinity_range;
+    p.nkeys = 2;
+    p.steal_threshold = 3;
+    p.capacity = 4;
+    scheduler_type s(2, p);
+    // worker 0 owns key 0
+    for (int i = 0; i < 4; ++i)
+        assert(s.submit(1, 0, i));
+    int t = 99;
+    assert(!s.submit(1, 0, t) && t == 99);
+    // the owner runs its queue in order
+    assert(s.next(0, t) && t == 0);
+    // an idle worker steals the newest while the queue is long enough
+    assert(s.next(1, t) && t == 3);
+    assert(!s.next(1, t));
+    assert(s.next(0, t) && t == 1);
+    assert(s.next(0, t) && t == 2);
+    assert(!s.next(0, t));
+    auto s0 = s.statistics(0), s1 = s.statistics(1);
+    assert(s0.submitted == 4 && s0.executed == 3 && s0.stolen == 0);
+    assert(s1.submitted == 0 && s1.executed == 1 && s1.stolen == 1);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testThreads() {
+    // every task runs exactly once, whoever runs it
+    const int nthreads = 4, n = 20000;
+    scheduler_type::params p;
+    p.capacity = 64;
+    scheduler_type s(nthreads, p);
+    std::vector<std::atomic<int>> ran(nthreads * n);
+    for (auto& r : ran)
+        r = 0;
+    std::atomic<int> done(0);
+    std::vector<std::thread> threads;
+    for (int w = 0; w < nthreads; ++w)
+        threads.emplace_back([&, w] {
+            int t;
+            for (int i = 0; i < n; ) {
+                if (s.next(w, t)) {
+                    ++ran[t];
+                    continue;
+                }
+                t = w * n + i;
+                // hot keys: most tasks go to few workers
+                if (!s.submit(w, i % 3, t))
+                    ++ran[t];
+                ++i;
+            }
+            ++done;
+            while (done != nthreads)
+                while (s.next(w, t))
+                    ++ran[t];
+            while (s.next(w, t))
+                ++ran[t];
+        });
+    for (auto& th : threads)
+        th.join();
+    // the stealing rule leaves short queues to their owners
+    for (int w = 0; w < nthreads; ++w) {
+        int t;
+        while (s.next(w, t))
+            ++ran[t];
+    }
+    for (auto& r : ran)
+        assert(r == 1);
+    auto total = s.total();
+    assert(total.executed == total.submitted && total.stolen > 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testRoute();
+    testSteal();
+    testThreads();
+    return 0;
+}
@@ -0,0 +1,147 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <map>
+#include <thread>
+#include <unistd.h>
+#include "Hashtable.hh"
+#include "RedoLog.hh"
+#include "Checkpoint.hh"
+
+static const char* log_dir = "unit-checkpoint.redo";
+static const char* ckpt_dir = "unit-checkpoint.d";
+
+typedef std::map<int, std::pair<uint64_t, int>> image_type;   // key -> (tid, value or -1)
+
+static void remove_files() {
+    for (auto& f : RedoLog::log_files(log_dir))
+        unlink(f.c_str());
+    unlink(RedoLog::epoch_path(log_dir).c_str());
+    rmdir(log_dir);
+    checkpoint_manifest m;
+    if (Checkpoint::read_manifest(ckpt_dir, m))
+        for (uint32_t t = 0; t < m.nfiles; ++t)
+            unlink(Checkpoint::file_path(ckpt_dir, m.id, t).c_str());
+    unlink(Checkpoint::manifest_path(ckpt_dir).c_str());
+    rmdir(ckpt_dir);
+}
+
+// Applies file's records of epoch min_epoch or later, keeping each key's
+// highest TID
+static void apply(image_type& image, const std::string& file, RedoLog::epoch_type min_epoch) {
+    RedoLog::reader in;
+    assert(in.open(file));
+    redo_record r;
+    std::string key, value;
+    while (in.next(r, key, value)) {
+        assert(r.table == 7);
+        if (r.epoch < min_epoch)
+            continue;
+        int k = TLogCodec<int>::decode(key.data(), key.size());
+        int v = r.flags ? -1 : TLogCodec<int>::decode(value.data(), value.size());
+        auto it = image.find(k);
+        if (it == image.end() || it->second.first <= r.tid)
+            image[k] = std::make_pair(r.tid, v);
+    }
+}
+
+void testRecover() {
+    typedef Hashtable<int, int> table_type;
+    const int nthreads = 3, nkeys = 500;
+    table_type h(1000);
+    for (int k = 0; k < nkeys; k += 2)
+        h.nontrans_insert(k, k);
+    RedoLog log(log_dir, 2);
+    assert(log.register_object(h, 7));
+    assert(log.start());
+    Checkpoint ckpt(ckpt_dir, 2);
+    assert(ckpt.add(h, 7));
+
+    // the initial load isn't logged, so the first checkpoint must hold it
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&, t] {
+            TThread::set_id(t);
+            for (int i = 0; !stop; ++i) {
+                int k = (i * nthreads + t) % nkeys;
+                TRANSACTION {
+                    if (i % 4 == 3)
+                        h.transDelete(k);
+                    else
+                        h.transPut(k, i);
+                } RETRY(true);
+            }
+        });
+    usleep(100000);
+    assert(ckpt.write(&log));
+    checkpoint_manifest first = ckpt.manifest();
+    assert(first.id == 1 && first.nfiles == 2 && first.records > 0);
+    assert(ckpt.bytes() >= first.records * sizeof(redo_record));
+    usleep(500000);
+    assert(ckpt.write(&log));
+    checkpoint_manifest m;
+    assert(Checkpoint::read_manifest(ckpt_dir, m));
+    assert(m.id == 2 && m.snapshot_tid > first.snapshot_tid && m.log_epoch > first.log_epoch);
+    // the first checkpoint's files are gone
+    assert(access(Checkpoint::file_path(ckpt_dir, 1, 0).c_str(), F_OK) != 0);
+    usleep(300000);
+    stop = true;
+    for (auto& th : threads)
+        th.join();
+    log.stop();
+    // ... and so are log segments it alone needed
+    assert(access(RedoLog::log_path(log_dir, 0, 0).c_str(), F_OK) != 0);
+
+    // the checkpoint plus the remaining log rebuilds the table
+    image_type image;
+    for (uint32_t t = 0; t < m.nfiles; ++t)
+        apply(image, Checkpoint::file_path(ckpt_dir, m.id, t), 0);
+    for (auto& file : RedoLog::log_files(log_dir))
+        apply(image, file, m.log_epoch);
+    for (int k = 0; k < nkeys; ++k) {
+        int v;
+        bool found = h.nontrans_find(k, v);
+        auto it = image.find(k);
+        assert(found == (it != image.end() && it->second.second >= 0));
+        if (found)
+            assert(v == it->second.second);
+    }
+    remove_files();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testNoLog() {
+    Hashtable<std::string, std::string> h(100);
+    h.nontrans_insert(std::string("a"), std::string("first"));
+    h.nontrans_insert(std::string("b"), std::string("second"));
+    Checkpoint ckpt(ckpt_dir);
+    assert(ckpt.add(h, 1));
+    assert(ckpt.write());
+    checkpoint_manifest m;
+    assert(Checkpoint::read_manifest(ckpt_dir, m));
+    assert(m.id == 1 && m.nfiles == 1 && m.records == 2);
+
+    RedoLog::reader in;
+    assert(in.open(Checkpoint::file_path(ckpt_dir, 1, 0)));
+    std::map<std::string, std::string> image;
+    redo_record r;
+    std::string key, value;
+    while (in.next(r, key, value)) {
+        assert(r.table == 1 && r.epoch == 0 && !r.flags);
+        image[key] = value;
+    }
+    assert(image.size() == 2 && image["a"] == "first" && image["b"] == "second");
+    remove_files();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    remove_files();
+    testRecover();
+    testNoLog();
+    return 0;
+}
@@ -0,0 +1,82 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <unistd.h>
+#include "EventTrace.hh"
+
+static const char* path = "unit-eventtrace.trace";
+
+void testRoundTrip() {
+    const int nthreads = 4, n = 100000;
+    {
+        EventTrace trace(nthreads, 1 << 20);
+        assert(trace.open(path) && trace.ticks_per_ns() > 0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; ++t)
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < n; ++i) {
+                    uint64_t start = EventTrace::now();
+                    trace.record(t, i % 2 ? trace_read : trace_txn, i % 3 ? trace_ok : trace_abort,
+                                 i % 3 ? trace_no_abort : trace_commit_abort, start, EventTrace::hash(i));
+                }
+            });
+        for (auto& th : threads)
+            th.join();
+        for (int t = 0; t < nthreads; ++t)
+            assert(trace.dropped(t) == 0);
+    }
+
+    EventTrace::reader in;
+    assert(in.open(path) && in.header().nthreads == nthreads);
+    std::vector<int> next(nthreads, 0);
+    std::vector<uint64_t> last(nthreads, 0);
+    trace_event e;
+    while (in.next(e)) {
+        assert(e.thread < nthreads);
+        int i = next[e.thread]++;
+        // each thread's events arrive complete and in order
+        assert(e.key_hash == EventTrace::hash(i));
+        assert(e.op == (i % 2 ? trace_read : trace_txn));
+        assert(e.outcome == (i % 3 ? trace_ok : trace_abort));
+        assert(e.reason == (i % 3 ? trace_no_abort : trace_commit_abort));
+        assert(e.tsc >= last[e.thread] && e.tsc >= in.header().start_tsc);
+        last[e.thread] = e.tsc;
+    }
+    for (int t = 0; t < nthreads; ++t)
+        assert(next[t] == n);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDrops() {
+    // a ring far smaller than a burst: events are dropped, never corrupted
+    const int n = 100000;
+    {
+        EventTrace trace(1, 16);
+        assert(trace.open(path));
+        for (int i = 0; i < n; ++i)
+            trace.record(0, trace_update, trace_ok, trace_no_abort, EventTrace::now(), i);
+        assert(trace.dropped(0) > 0);
+    }
+    EventTrace::reader in;
+    assert(in.open(path));
+    uint64_t kept = 0, dropped = 0, prev = 0;
+    trace_event e;
+    while (in.next(e))
+        if (e.op == trace_dropped)
+            dropped += e.key_hash;
+        else {
+            assert(e.op == trace_update && (kept == 0 || e.key_hash > prev));
+            prev = e.key_hash;
+            ++kept;
+        }
+    assert(kept + dropped == n);
+    unlink(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testRoundTrip();
+    testDrops();
+    return 0;
+}
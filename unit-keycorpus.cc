@@ -0,0 +1,141 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include "KeyCorpus.hh"
+
+// The line-by-line parse test_meme used to do.
+static std::vector<std::string> getline_keys(const std::string& file) {
+    std::ifstream in(file);
+    std::string line;
+    std::vector<std::string> keys;
+    while (std::getline(in, line))
+        if (line.rfind("P", 0) == 0)
+            keys.push_back(line.replace(0, 2, ""));
+    return keys;
+}
+
+static std::string temp_path(const char* name) {
+    const char* dir = getenv("TMPDIR");
+    return std::string(dir ? dir : "/tmp") + "/unit-keycorpus-" + std::to_string(getpid()) + "-" + name;
+}
+
+static void check_same(const KeyCorpus& c, const std::vector<std::string>& keys) {
+    assert(c.size() == keys.size());
+    for (uint64_t i = 0; i < c.size(); ++i) {
+        assert(c.length(i) == keys[i].size());
+        assert(memcmp(c.key(i), keys[i].data(), keys[i].size()) == 0);
+        assert(c.key(i)[c.length(i)] == 0);
+    }
+}
+
+void testConvert() {
+    std::string text = temp_path("small.txt");
+    {
+        std::ofstream out(text);
+        out << "P user1\n"
+            << "# not a key\n"
+            << "\n"
+            << "P\n"
+            << "P user22\r\n"
+            << "Puser333\n";
+        for (int i = 0; i < 1000; ++i)
+            out << "P key" << i * 7919 << "\n";
+        out << "P last-without-newline";
+    }
+    auto keys = getline_keys(text);
+    assert(keys.size() == 1005);
+
+    for (unsigned nthreads : {1, 2, 3, 8, 64}) {
+        std::string bin = temp_path("small.keys");
+        assert(KeyCorpus::convert(text, bin, nthreads));
+        KeyCorpus c;
+        assert(c.open(bin));
+        check_same(c, keys);
+        unlink(bin.c_str());
+    }
+
+    // open_text converts once, then reuses the corpus
+    KeyCorpus c;
+    assert(c.open_text(text, 4));
+    check_same(c, keys);
+    struct stat st1, st2;
+    assert(stat((text + ".keys").c_str(), &st1) == 0);
+    KeyCorpus c2(std::move(c));
+    assert(c.size() == 0);
+    assert(c2.open_text(text, 4));
+    assert(stat((text + ".keys").c_str(), &st2) == 0);
+    assert(st1.st_ino == st2.st_ino);
+    check_same(c2, keys);
+
+    unlink((text + ".keys").c_str());
+    unlink(text.c_str());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRejectsGarbage() {
+    std::string bin = temp_path("garbage.keys");
+    {
+        std::ofstream out(bin);
+        out << "this is not a corpus, but is long enough to hold a header";
+    }
+    KeyCorpus c;
+    assert(!c.open(bin));
+    assert(!c.open(bin + ".missing"));
+    unlink(bin.c_str());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Compare startup cost of the getline loader against the corpus for a
+// synthetic YCSB-style file. Usage: unit-keycorpus NKEYS
+void benchLoad(uint64_t nkeys) {
+    std::string text = temp_path("bench.txt");
+    {
+        std::ofstream out(text);
+        for (uint64_t i = 0; i < nkeys; ++i)
+            out << "P user" << (i * 0x9E3779B97F4A7C15ULL) % 10000000000000000000ULL << "\n";
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<char*> key_dat;
+    {
+        // the old loader: getline plus one malloc per key
+        std::ifstream in(text);
+        std::string line;
+        while (std::getline(in, line))
+            if (line.rfind("P", 0) == 0) {
+                line = line.replace(0, 2, "");
+                char* k = (char*) malloc(line.size() + 1);
+                memcpy(k, line.c_str(), line.size() + 1);
+                key_dat.push_back(k);
+            }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    KeyCorpus c;
+    assert(c.open_text(text, std::thread::hardware_concurrency()));
+    auto t2 = std::chrono::steady_clock::now();
+    c.close();
+    assert(c.open_text(text, std::thread::hardware_concurrency()));
+    auto t3 = std::chrono::steady_clock::now();
+    assert(c.size() == key_dat.size());
+
+    typedef std::chrono::duration<double> secs;
+    printf("%llu keys: getline+malloc %.3f sec, convert+mmap %.3f sec, mmap %.6f sec\n",
+           (unsigned long long) nkeys, secs(t1 - t0).count(),
+           secs(t2 - t1).count(), secs(t3 - t2).count());
+    for (auto k : key_dat)
+        free(k);
+    unlink((text + ".keys").c_str());
+    unlink(text.c_str());
+}
+
+int main(int argc, char** argv) {
+    testConvert();
+    testRejectsGarbage();
+    if (argc > 1)
+        benchLoad(strtoull(argv[1], nullptr, 0));
+    return 0;
+}
@@ -0,0 +1,105 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+#include "TBox.hh"
+#include "StoKnobs.hh"
+
+static bool same(const sto_knobs& a, const sto_knobs& b) {
+    for (int i = 0; i != StoKnobs::nknobs; ++i)
+        if (StoKnobs::get(a, i) != StoKnobs::get(b, i))
+            return false;
+    return true;
+}
+
+static void write_file(const char* path, const char* text) {
+    FILE* f = fopen(path, "w");
+    assert(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+void testProfile() {
+    const char* path = "/tmp/unit-knobs.profile";
+    sto_knobs k = sto_default_knobs;
+    for (int i = 0; i != StoKnobs::nknobs; ++i)
+        assert(StoKnobs::set(k, i, StoKnobs::get(k, i) ? 0 : 1));
+    assert(!StoKnobs::set(k, StoKnobs::find("tset_hash_steps"), 3));
+    assert(StoKnobs::write(path, k, "round trip"));
+    sto_knobs r = sto_default_knobs;
+    std::string error;
+    assert(StoKnobs::read(path, r, error) && same(r, k));
+
+    // knobs a profile leaves out keep their values
+    write_file(path, "# partial\n\nbackoff_max 7  # comment\n");
+    r = k;
+    assert(StoKnobs::read(path, r, error) && r.backoff_max == 7);
+    r.backoff_max = k.backoff_max;
+    assert(same(r, k));
+
+    const char* bad[] = {"spin_bound_wait\n", "spin_bound_wait x\n", "spin_bound_wait 1 2\n",
+                         "spin_bound_wait 99\n", "no_such_knob 1\n"};
+    for (const char* text : bad) {
+        write_file(path, text);
+        error.clear();
+        assert(!StoKnobs::read(path, r, error) && error == std::string(path) + ":1: bad knob setting");
+    }
+    assert(!StoKnobs::read("/nonexistent/profile", r, error));
+    unlink(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Transfers between boxes keep their sum under every commit path
+void testSettings() {
+#if STO_RUNTIME_KNOBS
+    const int nthreads = 4, nboxes = 8, ntxns = 5000;
+    for (unsigned sort = 0; sort != 2; ++sort)
+        for (unsigned steps = 0; steps != 3; ++steps)
+            for (unsigned abort_on_locked = 0; abort_on_locked != 2; ++abort_on_locked) {
+                sto_knobs k = sto_default_knobs;
+                k.sort_writeset = sort;
+                k.tset_hash_steps = steps;
+                k.abort_on_locked = abort_on_locked;
+                assert(StoKnobs::apply(k) && same(StoKnobs::current(), k));
+                TBox<int> boxes[nboxes];
+                for (auto& b : boxes)
+                    b.nontrans_write(100);
+                std::vector<std::thread> threads;
+                for (int t = 0; t < nthreads; ++t)
+                    threads.emplace_back([&, t] {
+                        TThread::set_id(t);
+                        for (int i = 0; i < ntxns; ++i) {
+                            int a = (i * 7 + t) % nboxes, b = (i * 3 + t + 1) % nboxes;
+                            TRANSACTION {
+                                int x = boxes[a];
+                                // read again after a write: the item is
+                                // found however it is looked up
+                                boxes[a] = x - 1;
+                                boxes[b] = boxes[b] + 1;
+                                assert(boxes[a] == x - 1 || a == b);
+                            } RETRY(true);
+                        }
+                    });
+                for (auto& th : threads)
+                    th.join();
+                int sum = 0;
+                for (auto& b : boxes)
+                    sum += b.nontrans_read();
+                assert(sum == 100 * nboxes);
+            }
+    assert(StoKnobs::apply(sto_default_knobs));
+#else
+    // the knobs are constants
+    assert(!StoKnobs::apply(sto_default_knobs));
+#endif
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testProfile();
+    testSettings();
+    return 0;
+}
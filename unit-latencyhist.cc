@@ -0,0 +1,71 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "LatencyHistogram.hh"
+
+static bool close_to(uint64_t got, uint64_t want) {
+    double err = got > want ? got - want : want - got;
+    return err <= want / double(LatencyHistogram::sub_buckets) + 1;
+}
+
+void testBuckets() {
+    // bucket_of is monotone and every value lies near its bucket's value
+    int last = -1;
+    for (uint64_t v = 0; v < 1000000; v += 1 + v / 100) {
+        int b = LatencyHistogram::bucket_of(v);
+        assert(b >= last);
+        assert(close_to(LatencyHistogram::bucket_value(b), v));
+        last = b;
+    }
+    for (uint64_t v = 0; v < 2 * LatencyHistogram::sub_buckets; ++v)
+        assert(LatencyHistogram::bucket_value(LatencyHistogram::bucket_of(v)) == v);
+    assert(LatencyHistogram::bucket_of(UINT64_MAX) == LatencyHistogram::nbuckets - 1);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testPercentiles() {
+    LatencyHistogram h;
+    assert(h.count() == 0 && h.percentile(99) == 0);
+
+    std::mt19937_64 gen(1);
+    std::exponential_distribution<double> d(1.0 / 20000);
+    std::vector<uint64_t> v;
+    for (int i = 0; i < 200000; ++i) {
+        v.push_back(d(gen));
+        h.record(v.back());
+    }
+    std::sort(v.begin(), v.end());
+    for (double p : {1.0, 50.0, 90.0, 99.0, 99.9}) {
+        uint64_t want = v[size_t(p / 100 * v.size() + 0.5) - 1];
+        assert(close_to(h.percentile(p), want));
+    }
+    assert(h.percentile(0) == v.front() && h.min() == v.front());
+    assert(h.percentile(100) == v.back() && h.max() == v.back());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testMerge() {
+    LatencyHistogram a, b, all;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        (i % 3 ? a : b).record(i * 1000);
+        all.record(i * 1000);
+    }
+    a.merge(b);
+    assert(a.count() == 1000 && a.min() == 1000 && a.max() == 1000000);
+    assert(a.mean() == all.mean());
+    for (double p : {10.0, 50.0, 99.0})
+        assert(a.percentile(p) == all.percentile(p));
+    a.reset();
+    assert(a.count() == 0 && a.max() == 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testBuckets();
+    testPercentiles();
+    testMerge();
+    return 0;
+}
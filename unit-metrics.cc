@@ -0,0 +1,110 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "Metrics.hh"
+
+static const char* file = "unit-metrics.prom";
+static const char* sock = "unit-metrics.sock";
+
+static std::string slurp(const char* path) {
+    std::ifstream f(path);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+// value of the series starting with prefix, or -1
+static double value(const std::string& text, const std::string& prefix) {
+    size_t p = text.find("\n" + prefix + " ");
+    return p == std::string::npos ? -1 : atof(text.c_str() + p + prefix.size() + 2);
+}
+
+static std::string fetch(const char* request) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock);
+    assert(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+    if (*request)
+        assert(write(fd, request, strlen(request)) == ssize_t(strlen(request)));
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        out.append(buf, n);
+    close(fd);
+    return out;
+}
+
+void testLive() {
+    TBox<int> box;
+    std::atomic<uint64_t> ticks(0);
+    std::atomic<bool> done(false);
+    MetricsSampler m(0.05);
+    m.add_sto_counters();
+    m.add_counter("unit_ticks_total", "a test counter", "", [&] { return ticks.load(); });
+    assert(m.start(file, sock));
+
+    std::thread worker([&] {
+        TThread::set_id(1);
+        Sto::update_threadid();
+        while (!done) {
+            TRANSACTION {
+                box = box + 1;
+            } RETRY(true);
+            ++ticks;
+        }
+    });
+    usleep(300000);
+    // counters are visible while the workload runs
+    std::string text = slurp(file);
+    assert(text.find("# TYPE sto_txp_total counter") != std::string::npos);
+    assert(text.find("# TYPE sto_txp_per_second gauge") != std::string::npos);
+    assert(value(text, "sto_txp_total{counter=\"starts\"}") > 0);
+    assert(value(text, "unit_ticks_total") > 0);
+    assert(value(text, "unit_ticks_per_second") > 0);
+
+    std::string http = fetch("GET /metrics HTTP/1.0\r\n\r\n");
+    assert(http.compare(0, 17, "HTTP/1.0 200 OK\r\n") == 0);
+    assert(http.find("unit_ticks_total ") != std::string::npos);
+    std::string bare = fetch("");
+    assert(bare.compare(0, 7, "# HELP ") == 0);
+
+    done = true;
+    worker.join();
+    m.stop();
+    // the last sample has the final totals
+    text = slurp(file);
+    assert(value(text, "unit_ticks_total") == double(ticks));
+    assert(access(sock, F_OK) != 0);
+    unlink(file);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReset() {
+    std::atomic<uint64_t> total(1000);
+    MetricsSampler m(0.05);
+    m.add_counter("unit_resets_total", "a counter that is reset", "", [&] { return total.load(); });
+    assert(m.start("", ""));
+    usleep(120000);
+    total = 10;
+    usleep(120000);
+    m.stop();
+    // a drop is a reset, not a negative rate
+    std::string text = m.text();
+    assert(value(text, "unit_resets_total") == 10);
+    assert(value(text, "unit_resets_per_second") >= 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testLive();
+    testReset();
+    return 0;
+}
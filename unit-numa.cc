@@ -0,0 +1,95 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+#include <thread>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "NumaTopology.hh"
+
+void testCpulist() {
+    std::vector<int> v;
+    assert(NumaTopology::parse_cpulist("0-3,8,10-11", v));
+    assert((v == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    assert(NumaTopology::parse_cpulist("5", v) && v == std::vector<int>{5});
+    assert(!NumaTopology::parse_cpulist("", v));
+    assert(!NumaTopology::parse_cpulist("3-1", v));
+    assert(!NumaTopology::parse_cpulist("1,x", v));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testPlacement() {
+    // two sockets, CPUs numbered alternately as on many dual-socket boxes
+    NumaTopology t({{0, 2, 4, 6}, {1, 3, 5, 7}});
+    std::vector<int> v;
+    assert(t.nnodes() == 2 && t.node_of(4) == 0 && t.node_of(5) == 1 && t.node_of(8) == -1);
+    assert(t.place("compact", 6, v) && (v == std::vector<int>{0, 2, 4, 6, 1, 3}));
+    assert(t.place("scatter", 6, v) && (v == std::vector<int>{0, 1, 2, 3, 4, 5}));
+    assert(t.place("node:1", 6, v) && (v == std::vector<int>{1, 3, 5, 7, 1, 3}));
+    assert(t.place("7,0-1", 4, v) && (v == std::vector<int>{7, 0, 1, 7}));
+    assert(!t.place("node:2", 1, v) && !t.place("node:", 1, v) && !t.place("node:1x", 1, v));
+    assert(!t.place("sideways", 1, v));
+
+    // scatter with unequal nodes, and a node with no CPUs
+    NumaTopology u({{0, 1, 2}, {}, {3}});
+    assert(u.place("scatter", 4, v) && (v == std::vector<int>{0, 3, 1, 2}));
+    assert(!u.place("node:1", 1, v));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSystem() {
+    const NumaTopology& t = NumaTopology::system();
+    assert(t.nnodes() >= 1);
+    std::vector<int> v;
+    assert(t.place("compact", 3, v) && v.size() == 3);
+    for (int cpu : v)
+        assert(t.node_of(cpu) >= 0);
+
+    // memory policy calls may be refused (containers); they must not break
+    // the memory they're applied to
+    size_t len = 1 << 20;
+    char* p = static_cast<char*>(aligned_alloc(4096, len));
+    for (size_t i = 0; i < len; i += 4096)
+        p[i] = i;
+    t.interleave(p, len);
+    NumaTopology::bind(p, len, t.node_of(v[0]));
+    {
+        NumaTopology::interleave_guard g;
+        char* q = new char[len];
+        q[0] = q[len - 1] = 1;
+        delete[] q;
+    }
+    for (size_t i = 0; i < len; i += 4096)
+        assert(p[i] == char(i));
+    free(p);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRehome() {
+    TBox<int> box;
+    std::thread([&] {
+        TThread::set_id(1);
+        Sto::update_threadid();
+        TRANSACTION {
+            box = 1;
+        } RETRY(false);
+        Sto::rehome_thread();
+        TRANSACTION {
+            box = box + 1;
+        } RETRY(false);
+    }).join();
+    TThread::set_id(0);
+    Sto::rehome_thread();
+    TRANSACTION {
+        assert(box == 2);
+    } RETRY(false);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testCpulist();
+    testPlacement();
+    testSystem();
+    testRehome();
+    return 0;
+}
@@ -0,0 +1,83 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <atomic>
+#include <string>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "ParallelLoader.hh"
+
+void testRange() {
+    for (int nthreads : {1, 3, 8}) {
+        ParallelLoader loader(nthreads);
+        loader.partition_range(1000);
+        std::vector<std::atomic<int>> seen(1000);
+        std::atomic<int> inits(0);
+        loader.run([&](int) {
+                ++inits;
+            }, [&](int t, uint64_t i) {
+                assert(i >= 1000 * uint64_t(t) / nthreads && i < 1000 * uint64_t(t + 1) / nthreads);
+                ++seen[i];
+            });
+        assert(inits == nthreads);
+        for (auto& s : seen)
+            assert(s == 1);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testPrefix() {
+    // YCSB-style keys: a shared prefix, then digits in no particular order
+    const uint64_t n = 100000;
+    std::vector<std::string> keys;
+    for (uint64_t i = 0; i < n; ++i)
+        keys.push_back("user" + std::to_string((i * 2654435761U) % 1000000007));
+    auto key = [&](uint64_t i) {
+        return std::make_pair(keys[i].data(), keys[i].size());
+    };
+    const int nthreads = 6;
+    ParallelLoader loader(nthreads);
+    loader.partition_by_prefix(n, key);
+    assert(loader.size() == n);
+
+    std::vector<std::atomic<int>> seen(n);
+    std::vector<std::string> lo(nthreads, "\xff"), hi(nthreads, "");
+    loader.run([](int) {
+        }, [&](int t, uint64_t i) {
+            ++seen[i];
+            lo[t] = std::min(lo[t], keys[i].substr(0, 6));
+            hi[t] = std::max(hi[t], keys[i].substr(0, 6));
+        });
+    for (auto& s : seen)
+        assert(s == 1);
+    for (int t = 0; t < nthreads; ++t) {
+        // about n/T keys each, in disjoint ranges of key space
+        assert(loader.size(t) > n / nthreads * 0.8 && loader.size(t) < n / nthreads * 1.2);
+        if (t)
+            assert(hi[t - 1] < lo[t]);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testHashtableLoad() {
+    Hashtable<int, int, true> h(100000);
+    ParallelLoader loader(4);
+    loader.partition_range(100000);
+    loader.run([](int t) {
+            TThread::set_id(t);
+        }, [&](int, uint64_t i) {
+            h.nontrans_insert(i, i * 3);
+        });
+    for (int i = 0; i < 100000; ++i) {
+        int v;
+        assert(h.nontrans_find(i, v) && v == i * 3);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testRange();
+    testPrefix();
+    testHashtableLoad();
+    return 0;
+}
@@ -0,0 +1,58 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <chrono>
+#include "PerfCounters.hh"
+
+static volatile uint64_t sink;
+
+static void spin(double seconds) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    uint64_t x = 0;
+    while (std::chrono::steady_clock::now() < end)
+        for (int i = 0; i < 1000; ++i)
+            x += i * x + 1;
+    sink = x;
+}
+
+void testInheritedThreads() {
+    // threads created after the counters are opened are counted
+    PerfCounters perf;
+    perf.start();
+    for (int i = 0; i < 2; ++i)
+        std::thread(spin, 0.05).join();
+    perf.stop();
+    double task_ns = perf.value(PerfCounters::task_clock);
+    if (!perf.available(PerfCounters::task_clock))
+        assert(task_ns == -1);
+    else
+        assert(task_ns > 0.08e9 && task_ns < 1e9);
+    if (perf.available(PerfCounters::instructions))
+        assert(perf.value(PerfCounters::instructions) > 1000000);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testStartStop() {
+    PerfCounters perf;
+    perf.start();
+    spin(0.02);
+    perf.stop();
+    double first = perf.value(PerfCounters::task_clock);
+    spin(0.02);
+    // stopped counters don't move
+    assert(perf.value(PerfCounters::task_clock) == first);
+    // start() resets
+    perf.start();
+    perf.stop();
+    assert(perf.value(PerfCounters::task_clock) <= first);
+    for (int c = 0; c < PerfCounters::ncounters; ++c)
+        assert(PerfCounters::name(c) && (perf.available(c) || perf.value(c) == -1));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testInheritedThreads();
+    testStartStop();
+    return 0;
+}
@@ -78,7 +78,7 @@ int main(int argc, char* argv[]) {
     pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
     pthread_detach(advancer);
 
-    while (Transaction::global_epochs.global_epoch < nepochs + 1)
+    while (Transaction::global_epochs->global_epoch < nepochs + 1)
         usleep(useconds_t(delay * 1e6));
     stop = true;
 
@@ -0,0 +1,187 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "Hashtable.hh"
+#include "RedoLog.hh"
+#include "Checkpoint.hh"
+#include "Recovery.hh"
+
+static const char* log_dir = "unit-recovery.redo";
+static const char* ckpt_dir = "unit-recovery.d";
+
+typedef Hashtable<int, int> table_type;
+
+static void remove_files() {
+    for (auto& f : RedoLog::log_files(log_dir))
+        unlink(f.c_str());
+    unlink(RedoLog::epoch_path(log_dir).c_str());
+    rmdir(log_dir);
+    checkpoint_manifest m;
+    if (Checkpoint::read_manifest(ckpt_dir, m))
+        for (uint32_t t = 0; t < m.nfiles; ++t)
+            unlink(Checkpoint::file_path(ckpt_dir, m.id, t).c_str());
+    unlink(Checkpoint::manifest_path(ckpt_dir).c_str());
+    rmdir(ckpt_dir);
+}
+
+// Runs nthreads writers on h for a while, checkpointing midway if ckpt
+static void run_writers(table_type& h, int nkeys, Checkpoint* ckpt, RedoLog& log) {
+    const int nthreads = 3;
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&, t] {
+            TThread::set_id(t);
+            for (int i = 0; !stop; ++i) {
+                int k = (i * nthreads + t) % nkeys;
+                TRANSACTION {
+                    if (i % 4 == 3)
+                        h.transDelete(k);
+                    else
+                        h.transPut(k, i);
+                } RETRY(true);
+            }
+        });
+    usleep(200000);
+    if (ckpt)
+        assert(ckpt->write(&log));
+    usleep(300000);
+    stop = true;
+    for (auto& th : threads)
+        th.join();
+    log.stop();
+}
+
+static void check_same(table_type& a, table_type& b, int nkeys) {
+    for (int k = 0; k < nkeys; ++k) {
+        int va, vb;
+        bool fa = a.nontrans_find(k, va), fb = b.nontrans_find(k, vb);
+        assert(fa == fb);
+        if (fa)
+            assert(va == vb);
+    }
+}
+
+void testCheckpointAndLog() {
+    const int nkeys = 500;
+    table_type h(1000);
+    for (int k = 0; k < nkeys; k += 2)
+        h.nontrans_insert(k, k);
+    RedoLog log(log_dir, 2);
+    assert(log.register_object(h, 7));
+    assert(log.start());
+    Checkpoint ckpt(ckpt_dir, 2, MAX_THREADS - 2);
+    assert(ckpt.add(h, 7));
+    run_writers(h, nkeys, &ckpt, log);
+
+    table_type h2(1000);
+    Recovery rec(ckpt_dir, log_dir, 4);
+    assert(rec.add(h2, 7));
+    assert(rec.run());
+    assert(rec.records() == ckpt.manifest().records && rec.log_records() > 0);
+    check_same(h, h2, nkeys);
+    // new commits order after every recovered one
+    assert(Transaction::next_tid() > rec.max_tid());
+    remove_files();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testLogOnly() {
+    const int nkeys = 300;
+    table_type h(1000);
+    RedoLog log(log_dir, 1);
+    assert(log.register_object(h, 7));
+    assert(log.start());
+    run_writers(h, nkeys, nullptr, log);
+
+    table_type h2(1000);
+    Recovery rec("", log_dir, 2);
+    assert(rec.add(h2, 7));
+    assert(rec.run());
+    assert(rec.records() == 0);
+    check_same(h, h2, nkeys);
+
+    // records of a table nobody added fail recovery
+    Recovery bad("", log_dir, 2);
+    assert(!bad.run());
+    remove_files();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Each key is applied once, each thread applies its keys in key order,
+// and threads' key ranges don't overlap.
+void testBulkBuild() {
+    const int nkeys = 2000, nthreads = 4;
+    table_type h(1000);
+    for (int k = 0; k < nkeys; k += 2)
+        h.nontrans_insert(k, k);
+    RedoLog log(log_dir, 2);
+    assert(log.register_object(h, 7));
+    assert(log.start());
+    Checkpoint ckpt(ckpt_dir, 2, MAX_THREADS - 2);
+    assert(ckpt.add(h, 7));
+    run_writers(h, nkeys, &ckpt, log);
+
+    std::vector<std::vector<std::string>> applied(nthreads);
+    Recovery rec(ckpt_dir, log_dir, nthreads);
+    rec.add_table(7, [&](const redo_record& r, const char* key, const char*) {
+        applied[TThread::id()].push_back(std::string(key, r.key_len));
+    });
+    assert(rec.run());
+    std::vector<std::pair<std::string, std::string>> ranges;
+    size_t napplied = 0;
+    for (auto& keys : applied) {
+        for (size_t i = 1; i < keys.size(); ++i)
+            assert(keys[i - 1] < keys[i]);
+        if (!keys.empty())
+            ranges.push_back(std::make_pair(keys.front(), keys.back()));
+        napplied += keys.size();
+    }
+    std::sort(ranges.begin(), ranges.end());
+    for (size_t i = 1; i < ranges.size(); ++i)
+        assert(ranges[i - 1].second < ranges[i].first);
+    assert(ranges.size() > 1 && napplied <= size_t(nkeys));
+    assert(napplied < rec.records() + rec.log_records());
+    remove_files();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testThomasWriteRule() {
+    table_type h(10);
+    redo_record r;
+    memset(&r, 0, sizeof(r));
+    r.key_len = r.value_len = sizeof(int);
+    int k = 1, v = 5;
+    TThread::set_id(0);
+    r.tid = 10 * TransactionTid::increment_value;
+    h.recover_apply(r, reinterpret_cast<char*>(&k), reinterpret_cast<char*>(&v));
+    // older writes and removes lose
+    v = 3;
+    r.tid = 5 * TransactionTid::increment_value;
+    h.recover_apply(r, reinterpret_cast<char*>(&k), reinterpret_cast<char*>(&v));
+    r.flags = redo_record::remove_flag;
+    r.value_len = 0;
+    h.recover_apply(r, reinterpret_cast<char*>(&k), nullptr);
+    assert(h.nontrans_find(k, v) && v == 5);
+    r.tid = 20 * TransactionTid::increment_value;
+    h.recover_apply(r, reinterpret_cast<char*>(&k), nullptr);
+    assert(!h.nontrans_find(k, v));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    remove_files();
+    testCheckpointAndLog();
+    testLogOnly();
+    testBulkBuild();
+    testThomasWriteRule();
+    return 0;
+}
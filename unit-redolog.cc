@@ -0,0 +1,125 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <map>
+#include <thread>
+#include <unistd.h>
+#include "Hashtable.hh"
+#include "TBox.hh"
+#include "RedoLog.hh"
+
+static const char* dir = "unit-redolog.d";
+
+static void remove_logs() {
+    for (auto& f : RedoLog::log_files(dir))
+        unlink(f.c_str());
+    unlink(RedoLog::epoch_path(dir).c_str());
+    rmdir(dir);
+}
+
+void testReplay() {
+    typedef Hashtable<int, int> table_type;
+    const int nthreads = 4, nloggers = 2, n = 2000;
+    table_type h(1000);
+    TBox<int> box;
+    RedoLog log(dir, nloggers);
+    assert(log.register_object(h, 7));
+    // TBox doesn't log; a transaction may still write both
+    assert(!log.register_object(box, 8));
+    assert(log.start());
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&, t] {
+            TThread::set_id(t);
+            for (int i = 0; i < n; ++i) {
+                int k = (i * nthreads + t) % 500;
+                TRANSACTION {
+                    if (i % 5 == 4)
+                        h.transDelete(k);
+                    else
+                        h.transPut(k, i);
+                    box = i;
+                } RETRY(true);
+            }
+            // commits return before they're durable
+            assert(log.wait_durable(log.commit_epoch()));
+            assert(log.durable_epoch() >= log.commit_epoch());
+        });
+    for (auto& th : threads)
+        th.join();
+    log.stop();
+    assert(log.bytes() > 0);
+
+    // replaying each key's last write (by TID) rebuilds the table
+    std::map<int, std::pair<uint64_t, int>> last;   // key -> (tid, value or -1)
+    RedoLog::epoch_type max_epoch = 0;
+    size_t nrecords = 0;
+    assert(RedoLog::log_files(dir).size() == size_t(nloggers));
+    for (auto& file : RedoLog::log_files(dir)) {
+        RedoLog::reader in;
+        assert(in.open(file));
+        redo_record r;
+        std::string key, value;
+        while (in.next(r, key, value)) {
+            ++nrecords;
+            assert(r.table == 7 && r.key_len == sizeof(int));
+            assert(r.flags == redo_record::remove_flag ? r.value_len == 0 : r.value_len == sizeof(int));
+            int k = TLogCodec<int>::decode(key.data(), key.size());
+            int v = r.flags ? -1 : TLogCodec<int>::decode(value.data(), value.size());
+            auto it = last.find(k);
+            assert(it == last.end() || it->second.first != r.tid);
+            if (it == last.end() || it->second.first < r.tid)
+                last[k] = std::make_pair(r.tid, v);
+            max_epoch = std::max(max_epoch, r.epoch);
+        }
+    }
+    // every put logs; a remove logs only if the key was there
+    assert(nrecords >= size_t(nthreads * n * 4 / 5) && nrecords <= size_t(nthreads * n));
+    for (int k = 0; k < 500; ++k) {
+        int v;
+        bool found = h.nontrans_find(k, v);
+        auto it = last.find(k);
+        assert(found == (it != last.end() && it->second.second >= 0));
+        if (found)
+            assert(v == it->second.second);
+    }
+    assert(RedoLog::persistent_epoch(dir) >= max_epoch);
+    remove_logs();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testStrings() {
+    Hashtable<std::string, std::string> h(100);
+    RedoLog log(dir);
+    assert(log.register_object(h, 1));
+    assert(log.start());
+    TThread::set_id(0);
+    TRANSACTION {
+        h.transPut(std::string("key"), std::string("a longer value"));
+    } RETRY(false);
+    // a transaction that only reads logs nothing
+    TRANSACTION {
+        std::string v;
+        assert(h.transGet(std::string("key"), v));
+    } RETRY(false);
+    log.stop();
+
+    RedoLog::reader in;
+    assert(in.open(RedoLog::log_path(dir, 0, 0)));
+    redo_record r;
+    std::string key, value;
+    assert(in.next(r, key, value) && key == "key" && value == "a longer value");
+    assert(!in.next(r, key, value));
+    remove_logs();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    testReplay();
+    testStrings();
+    return 0;
+}
@@ -0,0 +1,133 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <unistd.h>
+#include "Hashtable.hh"
+#include "RequestServer.hh"
+
+static const char* path = "unit-requestserver.sock";
+
+class TestIndex : public BenchIndex {
+public:
+    TestIndex()
+        : h_(1000) {
+    }
+    bool read(uint64_t key, uint64_t& value) override {
+        return h_.transGet(key, value);
+    }
+    bool update(uint64_t key, uint64_t value) override {
+        return h_.transPut(key, value);
+    }
+    bool insert(uint64_t key, uint64_t value) override {
+        return h_.transInsert(key, value);
+    }
+    bool remove(uint64_t key) override {
+        return h_.transDelete(key);
+    }
+    void load(uint64_t key, uint64_t value) override {
+        h_.nontrans_insert(key, value);
+    }
+private:
+    Hashtable<uint64_t, uint64_t> h_;
+};
+
+static request_msg make_request(uint32_t id, int op, uint64_t key, uint64_t value = 0) {
+    request_msg r;
+    memset(&r, 0, sizeof(r));
+    r.id = id;
+    r.op = op;
+    r.key = key;
+    r.value = value;
+    return r;
+}
+
+static void receive_all(RequestClient& c, std::vector<response_msg>& out, size_t n) {
+    out.clear();
+    while (out.size() < n)
+        assert(c.receive(out));
+    assert(out.size() == n);
+}
+
+void testPipeline() {
+    TestIndex idx;
+    RequestServer server(idx, 2, std::vector<int>(), 8);
+    assert(server.start(path));
+    RequestClient c;
+    assert(c.connect(path));
+
+    // pipelined: every put before any response is read
+    std::vector<request_msg> reqs;
+    for (uint32_t i = 0; i < 100; ++i)
+        reqs.push_back(make_request(i, request_msg::put, i, i * 10));
+    assert(c.send(reqs.data(), reqs.size()));
+    std::vector<response_msg> resps;
+    receive_all(c, resps, 100);
+    for (uint32_t i = 0; i < 100; ++i)
+        assert(resps[i].id == i && resps[i].status == response_msg::ok);
+
+    reqs.clear();
+    reqs.push_back(make_request(1000, request_msg::get, 7));
+    reqs.push_back(make_request(1001, request_msg::get, 500));
+    reqs.push_back(make_request(1002, request_msg::remove, 7));
+    reqs.push_back(make_request(1003, request_msg::get, 7));
+    // the index can't scan
+    reqs.push_back(make_request(1004, request_msg::scan, 0));
+    reqs.push_back(make_request(1005, 99, 0));
+    assert(c.send(reqs.data(), reqs.size()));
+    receive_all(c, resps, reqs.size());
+    assert(resps[0].id == 1000 && resps[0].status == response_msg::ok && resps[0].value == 70);
+    assert(resps[1].status == response_msg::not_found);
+    assert(resps[2].status == response_msg::ok);
+    assert(resps[3].status == response_msg::not_found);
+    assert(resps[4].status == response_msg::bad_request && resps[5].status == response_msg::bad_request);
+    // batches hold several requests
+    assert(server.requests() == 106 && server.batches() < server.requests());
+    server.stop();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testClients() {
+    const int nclients = 4, n = 2000;
+    TestIndex idx;
+    RequestServer server(idx, 2);
+    assert(server.start(path));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nclients; ++t)
+        threads.emplace_back([&, t] {
+            RequestClient c;
+            assert(c.connect(path));
+            std::vector<request_msg> reqs;
+            std::vector<response_msg> resps;
+            for (int i = 0; i < n; ++i) {
+                // every client increments its own key's counter
+                reqs.clear();
+                reqs.push_back(make_request(2 * i, request_msg::get, t));
+                assert(c.send(reqs.data(), 1));
+                receive_all(c, resps, 1);
+                uint64_t v = resps[0].status == response_msg::ok ? resps[0].value : 0;
+                assert(v == uint64_t(i));
+                reqs[0] = make_request(2 * i + 1, request_msg::put, t, v + 1);
+                assert(c.send(reqs.data(), 1));
+                receive_all(c, resps, 1);
+                assert(resps[0].id == uint32_t(2 * i + 1));
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+    assert(server.requests() == uint64_t(2 * n * nclients));
+    server.stop();
+    // the socket is gone
+    RequestClient c;
+    assert(!c.connect(path));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    testPipeline();
+    testClients();
+    return 0;
+}
@@ -1,17 +1,161 @@
+#undef NDEBUG
 #include "sampling.hh"
 #include <iostream>
+#include <chrono>
+#include <set>
+#include <stdlib.h>
 
 using namespace StoSampling;
 
-int main() {
-    // testing a zipf distribution, generating numbers between 1 and 1000 with theta=0.8
-    StoRandomDistribution *dist = new StoZipfDistribution(1 /*seed*/, 1 /*low*/, 1000 /*high*/, 0.8 /*skew*/);
+// exact zipf pmf over ranks 1..n
+static std::vector<double> zipf_pmf(size_t n, double skew) {
+    std::vector<double> p(n);
+    double sum = 0;
+    for (size_t r = 1; r <= n; ++r)
+        sum += p[r - 1] = std::pow(double(r), -skew);
+    for (auto& x : p)
+        x /= sum;
+    return p;
+}
+
+// total variation distance between sampled frequencies and a pmf
+static double tv_distance(const std::vector<size_t>& counts, size_t nsamples, const std::vector<double>& pmf) {
+    double d = 0;
+    for (size_t i = 0; i < pmf.size(); ++i)
+        d += std::abs(double(counts[i]) / nsamples - pmf[i]);
+    return d / 2;
+}
+
+void testZipfFidelity() {
+    const size_t n = 1000, nsamples = 2000000;
+    for (double skew : {0.0, 0.5, 0.8, 0.99, 1.0, 1.2, 2.0}) {
+        StoZipfDistribution dist(1, 10, 10 + n - 1, skew);
+        std::vector<size_t> counts(n, 0);
+        for (size_t i = 0; i < nsamples; ++i) {
+            index_t x = dist.sample();
+            assert(x >= 10 && x < 10 + n);
+            ++counts[x - 10];
+        }
+        auto pmf = zipf_pmf(n, skew);
+        assert(tv_distance(counts, nsamples, pmf) < 0.01);
+        // the head of the distribution within a few standard deviations
+        for (size_t r = 0; r < 10; ++r) {
+            double expect = pmf[r] * nsamples;
+            assert(std::abs(counts[r] - expect) < 5 * std::sqrt(expect) + 1);
+        }
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testZipfLargeUniverse() {
+    // no per-index setup: a 40M-key universe is free to construct
+    auto t0 = std::chrono::steady_clock::now();
+    StoZipfDistribution dist(1, 0, 40000000 - 1, 0.99);
+    size_t rank1 = 0;
+    for (int i = 0; i < 1000000; ++i) {
+        index_t x = dist.sample();
+        assert(x < 40000000);
+        rank1 += x == 0;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    assert(secs < 5);
+    // P(rank 1) for n = 40M, skew 0.99 is 0.0507
+    assert(rank1 > 49800 && rank1 < 51700);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testZipfTranslationTable() {
+    std::vector<index_t> table;
+    for (index_t i = 0; i < 100; ++i)
+        table.push_back(1000 - i);
+    StoZipfDistribution dist(1, 0, 99, 1.0, table);
+    size_t top = 0;
+    for (int i = 0; i < 100000; ++i) {
+        index_t x = dist.sample();
+        assert(x > 900 && x <= 1000);
+        top += x == 1000;
+    }
+    assert(top > 18000 && top < 20500);  // P(rank 1) = 1/H(100) = 0.193
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testScrambledZipf() {
+    for (index_t n : {2, 3, 1000, 1024, 1025, 77777}) {
+        StoScrambledZipfDistribution dist(1, 5, 5 + n - 1, 0.99);
+        std::set<index_t> image;
+        for (index_t r = 0; r < n; ++r) {
+            index_t x = dist.permute(r);
+            assert(x < n);
+            image.insert(x);
+        }
+        assert(image.size() == n);
+    }
+
+    // same popularity profile, different positions
+    const size_t n = 1000, nsamples = 1000000;
+    StoScrambledZipfDistribution dist(1, 0, n - 1, 0.9);
+    std::vector<size_t> counts(n, 0);
+    for (size_t i = 0; i < nsamples; ++i)
+        ++counts[dist.sample()];
+    std::vector<size_t> by_rank(n);
+    for (size_t r = 0; r < n; ++r)
+        by_rank[r] = counts[dist.permute(r)];
+    assert(tv_distance(by_rank, nsamples, zipf_pmf(n, 0.9)) < 0.01);
+    printf("PASS: %s\n", __FUNCTION__);
+}
 
-    for (int i = 0; i < 1000; ++i)
-        std::cout << dist->sample() << ", ";
-    std::cout << std::endl;
+void testHotspot() {
+    const size_t nsamples = 1000000;
+    StoHotspotDistribution dist(1, 100, 1099, 0.2, 0.8);
+    size_t hot = 0;
+    std::vector<size_t> counts(1000, 0);
+    for (size_t i = 0; i < nsamples; ++i) {
+        index_t x = dist.sample();
+        assert(x >= 100 && x < 1100);
+        ++counts[x - 100];
+        hot += x < 300;
+    }
+    assert(std::abs(double(hot) / nsamples - 0.8) < 0.005);
+    // uniform within each part
+    assert(counts[0] > 3600 && counts[0] < 4400);
+    assert(counts[999] > 200 && counts[999] < 300);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Setup and sampling cost of the rejection-inversion sampler against the
+// pmf-table sampler it replaced. Usage: unit-sampling NKEYS
+void benchZipf(size_t n) {
+    const size_t nsamples = 10000000;
+    typedef std::chrono::duration<double> secs;
+    size_t sum = 0;
 
-    delete dist;
+    auto t0 = std::chrono::steady_clock::now();
+    std::mt19937 gen(1);
+    auto pmf = zipf_pmf(n, 0.99);
+    std::discrete_distribution<index_t> table(pmf.begin(), pmf.end());
+    auto t1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nsamples; ++i)
+        sum += table(gen);
+    auto t2 = std::chrono::steady_clock::now();
+    StoZipfDistribution dist(1, 0, n - 1, 0.99);
+    auto t3 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nsamples; ++i)
+        sum += dist.sample();
+    auto t4 = std::chrono::steady_clock::now();
+
+    printf("zipf over %zu keys: pmf table setup %.3f sec, %.1f ns/sample; "
+           "rejection-inversion setup %.6f sec, %.1f ns/sample (%zu)\n",
+           n, secs(t1 - t0).count(), secs(t2 - t1).count() * 1e9 / nsamples,
+           secs(t3 - t2).count(), secs(t4 - t3).count() * 1e9 / nsamples, sum % 10);
+}
 
+int main(int argc, char** argv) {
+    testZipfFidelity();
+    testZipfLargeUniverse();
+    testZipfTranslationTable();
+    testScrambledZipf();
+    testHotspot();
+    if (argc > 1)
+        benchZipf(strtoull(argv[1], nullptr, 0));
     return 0;
 }
@@ -0,0 +1,252 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "SharedHashtable.hh"
+
+static const char* path = "unit-sharedregion.shm";
+
+typedef SharedHashtable<int, int> table_type;
+
+static void start_epoch_advancer() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+}
+
+// Runs f in a child process and returns its exit status. The child maps
+// the region itself, so it sees it at another address than the parent.
+template <typename F>
+static pid_t spawn(F f) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        start_epoch_advancer();
+        SharedRegion r;
+        bool ok = r.open(path) && f(r);
+        r.close();
+        _exit(ok ? 0 : 1);
+    }
+    return pid;
+}
+
+static bool wait_ok(pid_t pid) {
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void testOffsets() {
+    SharedRegion r;
+    assert(r.create(path, 1 << 20));
+    {
+        table_type h(r, "t", 64);
+        assert(h.ok());
+        for (int i = 0; i < 100; ++i)
+            assert(h.nontrans_insert(i, i * 2));
+        assert(!h.nontrans_insert(5, 0));
+    }
+    // another mapping finds the same table
+    SharedRegion r2;
+    assert(r2.open(path));
+    assert(r2.find("t") && r.find("t") != r2.find("t"));
+    table_type h2(r2, "t");
+    assert(h2.nbuckets() == 64 && h2.nontrans_size() == 100);
+    int v;
+    assert(h2.nontrans_find(7, v) && v == 14);
+    assert(!h2.nontrans_find(100, v));
+
+    // freed blocks are reused
+    void* p = r.allocate(40);
+    size_t used = r.used();
+    SharedRegion::deallocate(p);
+    assert(r.allocate(48) == p && r.used() == used);
+    assert(!r.allocate(2 << 20));
+    // retired blocks wait until every attached process is past the epoch
+    assert(wait_ok(spawn([](SharedRegion& r) {
+        void* q = r.allocate(48);
+        if (r.attach_transactions(1) < 0)
+            return false;
+        r.retire(q);
+        bool waited = r.allocate(48) != q;
+        usleep(400000);
+        return waited && r.allocate(48) == q;
+    })));
+    r2.close();
+    r.close();
+    SharedRegion::remove(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testFull() {
+    SharedRegion r;
+    assert(r.create(path, 64 << 10));
+    assert(r.attach_transactions(1) == 0);
+    TThread::set_id(0);
+    table_type h(r, "t", 16);
+    assert(h.ok());
+    int n = 0;
+    bool full = false;
+    while (!full) {
+        try {
+            TRANSACTION {
+                h.transInsert(n, n);
+                h.transInsert(n + 1, n + 1);
+            } RETRY(true);
+            n += 2;
+        } catch (std::bad_alloc&) {
+            full = true;
+        }
+    }
+    // the failed transaction left nothing behind, and others still run
+    assert(n > 0 && !TThread::txn->in_progress());
+    assert(h.nontrans_size() == size_t(n));
+    int v;
+    TRANSACTION {
+        assert(h.transGet(n - 1, v) && !h.transGet(n, v));
+        h.transPut(0, 42);
+    } RETRY(true);
+    assert(h.nontrans_find(0, v) && v == 42);
+    r.detach_transactions();
+    r.close();
+    SharedRegion::remove(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testProcesses() {
+    const int nprocs = 3, nthreads = 2, nkeys = 10, n = 2000;
+    SharedRegion r;
+    assert(r.create(path, 4 << 20));
+    {
+        table_type h(r, "counters", 16);
+        for (int k = 0; k < nkeys; ++k)
+            assert(h.nontrans_insert(k, 0));
+    }
+    std::vector<pid_t> pids;
+    for (int p = 0; p < nprocs; ++p)
+        pids.push_back(spawn([=](SharedRegion& r) {
+            int first = r.attach_transactions(nthreads);
+            if (first < 0)
+                return false;
+            table_type h(r, "counters");
+            std::vector<std::thread> threads;
+            for (int t = 0; t < nthreads; ++t)
+                threads.emplace_back([&, t] {
+                    TThread::set_id(first + t);
+                    for (int i = 0; i < n; ++i) {
+                        // move a unit between two keys, and churn a
+                        // private key through insert and delete
+                        int a = (i + p) % nkeys, b = (a + 1 + (i * 7 + t) % (nkeys - 1)) % nkeys;
+                        int priv = 1000 + (first + t) * 10 + (i / 2) % 10;
+                        TRANSACTION {
+                            int va, vb;
+                            assert(h.transGet(a, va) && h.transGet(b, vb));
+                            h.transPut(a, va - 1);
+                            h.transPut(b, vb + 1);
+                            if (i % 2)
+                                h.transDelete(priv);
+                            else
+                                h.transInsert(priv, i);
+                        } RETRY(true);
+                        TRANSACTION {
+                            int va;
+                            assert(h.transGet(a, va));
+                            h.transPut(a, va + 1);
+                        } RETRY(true);
+                    }
+                });
+            for (auto& th : threads)
+                th.join();
+            return true;
+        }));
+    for (auto pid : pids)
+        assert(wait_ok(pid));
+
+    // each transaction added 1 in total
+    table_type h(r, "counters");
+    int sum = 0, v;
+    for (int k = 0; k < nkeys; ++k) {
+        assert(h.nontrans_find(k, v));
+        sum += v;
+    }
+    assert(sum == nprocs * nthreads * n);
+    // private keys ended deleted
+    assert(h.nontrans_size() == size_t(nkeys));
+    // commit TIDs came from the shared counter
+    SharedRegion r2;
+    assert(r2.open(path));
+    assert(r2.attach_transactions(MAX_THREADS) == 0);
+    assert(Transaction::next_tid() > TransactionTid::type(2 * nprocs * nthreads * n) * TransactionTid::increment_value);
+    r2.detach_transactions();
+    r2.close();
+    r.close();
+    SharedRegion::remove(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testEpochs() {
+    // every process runs an advancer, but epochs pass at one's pace
+    // (every 100 ms)
+    SharedRegion r;
+    assert(r.create(path, 1 << 20));
+    std::vector<pid_t> pids;
+    for (int p = 0; p < 3; ++p)
+        pids.push_back(spawn([](SharedRegion& r) {
+            if (r.attach_transactions(1) < 0)
+                return false;
+            auto e0 = Transaction::global_epochs->global_epoch;
+            usleep(1500000);
+            auto n = Transaction::global_epochs->global_epoch - e0;
+            return n >= 5 && n <= 22;
+        }));
+    for (auto pid : pids)
+        assert(wait_ok(pid));
+    r.close();
+    SharedRegion::remove(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testThreadIds() {
+    SharedRegion r, r2;
+    assert(r.create(path, 1 << 20));
+    assert(r.attach_transactions(20) == 0);
+    r.detach_transactions();
+    // a live process holds its range
+    int to_parent[2], to_child[2];
+    assert(pipe(to_parent) == 0 && pipe(to_child) == 0);
+    pid_t pid = spawn([=](SharedRegion& r) {
+        int first = r.attach_transactions(20);
+        char c = first;
+        if (write(to_parent[1], &c, 1) != 1)
+            return false;
+        // wait until the parent has tried
+        return read(to_child[0], &c, 1) == 1 && first == 0;
+    });
+    char c;
+    assert(read(to_parent[0], &c, 1) == 1 && c == 0);
+    assert(r2.open(path));
+    assert(r2.attach_transactions(20) == -1);
+    assert(r2.attach_transactions(12) == 20);
+    r2.detach_transactions();
+    assert(write(to_child[1], &c, 1) == 1);
+    assert(wait_ok(pid));
+    assert(r2.attach_transactions(20) == 0);
+    r2.detach_transactions();
+    for (int fd : {to_parent[0], to_parent[1], to_child[0], to_child[1]})
+        close(fd);
+    r2.close();
+    r.close();
+    SharedRegion::remove(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testOffsets();
+    testFull();
+    testProcesses();
+    testEpochs();
+    testThreadIds();
+    return 0;
+}
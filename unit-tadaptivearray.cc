@@ -0,0 +1,172 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include "Transaction.hh"
+#include "TAdaptiveArray.hh"
+
+typedef TAdaptiveArray<int, 16> array_type;
+
+// Make slot i fail validation until it leaves optimistic mode.
+static void heat(array_type& f, unsigned i) {
+    while (f.nontrans_mode(i) == array_type::mode_optimistic) {
+        TestTransaction t1(1);
+        int x = f[i];
+        f[0] = x;
+
+        TestTransaction t2(2);
+        f[i] = x + 1;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+}
+
+void testSimpleInt() {
+    array_type f;
+
+    {
+        TransactionGuard t;
+        f[1] = 100;
+    }
+
+    {
+        TransactionGuard t2;
+        int f_read = f[1];
+        assert(f_read == 100);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSwitchToShared() {
+    array_type f;
+    heat(f, 1);
+    assert(f.nontrans_mode(1) == array_type::mode_shared);
+    assert(f.pessimistic_switches() == 1);
+    int before = f.nontrans_get(1);
+
+    {
+        // a locked read is not invalidated by a later writer: the writer
+        // cannot commit while the lock is held
+        TestTransaction t1(1);
+        int x = f[1];
+        f[2] = x;
+
+        TestTransaction t2(2);
+        f[1] = 7;
+        assert(!t2.try_commit());
+
+        assert(t1.try_commit());
+    }
+
+    {
+        TestTransaction t3(3);
+        f[1] = 8;
+        assert(t3.try_commit());
+    }
+    assert(f.nontrans_get(1) == 8);
+    assert(f.nontrans_get(2) == before);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testUpgradeToExclusive() {
+    array_type f;
+    heat(f, 1);
+
+    {
+        TestTransaction t1(1);
+        int x = f[1];
+        f[1] = x + 1;
+
+        TestTransaction t2(2);
+        int y = f[1];
+        f[1] = y + 1;
+
+        // both hold shared locks; neither can upgrade
+        assert(!t2.try_commit());
+        assert(f.nontrans_mode(1) == array_type::mode_exclusive);
+        assert(t1.try_commit());
+    }
+
+    try {
+        TestTransaction t1(1);
+        int x = f[1];
+        f[1] = x + 1;
+
+        TestTransaction t2(2);
+        int y = f[1];
+        (void) y;
+        assert(false && "shouldn't get here");
+    } catch (Transaction::Abort e) {
+    }
+
+    {
+        TransactionGuard t;
+        int x = f[1];
+        f[1] = x + 1;
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testCooldown() {
+    array_type f;
+    heat(f, 1);
+    for (int i = 0; i < array_type::score_max
+             && f.nontrans_mode(1) != array_type::mode_optimistic; ++i) {
+        TransactionGuard t;
+        int x = f[1];
+        (void) x;
+    }
+    assert(f.nontrans_mode(1) == array_type::mode_optimistic);
+    assert(f.optimistic_switches() == 1);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrentIncrements() {
+    static array_type f;
+    const int nthreads = 4, ntrans = 100000;
+    // start with the hot slot pessimistic so both paths get exercised
+    heat(f, 0);
+    f.nontrans_put(0, 0);
+    std::vector<std::thread> thrs;
+    for (int tid = 0; tid < nthreads; ++tid)
+        thrs.emplace_back([=]() {
+            TThread::set_id(tid);
+            Sto::update_threadid();
+            for (int i = 0; i < ntrans; ++i) {
+                TRANSACTION {
+                    int x = f[0];
+                    f[0] = x + 1;
+                    int y = f[1 + (i % 15)];
+                    f[1 + (i % 15)] = y + 1;
+                } RETRY(true);
+            }
+        });
+    for (auto& t : thrs)
+        t.join();
+
+    int sum = 0;
+    for (unsigned i = 1; i < f.size(); ++i)
+        sum += f.nontrans_get(i);
+    assert(f.nontrans_get(0) == nthreads * ntrans);
+    assert(sum == nthreads * ntrans);
+    printf("mode switches: %llu to pessimistic, %llu to optimistic\n",
+           (unsigned long long) f.pessimistic_switches(),
+           (unsigned long long) f.optimistic_switches());
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimpleInt();
+    testSwitchToShared();
+    testUpgradeToExclusive();
+    testCooldown();
+    testConcurrentIncrements();
+    return 0;
+}
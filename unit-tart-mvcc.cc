@@ -0,0 +1,273 @@
+#undef NDEBUG
+#undef TART_MVCC
+#define TART_MVCC 1
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <time.h>
+#include <unistd.h>
+#include "Transaction.hh"
+#include "TART.hh"
+
+// TART_MVCC: snapshot lookups and scans, deletes that wait to be unlinked,
+// and re-inserts of deleted keys.
+//
+// A value holds its key in the low 32 bits and an amount in the high 32,
+// so the key can be loaded from any version of a record.
+
+typedef TART<uint64_t> tart_type;
+
+static TID value(uint32_t key, uint32_t amount) {
+    return TID(key) | (TID(amount) << 32);
+}
+static uint32_t amount(TID val) {
+    return val >> 32;
+}
+
+static void make_key(uint32_t key, Key& k) {
+    uint64_t be = __builtin_bswap64(key);
+    k.set(reinterpret_cast<const char*>(&be), sizeof(be));
+}
+
+static void loadKey(TID tid, Key& k) {
+    make_key(uint32_t(tart_type::getTIDFromRec(tid)), k);
+}
+
+static TID lookup(tart_type& t, uint32_t key, ThreadInfo& ti) {
+    Key k;
+    make_key(key, k);
+    auto r = t.t_lookup(k, ti);
+    if (!std::get<1>(r))
+        Sto::abort();
+    return std::get<0>(r);
+}
+static TID snapshot_lookup(tart_type& t, uint32_t key, ThreadInfo& ti) {
+    Key k;
+    make_key(key, k);
+    return std::get<0>(t.t_lookup_snapshot(k, ti));
+}
+static void insert(tart_type& t, uint32_t key, uint32_t amt, ThreadInfo& ti) {
+    Key k;
+    make_key(key, k);
+    if (!std::get<1>(t.t_insert(k, value(key, amt), ti)))
+        Sto::abort();
+}
+static bool remove(tart_type& t, uint32_t key, TID val, ThreadInfo& ti) {
+    Key k;
+    make_key(key, k);
+    auto r = t.t_remove(k, val, ti);
+    if (!std::get<1>(r))
+        Sto::abort();
+    return std::get<0>(r);
+}
+
+// Lets the epoch advancer pass two epochs, then starts a transaction so
+// this thread's RCU callbacks, pending unlinks included, run.
+static void run_rcu() {
+    auto e = Transaction::global_epochs->global_epoch;
+    while (Transaction::global_epochs->global_epoch < e + 3)
+        usleep(10000);
+    TRANSACTION {
+    } RETRY(true);
+}
+
+void testSnapshotLookup() {
+    tart_type t(loadKey);
+    auto ti = t.getThreadInfo();
+    TRANSACTION {
+        for (uint32_t key = 1; key <= 3; ++key)
+            insert(t, key, 10, ti);
+    } RETRY(true);
+
+    {
+        TestTransaction t1(1);
+        assert(snapshot_lookup(t, 1, ti) == value(1, 10));
+
+        TestTransaction t2(2);
+        insert(t, 1, 11, ti);
+        assert(remove(t, 2, value(2, 10), ti));
+        insert(t, 4, 10, ti);
+        assert(t2.try_commit());
+
+        // t1 sees its snapshot: the old value, the deleted key, not the
+        // inserted one
+        t1.use();
+        assert(snapshot_lookup(t, 1, ti) == value(1, 10));
+        assert(snapshot_lookup(t, 2, ti) == value(2, 10));
+        assert(snapshot_lookup(t, 4, ti) == 0);
+        assert(t1.try_commit());
+    }
+
+    TRANSACTION {
+        assert(snapshot_lookup(t, 1, ti) == value(1, 11));
+        assert(snapshot_lookup(t, 2, ti) == 0);
+        assert(snapshot_lookup(t, 4, ti) == value(4, 10));
+        // OCC lookups agree
+        assert(lookup(t, 2, ti) == 0 && lookup(t, 4, ti) == value(4, 10));
+    } RETRY(true);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDeleteReinsert() {
+    tart_type t(loadKey);
+    auto ti = t.getThreadInfo();
+    TRANSACTION {
+        insert(t, 1, 1, ti);
+    } RETRY(true);
+
+    {
+        TestTransaction before(1);
+        assert(snapshot_lookup(t, 1, ti) == value(1, 1));
+
+        TestTransaction t2(2);
+        assert(remove(t, 1, value(1, 1), ti));
+        assert(t2.try_commit());
+
+        TestTransaction between(3);
+        assert(snapshot_lookup(t, 1, ti) == 0);
+
+        // the deleted record is still in the tree; inserting revives it
+        TestTransaction t4(4);
+        assert(lookup(t, 1, ti) == 0);
+        insert(t, 1, 2, ti);
+        assert(t4.try_commit());
+
+        before.use();
+        assert(snapshot_lookup(t, 1, ti) == value(1, 1));
+        assert(before.try_commit());
+        between.use();
+        assert(snapshot_lookup(t, 1, ti) == 0);
+        assert(between.try_commit());
+    }
+
+    // the revived record is not unlinked; a later delete is, and the key
+    // can be inserted again after that
+    run_rcu();
+    TRANSACTION {
+        assert(lookup(t, 1, ti) == value(1, 2));
+        assert(remove(t, 1, value(1, 2), ti));
+    } RETRY(true);
+    run_rcu();
+    TRANSACTION {
+        assert(lookup(t, 1, ti) == 0 && snapshot_lookup(t, 1, ti) == 0);
+        insert(t, 1, 3, ti);
+    } RETRY(true);
+    TRANSACTION {
+        assert(lookup(t, 1, ti) == value(1, 3) && snapshot_lookup(t, 1, ti) == value(1, 3));
+    } RETRY(true);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDestroyWithPendingUnlinks() {
+    TThread::set_id(0);
+    {
+        tart_type t(loadKey);
+        auto ti = t.getThreadInfo();
+        TRANSACTION {
+            for (uint32_t key = 1; key <= 10; ++key)
+                insert(t, key, 0, ti);
+        } RETRY(true);
+        TRANSACTION {
+            for (uint32_t key = 1; key <= 10; ++key)
+                assert(remove(t, key, value(key, 0), ti));
+        } RETRY(true);
+    }
+    // the unlinks find the tree gone
+    run_rcu();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Writers move amounts between keys, and move whole keys by deleting one
+// and inserting another, so every committed state has nkeys keys and the
+// same total. Scanners check both; OCC scans abort when a scanned key
+// changes, snapshot scans never do.
+template <bool Snapshot>
+static void runScans(const char* name) {
+    const uint32_t keyspace = 400, nkeys = 200, start_amount = 10;
+    tart_type t(loadKey);
+    auto ti = t.getThreadInfo();
+    TThread::set_id(0);
+    TRANSACTION {
+        for (uint32_t key = 1; key <= nkeys; ++key)
+            insert(t, 2 * key, start_amount, ti);
+    } RETRY(true);
+
+    std::atomic<bool> stop(false);
+    unsigned long writes = 0, scans = 0, attempts = 0;
+    std::thread writer([&]() {
+        TThread::set_id(1);
+        Sto::update_threadid();
+        auto ti = t.getThreadInfo();
+        unsigned x = 1;
+        while (!stop) {
+            x = x * 1103515245 + 12345;
+            uint32_t a = 1 + (x >> 8) % keyspace, b = 1 + (x >> 18) % keyspace;
+            if (a == b)
+                continue;
+            TRANSACTION {
+                TID va = lookup(t, a, ti), vb = lookup(t, b, ti);
+                if (va && vb && amount(va)) {
+                    insert(t, a, amount(va) - 1, ti);
+                    insert(t, b, amount(vb) + 1, ti);
+                } else if (va && !vb) {
+                    assert(remove(t, a, va, ti));
+                    insert(t, b, amount(va), ti);
+                }
+            } RETRY(true);
+            ++writes;
+        }
+    });
+    std::thread scanner([&]() {
+        TThread::set_id(2);
+        Sto::update_threadid();
+        auto ti = t.getThreadInfo();
+        std::vector<TID> result(keyspace + 1);
+        Key start, end, cont;
+        make_key(0, start);
+        make_key(keyspace + 1, end);
+        while (!stop) {
+            std::size_t found;
+            uint64_t total;
+            TRANSACTION {
+                ++attempts;
+                total = 0;
+                bool ok = std::get<1>(Snapshot
+                    ? t.t_lookupRange_snapshot(start, end, cont, result.data(), result.size(), found, ti)
+                    : t.t_lookupRange(start, end, cont, result.data(), result.size(), found, ti));
+                if (!ok)
+                    Sto::abort();
+                for (std::size_t i = 0; i != found; ++i)
+                    total += amount(Snapshot ? result[i] : tart_type::getTIDFromRec(result[i]));
+            } RETRY(true);
+            assert(found == nkeys && total == nkeys * start_amount);
+            ++scans;
+        }
+    });
+
+    struct timespec ts = {0, 500000000};
+    nanosleep(&ts, nullptr);
+    stop = true;
+    writer.join();
+    scanner.join();
+    printf("%s: %lu writer commits, %lu/%lu scan commits/attempts\n",
+           name, writes, scans, attempts);
+}
+
+int main() {
+    pthread_t advancer;
+    Transaction::global_epochs->run = true;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+
+    testSnapshotLookup();
+    testDeleteReinsert();
+    testDestroyWithPendingUnlinks();
+    runScans<false>("TART t_lookupRange()");
+    runScans<true>("TART t_lookupRange_snapshot()");
+
+    Transaction::global_epochs->run = false;
+    pthread_join(advancer, NULL);
+    return 0;
+}
@@ -6,6 +6,9 @@
 #include "Transaction.hh"
 #include "TBox.hh"
 #include "StringWrapper.hh"
+#include <thread>
+#include <atomic>
+#include <time.h>
 
 #define GUARDED if (TransactionGuard tguard{})
 
@@ -245,6 +248,182 @@ void testStringWrapper() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testMvSnapshotRead() {
+    TMvBox<int> a, b;
+    a.nontrans_write(1);
+    b.nontrans_write(1);
+
+    {
+        TestTransaction t1(1);
+        assert(a.snapshot_read() == 1);
+
+        TestTransaction t2(2);
+        a = 2;
+        b = 2;
+        assert(t2.try_commit());
+
+        // t1 keeps reading its snapshot, including b, which it had not
+        // touched before t2 committed
+        t1.use();
+        assert(a.snapshot_read() == 1);
+        assert(b.snapshot_read() == 1);
+        assert(t1.try_commit());
+    }
+
+    {
+        TransactionGuard t3;
+        assert(a.snapshot_read() == 2);
+        assert(b.snapshot_read() == 2);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testMvSnapshotString() {
+    TMvBox<std::string> f;
+    f.nontrans_write("0");
+
+    TestTransaction t1(1);
+    assert(f.snapshot_read() == "0");
+    for (int i = 1; i < 10; ++i) {
+        TestTransaction t(2);
+        f = std::to_string(i);
+        assert(t.try_commit());
+    }
+    t1.use();
+    assert(f.snapshot_read() == "0");
+    assert(t1.try_commit());
+    assert(f.nontrans_read() == "9");
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testMvTrim() {
+    TMvBox<int> f;
+    auto saved = Transaction::global_epochs->snapshot_tid;
+
+    // no snapshot is older than now: install keeps just one old version
+    for (int i = 0; i < 10; ++i) {
+        TransactionGuard t;
+        f = i;
+    }
+    {
+        TransactionGuard t;
+        Transaction::global_epochs->snapshot_tid = Sto::transaction()->snapshot_tid();
+    }
+    {
+        TransactionGuard t;
+        f = 10;
+    }
+    assert(f.nontrans_history_length() == 1);
+
+    Transaction::global_epochs->snapshot_tid = saved;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Long read-only transactions over many boxes, racing a writer. Optimistic
+// readers abort whenever a box they read is overwritten; snapshot readers
+// never do.
+template <typename B, typename F>
+static void runLongReaders(const char* name, F read) {
+    const int nboxes = 1000;
+    std::vector<B> boxes(nboxes);
+    std::atomic<bool> stop(false);
+    unsigned long writes = 0, reads = 0, attempts = 0;
+
+    std::thread writer([&]() {
+        TThread::set_id(1);
+        Sto::update_threadid();
+        unsigned x = 1;
+        while (!stop) {
+            x = x * 1103515245 + 12345;
+            TRANSACTION {
+                boxes[(x >> 8) % nboxes] = int(x);
+            } RETRY(true);
+            ++writes;
+        }
+    });
+    std::thread reader([&]() {
+        TThread::set_id(2);
+        Sto::update_threadid();
+        while (!stop) {
+            TRANSACTION {
+                ++attempts;
+                long sum = 0;
+                for (auto& b : boxes)
+                    sum += read(b);
+                (void) sum;
+            } RETRY(true);
+            ++reads;
+        }
+    });
+
+    struct timespec ts = {0, 500000000};
+    nanosleep(&ts, nullptr);
+    stop = true;
+    writer.join();
+    reader.join();
+    printf("%s: %lu writer commits, %lu/%lu long-reader commits/attempts\n",
+           name, writes, reads, attempts);
+}
+
+// Snapshot reads of heap-allocated values racing installs that replace
+// them; a reader must never copy a string while it is overwritten.
+static void testMvStringRace() {
+    TMvBox<std::string> box(std::string(16, 'a'));
+    std::atomic<bool> stop(false);
+    unsigned long reads = 0;
+
+    std::thread writer([&]() {
+        TThread::set_id(1);
+        Sto::update_threadid();
+        unsigned x = 1;
+        while (!stop) {
+            x = x * 1103515245 + 12345;
+            TRANSACTION {
+                box = std::string(16 + (x >> 8) % 200, 'a' + (x >> 16) % 26);
+            } RETRY(true);
+        }
+    });
+    std::thread reader([&]() {
+        TThread::set_id(2);
+        Sto::update_threadid();
+        while (!stop) {
+            TRANSACTION {
+                std::string v = box.snapshot_read();
+                assert(v.size() >= 16 && v.size() < 216);
+                assert(v.find_first_not_of(v[0]) == std::string::npos);
+            } RETRY(true);
+            ++reads;
+        }
+    });
+
+    struct timespec ts = {0, 300000000};
+    nanosleep(&ts, nullptr);
+    stop = true;
+    writer.join();
+    reader.join();
+    assert(reads > 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void benchMvLongReaders() {
+    pthread_t advancer;
+    Transaction::global_epochs->run = true;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+
+    testMvStringRace();
+    runLongReaders<TBox<int> >("TBox read()", [](TBox<int>& b) {
+            return b.read();
+        });
+    runLongReaders<TMvBox<int> >("TMvBox snapshot_read()", [](TMvBox<int>& b) {
+            return b.snapshot_read();
+        });
+
+    Transaction::global_epochs->run = false;
+    pthread_join(advancer, NULL);
+}
+
 int main() {
     testSimpleInt();
     testSimpleString();
@@ -252,5 +431,9 @@ int main() {
     testOpacity1();
     testNoOpacity1();
     testStringWrapper();
+    testMvSnapshotRead();
+    testMvSnapshotString();
+    testMvTrim();
+    benchMvLongReaders();
     return 0;
 }
@@ -0,0 +1,237 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <time.h>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "TRowBox.hh"
+
+// a 256-byte stats row: one line of counters, then three lines of history
+struct stats_row {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t pad0[6];
+    uint64_t history[24];
+};
+
+static_assert(sizeof(stats_row) == 256, "stats_row should span four lines");
+
+std::ostream& operator<<(std::ostream& w, const stats_row& r) {
+    return w << "{" << r.hits << "/" << r.misses << "}";
+}
+
+static stats_row make_row(uint64_t x) {
+    stats_row r;
+    r.hits = r.misses = x;
+    for (auto& w : r.pad0)
+        w = x;
+    for (auto& w : r.history)
+        w = x;
+    return r;
+}
+
+static bool row_is(const stats_row& r, uint64_t x) {
+    stats_row y = make_row(x);
+    return memcmp(&r, &y, sizeof(r)) == 0;
+}
+
+void testSimpleRow() {
+    TRowBox<stats_row> f;
+
+    {
+        TransactionGuard t;
+        f.write(make_row(7));
+    }
+
+    {
+        TransactionGuard t2;
+        assert(row_is(f.read(), 7));
+        assert(f.read(&stats_row::misses) == 7);
+        f.write(&stats_row::hits, uint64_t(8));
+        assert(f.read(&stats_row::hits) == 8);
+        stats_row r = f.read(f.mask_of(&stats_row::hits));
+        assert(r.hits == 8 && r.misses == 7 && r.history[0] == 0);
+    }
+    assert(f.nontrans_read().hits == 8);
+    assert(f.nontrans_read().history[23] == 7);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testFieldConflicts() {
+    TRowBox<stats_row> f;
+    TRowBox<stats_row> g;
+
+    {
+        // a write to another line does not invalidate a field read
+        TestTransaction t1(1);
+        uint64_t x = f.read(&stats_row::hits);
+        g.write(&stats_row::hits, x);
+
+        TestTransaction t2(2);
+        f.write(&stats_row::history, make_row(3).history);
+        assert(t2.try_commit());
+
+        assert(t1.try_commit());
+    }
+
+    {
+        // a write to the same line does
+        TestTransaction t1(1);
+        uint64_t x = f.read(&stats_row::hits);
+        g.write(&stats_row::hits, x);
+
+        TestTransaction t2(2);
+        f.write(&stats_row::misses, uint64_t(4));
+        assert(t2.try_commit());
+
+        assert(!t1.try_commit());
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testBlindWritesMerge() {
+    TRowBox<stats_row> f(make_row(1));
+
+    {
+        // blind writes to different fields of one line both survive
+        TestTransaction t1(1);
+        f.write(&stats_row::hits, uint64_t(10));
+
+        TestTransaction t2(2);
+        f.write(&stats_row::misses, uint64_t(20));
+        assert(t2.try_commit());
+
+        assert(t1.try_commit());
+    }
+    assert(f.nontrans_read().hits == 10);
+    assert(f.nontrans_read().misses == 20);
+    assert(f.nontrans_read().pad0[0] == 1);
+
+    {
+        // a read of a partly written line merges in the rest
+        TransactionGuard t;
+        f.write(&stats_row::hits, uint64_t(11));
+        stats_row r = f.read();
+        assert(r.hits == 11 && r.misses == 20 && r.history[5] == 1);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testBoxReadField() {
+    TBox<stats_row> f;
+
+    {
+        TransactionGuard t;
+        f = make_row(5);
+    }
+
+    {
+        TransactionGuard t2;
+        assert(f.read(&stats_row::misses) == 5);
+        assert(row_is(f.read(), 5));
+    }
+
+    {
+        // field reads still conflict with any write to the box
+        TestTransaction t1(1);
+        uint64_t x = f.read(&stats_row::hits);
+        TBox<int> g;
+        g = int(x);
+
+        TestTransaction t2(2);
+        f = make_row(6);
+        assert(t2.try_commit());
+
+        assert(!t1.try_commit());
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// A writer rewrites whole rows while a reader checks every row it reads is
+// untorn. Reports how many readers had to retry.
+template <typename B, typename F>
+static void runTornReads(const char* name, F read) {
+    const int nrows = 64;
+    std::vector<B> rows(nrows);
+    std::atomic<bool> stop(false);
+    unsigned long writes = 0, reads = 0, attempts = 0;
+
+    std::thread writer([&]() {
+        TThread::set_id(1);
+        Sto::update_threadid();
+        unsigned x = 1;
+        while (!stop) {
+            x = x * 1103515245 + 12345;
+            TRANSACTION {
+                rows[(x >> 8) % nrows] = make_row(x);
+            } RETRY(true);
+            ++writes;
+        }
+    });
+    std::thread reader([&]() {
+        TThread::set_id(2);
+        Sto::update_threadid();
+        while (!stop) {
+            uint64_t sum;
+            TRANSACTION {
+                ++attempts;
+                sum = 0;
+                for (auto& r : rows)
+                    sum += read(r);
+            } RETRY(true);
+            (void) sum;
+            ++reads;
+        }
+    });
+
+    struct timespec ts = {0, 200000000};
+    nanosleep(&ts, nullptr);
+    stop = true;
+    writer.join();
+    reader.join();
+    printf("%s: %lu writer commits, %lu/%lu reader commits/attempts\n",
+           name, writes, reads, attempts);
+}
+
+template <typename T>
+struct row_assign : public TRowBox<T> {
+    row_assign& operator=(const T& x) {
+        this->write(x);
+        return *this;
+    }
+};
+
+void testConcurrentRows() {
+    runTornReads<TBox<stats_row> >("TBox read()", [](TBox<stats_row>& b) {
+            stats_row r = b.read();
+            assert(row_is(r, r.hits));
+            return r.hits;
+        });
+    runTornReads<row_assign<stats_row> >("TRowBox read()", [](row_assign<stats_row>& b) {
+            stats_row r = b.read();
+            for (unsigned i = 0; i < 8; ++i)
+                assert(r.history[i] == r.history[0] && r.history[16 + i] == r.history[16]);
+            return r.hits;
+        });
+    runTornReads<row_assign<stats_row> >("TRowBox read(field)", [](row_assign<stats_row>& b) {
+            return b.read(&stats_row::hits);
+        });
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimpleRow();
+    testFieldConflicts();
+    testBlindWritesMerge();
+    testBoxReadField();
+    testConcurrentRows();
+    return 0;
+}
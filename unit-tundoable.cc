@@ -0,0 +1,177 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "TransUndoable.hh"
+#include "TransPessimisticLocking.hh"
+
+TransPessimisticLocking __pessimistLocking;
+
+// An array updated in place; every write logs how to restore the old value.
+class EagerArray : public TransUndoable {
+public:
+    EagerArray(unsigned n)
+        : v_(n, 0) {
+    }
+    int get(unsigned i) const {
+        return v_[i];
+    }
+    void set(unsigned i, int x) {
+        int old = v_[i];
+        add_undo([this, i, old]() { v_[i] = old; });
+        v_[i] = x;
+    }
+    void set_with_lock(SpinLock* l, unsigned i, int x) {
+        __pessimistLocking.transSpinLock(l);
+        int old = v_[i];
+        add_undo([=]() {
+                // rollback must run before the lock is released
+                assert(!l->tryLock());
+                v_[i] = old;
+            });
+        v_[i] = x;
+    }
+    static void undo_set(void* self, void* c1, void* c2) {
+        ((EagerArray*) self)->v_[(uintptr_t) c1] = (int) (uintptr_t) c2;
+    }
+    void legacy_set(unsigned i, int x) {
+        add_undo(undo_set, (void*) (uintptr_t) i, (void*) (uintptr_t) v_[i]);
+        v_[i] = x;
+    }
+private:
+    std::vector<int> v_;
+};
+
+// counts live copies, to check records are destroyed
+struct tracked {
+    static int live;
+    std::string s;
+    tracked(std::string x)
+        : s(std::move(x)) {
+        ++live;
+    }
+    tracked(const tracked& x)
+        : s(x.s) {
+        ++live;
+    }
+    ~tracked() {
+        --live;
+    }
+};
+int tracked::live = 0;
+
+void testCommitKeeps() {
+    EagerArray a(4);
+    {
+        TransactionGuard t;
+        a.set(0, 1);
+        a.set(1, 2);
+        tracked x("a string too long for the small-string buffer");
+        a.add_undo([x]() { assert(false); });
+    }
+    assert(a.get(0) == 1 && a.get(1) == 2);
+    assert(tracked::live == 0);
+    assert(TUndoLog::thread_log().empty());
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbortRollsBack() {
+    EagerArray a(4);
+    {
+        TestTransaction t(1);
+        a.set(0, 1);
+        a.set(0, 2);
+        a.legacy_set(0, 3);
+        a.set(1, 4);
+        tracked x("a string too long for the small-string buffer");
+        a.add_undo([x]() { assert(x.s.size() > 20); });
+        assert(a.get(0) == 3 && a.get(1) == 4);
+        Sto::silent_abort();
+    }
+    assert(a.get(0) == 0 && a.get(1) == 0);
+    assert(tracked::live == 0);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testManyRecords() {
+    EagerArray a(16);
+    const int n = 100000; // spans several chunks
+    {
+        TestTransaction t(1);
+        for (int i = 0; i < n; ++i)
+            a.set(i % 16, i + 1);
+        assert(TUndoLog::thread_log().size() == unsigned(n));
+        Sto::silent_abort();
+    }
+    for (unsigned i = 0; i < 16; ++i)
+        assert(a.get(i) == 0);
+
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; ++i)
+            a.set(i % 16, i + 1);
+    }
+    assert(a.get(15) == n);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testWithOptimistic() {
+    EagerArray a(4);
+    TBox<int> b;
+
+    {
+        // a failed optimistic read rolls back the eager update
+        TestTransaction t1(1);
+        int x = b;
+        a.set(0, x + 1);
+
+        TestTransaction t2(2);
+        b = 5;
+        assert(t2.try_commit());
+
+        assert(!t1.try_commit());
+    }
+    assert(a.get(0) == 0);
+
+    {
+        TestTransaction t1(1);
+        int x = b;
+        a.set(0, x + 1);
+        assert(t1.try_commit());
+    }
+    assert(a.get(0) == 6);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRollbackUnderLocks() {
+    EagerArray a(4);
+    SpinLock l0, l1;
+    {
+        // the second lock's item comes after the undo log's item, so it is
+        // cleaned up first
+        TestTransaction t(1);
+        a.set_with_lock(&l0, 0, 1);
+        a.set_with_lock(&l1, 1, 2);
+        Sto::silent_abort();
+    }
+    assert(a.get(0) == 0 && a.get(1) == 0);
+    assert(l0.tryLock() && l1.tryLock());
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testCommitKeeps();
+    testAbortRollsBack();
+    testManyRecords();
+    testWithOptimistic();
+    testRollbackUnderLocks();
+    return 0;
+}
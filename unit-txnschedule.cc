@@ -0,0 +1,155 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "Hashtable.hh"
+#include "TxnSchedule.hh"
+
+static const char* path = "unit-txnschedule.sched";
+
+typedef Hashtable<int, int> table_type;
+
+static const int nthreads = 4, nkeys = 8, n = 2000;
+
+// Operation 0 increments a counter; operation 1 removes it, or inserts it
+// if it is missing. Both return whether the key existed.
+static bool run_op(table_type& h, int kind, int k) {
+    int v;
+    bool hit = h.transGet(k, v);
+    if (kind == 0)
+        h.transPut(k, hit ? v + 1 : 1);
+    else if (hit)
+        h.transDelete(k);
+    else
+        h.transInsert(k, 1);
+    return hit;
+}
+static int op_kind(int t, int i, int k) {
+    return (i + t + k) % 7 == 0;
+}
+
+static void load(table_type& h) {
+    for (int k = 0; k < nkeys; ++k)
+        h.nontrans_insert(k, 0);
+}
+
+// -1 for missing keys
+static std::vector<int> contents(table_type& h) {
+    std::vector<int> v(nkeys);
+    for (int k = 0; k < nkeys; ++k)
+        if (!h.nontrans_find(k, v[k]))
+            v[k] = -1;
+    return v;
+}
+
+static std::vector<int> recorded;
+
+// Records n two-operation transactions per thread, as bench does.
+static void record() {
+    table_type h(64);
+    load(h);
+    TxnSchedule schedule(nthreads);
+    schedule.start();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&, t] {
+            TThread::set_id(t);
+            for (int i = 0; i < n; ++i) {
+                int a = (i * 3 + t) % nkeys, b = (i * 5 + t + 1) % nkeys;
+                bool attempted = false, executed = false;
+                TRANSACTION {
+                    if (attempted && !executed)
+                        schedule.abort(t);
+                    schedule.attempt(t);
+                    attempted = true;
+                    executed = false;
+                    for (int k : {a, b}) {
+                        schedule.op(t, op_kind(t, i, k), k, 0);
+                        schedule.op_done(t, run_op(h, op_kind(t, i, k), k));
+                    }
+                    executed = true;
+                } RETRY(true);
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+    schedule.stop();
+    assert(schedule.size() > uint64_t(nthreads * n * 4));
+    assert(schedule.write(path, "hashtable", nkeys, nkeys));
+    recorded = contents(h);
+}
+
+void testRecord() {
+    record();
+    TxnReplay r;
+    assert(r.open(path));
+    assert(r.header().nthreads == nthreads && r.header().nkeys == nkeys
+           && std::string(r.header().ds) == "hashtable");
+    auto& events = r.events();
+    assert(events.size() == r.header().nevents);
+    // each committed transaction locked the items it wrote
+    uint64_t commits = 0;
+    for (size_t i = 0; i != events.size(); ++i)
+        if (events[i].type == sched_commit && events[i].outcome) {
+            ++commits;
+            assert(events[i].value >= 1 && events[i].value <= 2);
+            for (size_t j = 1; j <= events[i].value; ++j)
+                assert(events[i + j].type == sched_lock && events[i + j].thread == events[i].thread);
+        }
+    assert(commits == uint64_t(nthreads * n));
+
+    // not a schedule
+    FILE* f = fopen(path, "r+b");
+    assert(f && fwrite("XXXX", 4, 1, f) == 1);
+    fclose(f);
+    assert(!r.open(path));
+    unlink(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReplay() {
+    record();
+    TxnReplay r;
+    assert(r.open(path));
+    uint64_t recorded_aborts = 0;
+    for (auto& e : r.events())
+        recorded_aborts += (e.type == sched_commit && !e.outcome) || e.type == sched_abort;
+
+    std::vector<std::vector<int>> results;
+    std::vector<TxnReplay::stats> stats;
+    for (int round = 0; round < 2; ++round) {
+        table_type h(64);
+        load(h);
+        uint64_t events = 0;
+        r.run([](int t) { TThread::set_id(t); },
+              [&](const schedule_event& e) { return run_op(h, e.kind, e.key); },
+              [&](const schedule_event&, bool, uint64_t) { ++events; });
+        auto s = r.total();
+        // ops and the rest of aborted attempts still take their turn
+        assert(events > s.attempts * 2);
+        // the replay is the recorded run
+        assert(s.divergences == 0);
+        assert(s.commits == uint64_t(nthreads * n) && s.commits + s.forced_aborts == s.attempts);
+        assert(contents(h) == recorded);
+        results.push_back(contents(h));
+        stats.push_back(s);
+    }
+    // replays are identical
+    assert(results[0] == results[1]);
+    assert(stats[0].attempts == stats[1].attempts && stats[0].commits == stats[1].commits
+           && stats[0].forced_aborts == stats[1].forced_aborts && stats[0].divergences == stats[1].divergences);
+    assert(stats[0].forced_aborts == recorded_aborts);
+    unlink(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    testRecord();
+    testReplay();
+    return 0;
+}